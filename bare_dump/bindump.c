@@ -0,0 +1,246 @@
+/* bindump.c
+ *
+ * Binary memory dump for bare_dump.
+ *
+ * dump_mem() sends 16 bytes as a 48 character line of hex,
+ * so getting the 64K of the bootrom out takes a long time.
+ * Here we send the raw bytes in frames with a sequence number
+ * and a CRC, stuffing the uart fifo as full as it will go.
+ * The dumprecv program (in the serial directory) writes the
+ * frames into a file and asks for any it missed to be sent again.
+ *
+ * The frame format is in bindump.h
+ */
+
+#include "bindump.h"
+
+typedef unsigned int u32;
+typedef unsigned long u64;
+
+/* How long we wait for dumprecv to say go, and then
+ * how long it can be quiet before we figure it went away.
+ * It asks again every half second while it is running.
+ */
+#define BD_WAIT_US	(5*1000*1000)
+#define BD_QUIET_US	(5*1000*1000)
+
+void printf ( char *, ... );
+int uart_tstc ( void );
+int uart_getc ( void );
+u64 deadline_us ( u64 );
+int deadline_passed ( u64 );
+void uart_write ( char *, int );
+void uart_flush ( void );
+
+/* The ARMv8 crc32 instructions (we build with +crc) */
+static inline u32
+crc32_byte ( u32 crc, u32 val )
+{
+	asm volatile ( "crc32b %w0, %w0, %w1" : "+r" (crc) : "r" (val) );
+	return crc;
+}
+
+static inline u32
+crc32_word ( u32 crc, u32 val )
+{
+	asm volatile ( "crc32w %w0, %w0, %w1" : "+r" (crc) : "r" (val) );
+	return crc;
+}
+
+static void
+put32 ( char *buf, u32 val )
+{
+	buf[0] = val;
+	buf[1] = val >> 8;
+	buf[2] = val >> 16;
+	buf[3] = val >> 24;
+}
+
+static u32
+get32 ( char *buf )
+{
+	unsigned char *p = (unsigned char *) buf;
+
+	return p[0] | (p[1] << 8) | (p[2] << 16) | (p[3] << 24);
+}
+
+/* Data is copied a word at a time, since the bootrom
+ * (and device registers) want aligned 32 bit reads,
+ * and so the CRC is for exactly what we send.
+ */
+static u32 frame_buf[BD_FRAME_SIZE/4];
+
+static void
+send_frame ( int type, u32 seq, u32 addr, u32 *data, int len )
+{
+	char hdr[BD_HDR_SIZE];
+	char tail[4];
+	u32 crc = ~0;
+	int i;
+
+	hdr[0] = BD_MAGIC0;
+	hdr[1] = BD_MAGIC1;
+	hdr[2] = type;
+	hdr[3] = 0;
+	put32 ( &hdr[4], seq );
+	put32 ( &hdr[8], addr );
+	hdr[12] = len;
+	hdr[13] = len >> 8;
+	hdr[14] = 0;
+	hdr[15] = 0;
+
+	for ( i=2; i<BD_HDR_SIZE; i++ )
+	    crc = crc32_byte ( crc, hdr[i] );
+
+	for ( i=0; i<len/4; i++ ) {
+	    frame_buf[i] = data[i];
+	    crc = crc32_word ( crc, frame_buf[i] );
+	}
+
+	put32 ( tail, ~crc );
+
+	uart_write ( hdr, BD_HDR_SIZE );
+	uart_write ( (char *) frame_buf, len );
+	uart_write ( tail, 4 );
+}
+
+static u32 dump_addr;
+static u32 dump_bytes;
+static u32 dump_frames;
+
+static void
+send_data ( u32 seq )
+{
+	u32 off = seq * BD_FRAME_SIZE;
+	u32 len = BD_FRAME_SIZE;
+
+	if ( off + len > dump_bytes )
+	    len = dump_bytes - off;
+
+	send_frame ( BD_DATA, seq, dump_addr + off, (u32 *) (unsigned long) (dump_addr + off), len );
+}
+
+static void
+send_all ( void )
+{
+	u32 info[3];
+	u32 seq;
+
+	info[0] = dump_bytes;
+	info[1] = dump_frames;
+	info[2] = BD_FRAME_SIZE;
+	send_frame ( BD_START, 0, dump_addr, info, sizeof(info) );
+
+	for ( seq=0; seq<dump_frames; seq++ )
+	    send_data ( seq );
+
+	send_frame ( BD_END, dump_frames, dump_addr, 0, 0 );
+}
+
+/* Returns -1 if nothing comes before the deadline */
+static int
+getc_until ( u64 end )
+{
+	while ( ! uart_tstc () )
+	    if ( deadline_passed ( end ) )
+		return -1;
+	return uart_getc ();
+}
+
+/* Read a command from the host.
+ * Anything that isn't a command (noise on the line, someone
+ * typing at us, part of a command we lost bytes from) is
+ * skipped over until we see the magic again.
+ * Returns the command, 0 for a bad one (which we ignore),
+ * or -1 if no command shows up before the deadline.
+ */
+static int
+get_cmd ( u32 *seq, u32 *count, u64 end )
+{
+	char buf[BD_CMD_SIZE];
+	u32 crc = ~0;
+	int c, i;
+
+	c = getc_until ( end );
+	for ( ;; ) {
+	    if ( c < 0 )
+		return -1;
+	    if ( c != BD_MAGIC0 ) {
+		c = getc_until ( end );
+		continue;
+	    }
+	    c = getc_until ( end );
+	    if ( c == BD_MAGIC1 )
+		break;
+	}
+
+	buf[0] = BD_MAGIC0;
+	buf[1] = BD_MAGIC1;
+	for ( i=2; i<BD_CMD_SIZE; i++ ) {
+	    if ( (c = getc_until ( end )) < 0 )
+		return -1;
+	    buf[i] = c;
+	}
+
+	for ( i=2; i<12; i++ )
+	    crc = crc32_byte ( crc, buf[i] );
+	if ( ~crc != get32 ( &buf[12] ) )
+	    return 0;
+
+	*seq = get32 ( &buf[4] );
+	*count = get32 ( &buf[8] );
+	return buf[2];
+}
+
+/* Dump nbytes (a multiple of 4) starting at addr.
+ * We wait a while for dumprecv to say go, and keep serving
+ * resend requests until it says it is done (or goes quiet).
+ * With nobody there, we just go on.
+ */
+void
+bin_dump ( u32 addr, u32 nbytes )
+{
+	u32 seq, count;
+	int started = 0;
+	int cmd;
+
+	dump_addr = addr & ~3;
+	dump_bytes = nbytes & ~3;
+	dump_frames = (dump_bytes + BD_FRAME_SIZE - 1) / BD_FRAME_SIZE;
+
+	printf ( "Binary dump of %h bytes at %h\n", dump_bytes, dump_addr );
+	printf ( "Waiting %d seconds for dumprecv\n", BD_WAIT_US / 1000000 );
+
+	for ( ;; ) {
+	    cmd = get_cmd ( &seq, &count, deadline_us ( started ? BD_QUIET_US : BD_WAIT_US ) );
+
+	    switch ( cmd ) {
+		case -1:
+		    if ( started )
+			printf ( "\nBinary dump, dumprecv went away\n" );
+		    else
+			printf ( "No dumprecv, binary dump skipped\n" );
+		    return;
+		case BD_GO:
+		    started = 1;
+		    send_all ();
+		    break;
+		case BD_RESEND:
+		    if ( ! started )
+			break;
+		    while ( count-- && seq < dump_frames )
+			send_data ( seq++ );
+		    send_frame ( BD_END, dump_frames, dump_addr, 0, 0 );
+		    break;
+		case BD_QUIT:
+		    uart_flush ();
+		    printf ( "\nBinary dump done\n" );
+		    return;
+		default:
+		    /* garbled, dumprecv will time out and ask again */
+		    break;
+	    }
+	}
+}
+
+/* THE END */
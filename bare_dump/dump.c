@@ -6,16 +6,12 @@
 
 /* When I first ran this, the green LED simply came on,
  * which was lucky for me, otherwise I would have just
- * thought the demo had failed.  With this count, it
- * stays on for 45 seconds!  So the CPU is either just
- * running about 100 times slower, or caches are not
- * enabled or something of the sort.
+ * thought the demo had failed.  The delay was a loop count,
+ * which with caches off and the bootrom's CPU clock took
+ * 45 seconds instead of 1.  Now it comes from the generic
+ * counter (delay.c), so it is what it says.
  */
-// #define DELAY_COUNT	100000000
-
-/* This gives something like a 1 hz blink rate.
- */
-#define DELAY_COUNT	1000000
+#define BLINK_MS	500
 
 typedef volatile unsigned int vu32;
 typedef unsigned int u32;
@@ -26,7 +22,10 @@ void uart_init ( void );
 void uart_puts ( char * );
 
 void printf ( char *, ... );
+void delay_init ( void );
+void mdelay ( unsigned int );
 void show_reg ( char *, int * );
+void bin_dump ( u32, u32 );
 
 /* The TRM describes the GPIO in chapter 20
  *
@@ -68,10 +67,7 @@ struct rock_gpio {
 void
 delay ( void )
 {
-        volatile int count = DELAY_COUNT;
-
-        while ( count-- )
-            ;
+	mdelay ( BLINK_MS );
 }
 
 /* The LED is on B3
@@ -182,6 +178,7 @@ void
 main ( void )
 {
 	uart_init();
+	delay_init ();
 	led_on ();
 	printf ( "\n" );
 
@@ -197,6 +194,9 @@ main ( void )
 
 	// dump_mem ( (u32 *) 0xffff0000, 0x10000/4 );
 
+	/* Much faster, but needs serial/dumprecv on the other end */
+	bin_dump ( 0xffff0000, 0x10000 );
+
 	show_cpu ();
 
 	printf ( "Blinking ...\n" );
@@ -267,4 +267,57 @@ uart_puts ( char *s )
 	}
 }
 
+/* The fifos are 64 bytes deep */
+#define UART_FIFO_SIZE	64
+
+/* Raw bytes for the binary dump.
+ * Rather than checking TNF for every byte, we look at
+ * the fifo level once and fill all the room there is.
+ */
+void
+uart_write ( char *buf, int n )
+{
+	struct rock_uart *up = UART_BASE;
+	int room;
+
+	while ( n > 0 ) {
+	    room = UART_FIFO_SIZE - up->tfl;
+	    if ( room > n )
+		room = n;
+	    n -= room;
+	    while ( room-- )
+		up->data = *buf++;
+	}
+}
+
+/* Wait till everything is out on the wire */
+void
+uart_flush ( void )
+{
+	struct rock_uart *up = UART_BASE;
+
+	while ( ! (up->status & ST_TE) || (up->status & ST_BUSY) )
+	    ;
+}
+
+/* Is there a character waiting? */
+int
+uart_tstc ( void )
+{
+	struct rock_uart *up = UART_BASE;
+
+	return up->status & ST_RNE;
+}
+
+int
+uart_getc ( void )
+{
+	struct rock_uart *up = UART_BASE;
+
+	while ( ! (up->status & ST_RNE) )
+	    ;
+
+	return up->data & 0xff;
+}
+
 /* THE END */
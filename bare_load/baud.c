@@ -0,0 +1,340 @@
+/* baud.c
+ *
+ * Baud rate engine for UART2 on the RK3399.
+ *
+ * uart_baud() just divides the 24 Mhz crystal by 16 and by an
+ * integer, which is exact for 1.5 Mbaud and nothing faster.
+ * 3 Mbaud needs 48 Mhz, 4 Mbaud needs 64 Mhz.  The CRU gives us
+ * three ways to clock the uart (see the clock tree in the TRM):
+ *
+ *   xin24m			the crystal
+ *   pll / n			CPLL or GPLL, integer divider (1-128)
+ *   pll / n * num / den	then a fractional divider (16 bit each)
+ *
+ * We try them all (with whatever rate the PLLs are running at),
+ * pick the one that gives the smallest baud rate error,
+ * and report that error in parts per million.
+ *
+ * The fractional divider is a last resort: it makes its rate by
+ * skipping input clocks, so the output jitters.  Rockchip wants
+ * the input at least 20 times the output.  We go down to 8 times
+ * if nothing else is close, since the uart averages over 16 clocks
+ * per bit, but it has to win by a lot.
+ *
+ * The registers (all in CRU_BASE, all with a write mask in the
+ * upper 16 bits except the fraction):
+ *   CLKSEL_CON33 bit 15	uart_src: 0 = CPLL, 1 = GPLL
+ *				(shared with UART1 and UART3)
+ *   CLKSEL_CON35 [6:0]		uart2 divider, n-1
+ *   CLKSEL_CON35 [9:8]		uart2 clock: 0 = div, 1 = frac, 2 = xin24m
+ *   CLKSEL_CON102		uart2 fraction, num << 16 | den
+ *   CLKGATE_CON9 bits 4, 5	gates for the div and frac clocks
+ *
+ * This builds on linux for trying things out:
+ *   cc -DBAUD_TEST -o baud_test baud.c ; ./baud_test
+ */
+
+#include "baud.h"
+
+typedef volatile unsigned int vu32;
+typedef unsigned int u32;
+typedef unsigned long u64;
+
+#define BIT(x)	(1<<(x))
+
+#define XIN_RATE	24000000
+
+/* The TRM does not say, but 64 Mhz (4 Mbaud) is known to work */
+#define UART_SCLK_MAX	100000000
+
+#define MAX_DIV		128
+#define FRAC_RATIO	20
+#define FRAC_RATIO_MIN	8
+
+static char *src_names[] = { "xin24m", "div", "frac" };
+static char *pll_names[] = { "cpll", "gpll" };
+
+/* ------------------------------------------------------ */
+
+/* Work out the uart divisor and error for one clock */
+static void
+baud_try ( struct baud_setting *sp, u64 sclk )
+{
+	u64 div;
+
+	sp->sclk = sclk;
+	div = (sclk + 8 * sp->baud) / (16 * sp->baud);
+	if ( div < 1 )
+	    div = 1;
+	if ( div > 0xffff )
+	    div = 0xffff;
+	sp->divisor = div;
+	sp->actual = sclk / (16 * div);
+	sp->ppm = ((long) sp->actual - sp->baud) * 1000000L / sp->baud;
+}
+
+/* Ties go to the simpler clock, the fraction has to win by a bit */
+static int
+baud_score ( struct baud_setting *sp )
+{
+	int score = sp->ppm < 0 ? -sp->ppm : sp->ppm;
+
+	if ( sp->src == BAUD_FRAC ) {
+	    score += 100;
+	    if ( (u64) sp->sclk * FRAC_RATIO > sp->sclk * (u64) sp->den / sp->num )
+		score += 2000;
+	}
+	return score;
+}
+
+/* Best num/den for a ratio (less than 1) with both no bigger
+ * than max, by continued fractions.
+ */
+static void
+rational ( u64 given_num, u64 given_den, u32 max, u32 *num, u32 *den )
+{
+	u64 n0 = 0, d0 = 1;
+	u64 n1 = 1, d1 = 0;
+	u64 n, d, a, t, k;
+
+	n = given_num;
+	d = given_den;
+
+	while ( d ) {
+	    a = n / d;
+	    if ( n1 * a + n0 > max || d1 * a + d0 > max ) {
+		/* the best semiconvergent that fits */
+		k = (max - n0) / (n1 ? n1 : 1);
+		t = (max - d0) / (d1 ? d1 : 1);
+		if ( t < k )
+		    k = t;
+		if ( 2 * k >= a ) {
+		    n1 = n1 * k + n0;
+		    d1 = d1 * k + d0;
+		}
+		break;
+	    }
+	    t = n1 * a + n0;
+	    n0 = n1;
+	    n1 = t;
+	    t = d1 * a + d0;
+	    d0 = d1;
+	    d1 = t;
+
+	    t = n % d;
+	    n = d;
+	    d = t;
+	}
+
+	*num = n1;
+	*den = d1;
+}
+
+/* Find the best setting for baud, given the PLL rates (Hz).
+ * Returns 0 if nothing can do it.
+ */
+int
+baud_solve ( int baud, u32 *pll_rates, struct baud_setting *best )
+{
+	struct baud_setting try;
+	int pll, div;
+	u64 parent, want;
+	int mult;
+
+	if ( baud <= 0 )
+	    return 0;
+
+	try.baud = baud;
+	try.src = BAUD_XIN;
+	try.pll = 0;
+	try.div = 1;
+	try.num = try.den = 1;
+	baud_try ( &try, XIN_RATE );
+	*best = try;
+
+	for ( pll = PLL_CPLL; pll <= PLL_GPLL; pll++ ) {
+	    if ( pll_rates[pll] == 0 )
+		continue;
+	    try.pll = pll;
+
+	    /* integer dividers */
+	    try.src = BAUD_DIV;
+	    try.num = try.den = 1;
+	    for ( div = 1; div <= MAX_DIV; div++ ) {
+		parent = pll_rates[pll] / div;
+		if ( parent > UART_SCLK_MAX )
+		    continue;
+		try.div = div;
+		baud_try ( &try, parent );
+		if ( try.actual > 0 && baud_score ( &try ) < baud_score ( best ) )
+		    *best = try;
+	    }
+
+	    /* the fraction, aiming for an exact multiple of 16 * baud */
+	    try.src = BAUD_FRAC;
+	    for ( div = 1; div <= 4; div++ ) {
+		parent = pll_rates[pll] / div;
+		try.div = div;
+		for ( mult = 1; mult <= 4; mult++ ) {
+		    want = (u64) 16 * baud * mult;
+		    if ( want * FRAC_RATIO_MIN > parent || want > UART_SCLK_MAX )
+			break;
+		    rational ( want, parent, 0xffff, &try.num, &try.den );
+		    if ( try.num == 0 || try.den == 0 )
+			continue;
+		    baud_try ( &try, parent * try.num / try.den );
+		    if ( try.actual > 0 && baud_score ( &try ) < baud_score ( best ) )
+			*best = try;
+		}
+	    }
+	}
+
+	return 1;
+}
+
+char *
+baud_src_name ( struct baud_setting *sp )
+{
+	return src_names[sp->src];
+}
+
+char *
+baud_pll_name ( struct baud_setting *sp )
+{
+	return pll_names[sp->pll];
+}
+
+#ifndef BAUD_TEST
+
+/* ------------------------------------------------------ */
+/* The hardware side */
+
+#define CRU_BASE	0xff760000
+
+#define CPLL_CON0	0x60
+#define GPLL_CON0	0x80
+
+#define CLKSEL_CON(n)	(0x100 + (n)*4)
+#define CLKGATE_CON(n)	(0x300 + (n)*4)
+
+#define REG(off)	(*(vu32 *) (u64) (CRU_BASE + (off)))
+
+/* Rockchip registers with a write mask in the upper half */
+#define MASK_WRITE(off, mask, val)	REG(off) = ((mask) << 16) | (val)
+
+#define PLL_MODE_SHIFT	8
+#define PLL_MODE_MASK	3
+#define PLL_MODE_NORMAL	1
+#define PLL_DSMPD	BIT(3)
+
+#define UART2_SEL_DIV	0
+#define UART2_SEL_FRAC	1
+#define UART2_SEL_XIN	2
+
+static u32 uart2_clock = XIN_RATE;
+
+/* What a PLL is running at right now */
+static u32
+pll_rate ( u32 con0 )
+{
+	u32 c0, c1, c2, c3;
+	u64 fbdiv, refdiv, post1, post2;
+	u64 vco;
+
+	c0 = REG(con0);
+	c1 = REG(con0 + 4);
+	c2 = REG(con0 + 8);
+	c3 = REG(con0 + 12);
+
+	if ( ((c3 >> PLL_MODE_SHIFT) & PLL_MODE_MASK) != PLL_MODE_NORMAL )
+	    return XIN_RATE;	/* slow mode, just the crystal */
+
+	fbdiv = c0 & 0xfff;
+	refdiv = c1 & 0x3f;
+	post1 = (c1 >> 8) & 0x7;
+	post2 = (c1 >> 12) & 0x7;
+	if ( ! refdiv || ! post1 || ! post2 )
+	    return 0;
+
+	vco = (u64) XIN_RATE * fbdiv;
+	if ( ! (c3 & PLL_DSMPD) )
+	    vco += ((u64) XIN_RATE * (c2 & 0xffffff)) >> 24;
+
+	return vco / refdiv / post1 / post2;
+}
+
+void
+baud_pll_rates ( u32 *rates )
+{
+	rates[PLL_CPLL] = pll_rate ( CPLL_CON0 );
+	rates[PLL_GPLL] = pll_rate ( GPLL_CON0 );
+}
+
+/* The uart clock that the engine set up */
+u32
+uart_clock_rate ( void )
+{
+	return uart2_clock;
+}
+
+/* Set up the CRU for a setting.
+ * The uart must be idle (nothing left to send),
+ * the caller then loads sp->divisor into the uart.
+ * We run from the crystal while the rest is changed.
+ */
+void
+baud_clock ( struct baud_setting *sp )
+{
+	MASK_WRITE ( CLKSEL_CON(35), 0x3 << 8, UART2_SEL_XIN << 8 );
+
+	if ( sp->src != BAUD_XIN ) {
+	    MASK_WRITE ( CLKSEL_CON(33), 1 << 15, sp->pll << 15 );
+	    MASK_WRITE ( CLKSEL_CON(35), 0x7f, sp->div - 1 );
+	    MASK_WRITE ( CLKGATE_CON(9), 0x3 << 4, 0 );		/* ungate */
+	}
+
+	if ( sp->src == BAUD_FRAC ) {
+	    REG(CLKSEL_CON(102)) = (sp->num << 16) | sp->den;
+	    MASK_WRITE ( CLKSEL_CON(35), 0x3 << 8, UART2_SEL_FRAC << 8 );
+	} else if ( sp->src == BAUD_DIV )
+	    MASK_WRITE ( CLKSEL_CON(35), 0x3 << 8, UART2_SEL_DIV << 8 );
+
+	uart2_clock = sp->sclk;
+}
+
+#endif	/* BAUD_TEST */
+
+/* ------------------------------------------------------ */
+
+#ifdef BAUD_TEST
+#include <stdio.h>
+#include <stdlib.h>
+
+/* PLL rates as U-Boot leaves them, or from the command line (Mhz) */
+int
+main ( int argc, char **argv )
+{
+	static int bauds[] = { 115200, 230400, 460800, 921600, 1000000,
+	    1500000, 2000000, 3000000, 3500000, 4000000, 5000000, 6000000 };
+	u32 rates[2] = { 800000000, 800000000 };
+	struct baud_setting s;
+	int i;
+
+	if ( argc > 1 )
+	    rates[PLL_CPLL] = atof ( argv[1] ) * 1000000;
+	if ( argc > 2 )
+	    rates[PLL_GPLL] = atof ( argv[2] ) * 1000000;
+
+	printf ( "cpll %u, gpll %u\n", rates[PLL_CPLL], rates[PLL_GPLL] );
+	for ( i=0; i<sizeof(bauds)/sizeof(bauds[0]); i++ ) {
+	    if ( ! baud_solve ( bauds[i], rates, &s ) )
+		continue;
+	    printf ( "%8d  %-6s %s/%-3d %5u/%-5u sclk %9u  divisor %3d  %8d  %6d ppm\n",
+		s.baud, baud_src_name ( &s ), s.src == BAUD_XIN ? " -- " : baud_pll_name ( &s ), s.div,
+		s.num, s.den, s.sclk, s.divisor, s.actual, s.ppm );
+	}
+	return 0;
+}
+#endif	/* BAUD_TEST */
+
+/* THE END */
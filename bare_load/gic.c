@@ -0,0 +1,155 @@
+/* gic.c
+ *
+ * Just enough GIC-500 setup for bare_load to get
+ * the uart receive interrupt.
+ *
+ * The bootrom runs us at EL3.  At EL3 a group 0 interrupt
+ * shows up as an FIQ, so that is what we use, and we set
+ * SCR_EL3.FIQ so it is taken here.  Everything we change
+ * is put back by gic_stop() before we jump to a new image,
+ * which can then set up the GIC however it likes.
+ *
+ * The full story is in inter/gic500.c and the
+ * "GICv3 and GICv4 Software Overview" from ARM.
+ */
+
+typedef volatile unsigned int vu32;
+typedef volatile unsigned long vu64;
+typedef unsigned int u32;
+typedef unsigned long u64;
+
+#define BIT(x)	(1<<(x))
+
+#define GICD_BASE	0xfee00000
+#define GICR_BASE	0xfef00000	/* core 0 */
+
+/* distributor */
+#define GICD_CTLR	0x0000
+#define GICD_IGROUPR	0x0080
+#define GICD_ISENABLER	0x0100
+#define GICD_ICENABLER	0x0180
+#define GICD_ICPENDR	0x0280
+#define GICD_IPRIORITYR	0x0400
+#define GICD_IGRPMODR	0x0d00
+#define GICD_IROUTER	0x6000
+
+#define CTLR_ENABLE_G0	BIT(0)
+#define CTLR_ARE_S	BIT(4)
+#define CTLR_RWP	BIT(31)
+
+/* redistributor */
+#define GICR_WAKER	0x0014
+#define WAKER_SLEEP	BIT(1)
+#define WAKER_ASLEEP	BIT(2)
+
+/* SCR_EL3 */
+#define SCR_FIQ		BIT(2)
+
+#define REG(a)		(*(vu32 *) (unsigned long) (a))
+
+static u64 save_scr;
+static u64 save_vbar;
+static u32 save_ctlr;
+
+extern char vectors[];
+
+static void
+gicd_wait ( void )
+{
+	while ( REG(GICD_BASE + GICD_CTLR) & CTLR_RWP )
+	    ;
+}
+
+void
+gic_init ( void )
+{
+	u64 val;
+
+	asm volatile ( "mrs %0, scr_el3" : "=r" (save_scr) );
+	asm volatile ( "mrs %0, vbar_el3" : "=r" (save_vbar) );
+
+	asm volatile ( "msr vbar_el3, %0" : : "r" (vectors) );
+	asm volatile ( "msr scr_el3, %0" : : "r" (save_scr | SCR_FIQ) );
+	asm volatile ( "isb" );
+
+	/* system register interface */
+	asm volatile ( "mrs %0, icc_sre_el3" : "=r" (val) );
+	val |= 0x9;			/* SRE and Enable (for lower ELs) */
+	asm volatile ( "msr icc_sre_el3, %0" : : "r" (val) );
+	asm volatile ( "isb" );
+
+	/* wake up our redistributor */
+	REG(GICR_BASE + GICR_WAKER) &= ~WAKER_SLEEP;
+	while ( REG(GICR_BASE + GICR_WAKER) & WAKER_ASLEEP )
+	    ;
+
+	save_ctlr = REG(GICD_BASE + GICD_CTLR);
+	REG(GICD_BASE + GICD_CTLR) = save_ctlr | CTLR_ARE_S | CTLR_ENABLE_G0;
+	gicd_wait ();
+
+	asm volatile ( "msr icc_pmr_el1, %0" : : "r" (0xffUL) );
+	asm volatile ( "msr icc_igrpen0_el1, %0" : : "r" (1UL) );
+	asm volatile ( "isb" );
+}
+
+/* An SPI, as group 0, to core 0 */
+void
+gic_enable ( int irq )
+{
+	int reg = irq / 32;
+	u32 bit = BIT(irq % 32);
+
+	REG(GICD_BASE + GICD_IGROUPR + reg*4) &= ~bit;
+	REG(GICD_BASE + GICD_IGRPMODR + reg*4) &= ~bit;
+	*(volatile unsigned char *) (unsigned long) (GICD_BASE + GICD_IPRIORITYR + irq) = 0x80;
+	*(vu64 *) (unsigned long) (GICD_BASE + GICD_IROUTER + irq*8) = 0;
+	REG(GICD_BASE + GICD_ISENABLER + reg*4) = bit;
+	gicd_wait ();
+}
+
+static void
+gic_disable ( int irq )
+{
+	REG(GICD_BASE + GICD_ICENABLER + (irq/32)*4) = BIT(irq % 32);
+	REG(GICD_BASE + GICD_ICPENDR + (irq/32)*4) = BIT(irq % 32);
+	gicd_wait ();
+}
+
+int
+gic_irqwho ( void )
+{
+	u64 val;
+
+	asm volatile ( "mrs %0, icc_iar0_el1" : "=r" (val) );
+	return val & 0xffffff;
+}
+
+void
+gic_irqack ( int irq )
+{
+	asm volatile ( "msr icc_eoir0_el1, %0" : : "r" ((u64) irq) );
+}
+
+/* Put things back the way the bootrom had them */
+void
+gic_stop ( int irq )
+{
+	asm volatile ( "msr DAIFSet, #3" );
+
+	gic_disable ( irq );
+	asm volatile ( "msr icc_igrpen0_el1, %0" : : "r" (0UL) );
+
+	/* ARE can't be turned back off, the next program
+	 * will set things up its own way anyhow.
+	 */
+	if ( ! (save_ctlr & CTLR_ENABLE_G0) ) {
+	    REG(GICD_BASE + GICD_CTLR) &= ~CTLR_ENABLE_G0;
+	    gicd_wait ();
+	}
+
+	asm volatile ( "msr scr_el3, %0" : : "r" (save_scr) );
+	asm volatile ( "msr vbar_el3, %0" : : "r" (save_vbar) );
+	asm volatile ( "isb" );
+}
+
+/* THE END */
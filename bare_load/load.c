@@ -0,0 +1,446 @@
+/* load.c
+ *
+ * bare_load - a resident uart loader for the RK3399.
+ *
+ * The bootrom puts this in SRAM and runs it.  It listens on
+ * the console uart for an image sent by the sendload program
+ * (in the serial directory), puts it in SRAM after us and
+ * jumps to it.  The protocol is in binload.h
+ *
+ * Not DDR.  The bootrom doesn't start it, and we are a single
+ * stage image with nothing to do that (it takes the Rockchip
+ * DDR blob or U-Boot TPL).  A DDR that was never initialized
+ * just hangs the bus, so we don't allow it.
+ *
+ * Receiving is interrupt driven (see uart.c), so the uart fifo
+ * gets emptied while we are busy checking CRCs and copying.
+ *
+ * We start at 1.5 Mbaud, the host can ask for something faster
+ * (see baud.c for how we get the uart clock).
+ */
+
+#include "binload.h"
+#include "baud.h"
+
+typedef unsigned int u32;
+typedef unsigned long u64;
+
+void uart_init ( void );
+void uart_puts ( char * );
+int uart_getc ( void );
+void uart_write ( char *, int );
+void uart_flush ( void );
+void uart_rx_handler ( void );
+void uart_rx_irq_init ( void );
+void uart_rx_irq_stop ( void );
+int uart_rx_errors ( void );
+int uart_getc_until ( unsigned long );
+
+void gic_init ( void );
+void gic_enable ( int );
+void gic_stop ( int );
+int gic_irqwho ( void );
+void gic_irqack ( int );
+
+void jump_to ( u64 );
+void spin ( void );
+
+void printf ( char *, ... );
+
+#define IRQ_UART2	132
+
+/* Where an image may go: the rest of the 192K of SRAM
+ * (INTMEM) after us, starting at a 4K boundary.
+ */
+#define SRAM_TOP	0xff8f0000
+#define LOAD_ALIGN	0x1000
+
+extern char __bss_end__[];
+
+/* The generic timer runs from the crystal, once it is going.
+ * The bootrom may not have started the secure timer that
+ * drives it, so we do that (U-Boot SPL does the same).
+ * It is laid out like the timers in inter/timer.c
+ */
+#define COUNTER_FREQ	24000000
+#define STIMER_BASE	0xff8680a0
+
+#define STIMER_LOAD0	0x00
+#define STIMER_LOAD1	0x04
+#define STIMER_CONTROL	0x1c
+#define STIMER_ENA	1
+
+#define STIMER(off)	(*(volatile u32 *) (u64) (STIMER_BASE + (off)))
+
+/* The rate we run at now, and the one to go back to */
+static struct baud_setting cur_baud;
+static struct baud_setting old_baud;
+
+/* When set, give up on a new baud rate at this count */
+static u64 baud_deadline;
+
+/* The ARMv8 crc32 instructions (we build with +crc) */
+static inline u32
+crc32_byte ( u32 crc, u32 val )
+{
+	asm volatile ( "crc32b %w0, %w0, %w1" : "+r" (crc) : "r" (val) );
+	return crc;
+}
+
+static inline u32
+crc32_word ( u32 crc, u32 val )
+{
+	asm volatile ( "crc32w %w0, %w0, %w1" : "+r" (crc) : "r" (val) );
+	return crc;
+}
+
+static inline u32
+crc32_dword ( u32 crc, u64 val )
+{
+	asm volatile ( "crc32x %w0, %w0, %x1" : "+r" (crc) : "r" (val) );
+	return crc;
+}
+
+static void
+put32 ( char *buf, u32 val )
+{
+	buf[0] = val;
+	buf[1] = val >> 8;
+	buf[2] = val >> 16;
+	buf[3] = val >> 24;
+}
+
+static u32
+get32 ( unsigned char *p )
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | (p[3] << 24);
+}
+
+/* The header goes in front so the payload is word aligned */
+static u32 frame_buf[(BL_HDR_SIZE + BL_FRAME_SIZE + 4) / 4];
+
+static void
+reply ( int what, int why, u32 next )
+{
+	char buf[BL_REPLY_SIZE];
+	u32 crc = ~0;
+	int i;
+
+	buf[0] = BL_MAGIC0;
+	buf[1] = BL_MAGIC1;
+	buf[2] = what;
+	buf[3] = why;
+	put32 ( &buf[4], next );
+	put32 ( &buf[8], uart_rx_errors () );
+
+	for ( i=2; i<12; i++ )
+	    crc = crc32_byte ( crc, buf[i] );
+	put32 ( &buf[12], ~crc );
+
+	uart_write ( buf, BL_REPLY_SIZE );
+}
+
+static inline u64
+read_count ( void )
+{
+	u64 val;
+
+	asm volatile ( "mrs %0, cntpct_el0" : "=r" (val) );
+	return val;
+}
+
+static void
+stimer_init ( void )
+{
+	if ( STIMER(STIMER_CONTROL) & STIMER_ENA )
+	    return;
+
+	asm volatile ( "msr cntfrq_el0, %0" : : "r" ((u64) COUNTER_FREQ) );
+	STIMER(STIMER_CONTROL) = 0;
+	STIMER(STIMER_LOAD0) = 0xffffffff;
+	STIMER(STIMER_LOAD1) = 0xffffffff;
+	STIMER(STIMER_CONTROL) = STIMER_ENA;
+}
+
+/* -1 if we are waiting out a baud change and time is up */
+static int
+get_byte ( void )
+{
+	if ( baud_deadline )
+	    return uart_getc_until ( baud_deadline );
+	return uart_getc ();
+}
+
+/* Read one frame into frame_buf.
+ * Returns the type, 0 if it is damaged,
+ * or -1 if time ran out after a baud change.
+ */
+static int
+get_frame ( u32 *seq, u32 *addr, int *len )
+{
+	unsigned char *buf = (unsigned char *) frame_buf;
+	u32 crc = ~0;
+	int c, i, n;
+
+	for ( ;; ) {
+	    if ( (c = get_byte ()) < 0 )
+		return -1;
+	    if ( c != BL_MAGIC0 )
+		continue;
+	    while ( (c = get_byte ()) == BL_MAGIC0 )
+		;
+	    if ( c < 0 )
+		return -1;
+	    if ( c == BL_MAGIC1 )
+		break;
+	}
+
+	buf[0] = BL_MAGIC0;
+	buf[1] = BL_MAGIC1;
+	for ( i=2; i<BL_HDR_SIZE; i++ ) {
+	    if ( (c = get_byte ()) < 0 )
+		return -1;
+	    buf[i] = c;
+	}
+
+	n = buf[12] | (buf[13] << 8);
+	if ( n > BL_FRAME_SIZE )
+	    return 0;
+
+	for ( i=0; i<n+4; i++ ) {
+	    if ( (c = get_byte ()) < 0 )
+		return -1;
+	    buf[BL_HDR_SIZE+i] = c;
+	}
+
+	for ( i=2; i<BL_HDR_SIZE; i++ )
+	    crc = crc32_byte ( crc, buf[i] );
+	for ( i=0; i<n/4; i++ )
+	    crc = crc32_word ( crc, frame_buf[BL_HDR_SIZE/4 + i] );
+	for ( i=n & ~3; i<n; i++ )
+	    crc = crc32_byte ( crc, buf[BL_HDR_SIZE+i] );
+
+	if ( ~crc != get32 ( &buf[BL_HDR_SIZE+n] ) )
+	    return 0;
+
+	*seq = get32 ( &buf[4] );
+	*addr = get32 ( &buf[8] );
+	*len = n;
+	return buf[2];
+}
+
+static u64
+load_base ( void )
+{
+	return ((u64) __bss_end__ + LOAD_ALIGN - 1) & ~(u64) (LOAD_ALIGN - 1);
+}
+
+/* Is all of addr .. addr+len where an image may go? */
+static int
+load_ok ( u64 addr, u64 len )
+{
+	return addr >= load_base () && addr <= SRAM_TOP && len <= SRAM_TOP - addr;
+}
+
+static void
+copy_out ( u32 addr, int len )
+{
+	u32 *wsrc = &frame_buf[BL_HDR_SIZE/4];
+	u32 *wdst = (u32 *) (u64) addr;
+	char *src = (char *) wsrc;
+	char *dst = (char *) wdst;
+	int i;
+
+	if ( (addr & 3) == 0 ) {
+	    for ( i=0; i<len/4; i++ )
+		wdst[i] = wsrc[i];
+	    i *= 4;
+	} else
+	    i = 0;
+
+	for ( ; i<len; i++ )
+	    dst[i] = src[i];
+}
+
+static u32
+image_crc ( u32 addr, u32 nbytes )
+{
+	unsigned char *p = (unsigned char *) (u64) addr;
+	u32 crc = ~0;
+	u32 i = 0;
+
+	if ( (addr & 7) == 0 )
+	    for ( ; i + 8 <= nbytes; i += 8 )
+		crc = crc32_dword ( crc, *(u64 *) &p[i] );
+	for ( ; i < nbytes; i++ )
+	    crc = crc32_byte ( crc, p[i] );
+
+	return ~crc;
+}
+
+static void
+start_image ( u32 entry )
+{
+	printf ( "bare_load: starting image at %h\n", entry );
+	uart_flush ();
+
+	uart_rx_irq_stop ();
+	gic_stop ( IRQ_UART2 );
+
+	jump_to ( entry );
+}
+
+static void
+show_baud ( struct baud_setting *sp )
+{
+	printf ( "bare_load: %d baud from %s", sp->baud, baud_src_name ( sp ) );
+	if ( sp->src != BAUD_XIN )
+	    printf ( " %s/%d", baud_pll_name ( sp ), sp->div );
+	if ( sp->src == BAUD_FRAC )
+	    printf ( " * %d/%d", sp->num, sp->den );
+	printf ( ", uart clock %d, error %d ppm\n", sp->sclk, sp->ppm );
+}
+
+/* Work out a new rate, ack at the old one, then switch */
+static void
+new_baud ( int baud, u32 next )
+{
+	struct baud_setting s;
+	u32 rates[2];
+
+	baud_pll_rates ( rates );
+	if ( ! baud_solve ( baud, rates, &s ) || s.ppm > BL_BAUD_PPM || s.ppm < -BL_BAUD_PPM ) {
+	    reply ( BL_NAK, BL_WHY_BAUD, next );
+	    return;
+	}
+
+	reply ( BL_ACK, 0, next );
+
+	/* uart_set_clock waits for the ack to go out */
+	old_baud = cur_baud;
+	cur_baud = s;
+	uart_set_clock ( &cur_baud );
+	baud_deadline = read_count () + BL_BAUD_WAIT * COUNTER_FREQ;
+}
+
+static void
+load ( void )
+{
+	unsigned char *payload = (unsigned char *) &frame_buf[BL_HDR_SIZE/4];
+	u32 next = 0;
+	u32 seq, addr;
+	int type, len;
+
+	for ( ;; ) {
+	    type = get_frame ( &seq, &addr, &len );
+
+	    /* nobody talked to us at the new rate */
+	    if ( type < 0 ) {
+		baud_deadline = 0;
+		cur_baud = old_baud;
+		uart_set_clock ( &cur_baud );
+		show_baud ( &cur_baud );
+		continue;
+	    }
+
+	    /* somebody did */
+	    if ( type > 0 && baud_deadline ) {
+		baud_deadline = 0;
+		show_baud ( &cur_baud );
+	    }
+
+	    if ( type == 0 ) {
+		reply ( BL_NAK, BL_WHY_CRC, next );
+		continue;
+	    }
+
+	    if ( type == BL_PING ) {
+		next = 1;
+		reply ( BL_ACK, 0, next );
+		continue;
+	    }
+
+	    if ( type == BL_BAUD && len == 4 ) {
+		new_baud ( get32 ( payload ), next );
+		continue;
+	    }
+
+	    /* a resend we did not need */
+	    if ( seq < next ) {
+		reply ( BL_ACK, 0, next );
+		continue;
+	    }
+
+	    if ( next == 0 || seq > next ) {
+		reply ( BL_NAK, BL_WHY_SEQ, next );
+		continue;
+	    }
+
+	    if ( type == BL_WRITE ) {
+		if ( ! load_ok ( addr, len ) ) {
+		    reply ( BL_NAK, BL_WHY_ADDR, next );
+		    continue;
+		}
+		copy_out ( addr, len );
+		next++;
+		reply ( BL_ACK, 0, next );
+		continue;
+	    }
+
+	    if ( type == BL_JUMP && len == 12 ) {
+		if ( ! load_ok ( addr, 4 ) || ! load_ok ( get32 ( payload ), get32 ( payload+4 ) ) ) {
+		    reply ( BL_NAK, BL_WHY_ADDR, next );
+		    continue;
+		}
+		if ( image_crc ( get32 ( payload ), get32 ( payload+4 ) ) != get32 ( payload+8 ) ) {
+		    reply ( BL_NAK, BL_WHY_IMAGE, next );
+		    continue;
+		}
+		next++;
+		reply ( BL_ACK, 0, next );
+		start_image ( addr );
+	    }
+
+	    reply ( BL_NAK, BL_WHY_TYPE, next );
+	}
+}
+
+void
+handle_fiq ( void )
+{
+	int irq;
+
+	irq = gic_irqwho ();
+	if ( irq >= 1020 )
+	    return;		/* spurious */
+
+	if ( irq == IRQ_UART2 )
+	    uart_rx_handler ();
+
+	gic_irqack ( irq );
+}
+
+void
+handle_bad ( int why )
+{
+	printf ( "bare_load: unexpected exception %d\n", why );
+	spin ();
+}
+
+void
+main ( void )
+{
+	uart_init ();
+	stimer_init ();
+	uart_set_baud ( BL_BAUD_START, &cur_baud );
+	printf ( "\nbare_load ready, loads from %h to %h\n", load_base (), SRAM_TOP );
+
+	gic_init ();
+	gic_enable ( IRQ_UART2 );
+	uart_rx_irq_init ();
+	asm volatile ( "msr DAIFClr, #1" );
+
+	load ();
+}
+
+/* THE END */
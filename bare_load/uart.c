@@ -0,0 +1,491 @@
+/* RK3399 - uart.c
+ *
+ * Tom Trebisky  1-18-2022
+ *
+ * For bare_load, the receive side is interrupt driven,
+ * the handler moves the fifo into a ring (see the end).
+ */
+
+#include "baud.h"
+
+typedef volatile unsigned int vu32;
+typedef unsigned int u32;
+
+#define BIT(x)	(1<<(x))
+
+/* The TRM keeps register details in Appendix B
+ */
+struct rock_uart {
+	vu32	data;
+	vu32	ier;
+#define		dll	data
+#define		dlh	ier
+	vu32	iir;
+	vu32	lcr;
+
+	vu32	mcr;
+	vu32	lsr;
+	vu32	msr;
+	vu32	scr;
+
+	u32	_pad0[4];
+
+	vu32	srbr;		/* 0x30 */
+	u32	_pad1[3];
+
+	u32	_pad2[12];
+
+	vu32	far;		/* 0x70 */
+	vu32	tfr;		/* 0x74 */
+	vu32	rfw;		/* 0x78 */
+	vu32	status;		/* 0x7c */
+
+	vu32	tfl;		/* 0x80 */
+	vu32	rfl;		/* 0x84 */
+	vu32	srr;		/* 0x88 */
+	vu32	srts;		/* 0x8c */
+
+	vu32	sbcr;		/* 0x90 */
+	vu32	sdmam;		/* 0x94 */
+	vu32	sfe;		/* 0x98 */
+	vu32	srt;		/* 0x9c */
+
+	vu32	stet;		/* 0xa0 */
+	vu32	htx;		/* 0xa4 */
+	vu32	dmasa;		/* 0xa8 */
+	u32	_pad3;		/* 0xac */
+
+	u32	_pad4[16];
+
+	u32	_pad5;		/* 0xf0 */
+	vu32	cpr;		/* 0xf4 */
+	vu32	ucv;		/* 0xf8 */
+	vu32	ctr;		/* 0xfc */
+
+};
+
+#define UART0_BASE	((struct rock_uart *) 0xff180000)
+#define UART1_BASE	((struct rock_uart *) 0xff190000)
+#define UART2_BASE	((struct rock_uart *) 0xff1a0000)
+#define UART3_BASE	((struct rock_uart *) 0xff1b0000)
+
+#define UART4_BASE	((struct rock_uart *) 0xff370000)
+
+#define UART_BASE	UART2_BASE
+
+/* Bits in the status register */
+#define ST_BUSY		BIT(0)
+#define ST_TNF		BIT(1)
+#define ST_TE		BIT(2)
+#define ST_RNE		BIT(3)
+#define ST_RF		BIT(4)
+
+/* Bits in the SRR register */
+#define SRR_RESET_UART	0x01
+#define SRR_RESET_RFIFO	0x02
+#define SRR_RESET_TFIFO	0x04
+
+/* Baud rates possible are:
+ * 115.2Kbps, 460.8Kbps, 921.6Kbps, 1.5Mbps, 3Mbps, 4Mbps.
+ * From the 24 Mhz crystal only 1.5M is exact, baud.c
+ * finds a better clock for the others.
+ */
+
+/* now for the pin control (iomux) settings.
+ * For UART2, the pins are on GPIO4B
+ */
+#define GRF_BASE		0xff770000
+#define GRF_IOMUX_BASE		0xff77e000
+#define GRF_GPIO4B_IOMUX        0xe024
+
+/* The PMU GRF iomux registers control GPIO0 and GPIO1
+ */
+#define PMU_GRF_BASE		0xff320000
+
+struct iomux_regs {
+	vu32	iomux[12];
+};
+
+struct pmu_iomux_regs {
+	vu32	iomux[8];
+};
+
+/* belongs in an iomux.h file
+ */
+#define IOMUX_2A	0
+#define IOMUX_2B	1
+#define IOMUX_2C	2
+#define IOMUX_2D	3
+#define IOMUX_3A	4
+#define IOMUX_3B	5
+#define IOMUX_3C	6
+#define IOMUX_3D	7
+#define IOMUX_4A	8
+#define IOMUX_4B	9
+#define IOMUX_4C	10
+#define IOMUX_4D	11
+
+#define PMU_IOMUX_0A	0
+#define PMU_IOMUX_0B	1
+#define PMU_IOMUX_0C	2	/* not in RK3399 */
+#define PMU_IOMUX_0D	3	/* not in RK3399 */
+#define PMU_IOMUX_1A	4
+#define PMU_IOMUX_1B	5
+#define PMU_IOMUX_1C	6
+#define PMU_IOMUX_1D	7
+
+#ifdef notdef
+/* XXX - hack */
+typedef unsigned long u64;
+void
+io_write ( u64 base, u64 offset, u32 value )
+{
+	u32 *addr = (u32 *) (base + offset);
+
+	*addr = value;
+}
+#endif
+
+void
+iomux_set ( int gpio, int bit, int func )
+{
+	struct iomux_regs *ior = (struct iomux_regs *)  GRF_IOMUX_BASE;
+	u32 val;
+
+	val = (3<<(16+bit*2));
+	val |= (func<<(bit*2));
+
+	ior->iomux[gpio] = val;
+}
+
+/* We need to do this for UART2 which is our console.
+ * see page 204 in the TRM.
+ * Note that GRF is "general register files".
+ * There is also a PMUGRF.
+ * On page 55 in the datasheet we see:
+ * GPIO_B0 is our uart Rx when func 3 is selected
+ * GPIO_B1 is our uart Tx when func 3 is selected
+ * This particular GRF register is described on TRM page 309.
+ * The upper 16 bits are used to enable writes to the
+ * lower 16 bits.  Hence the mask of "3".
+ * Only 6 pins (GPIO4B[0] to GPIO4B[5]) are controlled by
+ * this register.  Each pin has 2 bits to control it.
+ * We mess with bits 0 and 1, setting the value of both to 2.
+ * Since this comment is becoming a tutorial on this, here are
+ * the 4 possible settings for those 2 bits:
+ * 0 = gpio
+ * 1 = sdmmc
+ * 2 = uart2
+ * 3 = reserved or JTAG
+ */
+void
+uart_iomux ( void )
+{
+	// rk_iomux_config(RK_UART0_IOMUX + ch);
+	// rk_uart_iomux_config(iomux_id);
+	// grf_writel((3 << 18) | (3 << 16) | (2 << 2) | (2 << 0), GRF_GPIO4B_IOMUX);
+	// #define grf_writel(v, offset)   do { writel(v, RKIO_GRF_PHYS + offset); } while (0)
+	// #define RKIO_GRF_PHYS                   0xFF770000
+	// #define GRF_GPIO4B_IOMUX        0xe024
+	// io_write ( GRF_BASE, GRF_GPIO4B_IOMUX, 
+	//     (3 << 18) | (3 << 16) | (2 << 2) | (2 << 0) );
+
+	/* Some boards have Uart 2 on these pins */
+	// iomux_set ( IOMUX_4B, 0, 2 );		/* GPIO4_B0 */
+	// iomux_set ( IOMUX_4B, 1, 2 );		/* GPIO4_B1 */
+
+	/* Orange Pi 4 uses these pins for Uart 2 */
+	iomux_set ( IOMUX_4C, 3, 1 );		/* GPIO4_C3 */
+	iomux_set ( IOMUX_4C, 4, 1 );		/* GPIO4_C4 */
+}
+
+void uart_flush ( void );
+
+#define LCR_DLAT	0x80
+
+#define BAUD_MODE_X	16
+
+static void
+uart_divisor ( u32 rate )
+{
+	struct rock_uart *up = UART_BASE;
+
+	up->lcr |= LCR_DLAT;
+
+	up->dll = rate & 0xff;
+	up->dlh = (rate >> 8 ) & 0xff;
+
+	up->lcr &= ~LCR_DLAT;
+}
+
+/* Any rate, using the best clock the CRU can give us (baud.c).
+ * Waits for pending output to go first.
+ * Returns 0 if the rate is impossible, else fills in *sp
+ * (if given) with how we did it, including the error.
+ */
+int
+uart_set_baud ( int baud, struct baud_setting *sp )
+{
+	struct baud_setting s;
+	u32 rates[2];
+
+	baud_pll_rates ( rates );
+	if ( ! baud_solve ( baud, rates, &s ) )
+	    return 0;
+
+	uart_set_clock ( &s );
+
+	if ( sp )
+	    *sp = s;
+	return 1;
+}
+
+/* Go (back) to a setting we already worked out.
+ * The receive fifo is tossed, anything in it
+ * came at the wrong rate.
+ */
+void
+uart_set_clock ( struct baud_setting *sp )
+{
+	struct rock_uart *up = UART_BASE;
+
+	uart_flush ();
+
+	baud_clock ( sp );
+	uart_divisor ( sp->divisor );
+
+	up->srr = SRR_RESET_RFIFO;
+}
+
+void
+uart_baud ( int baud )
+{
+	(void) uart_set_baud ( baud, 0 );
+}
+
+void
+uart_init ( void )
+{
+	struct rock_uart *up = UART_BASE;
+
+	uart_iomux ();
+
+	/* -- reset the uart and both fifos */
+	up->srr = SRR_RESET_UART | SRR_RESET_RFIFO | SRR_RESET_TFIFO;
+
+	/* -- disable interrupts */
+	up->ier = 0;
+
+	// val = rk_uart_set_iop(base, IRDA_SIR_DISABLED);
+	// writel(irda, base + UART_MCR);
+	up->mcr = 0;
+
+#define LCR_DATA8	0x3
+	// val = rk_uart_set_lcr(base, UART_BIT8, PARITY_DISABLED, ONE_STOP_BIT);
+	/* Parity is disabled and we get one stop bit when zeros are set
+	 */
+	up->lcr = LCR_DATA8;
+
+	// val = rk_uart_set_baudrate(base, baudrate);
+	uart_baud ( 1500000 );
+
+	// rk_uart_set_fifo(base);
+	up->sfe = 1;	/* enable fifos via shadow register */
+	up->srt = 1;	/* rcvr trigger via shadown register */
+	up->stet = 1;	/* tx empty trigger via shadown register */
+}
+
+void
+uart_putc ( char c )
+{
+	struct rock_uart *up = UART_BASE;
+
+	while ( ! (up->status & ST_TNF) )
+	    ;
+
+	up->data = c;
+}
+
+void
+uart_puts ( char *s )
+{
+	while ( *s ) {
+	    if (*s == '\n')
+		uart_putc('\r');
+	    uart_putc(*s++);
+	}
+}
+
+/* The fifos are 64 bytes deep */
+#define UART_FIFO_SIZE	64
+
+/* Raw bytes for our replies.
+ * Rather than checking TNF for every byte, we look at
+ * the fifo level once and fill all the room there is.
+ */
+void
+uart_write ( char *buf, int n )
+{
+	struct rock_uart *up = UART_BASE;
+	int room;
+
+	while ( n > 0 ) {
+	    room = UART_FIFO_SIZE - up->tfl;
+	    if ( room > n )
+		room = n;
+	    n -= room;
+	    while ( room-- )
+		up->data = *buf++;
+	}
+}
+
+/* Wait till everything is out on the wire */
+void
+uart_flush ( void )
+{
+	struct rock_uart *up = UART_BASE;
+
+	while ( ! (up->status & ST_TE) || (up->status & ST_BUSY) )
+	    ;
+}
+
+/* ------------------------------------------------------ */
+/* Receive ring.
+ *
+ * At 1.5 Mbaud a byte comes every 6.7 microseconds and
+ * the 64 byte fifo fills in about 430.  The loader has other
+ * things to do (checking CRCs, copying to SRAM) so the interrupt
+ * handler empties the fifo into this ring as things come in.
+ * It is big enough for every frame the host may have in flight.
+ */
+#define RX_RING_SIZE	8192	/* must be a power of 2 */
+#define RX_RING_MASK	(RX_RING_SIZE-1)
+
+static unsigned char rx_ring[RX_RING_SIZE];
+static volatile unsigned int rx_head;	/* written by the handler */
+static volatile unsigned int rx_tail;	/* written by uart_getc */
+
+static int rx_overrun;		/* ring was full */
+static int rx_errors;		/* fifo overrun, framing, ... */
+
+/* IER bits */
+#define IER_ERBFI	BIT(0)	/* rx data and rx timeout */
+#define IER_ELSI	BIT(2)	/* line status */
+
+/* LSR bits */
+#define LSR_OE		BIT(1)
+#define LSR_PE		BIT(2)
+#define LSR_FE		BIT(3)
+
+/* IIR interrupt id (low 4 bits) */
+#define IIR_NONE	0x1
+#define IIR_LINE	0x6
+#define IIR_RDA		0x4
+#define IIR_TIMEOUT	0xc
+#define IIR_BUSY	0x7
+
+/* RX trigger via srt: 0 = 1 char, 1 = 1/4, 2 = 1/2, 3 = 2 less than full */
+#define SRT_HALF	2
+
+void
+uart_rx_handler ( void )
+{
+	struct rock_uart *up = UART_BASE;
+	unsigned int head = rx_head;
+	int n;
+
+	switch ( up->iir & 0xf ) {
+	    case IIR_LINE:
+		if ( up->lsr & (LSR_OE|LSR_PE|LSR_FE) )
+		    rx_errors++;
+		break;
+	    case IIR_BUSY:
+		(void) up->status;
+		break;
+	}
+
+	/* One read of rfl tells us how much to take */
+	while ( (n = up->rfl) ) {
+	    while ( n-- ) {
+		if ( head - rx_tail >= RX_RING_SIZE ) {
+		    (void) up->data;
+		    rx_overrun++;
+		    continue;
+		}
+		rx_ring[head & RX_RING_MASK] = up->data;
+		head++;
+	    }
+	}
+
+	rx_head = head;
+}
+
+void
+uart_rx_irq_init ( void )
+{
+	struct rock_uart *up = UART_BASE;
+
+	rx_head = rx_tail = 0;
+	up->srt = SRT_HALF;
+	up->ier = IER_ERBFI | IER_ELSI;
+}
+
+void
+uart_rx_irq_stop ( void )
+{
+	struct rock_uart *up = UART_BASE;
+
+	up->ier = 0;
+	up->srt = 1;
+}
+
+/* Next byte from the ring, sleeping till one comes.
+ * The FIQ is masked around the check, otherwise one could
+ * come in between and we would sleep with data waiting.
+ * A pending interrupt still wakes up wfi when masked.
+ */
+int
+uart_getc ( void )
+{
+	int c;
+
+	while ( rx_head == rx_tail ) {
+	    asm volatile ( "msr DAIFSet, #1" );
+	    if ( rx_head == rx_tail )
+		asm volatile ( "wfi" );
+	    asm volatile ( "msr DAIFClr, #1" );
+	}
+
+	c = rx_ring[rx_tail & RX_RING_MASK];
+	rx_tail++;
+	return c;
+}
+
+/* Like uart_getc, but give up (and return -1) once the
+ * generic timer count passes deadline.  We poll rather than
+ * use wfi, since nothing would wake us up at the deadline.
+ */
+int
+uart_getc_until ( unsigned long deadline )
+{
+	unsigned long now;
+	int c;
+
+	while ( rx_head == rx_tail ) {
+	    asm volatile ( "mrs %0, cntpct_el0" : "=r" (now) );
+	    if ( now >= deadline )
+		return -1;
+	}
+
+	c = rx_ring[rx_tail & RX_RING_MASK];
+	rx_tail++;
+	return c;
+}
+
+int
+uart_rx_errors ( void )
+{
+	return rx_errors + rx_overrun;
+}
+
+/* THE END */
@@ -153,14 +153,14 @@ talker ( void )
 	}
 }
 
-/* This might give about a 1 second delay */
+void delay_init ( void );
+void mdelay ( unsigned int );
+
+/* One second, timed by the generic counter (delay.c) */
 void
 delay ( void )
 {
-        volatile int count = 100000000;
-
-        while ( count-- )
-            ;
+	mdelay ( 1000 );
 }
 
 /* This works, but manipulates all 32 bits.
@@ -224,6 +224,7 @@ void
 main ( void )
 {
 	uart_init();
+	delay_init ();
 
 	/* This will run the hello demo */
 	// talker ();
@@ -0,0 +1,401 @@
+/* a64.c
+ *
+ * Fast and approximate aarch64 instruction classifier,
+ * shared by the ROM analysis tools (datascan and friends).
+ *
+ * All we care about here is whether a 32 bit word could be
+ * an instruction on an ARMv8.0 core (A53/A72) and, if it is a
+ * branch or a pc relative reference, where it points.
+ * Encodings are from the ARMv8 ARM, section C4
+ * ("A64 Instruction Set Encoding").
+ *
+ * We are deliberately strict: anything that only exists in
+ * later versions of the architecture (SVE, atomics, pointer
+ * authentication other than the hint forms, MTE ...) is
+ * called invalid, since it cannot appear in the RK3399 or
+ * RK3328 bootrom, and that makes data stand out better.
+ */
+
+#include "a64.h"
+
+/* Sign extend the low "bits" bits of val */
+static int
+sext ( unsigned int val, int bits )
+{
+	int shift = 32 - bits;
+
+	return ((int) (val << shift)) >> shift;
+}
+
+static char *kind_names[A64_NKIND] = {
+	"invalid", "insn", "fp", "b", "bl", "bcond", "br",
+	"blr", "ret", "eret", "ldr_lit", "adr", "adrp", "udf"
+};
+
+char *
+a64_kind_name ( int kind )
+{
+	if ( kind < 0 || kind >= A64_NKIND )
+	    return "?";
+	return kind_names[kind];
+}
+
+/* Data processing -- immediate  (op0 = 100x) */
+static int
+dp_imm ( unsigned int w )
+{
+	int sf = w >> 31;
+	int op = (w >> 23) & 0x7;
+	int opc = (w >> 29) & 0x3;
+	int n = (w >> 22) & 1;
+
+	switch ( op ) {
+	    case 0:
+	    case 1:
+		return 1;		/* adr, adrp (handled by caller) */
+	    case 2:
+		return 1;		/* add/sub immediate */
+	    case 3:
+		return 0;		/* add/sub with tags (v8.5) */
+	    case 4:			/* logical immediate */
+		if ( ! sf && n )
+		    return 0;
+		return 1;
+	    case 5:			/* move wide */
+		if ( opc == 1 )
+		    return 0;
+		if ( ! sf && ((w >> 21) & 0x3) >= 2 )
+		    return 0;
+		return 1;
+	    case 6:			/* bitfield */
+		if ( opc == 3 )
+		    return 0;
+		if ( sf != n )
+		    return 0;
+		return 1;
+	    default:			/* extract */
+		if ( opc != 0 || (w & (1<<21)) )
+		    return 0;
+		if ( sf != n )
+		    return 0;
+		if ( ! sf && (w & (1<<15)) )
+		    return 0;
+		return 1;
+	}
+}
+
+/* Loads and stores  (op0 = x1x0) */
+static int
+ldst ( unsigned int w )
+{
+	int size = w >> 30;
+	int v = (w >> 26) & 1;
+	int opc;
+
+	/* load/store exclusive */
+	if ( (w & 0x3f000000) == 0x08000000 )
+	    return 1;
+
+	/* advanced SIMD load/store multiple and single structure */
+	if ( (w & 0xbe000000) == 0x0c000000 )
+	    return 2;
+
+	/* load/store pair, all 4 addressing forms */
+	if ( (w & 0x3a000000) == 0x28000000 ) {
+	    opc = size;
+	    if ( opc == 3 )
+		return 0;
+	    if ( ! v && opc == 1 && ! (w & (1<<22)) )
+		return 0;		/* stgp (v8.5) */
+	    return v ? 2 : 1;
+	}
+
+	/* load/store register, all forms */
+	if ( (w & 0x38000000) == 0x38000000 ) {
+	    opc = (w >> 22) & 0x3;
+	    if ( ! (w & (1<<24)) && (w & (1<<21)) ) {
+		/* register offset, or atomics / pac (v8.1+) */
+		if ( ((w >> 10) & 0x3) != 2 )
+		    return 0;
+		if ( ! (w & (1<<14)) )
+		    return 0;
+	    }
+	    if ( v ) {
+		if ( (opc & 2) && size != 0 )
+		    return 0;
+		return 2;
+	    }
+	    if ( size == 3 && opc == 3 )
+		return 0;
+	    if ( size == 2 && opc == 3 )
+		return 0;
+	    return 1;
+	}
+
+	return 0;
+}
+
+/* Data processing -- register  (op0 = x101) */
+static int
+dp_reg ( unsigned int w )
+{
+	int sf = w >> 31;
+	int op;
+
+	if ( ! (w & (1<<28)) ) {
+	    if ( ! (w & (1<<24)) ) {
+		/* logical (shifted register) */
+		if ( ! sf && (w & (1<<15)) )
+		    return 0;
+		return 1;
+	    }
+	    if ( ! (w & (1<<21)) ) {
+		/* add/sub (shifted register) */
+		if ( ((w >> 22) & 0x3) == 3 )
+		    return 0;
+		if ( ! sf && (w & (1<<15)) )
+		    return 0;
+		return 1;
+	    }
+	    /* add/sub (extended register) */
+	    if ( (w >> 22) & 0x3 )
+		return 0;
+	    if ( ((w >> 10) & 0x7) > 4 )
+		return 0;
+	    return 1;
+	}
+
+	op = (w >> 21) & 0xf;
+
+	if ( op & 0x8 ) {
+	    /* 3 source */
+	    if ( (w >> 29) & 0x3 )
+		return 0;
+	    op = ((w >> 20) & 0xe) | ((w >> 15) & 1);	/* op31:o0 */
+	    switch ( op ) {
+		case 0: case 1:
+		    return 1;
+		case 2: case 3: case 4: case 10: case 11: case 12:
+		    return sf;
+		default:
+		    return 0;
+	    }
+	}
+
+	switch ( op ) {
+	    case 0:		/* add/sub with carry */
+		return ((w >> 10) & 0x3f) == 0;
+	    case 2:		/* conditional compare */
+		if ( ! (w & (1<<29)) )
+		    return 0;
+		return (w & 0x410) == 0;
+	    case 4:		/* conditional select */
+		if ( w & (1<<29) )
+		    return 0;
+		return ((w >> 10) & 0x3) <= 1;
+	    case 6:
+		if ( w & (1<<30) ) {
+		    /* 1 source */
+		    if ( (w >> 16) & 0x1f )
+			return 0;
+		    return ((w >> 10) & 0x3f) < 6;
+		}
+		/* 2 source */
+		op = (w >> 10) & 0x3f;
+		if ( op == 2 || op == 3 )
+		    return 1;
+		if ( op >= 8 && op <= 11 )
+		    return 1;
+		if ( op >= 16 && op <= 23 )
+		    return 1;
+		return 0;
+	    default:
+		return 0;
+	}
+}
+
+/* Branches, exception generating and system instructions
+ * (op0 = 101x).  Fills in ip and returns the kind.
+ */
+static int
+branch ( unsigned int w, struct a64_insn *ip )
+{
+	if ( (w & 0x7c000000) == 0x14000000 ) {
+	    ip->off = sext ( w & 0x3ffffff, 26 ) * 4;
+	    if ( w & 0x80000000 )
+		return A64_BL;
+	    ip->flags |= A64F_NORETURN;
+	    return A64_B;
+	}
+
+	if ( (w & 0x7e000000) == 0x34000000 ) {		/* cbz, cbnz */
+	    ip->off = sext ( (w >> 5) & 0x7ffff, 19 ) * 4;
+	    return A64_BCOND;
+	}
+
+	if ( (w & 0x7e000000) == 0x36000000 ) {		/* tbz, tbnz */
+	    ip->off = sext ( (w >> 5) & 0x3fff, 14 ) * 4;
+	    return A64_BCOND;
+	}
+
+	if ( (w & 0xff000000) == 0x54000000 ) {
+	    if ( w & 0x10 )
+		return A64_INVALID;			/* bc.cond (v8.8) */
+	    ip->off = sext ( (w >> 5) & 0x7ffff, 19 ) * 4;
+	    return A64_BCOND;
+	}
+
+	if ( (w & 0xff000000) == 0xd4000000 ) {		/* exceptions */
+	    switch ( w & 0xffe0001f ) {
+		case 0xd4000001:	/* svc */
+		case 0xd4000002:	/* hvc */
+		case 0xd4000003:	/* smc */
+		    return A64_OTHER;
+		case 0xd4200000:	/* brk */
+		case 0xd4400000:	/* hlt */
+		    ip->flags |= A64F_NORETURN;
+		    return A64_OTHER;
+		default:
+		    return A64_INVALID;
+	    }
+	}
+
+	if ( (w & 0xffc00000) == 0xd5000000 ) {
+	    /* paciasp and pacibsp are hints, so they run anywhere */
+	    if ( w == 0xd503233f || w == 0xd503237f )
+		ip->flags |= A64F_PROLOGUE;
+	    return A64_OTHER;
+	}
+
+	if ( (w & 0xfffffc1f) == 0xd61f0000 ) {
+	    ip->flags |= A64F_NORETURN;
+	    return A64_BR;
+	}
+	if ( (w & 0xfffffc1f) == 0xd63f0000 )
+	    return A64_BLR;
+	if ( (w & 0xfffffc1f) == 0xd65f0000 ) {
+	    ip->flags |= A64F_NORETURN;
+	    return A64_RET;
+	}
+	if ( w == 0xd69f03e0 || w == 0xd6bf03e0 ) {	/* eret, drps */
+	    ip->flags |= A64F_NORETURN;
+	    return A64_ERET;
+	}
+
+	return A64_INVALID;
+}
+
+/* Classify one word.
+ * Returns the kind, which is also stored in ip.
+ */
+int
+a64_decode ( unsigned int w, struct a64_insn *ip )
+{
+	int op0 = (w >> 25) & 0xf;
+	int rv;
+	int opc;
+
+	ip->kind = A64_INVALID;
+	ip->size = 0;
+	ip->flags = 0;
+	ip->off = 0;
+
+	if ( w == 0 ) {
+	    ip->kind = A64_UDF;
+	    return A64_UDF;
+	}
+
+	/* Function entry patterns:
+	 *   stp x29, x30, [sp, #-N]!
+	 *   sub sp, sp, #N
+	 */
+	if ( (w & 0xffc07fff) == 0xa9807bfd || (w & 0xff8003ff) == 0xd10003ff )
+	    ip->flags |= A64F_PROLOGUE;
+
+	switch ( op0 ) {
+	    case 0x8:
+	    case 0x9:
+		if ( (w & 0x1f000000) == 0x10000000 ) {
+		    ip->off = sext ( ((w >> 3) & 0x1ffffc) | ((w >> 29) & 0x3), 21 );
+		    if ( w & 0x80000000 ) {
+			ip->off *= 4096;
+			ip->kind = A64_ADRP;
+		    } else
+			ip->kind = A64_ADR;
+		    break;
+		}
+		ip->kind = dp_imm ( w ) ? A64_OTHER : A64_INVALID;
+		break;
+
+	    case 0xa:
+	    case 0xb:
+		ip->kind = branch ( w, ip );
+		break;
+
+	    case 0x4: case 0x6: case 0xc: case 0xe:
+		if ( (w & 0x3b000000) == 0x18000000 ) {
+		    opc = w >> 30;
+		    ip->off = sext ( (w >> 5) & 0x7ffff, 19 ) * 4;
+		    if ( w & (1<<26) ) {
+			if ( opc == 3 )
+			    break;
+			ip->size = 4 << opc;
+		    } else
+			ip->size = (opc == 1) ? 8 : (opc == 3) ? 0 : 4;
+		    ip->kind = A64_LDR_LIT;
+		    break;
+		}
+		rv = ldst ( w );
+		if ( rv )
+		    ip->kind = (rv == 2) ? A64_FP : A64_OTHER;
+		break;
+
+	    case 0x5:
+	    case 0xd:
+		ip->kind = dp_reg ( w ) ? A64_OTHER : A64_INVALID;
+		break;
+
+	    case 0x7:
+	    case 0xf:
+		ip->kind = A64_FP;
+		break;
+
+	    default:
+		/* reserved, SVE and unallocated groups */
+		break;
+	}
+
+	if ( ip->kind == A64_INVALID )
+	    ip->flags = 0;
+
+	return ip->kind;
+}
+
+/* Position independent form of a decoded word.
+ * The offset fields of branches, adr/adrp and literal loads
+ * are masked out, so the same code at another address (or
+ * calling something that moved) compares equal.
+ * Anything else comes back unchanged.
+ */
+unsigned int
+a64_normalize ( unsigned int w, struct a64_insn *ip )
+{
+	switch ( ip->kind ) {
+	    case A64_B:
+	    case A64_BL:
+		return w & 0xfc000000;
+	    case A64_BCOND:
+		if ( (w & 0x7e000000) == 0x36000000 )
+		    return w & 0xfff8001f;	/* tbz, tbnz: keep bit number */
+		return w & 0xff00001f;		/* b.cond, cbz, cbnz */
+	    case A64_ADR:
+	    case A64_ADRP:
+		return w & 0x9f00001f;
+	    case A64_LDR_LIT:
+		return w & 0xff00001f;
+	    default:
+		return w;
+	}
+}
+
+/* THE END */
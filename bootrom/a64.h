@@ -0,0 +1,52 @@
+/* a64.h
+ *
+ * Just enough aarch64 instruction decoding to let the
+ * ROM analysis tools tell code from data and find
+ * branch and literal targets.
+ *
+ * This is NOT a disassembler, objdump does that job.
+ * What we want here is speed and a yes/no answer to
+ * "could this word be an instruction".
+ */
+
+/* Instruction kinds */
+#define A64_INVALID	0	/* unallocated, or not something a v8.0 core runs */
+#define A64_OTHER	1	/* valid, nothing special for our purposes */
+#define A64_FP		2	/* SIMD/FP group - valid, but suspicious in a ROM */
+#define A64_B		3	/* unconditional branch */
+#define A64_BL		4	/* branch and link (a call) */
+#define A64_BCOND	5	/* b.cond, cbz/cbnz, tbz/tbnz */
+#define A64_BR		6	/* branch to register */
+#define A64_BLR		7	/* call via register */
+#define A64_RET		8
+#define A64_ERET	9
+#define A64_LDR_LIT	10	/* pc relative load from a literal pool */
+#define A64_ADR		11
+#define A64_ADRP	12
+#define A64_UDF		13	/* all zeros and friends */
+
+#define A64_NKIND	14
+
+#define A64_NOP		0xd503201f
+
+/* One decoded word.
+ * This is kept small on purpose since the tools decode
+ * an entire image into an array of these.
+ */
+struct a64_insn {
+	unsigned char	kind;
+	unsigned char	size;	/* bytes loaded by LDR literal */
+	unsigned char	flags;
+	unsigned char	_pad;
+	int		off;	/* target, relative to the instruction */
+};
+
+/* flags */
+#define A64F_PROLOGUE	0x01	/* looks like a function entry */
+#define A64F_NORETURN	0x02	/* control never falls through */
+
+int a64_decode ( unsigned int, struct a64_insn * );
+unsigned int a64_normalize ( unsigned int, struct a64_insn * );
+char *a64_kind_name ( int );
+
+/* THE END */
@@ -128,7 +128,8 @@ struct string {
 struct string seg_strings;
 struct string sym_strings;
 
-#define MAX_SYM	400
+/* callgraph can find a lot of functions */
+#define MAX_SYM	4000
 
 struct symtab {
 	Elf32_Sym sym[MAX_SYM];
@@ -394,6 +395,8 @@ load_syms ( char *file )
 
 	while ( fgets ( line, MAXLINE, fp ) != NULL ) {
 	    line[strlen(line)-1] = '\0';	/* nuke newline */
+	    if ( strlen(line) < 10 )
+		continue;
 
 	    strncpy ( val, line, 8 );
 	    val[8] = '\0';
@@ -576,10 +579,11 @@ void add_null ( void )
 void init_symbol ( void )
 {
 	init_string ( &sym_strings );
+	add_string ( &sym_strings, "" );	/* st_name 0 is no name */
+	memset ( (char *) &syms, 0, sizeof ( struct symtab) );
 	syms.count = 0;
 	syms.size = 0;
 	syms.limit = MAX_SYM;
-	memset ( (char *) &syms, 0, sizeof ( struct symtab) );
 	add_null ();
 }
 
@@ -589,6 +593,11 @@ void add_symbol ( char *name, unsigned int addr )
 	int ix;
 	int info;
 
+	if ( syms.count >= syms.limit ) {
+	    fprintf ( stderr, "Too many symbols (max %d)\n", MAX_SYM );
+	    exit ( 1 );
+	}
+
 	sp = &syms.sym[syms.count++];
 	syms.size += sizeof ( *sp );
 
@@ -624,9 +633,19 @@ init_string ( struct string *sp )
 int add_string ( struct string *sp, char *s )
 {
 	int rv = sp->off;
+	int len = strlen(s) + 1;
+
+	while ( sp->off + len + 1 > sp->limit ) {
+	    sp->limit += PGSIZE;
+	    sp->buf = realloc ( sp->buf, sp->limit );
+	    if ( ! sp->buf ) {
+		fprintf ( stderr, "Out of memory for strings\n" );
+		exit ( 1 );
+	    }
+	}
 
 	strcpy ( &sp->buf[sp->off], s );
-	sp->off += strlen(s) + 1;
+	sp->off += len;
 
 	/* return offset of string just stored */
 	return rv;
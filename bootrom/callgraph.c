@@ -0,0 +1,746 @@
+/* callgraph -
+ *  find the functions in an aarch64 ROM image, who calls whom,
+ *  and write a symbol file that arm_wrap can read back.
+ *
+ *  Then objdump shows named functions and the "bl" instructions
+ *  show the name of what they call, which is most of what I was
+ *  doing by hand in bootrom.txt.
+ *
+ * Invoke this as follows:
+ *  callgraph [options] image
+ *  the image is a raw binary, or an ELF file from arm_wrap.
+ *  options are as follows:
+ *	-b base_addr (in hex, default ffff0000, not needed for ELF)
+ *	-a file	harvest names from an annotated listing (bootrom.txt)
+ *	-s file	take names from an existing symbol file
+ *	-g	show the call graph (calls and callers of each function)
+ *	-x	show the cross reference index (every call site)
+ *	-d	write the call graph for graphviz (dot)
+ *	-v	statistics and timing on stderr
+ *
+ * With no -g, -x or -d the symbol file goes to stdout:
+ *  ./callgraph -a bootrom.txt bootrom.bin >bootrom.sym
+ *  ./arm_wrap -bffff0000 bootrom.bin bootrom_n.elf bootrom.sym
+ *
+ * How functions are found:
+ *  - the entry point (the start of the image)
+ *  - the target of every "bl" in code we have reached
+ *  - addresses taken with adr/adrp that land on a prologue
+ *  - 64 bit pointers in data that land on a prologue
+ *	(the bootrom calls through tables like this with blr)
+ *  - finally any prologue nobody seems to reach
+ * Code is found by following control flow from each function
+ * start, so literal pools and tables are never decoded as code.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+
+#include "a64.h"
+#include "romimage.h"
+
+#define ADDR_BASE	0xffff0000
+
+/* How we found a function */
+#define F_ENTRY		0x01
+#define F_CALLED	0x02
+#define F_POINTER	0x04
+#define F_PROLOGUE	0x08
+#define F_NAMED		0x10
+
+/* Word marks */
+#define M_CODE		0x01
+#define M_DATA		0x02
+
+struct func {
+	int	start;		/* word index */
+	int	end;		/* one past the last word of code */
+	int	how;
+	int	ncalls;
+	int	ncallers;
+	char	*name;
+};
+
+struct edge {
+	int	site;		/* word index of the bl */
+	int	caller;		/* func index */
+	int	callee;		/* func index */
+	int	tail;		/* a "b" to another function */
+};
+
+unsigned int base = ADDR_BASE;
+int verbose = 0;
+
+unsigned int *image;
+int nwords;
+
+struct a64_insn *insn;
+unsigned char *mark;
+char **names;
+
+/* func_at[w] is the func index + 1 of a function starting at w */
+int *func_at;
+struct func *funcs;
+int nfuncs;
+
+struct edge *edges;
+int nedges;
+
+int *work;
+int nwork;
+
+void
+error ( char *msg )
+{
+	fprintf ( stderr, "%s\n", msg );
+	exit ( 1 );
+}
+
+static void
+use ( void )
+{
+	error ( "Usage: callgraph [-bBASE] [-a listing] [-s symfile] [-g] [-x] [-d] [-v] image" );
+}
+
+static void *
+xalloc ( long size )
+{
+	void *rv;
+
+	rv = calloc ( 1, size );
+	if ( ! rv )
+	    error ( "Out of memory" );
+	return rv;
+}
+
+static unsigned int
+waddr ( int i )
+{
+	return base + i * 4;
+}
+
+static int
+in_image ( unsigned int addr )
+{
+	return addr >= base && (addr & 3) == 0 && (addr - base) / 4 < nwords;
+}
+
+/* ---------------------------------------------------------- */
+
+static void
+add_func ( int w, int how )
+{
+	struct func *fp;
+
+	if ( w < 0 || w >= nwords )
+	    return;
+
+	if ( func_at[w] ) {
+	    funcs[func_at[w]-1].how |= how;
+	    return;
+	}
+
+	fp = &funcs[nfuncs++];
+	fp->start = w;
+	fp->how = how;
+	func_at[w] = nfuncs;
+
+	work[nwork++] = w;
+}
+
+static void
+push ( int w )
+{
+	if ( w >= 0 && w < nwords && ! (mark[w] & M_CODE) )
+	    work[nwork++] = w;
+}
+
+/* The target of adrp followed by add, or -1 */
+static int
+adrp_add ( int i )
+{
+	unsigned int w;
+	unsigned int addr;
+
+	if ( i + 1 >= nwords )
+	    return -1;
+	w = image[i+1];
+	if ( (w & 0xffc00000) != 0x91000000 )
+	    return -1;
+	if ( ((w >> 5) & 0x1f) != (image[i] & 0x1f) )
+	    return -1;
+
+	addr = (waddr(i) & ~0xfff) + insn[i].off + ((w >> 10) & 0xfff);
+	if ( ! in_image ( addr ) )
+	    return -1;
+	return (addr - base) / 4;
+}
+
+/* Follow control flow from everything on the work list */
+static void
+descend ( void )
+{
+	int w, t;
+	struct a64_insn *ip;
+
+	while ( nwork ) {
+	    w = work[--nwork];
+
+	    for ( ; w < nwords; w++ ) {
+		if ( mark[w] & (M_CODE|M_DATA) )
+		    break;
+		ip = &insn[w];
+		if ( ip->kind == A64_INVALID || ip->kind == A64_UDF )
+		    break;
+
+		mark[w] |= M_CODE;
+		t = w + ip->off / 4;
+
+		switch ( ip->kind ) {
+		    case A64_BL:
+			add_func ( t, F_CALLED );
+			break;
+		    case A64_B:
+		    case A64_BCOND:
+			push ( t );
+			break;
+		    case A64_LDR_LIT:
+			if ( t >= 0 && t < nwords ) {
+			    mark[t] |= M_DATA;
+			    if ( ip->size > 4 && t + 1 < nwords )
+				mark[t+1] |= M_DATA;
+			}
+			break;
+		    case A64_ADR:
+			if ( t >= 0 && t < nwords && (insn[t].flags & A64F_PROLOGUE) )
+			    add_func ( t, F_POINTER );
+			break;
+		    case A64_ADRP:
+			t = adrp_add ( w );
+			if ( t >= 0 && (insn[t].flags & A64F_PROLOGUE) )
+			    add_func ( t, F_POINTER );
+			break;
+		}
+
+		if ( ip->flags & A64F_NORETURN )
+		    break;
+	    }
+	}
+}
+
+/* Tables of 64 bit function pointers */
+static void
+find_pointers ( void )
+{
+	int i, t;
+
+	for ( i=0; i+1<nwords; i += 2 ) {
+	    if ( mark[i] & M_CODE )
+		continue;
+	    if ( image[i+1] != 0 || ! in_image ( image[i] ) )
+		continue;
+	    t = (image[i] - base) / 4;
+	    if ( insn[t].flags & A64F_PROLOGUE )
+		add_func ( t, F_POINTER );
+	}
+}
+
+/* Prologues that nothing we know of reaches */
+static void
+find_orphans ( void )
+{
+	int i;
+
+	for ( i=0; i<nwords; i++ ) {
+	    if ( mark[i] & (M_CODE|M_DATA) )
+		continue;
+	    if ( insn[i].flags & A64F_PROLOGUE )
+		add_func ( i, F_PROLOGUE );
+	}
+}
+
+/* ---------------------------------------------------------- */
+
+static int
+func_compare ( const void *a, const void *b )
+{
+	const struct func *fa = a;
+	const struct func *fb = b;
+
+	return fa->start - fb->start;
+}
+
+/* Sort the functions by address and work out where each ends.
+ * A function owns the code from its start up to the start of
+ * the next one.
+ */
+static void
+finish_funcs ( void )
+{
+	int i, w, limit;
+
+	qsort ( funcs, nfuncs, sizeof(struct func), func_compare );
+
+	for ( i=0; i<nfuncs; i++ ) {
+	    func_at[funcs[i].start] = i + 1;
+	    limit = (i + 1 < nfuncs) ? funcs[i+1].start : nwords;
+	    funcs[i].end = funcs[i].start + 1;
+	    for ( w = funcs[i].start; w < limit; w++ )
+		if ( mark[w] & M_CODE )
+		    funcs[i].end = w + 1;
+	}
+}
+
+/* The function containing word w, or -1 */
+static int
+func_of ( int w )
+{
+	int lo = 0;
+	int hi = nfuncs - 1;
+	int mid;
+
+	if ( nfuncs == 0 || w < funcs[0].start )
+	    return -1;
+
+	while ( lo < hi ) {
+	    mid = (lo + hi + 1) / 2;
+	    if ( funcs[mid].start <= w )
+		lo = mid;
+	    else
+		hi = mid - 1;
+	}
+
+	if ( w >= funcs[lo].end )
+	    return -1;
+	return lo;
+}
+
+static void
+build_edges ( void )
+{
+	int w, t;
+	int caller, callee;
+	struct edge *ep;
+
+	edges = xalloc ( (long) nwords * sizeof(struct edge) );
+	nedges = 0;
+
+	for ( w=0; w<nwords; w++ ) {
+	    if ( ! (mark[w] & M_CODE) )
+		continue;
+	    if ( insn[w].kind != A64_BL && insn[w].kind != A64_B )
+		continue;
+
+	    t = w + insn[w].off / 4;
+	    if ( t < 0 || t >= nwords || ! func_at[t] )
+		continue;
+	    callee = func_at[t] - 1;
+	    caller = func_of ( w );
+	    if ( caller < 0 )
+		continue;
+	    if ( insn[w].kind == A64_B && caller == callee )
+		continue;
+
+	    ep = &edges[nedges++];
+	    ep->site = w;
+	    ep->caller = caller;
+	    ep->callee = callee;
+	    ep->tail = insn[w].kind == A64_B;
+
+	    funcs[caller].ncalls++;
+	    funcs[callee].ncallers++;
+	}
+}
+
+static int
+edge_by_callee ( const void *a, const void *b )
+{
+	const struct edge *ea = a;
+	const struct edge *eb = b;
+
+	if ( ea->callee != eb->callee )
+	    return ea->callee - eb->callee;
+	return ea->site - eb->site;
+}
+
+/* ---------------------------------------------------------- */
+
+#define MAXLINE		1024
+#define MAXNAME		64
+
+static void
+set_name ( unsigned int addr, char *name )
+{
+	int w;
+
+	if ( ! in_image ( addr ) )
+	    return;
+	w = (addr - base) / 4;
+	if ( names[w] )
+	    return;
+	names[w] = strdup ( name );
+}
+
+/* Symbol file, the same format arm_wrap reads:
+ *  ffff0148 some_name
+ */
+static void
+load_syms ( char *path )
+{
+	FILE *fp;
+	char line[MAXLINE];
+	char name[MAXLINE];
+	unsigned int addr;
+
+	fp = fopen ( path, "r" );
+	if ( fp == NULL )
+	    error ( "Cannot read symbol file" );
+
+	while ( fgets ( line, MAXLINE, fp ) != NULL ) {
+	    if ( sscanf ( line, "%x %s", &addr, name ) != 2 )
+		continue;
+	    set_name ( addr, name );
+	}
+
+	fclose ( fp );
+}
+
+/* Comment words that are not names */
+static char *not_names[] = { "call", "calls", "called", NULL };
+
+/* Pick up a name at p, as long as it looks like one.
+ * It must be followed by an argument list, a closing quote,
+ * or nothing at all, so "read efuse (waste)" is not a name.
+ */
+static int
+get_name ( char *p, char *name )
+{
+	char **np;
+	int n = 0;
+
+	if ( ! isalpha ( *p ) && *p != '_' )
+	    return 0;
+	while ( (isalnum ( *p ) || *p == '_') && n < MAXNAME - 1 )
+	    name[n++] = *p++;
+	name[n] = '\0';
+
+	for ( np = not_names; *np; np++ )
+	    if ( strcmp ( name, *np ) == 0 )
+		return 0;
+
+	while ( *p == ' ' || *p == '\t' )
+	    p++;
+	return *p == '(' || *p == '"' || *p == '\n' || *p == '\0';
+}
+
+/* Find a name in a header comment like:
+ *  ; subroutine crypto_set_hash_len ( length )
+ *  ; subroutine "crypto3" -- only called once
+ *  ; subroutine - try_four ()
+ * but not in "; subroutine - read first 4 bytes of SRAM"
+ */
+static int
+comment_name ( char *line, char *name )
+{
+	char *p;
+
+	p = line + 1;
+	while ( *p == ' ' || *p == '\t' )
+	    p++;
+	if ( strncmp ( p, "subroutine", 10 ) != 0 )
+	    return 0;
+	p += 10;
+	while ( *p == ' ' || *p == '\t' || *p == '-' || *p == '"' )
+	    p++;
+	return get_name ( p, name );
+}
+
+/* Harvest names from my annotated listing.
+ * I write the callee name as a comment on the bl:
+ *  ffff01a0:	94000f73 	bl	0xffff3f6c	; read_efuse()
+ * and sometimes a header comment before the function itself.
+ */
+static void
+load_notes ( char *path )
+{
+	FILE *fp;
+	char line[MAXLINE];
+	char name[MAXNAME];
+	char pending[MAXNAME];
+	unsigned int addr;
+	char *p, *e;
+
+	fp = fopen ( path, "r" );
+	if ( fp == NULL )
+	    error ( "Cannot read annotated listing" );
+
+	pending[0] = '\0';
+
+	while ( fgets ( line, MAXLINE, fp ) != NULL ) {
+	    if ( line[0] == ';' ) {
+		if ( comment_name ( line, name ) )
+		    strcpy ( pending, name );
+		continue;
+	    }
+
+	    addr = strtoul ( line, &e, 16 );
+	    if ( e == line || *e != ':' )
+		continue;
+
+	    /* first code line after a header comment */
+	    if ( pending[0] ) {
+		set_name ( addr, pending );
+		pending[0] = '\0';
+	    }
+
+	    p = strstr ( line, "\tbl\t0x" );
+	    if ( ! p )
+		continue;
+	    addr = strtoul ( p + 4, &e, 16 );
+	    p = strchr ( e, ';' );
+	    if ( ! p )
+		continue;
+	    p++;
+	    while ( *p == ' ' || *p == '\t' )
+		p++;
+	    if ( get_name ( p, name ) )
+		set_name ( addr, name );
+	}
+
+	fclose ( fp );
+}
+
+static char *
+func_name ( struct func *fp )
+{
+	static char buf[4][MAXNAME];
+	static int n;
+	char *rv;
+
+	if ( fp->name )
+	    return fp->name;
+
+	rv = buf[n++ % 4];
+	if ( fp->how & F_ENTRY )
+	    sprintf ( rv, "reset_%08x", waddr(fp->start) );
+	else
+	    sprintf ( rv, "fn_%08x", waddr(fp->start) );
+	return rv;
+}
+
+/* ---------------------------------------------------------- */
+
+static void
+show_syms ( void )
+{
+	int i;
+
+	for ( i=0; i<nfuncs; i++ )
+	    printf ( "%08x %s\n", waddr(funcs[i].start), func_name ( &funcs[i] ) );
+}
+
+static void
+show_graph ( void )
+{
+	struct func *fp;
+	int i, j, k, n;
+	int last;
+
+	qsort ( edges, nedges, sizeof(struct edge), edge_by_callee );
+
+	/* edges are sorted by callee, so callers are easy */
+	j = 0;
+	for ( i=0; i<nfuncs; i++ ) {
+	    fp = &funcs[i];
+	    printf ( "%08x %s  (%d insns)\n", waddr(fp->start), func_name(fp), fp->end - fp->start );
+
+	    n = 0;
+	    for ( ; j<nedges && edges[j].callee == i; j++ ) {
+		printf ( n ? ", " : "    called from: " );
+		printf ( "%08x%s (%s)", waddr(edges[j].site), edges[j].tail ? " tail" : "",
+		    func_name ( &funcs[edges[j].caller] ) );
+		n++;
+	    }
+	    if ( n )
+		printf ( "\n" );
+
+	    /* each callee once */
+	    n = 0;
+	    last = -1;
+	    for ( k=0; k<nedges; k++ ) {
+		if ( edges[k].caller != i || edges[k].callee == last )
+		    continue;
+		last = edges[k].callee;
+		printf ( n ? ", " : "    calls: " );
+		printf ( "%s", func_name ( &funcs[edges[k].callee] ) );
+		n++;
+	    }
+	    if ( n )
+		printf ( "\n" );
+	}
+}
+
+static void
+show_xref ( void )
+{
+	struct edge *ep;
+	int i;
+
+	qsort ( edges, nedges, sizeof(struct edge), edge_by_callee );
+
+	for ( i=0; i<nedges; i++ ) {
+	    ep = &edges[i];
+	    printf ( "%08x %-24s %s %08x in %s\n",
+		waddr(funcs[ep->callee].start), func_name ( &funcs[ep->callee] ),
+		ep->tail ? "b " : "bl", waddr(ep->site), func_name ( &funcs[ep->caller] ) );
+	}
+}
+
+static void
+show_dot ( void )
+{
+	struct edge *ep;
+	int i;
+
+	printf ( "digraph callgraph {\n" );
+	printf ( "\tnode [shape=box, fontsize=10];\n" );
+	for ( i=0; i<nedges; i++ ) {
+	    ep = &edges[i];
+	    if ( i && ep->caller == ep[-1].caller && ep->callee == ep[-1].callee )
+		continue;
+	    printf ( "\t\"%s\" -> \"%s\"%s;\n", func_name ( &funcs[ep->caller] ),
+		func_name ( &funcs[ep->callee] ), ep->tail ? " [style=dashed]" : "" );
+	}
+	printf ( "}\n" );
+}
+
+static double
+now ( void )
+{
+	struct timespec ts;
+
+	clock_gettime ( CLOCK_MONOTONIC, &ts );
+	return ts.tv_sec + ts.tv_nsec * 1.0e-9;
+}
+
+int
+main ( int argc, char **argv )
+{
+	char *sym_file = NULL;
+	char *note_file = NULL;
+	struct rom rom;
+	int mode = 's';
+	double t0;
+	int i, n;
+
+	--argc;
+	++argv;
+
+	while ( argc && **argv == '-' ) {
+	    switch ( argv[0][1] ) {
+		case 'b':
+		    base = strtoul ( &argv[0][2], NULL, 16 );
+		    break;
+		case 'g':
+		case 'x':
+		case 'd':
+		    mode = argv[0][1];
+		    break;
+		case 'v':
+		    verbose = 1;
+		    break;
+		case 'a':
+		case 's':
+		    if ( argc < 2 )
+			use ();
+		    if ( argv[0][1] == 'a' )
+			note_file = argv[1];
+		    else
+			sym_file = argv[1];
+		    --argc;
+		    ++argv;
+		    break;
+		default:
+		    use ();
+	    }
+	    --argc;
+	    ++argv;
+	}
+
+	if ( argc != 1 )
+	    use ();
+
+	rom_load ( argv[0], &rom, base );
+	image = rom.words;
+	nwords = rom.nwords;
+	base = rom.base;
+
+	t0 = now ();
+
+	/* Decode the whole image once */
+	insn = xalloc ( (long) nwords * sizeof(struct a64_insn) );
+	for ( i=0; i<nwords; i++ )
+	    a64_decode ( image[i], &insn[i] );
+
+	mark = xalloc ( nwords );
+	names = xalloc ( (long) nwords * sizeof(char *) );
+	func_at = xalloc ( (long) nwords * sizeof(int) );
+	funcs = xalloc ( (long) nwords * sizeof(struct func) );
+	work = xalloc ( (long) nwords * 2 * sizeof(int) );
+
+	/* Hand given names first, they win */
+	if ( sym_file )
+	    load_syms ( sym_file );
+	if ( note_file )
+	    load_notes ( note_file );
+
+	add_func ( 0, F_ENTRY );
+	descend ();
+	find_pointers ();
+	descend ();
+	find_orphans ();
+	descend ();
+
+	/* Named addresses we did not find are functions too */
+	for ( i=0; i<nwords; i++ )
+	    if ( names[i] && ! func_at[i] && ! (mark[i] & M_DATA) )
+		add_func ( i, F_NAMED );
+	descend ();
+
+	finish_funcs ();
+	for ( i=0; i<nfuncs; i++ )
+	    funcs[i].name = names[funcs[i].start];
+	build_edges ();
+
+	if ( verbose ) {
+	    n = 0;
+	    for ( i=0; i<nwords; i++ )
+		if ( mark[i] & M_CODE )
+		    n++;
+	    fprintf ( stderr, "%d words, %d code, %d functions, %d calls\n",
+		nwords, n, nfuncs, nedges );
+	    fprintf ( stderr, "analysis took %.3f ms\n", (now() - t0) * 1000.0 );
+	}
+
+	switch ( mode ) {
+	    case 'g':
+		show_graph ();
+		break;
+	    case 'x':
+		show_xref ();
+		break;
+	    case 'd':
+		show_dot ();
+		break;
+	    default:
+		show_syms ();
+		break;
+	}
+
+	return 0;
+}
+
+/* THE END */
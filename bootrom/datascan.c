@@ -0,0 +1,666 @@
+/* datascan -
+ *  find the literal pools, tables and zero fill in an
+ *  aarch64 binary image and display them in a civilized way.
+ *
+ *  This supersedes dumpcon.  With dumpcon I had to find each
+ *  block of constants by eye, guess how many words it held,
+ *  then trim and splice the output by hand.  This does all
+ *  of that for the whole image in one pass.
+ *
+ * Invoke this as follows:
+ *  datascan [options] image
+ *  the image is a raw binary, or an ELF file from arm_wrap.
+ *  options are as follows:
+ *	-b base_addr (in hex, default ffff0000, not needed for ELF)
+ *	-m	just show a map of code/data/zero regions
+ *	-s file	splice the data blocks into an objdump listing
+ *	-f	the image uses SIMD/FP (U-Boot does, the bootrom does not)
+ *	-v	statistics and timing on stderr
+ *
+ * Typical invocations:
+ *  ./datascan bootrom.bin >bootrom.con
+ *  ./datascan -s bootrom.dis bootrom.bin >bootrom.sdis
+ *
+ * How it works:
+ *  1 - every word is decoded once (see a64.c)
+ *  2 - runs of valid instructions long enough to be code are
+ *	marked as "probably code".
+ *  3 - ldr (literal) instructions in that code tell us exactly
+ *	where the literal pools are and how wide the items are.
+ *  4 - runs are re-evaluated with the literal pools cut out,
+ *	anything that is still not code is data or zero fill.
+ * Every step is a linear pass over the image, so even U-Boot
+ * sized images take a few milliseconds.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "a64.h"
+#include "romimage.h"
+
+#define ADDR_BASE	0xffff0000
+
+/* A run of valid instructions shorter than this is
+ * assumed to be data that happens to decode.
+ */
+#define MIN_RUN		4
+
+/* Shorter than this (in words) and a block of zeros is
+ * called a constant, not fill.
+ */
+#define MIN_PAD		4
+
+/* Word classes */
+#define C_CODE		0
+#define C_DATA		1
+#define C_PAD		2
+
+/* Word flags */
+#define R_LIT4		0x01	/* loaded by a 4 byte ldr literal */
+#define R_LIT8		0x02	/* ... 8 byte */
+#define R_LIT16		0x04	/* ... 16 byte */
+#define R_ADR		0x08	/* address taken via adr/adrp */
+#define R_BRANCH	0x10	/* branch target */
+#define R_CAND		0x20	/* candidate code */
+
+struct region {
+	int	start;		/* word index */
+	int	end;		/* one past the last word */
+	int	class;
+};
+
+struct ref {
+	int	target;		/* word index */
+	int	from;		/* word index */
+};
+
+unsigned int base = ADDR_BASE;
+int allow_fp = 0;
+int verbose = 0;
+
+unsigned int *image;
+int nwords;
+
+struct a64_insn *insn;
+unsigned char *flags;
+unsigned char *class;
+
+struct region *regions;
+int nregions;
+
+struct ref *refs;
+int nrefs;
+
+void
+error ( char *msg )
+{
+	fprintf ( stderr, "%s\n", msg );
+	exit ( 1 );
+}
+
+static void
+use ( void )
+{
+	error ( "Usage: datascan [-bBASE] [-m] [-f] [-v] [-s dis_file] image" );
+}
+
+static void *
+xalloc ( int size )
+{
+	void *rv;
+
+	rv = calloc ( 1, size );
+	if ( ! rv )
+	    error ( "Out of memory" );
+	return rv;
+}
+
+static int
+is_valid ( int i )
+{
+	int k = insn[i].kind;
+
+	if ( k == A64_INVALID || k == A64_UDF )
+	    return 0;
+	if ( class[i] == C_DATA )
+	    return 0;
+	return 1;
+}
+
+/* Look at runs of valid instructions and mark the
+ * ones that are plausibly code.  Data words (once we
+ * know about them) break runs.
+ */
+static void
+mark_candidates ( void )
+{
+	int i, j, k;
+	int nfp;
+	int len;
+
+	i = 0;
+	while ( i < nwords ) {
+	    if ( ! is_valid ( i ) ) {
+		flags[i] &= ~R_CAND;
+		i++;
+		continue;
+	    }
+
+	    /* A run also ends after anything control cannot fall
+	     * through, since that is where literal pools get put.
+	     */
+	    nfp = 0;
+	    for ( j=i; j<nwords && is_valid(j); j++ ) {
+		if ( insn[j].kind == A64_FP )
+		    nfp++;
+		if ( insn[j].flags & A64F_NORETURN ) {
+		    j++;
+		    break;
+		}
+	    }
+
+	    len = j - i;
+	    if ( ! allow_fp )
+		len -= nfp;
+
+	    /* Short runs are fine if something branches to them,
+	     * if they end in a return (tiny functions), if they are
+	     * a lone branch into the image (vectors), or if they
+	     * are nothing but nop (alignment padding).
+	     */
+	    if ( nfp == 0 && (flags[i] & R_BRANCH) )
+		len = MIN_RUN;
+	    if ( nfp == 0 && j - i > 1 && (insn[j-1].flags & A64F_NORETURN) )
+		len = MIN_RUN;
+	    if ( j - i == 1 && insn[i].kind == A64_B ) {
+		k = i + insn[i].off / 4;
+		if ( k >= 0 && k < nwords )
+		    len = MIN_RUN;
+	    }
+	    for ( k=i; k<j && image[k] == A64_NOP; k++ )
+		;
+	    if ( k == j )
+		len = MIN_RUN;
+
+	    /* We insist on a sane fraction of integer instructions,
+	     * addresses in a table look like SIMD/FP to the decoder.
+	     */
+	    if ( len >= MIN_RUN && (allow_fp || nfp * 2 <= j - i) ) {
+		for ( ; i<j; i++ )
+		    flags[i] |= R_CAND;
+	    } else {
+		for ( ; i<j; i++ )
+		    flags[i] &= ~R_CAND;
+	    }
+	}
+}
+
+static void
+add_ref ( int target, int from )
+{
+	refs[nrefs].target = target;
+	refs[nrefs].from = from;
+	nrefs++;
+}
+
+/* The usual way to get at data more than 1M away is
+ *    adrp  x2, page
+ *    ldr   w2, [x2, #0xe70]     (or add x2, x2, #0xe70)
+ * Look a few instructions ahead for the second half and
+ * return the word index it refers to (or -1).
+ * The load size is returned via sizep (0 for add).
+ */
+#define ADRP_LOOK	4
+
+static int
+adrp_target ( int i, int *sizep )
+{
+	unsigned int page;
+	unsigned int w;
+	int rd = image[i] & 0x1f;
+	int j;
+	int off;
+
+	page = ((base + i * 4) & ~0xfff) + insn[i].off;
+
+	for ( j=i+1; j<nwords && j<=i+ADRP_LOOK; j++ ) {
+	    w = image[j];
+	    if ( ((w >> 5) & 0x1f) != rd )
+		continue;
+
+	    if ( (w & 0xffc00000) == 0x91000000 ) {	/* add xd, xn, #imm */
+		off = (w >> 10) & 0xfff;
+		*sizep = 0;
+	    } else if ( (w & 0x3fc00000) == 0x39400000 ) { /* ldr, unsigned offset */
+		*sizep = 1 << (w >> 30);
+		off = ((w >> 10) & 0xfff) * *sizep;
+	    } else
+		return -1;
+
+	    page += off;
+	    if ( page < base || (page & 3) )
+		return -1;
+	    return (page - base) / 4;
+	}
+
+	return -1;
+}
+
+/* Follow ldr literal, adr and adrp from candidate code.
+ * The loaded words are data, no doubt about it.
+ */
+static void
+mark_literals ( void )
+{
+	int i, t, n;
+	int size;
+
+	nrefs = 0;
+
+	for ( i=0; i<nwords; i++ ) {
+	    if ( ! (flags[i] & R_CAND) )
+		continue;
+
+	    if ( insn[i].kind == A64_BL || insn[i].kind == A64_B || insn[i].kind == A64_BCOND ) {
+		t = i + insn[i].off / 4;
+		if ( t >= 0 && t < nwords )
+		    flags[t] |= R_BRANCH;
+		continue;
+	    }
+
+	    if ( insn[i].kind == A64_ADR ) {
+		t = i + insn[i].off / 4;
+		if ( (insn[i].off & 3) == 0 && t >= 0 && t < nwords ) {
+		    flags[t] |= R_ADR;
+		    add_ref ( t, i );
+		}
+		continue;
+	    }
+
+	    if ( insn[i].kind == A64_ADRP ) {
+		t = adrp_target ( i, &size );
+		if ( t < 0 || t >= nwords )
+		    continue;
+		add_ref ( t, i );
+		if ( size < 4 ) {
+		    flags[t] |= R_ADR;
+		    continue;
+		}
+	    } else if ( insn[i].kind == A64_LDR_LIT ) {
+		size = insn[i].size;
+		if ( size == 0 )		/* prfm */
+		    continue;
+		t = i + insn[i].off / 4;
+		if ( t < 0 || t >= nwords )
+		    continue;
+		add_ref ( t, i );
+	    } else
+		continue;
+
+	    n = size / 4;
+	    if ( t + n > nwords )
+		continue;
+
+	    flags[t] |= (size == 4) ? R_LIT4 : (size == 8) ? R_LIT8 : R_LIT16;
+	    while ( n-- )
+		class[t++] = C_DATA;
+	}
+}
+
+/* Anything not code is data or fill.
+ * Long runs of zeros are fill, short ones are constants
+ * (a zero in a literal pool for example).
+ */
+static void
+classify ( void )
+{
+	int i, j;
+
+	for ( i=0; i<nwords; i++ ) {
+	    if ( class[i] == C_DATA )
+		continue;
+	    class[i] = (flags[i] & R_CAND) ? C_CODE : C_DATA;
+	}
+
+	i = 0;
+	while ( i < nwords ) {
+	    if ( image[i] != 0 || (flags[i] & (R_LIT4|R_LIT8|R_LIT16)) ) {
+		i++;
+		continue;
+	    }
+	    for ( j=i; j<nwords && image[j] == 0; j++ )
+		;
+	    if ( j - i >= MIN_PAD || i == 0 || class[i-1] == C_CODE ) {
+		for ( ; i<j; i++ )
+		    class[i] = C_PAD;
+	    }
+	    i = j;
+	}
+}
+
+static void
+build_regions ( void )
+{
+	int i;
+	struct region *rp;
+
+	regions = xalloc ( (nwords + 1) * sizeof(struct region) );
+	nregions = 0;
+
+	/* Big data areas get split where a table starts, so that
+	 * each table is shown with its own references.
+	 */
+	for ( i=0; i<nwords; i++ ) {
+	    if ( nregions && regions[nregions-1].class == class[i] &&
+		    ! (class[i] == C_DATA && (flags[i] & R_ADR)) ) {
+		regions[nregions-1].end = i + 1;
+		continue;
+	    }
+	    rp = &regions[nregions++];
+	    rp->start = i;
+	    rp->end = i + 1;
+	    rp->class = class[i];
+	}
+}
+
+static int
+ref_compare ( const void *a, const void *b )
+{
+	const struct ref *ra = a;
+	const struct ref *rb = b;
+
+	if ( ra->target != rb->target )
+	    return ra->target - rb->target;
+	return ra->from - rb->from;
+}
+
+static unsigned int
+waddr ( int i )
+{
+	return base + i * 4;
+}
+
+/* Find the region a word lives in */
+static int
+find_region ( int w )
+{
+	int lo = 0;
+	int hi = nregions - 1;
+	int mid;
+
+	while ( lo < hi ) {
+	    mid = (lo + hi + 1) / 2;
+	    if ( regions[mid].start <= w )
+		lo = mid;
+	    else
+		hi = mid - 1;
+	}
+	return lo;
+}
+
+#define MAX_SHOW_REFS	6
+
+/* Display one data block, dumpcon style, preceded by
+ * a comment saying who refers to it.
+ */
+static void
+show_block ( FILE *fp, struct region *rp, int *rix )
+{
+	int i, n;
+	int wide;
+	unsigned int hi, lo;
+
+	fprintf ( fp, "; ---- data: %08x to %08x (%d bytes) ----\n",
+	    waddr(rp->start), waddr(rp->end) - 1, (rp->end - rp->start) * 4 );
+
+	while ( *rix < nrefs && refs[*rix].target < rp->start )
+	    (*rix)++;
+
+	n = 0;
+	for ( i = *rix; i < nrefs && refs[i].target < rp->end; i++ ) {
+	    if ( n == 0 )
+		fprintf ( fp, "; referenced from:" );
+	    if ( n < MAX_SHOW_REFS )
+		fprintf ( fp, " %08x", waddr(refs[i].from) );
+	    n++;
+	}
+	if ( n > MAX_SHOW_REFS )
+	    fprintf ( fp, " (and %d more)", n - MAX_SHOW_REFS );
+	if ( n )
+	    fprintf ( fp, "\n" );
+	*rix = i;
+
+	/* 64 bit items are shown as such, just like dumpcon does
+	 * by default.  Pools often have the odd 32 bit load of the
+	 * low half of an item, so we go with the majority.
+	 */
+	n = 0;
+	for ( i=rp->start; i<rp->end; i++ ) {
+	    if ( flags[i] & R_LIT4 )
+		n--;
+	    if ( flags[i] & (R_LIT8|R_LIT16) )
+		n++;
+	}
+	wide = n > 0;
+	if ( (rp->start & 1) || ((rp->end - rp->start) & 1) )
+	    wide = 0;
+
+	if ( wide ) {
+	    for ( i=rp->start; i<rp->end; i += 2 ) {
+		hi = image[i+1];
+		lo = image[i];
+		fprintf ( fp, "%08x: %08x %08x\n", waddr(i), hi, lo );
+	    }
+	} else {
+	    for ( i=rp->start; i<rp->end; i++ )
+		fprintf ( fp, "%08x: %08x\n", waddr(i), image[i] );
+	}
+}
+
+static void
+show_pad ( FILE *fp, struct region *rp )
+{
+	fprintf ( fp, "; ---- zero fill: %08x to %08x (%d bytes) ----\n",
+	    waddr(rp->start), waddr(rp->end) - 1, (rp->end - rp->start) * 4 );
+}
+
+static char *class_names[] = { "code", "data", "zero" };
+
+static void
+show_map ( void )
+{
+	int i;
+	struct region *rp;
+
+	for ( i=0; i<nregions; i++ ) {
+	    rp = &regions[i];
+	    printf ( "%08x %08x %s\n", waddr(rp->start), waddr(rp->end) - 1,
+		class_names[rp->class] );
+	}
+}
+
+static void
+show_data ( void )
+{
+	int i;
+	int rix = 0;
+
+	for ( i=0; i<nregions; i++ ) {
+	    if ( regions[i].class == C_DATA ) {
+		show_block ( stdout, &regions[i], &rix );
+		printf ( "\n" );
+	    }
+	    if ( regions[i].class == C_PAD ) {
+		show_pad ( stdout, &regions[i] );
+		printf ( "\n" );
+	    }
+	}
+}
+
+#define MAXLINE	1024
+
+/* Parse the address off the front of an objdump line like:
+ *  ffff0428:	b94e7042 	ldr	w2, [x2, #0xe70]
+ * returns 0 if it is not such a line.
+ */
+static int
+dis_addr ( char *line, unsigned int *addr )
+{
+	char *p = line;
+	char *e;
+	unsigned long val;
+
+	while ( *p == ' ' )
+	    p++;
+	val = strtoul ( p, &e, 16 );
+	if ( e == p || *e != ':' || e[1] != '\t' )
+	    return 0;
+	*addr = val;
+	return 1;
+}
+
+/* Copy an objdump listing, replacing the bogus disassembly
+ * of data and zero fill with our blocks.
+ */
+static void
+splice ( char *path )
+{
+	FILE *fp;
+	char line[MAXLINE];
+	unsigned int addr;
+	int w, r;
+	int done = -1;
+	int rix = 0;
+
+	fp = fopen ( path, "r" );
+	if ( fp == NULL )
+	    error ( "Cannot open disassembly" );
+
+	while ( fgets ( line, MAXLINE, fp ) != NULL ) {
+	    if ( ! dis_addr ( line, &addr ) || addr < base || (addr & 3) ) {
+		fputs ( line, stdout );
+		continue;
+	    }
+	    w = (addr - base) / 4;
+	    if ( w >= nwords || class[w] == C_CODE ) {
+		fputs ( line, stdout );
+		continue;
+	    }
+
+	    r = find_region ( w );
+	    if ( r == done )
+		continue;
+	    done = r;
+
+	    if ( regions[r].class == C_DATA )
+		show_block ( stdout, &regions[r], &rix );
+	    else
+		show_pad ( stdout, &regions[r] );
+	}
+
+	fclose ( fp );
+}
+
+static double
+now ( void )
+{
+	struct timespec ts;
+
+	clock_gettime ( CLOCK_MONOTONIC, &ts );
+	return ts.tv_sec + ts.tv_nsec * 1.0e-9;
+}
+
+static void
+stats ( double t0 )
+{
+	int count[3];
+	int i;
+
+	count[0] = count[1] = count[2] = 0;
+	for ( i=0; i<nwords; i++ )
+	    count[class[i]]++;
+
+	fprintf ( stderr, "%d words, %d regions, %d literal references\n",
+	    nwords, nregions, nrefs );
+	fprintf ( stderr, "code %d, data %d, zero %d words\n",
+	    count[C_CODE], count[C_DATA], count[C_PAD] );
+	fprintf ( stderr, "analysis took %.3f ms\n", (now() - t0) * 1000.0 );
+}
+
+int
+main ( int argc, char **argv )
+{
+	char *dis_file = NULL;
+	struct rom rom;
+	int map = 0;
+	double t0;
+	int i;
+
+	--argc;
+	++argv;
+
+	while ( argc && **argv == '-' ) {
+	    if ( argv[0][1] == 'b' ) {
+		base = strtoul ( &argv[0][2], NULL, 16 );
+	    } else if ( argv[0][1] == 'm' ) {
+		map = 1;
+	    } else if ( argv[0][1] == 'f' ) {
+		allow_fp = 1;
+	    } else if ( argv[0][1] == 'v' ) {
+		verbose = 1;
+	    } else if ( argv[0][1] == 's' ) {
+		if ( argc < 2 )
+		    use ();
+		dis_file = argv[1];
+		--argc;
+		++argv;
+	    } else
+		use ();
+	    --argc;
+	    ++argv;
+	}
+
+	if ( argc != 1 )
+	    use ();
+
+	rom_load ( argv[0], &rom, base );
+	image = rom.words;
+	nwords = rom.nwords;
+	base = rom.base;
+
+	t0 = now ();
+
+	insn = xalloc ( nwords * sizeof(struct a64_insn) );
+	flags = xalloc ( nwords );
+	class = xalloc ( nwords );
+	refs = xalloc ( nwords * sizeof(struct ref) );
+
+	for ( i=0; i<nwords; i++ ) {
+	    a64_decode ( image[i], &insn[i] );
+	    class[i] = C_CODE;
+	}
+
+	mark_candidates ();
+	mark_literals ();
+	mark_candidates ();
+	classify ();
+	build_regions ();
+	qsort ( refs, nrefs, sizeof(struct ref), ref_compare );
+
+	if ( verbose )
+	    stats ( t0 );
+
+	if ( dis_file )
+	    splice ( dis_file );
+	else if ( map )
+	    show_map ();
+	else
+	    show_data ();
+
+	return 0;
+}
+
+/* THE END */
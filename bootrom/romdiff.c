@@ -0,0 +1,551 @@
+/* romdiff -
+ *  find the code two (or more) ROM images have in common.
+ *
+ *  A lot of code is shared between Rockchip bootrom generations,
+ *  but it moves around, so a byte compare is useless.
+ *  Here every word is first put into a position independent form
+ *  (branch, adr/adrp and literal offsets masked, pointers into the
+ *  image replaced by a tag), then we hash every run of K such words
+ *  and look for runs of one image in the other, and finally grow
+ *  each hit as far as it will go in both directions.
+ *
+ *  The result is a list of aligned blocks with the address in each
+ *  image, which is what you need to carry notes from bootrom.txt
+ *  over to a disassembly of the RK3328 rom.
+ *
+ * Invoke this as follows:
+ *  romdiff [options] image1 image2 [image3 ...]
+ *  images are raw binaries or ELF files from arm_wrap.
+ *  options are as follows:
+ *	-b base_addr (in hex, default ffff0000, not needed for ELF)
+ *	-k N	words per hash (default 8)
+ *	-m N	smallest block to report, in words (default 16)
+ *	-a	address map, one line per matched word
+ *	-l	block list for every pair (more than two images)
+ *	-s file	translate a symbol file for image1 into one for image2
+ *	-v	timing on stderr
+ *
+ * With two images you get the block list.
+ * With more you get a table, for each pair, of what fraction of
+ * the second image is found in the first, or the block list for
+ * every pair with -l.
+ *
+ *  ./romdiff bootrom.bin rk3328.bin
+ *  ./romdiff -s bootrom.sym bootrom.bin rk3328.bin >rk3328.sym
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "a64.h"
+#include "romimage.h"
+
+#define ADDR_BASE	0xffff0000
+
+/* Stands in for any pointer into the image itself */
+#define PTR_TAG		0xfeedf00d
+
+/* Give up looking at a hash that hits this many places */
+#define MAX_CAND	16
+
+typedef unsigned long long u64;
+
+struct kgram {
+	u64	hash;
+	int	pos;
+};
+
+struct image {
+	struct rom	rom;
+	unsigned int	*norm;		/* position independent words */
+	struct kgram	*index;		/* sorted by hash */
+	int		nindex;
+};
+
+struct block {
+	int	a;		/* word index in the first image */
+	int	b;		/* word index in the second */
+	int	len;
+	int	exact;		/* words identical before normalizing */
+};
+
+unsigned int base = ADDR_BASE;
+int K = 8;
+int min_len = 16;
+int verbose = 0;
+
+struct image *images;
+int nimages;
+
+struct block *blocks;
+int nblocks;
+
+void
+error ( char *msg )
+{
+	fprintf ( stderr, "%s\n", msg );
+	exit ( 1 );
+}
+
+static void
+use ( void )
+{
+	error ( "Usage: romdiff [-bBASE] [-kN] [-mN] [-a] [-l] [-s symfile] [-v] image1 image2 ..." );
+}
+
+static void *
+xalloc ( long size )
+{
+	void *rv;
+
+	rv = calloc ( 1, size );
+	if ( ! rv )
+	    error ( "Out of memory" );
+	return rv;
+}
+
+/* ---------------------------------------------------------- */
+
+static void
+normalize ( struct image *ip )
+{
+	struct rom *rp = &ip->rom;
+	struct a64_insn insn;
+	unsigned int w;
+	unsigned int lo, hi;
+	int prev_adrp = -1;
+	int i;
+
+	lo = rp->base;
+	hi = rp->base + rp->nwords * 4;
+
+	ip->norm = xalloc ( (long) rp->nwords * sizeof(unsigned int) );
+
+	for ( i=0; i<rp->nwords; i++ ) {
+	    w = rp->words[i];
+	    a64_decode ( w, &insn );
+
+	    if ( insn.kind == A64_INVALID || insn.kind == A64_UDF ) {
+		/* data, but a pointer into the rom will move too */
+		if ( w >= lo && w < hi )
+		    w = PTR_TAG;
+		ip->norm[i] = w;
+		prev_adrp = -1;
+		continue;
+	    }
+
+	    w = a64_normalize ( w, &insn );
+
+	    /* the add after an adrp holds the low 12 bits of the address */
+	    if ( prev_adrp >= 0 && (w & 0xffc00000) == 0x91000000 &&
+		    ((w >> 5) & 0x1f) == prev_adrp )
+		w &= 0xffc003ff;
+
+	    prev_adrp = insn.kind == A64_ADRP ? (w & 0x1f) : -1;
+	    ip->norm[i] = w;
+	}
+}
+
+/* Polynomial hash of K words, rolled along one word at a time */
+#define HASH_MUL	0x100000001b3ULL
+
+static u64 hash_out;		/* HASH_MUL ** (K-1) */
+
+static u64
+mix ( unsigned int w )
+{
+	return (w + 1) * 0x9e3779b97f4a7c15ULL;
+}
+
+static u64
+hash_first ( unsigned int *p )
+{
+	u64 h = 0;
+	int i;
+
+	for ( i=0; i<K; i++ )
+	    h = h * HASH_MUL + mix ( p[i] );
+	return h;
+}
+
+static u64
+hash_roll ( u64 h, unsigned int *p )
+{
+	return (h - mix ( p[0] ) * hash_out) * HASH_MUL + mix ( p[K] );
+}
+
+/* A run of the same word (zero fill, nops, 0xffffffff)
+ * is everywhere and tells us nothing.
+ */
+static int
+boring ( unsigned int *p )
+{
+	int i;
+
+	for ( i=1; i<K; i++ )
+	    if ( p[i] != p[0] )
+		return 0;
+	return 1;
+}
+
+static int
+kgram_compare ( const void *a, const void *b )
+{
+	const struct kgram *ka = a;
+	const struct kgram *kb = b;
+
+	if ( ka->hash < kb->hash )
+	    return -1;
+	if ( ka->hash > kb->hash )
+	    return 1;
+	return ka->pos - kb->pos;
+}
+
+static void
+build_index ( struct image *ip )
+{
+	int n = ip->rom.nwords;
+	unsigned int *norm = ip->norm;
+	u64 h;
+	int i;
+
+	ip->nindex = 0;
+	if ( n < K )
+	    return;
+
+	ip->index = xalloc ( (long) (n - K + 1) * sizeof(struct kgram) );
+
+	h = hash_first ( norm );
+	for ( i=0; ; i++ ) {
+	    if ( ! boring ( &norm[i] ) ) {
+		ip->index[ip->nindex].hash = h;
+		ip->index[ip->nindex].pos = i;
+		ip->nindex++;
+	    }
+	    if ( i + K >= n )
+		break;
+	    h = hash_roll ( h, &norm[i] );
+	}
+
+	qsort ( ip->index, ip->nindex, sizeof(struct kgram), kgram_compare );
+}
+
+/* First index entry with this hash, or -1 */
+static int
+lookup ( struct image *ip, u64 hash )
+{
+	int lo = 0;
+	int hi = ip->nindex;
+	int mid;
+
+	while ( lo < hi ) {
+	    mid = (lo + hi) / 2;
+	    if ( ip->index[mid].hash < hash )
+		lo = mid + 1;
+	    else
+		hi = mid;
+	}
+
+	if ( lo < ip->nindex && ip->index[lo].hash == hash )
+	    return lo;
+	return -1;
+}
+
+/* ---------------------------------------------------------- */
+
+/* Find the blocks of image B that also appear in image A.
+ * We walk B from the start, take the longest match we can
+ * find for each position and then skip past it.
+ */
+static void
+compare ( struct image *A, struct image *B )
+{
+	unsigned int *na = A->norm;
+	unsigned int *nb = B->norm;
+	int size_a = A->rom.nwords;
+	int size_b = B->rom.nwords;
+	int done_b = 0;
+	int p, i, k;
+	int a, len, back;
+	struct block best;
+	u64 h;
+
+	nblocks = 0;
+	if ( size_b < K || A->nindex == 0 )
+	    return;
+
+	h = hash_first ( nb );
+	p = 0;
+
+	for ( ;; ) {
+	    best.len = 0;
+
+	    if ( ! boring ( &nb[p] ) && (i = lookup ( A, h )) >= 0 ) {
+		for ( k=0; k<MAX_CAND && i+k < A->nindex && A->index[i+k].hash == h; k++ ) {
+		    a = A->index[i+k].pos;
+
+		    /* the hash could lie */
+		    if ( memcmp ( &na[a], &nb[p], K * sizeof(unsigned int) ) != 0 )
+			continue;
+
+		    len = K;
+		    while ( a + len < size_a && p + len < size_b && na[a+len] == nb[p+len] )
+			len++;
+		    back = 0;
+		    while ( a - back > 0 && p - back > done_b && na[a-back-1] == nb[p-back-1] )
+			back++;
+
+		    if ( len + back > best.len ) {
+			best.a = a - back;
+			best.b = p - back;
+			best.len = len + back;
+		    }
+		}
+	    }
+
+	    if ( best.len >= min_len ) {
+		best.exact = 0;
+		for ( i=0; i<best.len; i++ )
+		    if ( A->rom.words[best.a+i] == B->rom.words[best.b+i] )
+			best.exact++;
+		blocks[nblocks++] = best;
+		done_b = best.b + best.len;
+
+		/* skip over the block, starting a fresh hash */
+		p = done_b;
+		if ( p + K > size_b )
+		    break;
+		h = hash_first ( &nb[p] );
+		continue;
+	    }
+
+	    if ( p + K >= size_b )
+		break;
+	    h = hash_roll ( h, &nb[p] );
+	    p++;
+	}
+}
+
+static int
+covered ( void )
+{
+	int i, n = 0;
+
+	for ( i=0; i<nblocks; i++ )
+	    n += blocks[i].len;
+	return n;
+}
+
+/* ---------------------------------------------------------- */
+
+static void
+show_blocks ( struct image *A, struct image *B )
+{
+	struct block *bp;
+	int i;
+
+	printf ( "# %s vs %s\n", A->rom.name, B->rom.name );
+	printf ( "#  %-8s %-8s %6s %6s  delta\n", "A", "B", "words", "exact" );
+
+	for ( i=0; i<nblocks; i++ ) {
+	    bp = &blocks[i];
+	    printf ( "   %08x %08x %6d %6d  %+d\n",
+		A->rom.base + bp->a * 4, B->rom.base + bp->b * 4,
+		bp->len, bp->exact, (bp->b - bp->a) * 4 );
+	}
+
+	printf ( "# %d blocks, %d of %d words in B matched\n",
+	    nblocks, covered (), B->rom.nwords );
+}
+
+static void
+show_map ( struct image *A, struct image *B )
+{
+	struct block *bp;
+	int i, j;
+
+	for ( i=0; i<nblocks; i++ ) {
+	    bp = &blocks[i];
+	    for ( j=0; j<bp->len; j++ )
+		printf ( "%08x %08x%s\n",
+		    A->rom.base + (bp->a + j) * 4, B->rom.base + (bp->b + j) * 4,
+		    A->rom.words[bp->a+j] == B->rom.words[bp->b+j] ? "" : " *" );
+	}
+}
+
+/* Carry a symbol file (from callgraph, or made by hand)
+ * across to the second image.  Symbols that land outside
+ * every matched block are dropped.
+ */
+#define MAXLINE		256
+
+static void
+move_syms ( char *path, struct image *A, struct image *B )
+{
+	FILE *fp;
+	char line[MAXLINE];
+	char name[MAXLINE];
+	unsigned int addr;
+	int w, i;
+	int moved = 0;
+	int lost = 0;
+
+	fp = fopen ( path, "r" );
+	if ( fp == NULL )
+	    error ( "Cannot read symbol file" );
+
+	while ( fgets ( line, MAXLINE, fp ) != NULL ) {
+	    if ( sscanf ( line, "%x %s", &addr, name ) != 2 )
+		continue;
+	    w = (addr - A->rom.base) / 4;
+
+	    /* blocks are sorted in B, not in A */
+	    for ( i=0; i<nblocks; i++ )
+		if ( w >= blocks[i].a && w < blocks[i].a + blocks[i].len )
+		    break;
+	    if ( i == nblocks ) {
+		lost++;
+		continue;
+	    }
+
+	    printf ( "%08x %s\n", B->rom.base + (blocks[i].b + w - blocks[i].a) * 4, name );
+	    moved++;
+	}
+
+	fclose ( fp );
+
+	if ( verbose )
+	    fprintf ( stderr, "%d symbols moved, %d not in any block\n", moved, lost );
+}
+
+static double
+now ( void )
+{
+	struct timespec ts;
+
+	clock_gettime ( CLOCK_MONOTONIC, &ts );
+	return ts.tv_sec + ts.tv_nsec * 1.0e-9;
+}
+
+int
+main ( int argc, char **argv )
+{
+	char *sym_file = NULL;
+	int mode = 'b';
+	int all_pairs = 0;
+	int maxwords;
+	double t0;
+	int i, j;
+
+	--argc;
+	++argv;
+
+	while ( argc && **argv == '-' ) {
+	    switch ( argv[0][1] ) {
+		case 'b':
+		    base = strtoul ( &argv[0][2], NULL, 16 );
+		    break;
+		case 'k':
+		    K = atoi ( &argv[0][2] );
+		    break;
+		case 'm':
+		    min_len = atoi ( &argv[0][2] );
+		    break;
+		case 'a':
+		    mode = 'a';
+		    break;
+		case 'l':
+		    all_pairs = 1;
+		    break;
+		case 'v':
+		    verbose = 1;
+		    break;
+		case 's':
+		    if ( argc < 2 )
+			use ();
+		    sym_file = argv[1];
+		    mode = 's';
+		    --argc;
+		    ++argv;
+		    break;
+		default:
+		    use ();
+	    }
+	    --argc;
+	    ++argv;
+	}
+
+	if ( argc < 2 || K < 2 )
+	    use ();
+	if ( min_len < K )
+	    min_len = K;
+	if ( mode != 'b' && argc != 2 )
+	    error ( "-a and -s want exactly two images" );
+
+	nimages = argc;
+	images = xalloc ( nimages * sizeof(struct image) );
+
+	hash_out = 1;
+	for ( i=1; i<K; i++ )
+	    hash_out *= HASH_MUL;
+
+	t0 = now ();
+
+	/* Each image is normalized and indexed just once */
+	maxwords = 0;
+	for ( i=0; i<nimages; i++ ) {
+	    rom_load ( argv[i], &images[i].rom, base );
+	    normalize ( &images[i] );
+	    build_index ( &images[i] );
+	    if ( images[i].rom.nwords > maxwords )
+		maxwords = images[i].rom.nwords;
+	}
+
+	blocks = xalloc ( (long) (maxwords / K + 1) * sizeof(struct block) );
+
+	if ( verbose )
+	    fprintf ( stderr, "indexing took %.3f ms\n", (now() - t0) * 1000.0 );
+
+	if ( nimages == 2 || all_pairs ) {
+	    for ( i=0; i<nimages; i++ ) {
+		for ( j=i+1; j<nimages; j++ ) {
+		    compare ( &images[i], &images[j] );
+		    if ( mode == 'a' )
+			show_map ( &images[i], &images[j] );
+		    else if ( mode == 's' )
+			move_syms ( sym_file, &images[i], &images[j] );
+		    else
+			show_blocks ( &images[i], &images[j] );
+		}
+	    }
+	} else {
+	    /* how much of the column image is found in the row image */
+	    for ( i=0; i<nimages; i++ )
+		printf ( "%2d  %s\n", i, images[i].rom.name );
+	    printf ( "\n    " );
+	    for ( j=0; j<nimages; j++ )
+		printf ( " %5d", j );
+	    printf ( "\n" );
+	    for ( i=0; i<nimages; i++ ) {
+		printf ( "%2d: ", i );
+		for ( j=0; j<nimages; j++ ) {
+		    if ( i == j ) {
+			printf ( "     -" );
+			continue;
+		    }
+		    compare ( &images[i], &images[j] );
+		    printf ( " %4d%%", covered () * 100 / images[j].rom.nwords );
+		}
+		printf ( "\n" );
+	    }
+	}
+
+	if ( verbose )
+	    fprintf ( stderr, "total %.3f ms\n", (now() - t0) * 1000.0 );
+
+	return 0;
+}
+
+/* THE END */
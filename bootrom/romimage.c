@@ -0,0 +1,117 @@
+/* romimage.c
+ *
+ * Load a ROM image for the analysis tools.
+ *
+ * A raw binary is simply mapped, and the caller tells us
+ * the base address (the -b option in the tools).
+ *
+ * If the file is an ELF file, as made by arm_wrap, we map it
+ * and find the ROM image inside it (the .text section),
+ * which also gives us the base address.  arm_wrap makes
+ * 32 bit ELF files, but we take 64 bit ones too.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <elf.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "romimage.h"
+
+static void
+rom_error ( char *path, char *msg )
+{
+	fprintf ( stderr, "%s: %s\n", path, msg );
+	exit ( 1 );
+}
+
+/* Find the .text section in an ELF file */
+static void
+elf_find ( struct rom *rp, char *buf, long size )
+{
+	Elf32_Ehdr *eh32 = (Elf32_Ehdr *) buf;
+	Elf64_Ehdr *eh64 = (Elf64_Ehdr *) buf;
+	Elf32_Shdr *sh32;
+	Elf64_Shdr *sh64;
+	char *strings;
+	unsigned long off, len, addr;
+	int i;
+
+	off = 0;
+	len = 0;
+	addr = 0;
+
+	if ( buf[EI_CLASS] == ELFCLASS32 ) {
+	    if ( eh32->e_shoff + eh32->e_shnum * sizeof(*sh32) > size )
+		rom_error ( rp->name, "bad ELF section table" );
+	    sh32 = (Elf32_Shdr *) (buf + eh32->e_shoff);
+	    strings = buf + sh32[eh32->e_shstrndx].sh_offset;
+	    for ( i=0; i<eh32->e_shnum; i++ ) {
+		if ( strcmp ( strings + sh32[i].sh_name, ".text" ) != 0 )
+		    continue;
+		off = sh32[i].sh_offset;
+		len = sh32[i].sh_size;
+		addr = sh32[i].sh_addr;
+		break;
+	    }
+	} else {
+	    if ( eh64->e_shoff + eh64->e_shnum * sizeof(*sh64) > size )
+		rom_error ( rp->name, "bad ELF section table" );
+	    sh64 = (Elf64_Shdr *) (buf + eh64->e_shoff);
+	    strings = buf + sh64[eh64->e_shstrndx].sh_offset;
+	    for ( i=0; i<eh64->e_shnum; i++ ) {
+		if ( strcmp ( strings + sh64[i].sh_name, ".text" ) != 0 )
+		    continue;
+		off = sh64[i].sh_offset;
+		len = sh64[i].sh_size;
+		addr = sh64[i].sh_addr;
+		break;
+	    }
+	}
+
+	if ( len == 0 || off + len > size )
+	    rom_error ( rp->name, "no .text section in ELF file" );
+	if ( off & 3 )
+	    rom_error ( rp->name, "misaligned .text section" );
+
+	rp->words = (unsigned int *) (buf + off);
+	rp->nwords = len / 4;
+	rp->base = addr;
+}
+
+void
+rom_load ( char *path, struct rom *rp, unsigned int base )
+{
+	struct stat st;
+	char *buf;
+	int fd;
+
+	rp->name = path;
+
+	fd = open ( path, O_RDONLY );
+	if ( fd < 0 )
+	    rom_error ( path, "cannot open" );
+	if ( fstat ( fd, &st ) < 0 || st.st_size < 4 )
+	    rom_error ( path, "empty or unreadable" );
+
+	buf = mmap ( NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+	if ( buf == MAP_FAILED )
+	    rom_error ( path, "mmap fails" );
+	close ( fd );
+
+	if ( st.st_size > sizeof(Elf64_Ehdr) && memcmp ( buf, ELFMAG, SELFMAG ) == 0 ) {
+	    elf_find ( rp, buf, st.st_size );
+	    return;
+	}
+
+	/* a trailing partial word is ignored */
+	rp->words = (unsigned int *) buf;
+	rp->nwords = st.st_size / 4;
+	rp->base = base;
+}
+
+/* THE END */
@@ -0,0 +1,17 @@
+/* romimage.h
+ *
+ * Load a ROM image for the analysis tools.
+ * Either a raw binary (like bootrom.bin) or the
+ * ELF file arm_wrap makes out of one.
+ */
+
+struct rom {
+	char		*name;
+	unsigned int	*words;
+	int		nwords;
+	unsigned int	base;		/* address of words[0] */
+};
+
+void rom_load ( char *, struct rom *, unsigned int );
+
+/* THE END */
@@ -0,0 +1,35 @@
+/* baud.h
+ *
+ * Baud rate engine for UART2 (baud.c)
+ */
+
+#define BAUD_XIN	0
+#define BAUD_DIV	1
+#define BAUD_FRAC	2
+
+#define PLL_CPLL	0
+#define PLL_GPLL	1
+
+struct baud_setting {
+	int		baud;		/* what was asked for */
+	int		src;		/* BAUD_XIN, BAUD_DIV, BAUD_FRAC */
+	int		pll;		/* PLL_CPLL or PLL_GPLL */
+	int		div;		/* 1 to 128 */
+	unsigned int	num, den;	/* fraction */
+	unsigned int	sclk;		/* uart clock we get */
+	int		divisor;	/* in the uart, sclk / 16 / divisor */
+	int		actual;		/* baud rate we get */
+	int		ppm;		/* error in parts per million */
+};
+
+int baud_solve ( int, unsigned int *, struct baud_setting * );
+char *baud_src_name ( struct baud_setting * );
+char *baud_pll_name ( struct baud_setting * );
+void baud_pll_rates ( unsigned int * );
+void baud_clock ( struct baud_setting * );
+unsigned int uart_clock_rate ( void );
+
+int uart_set_baud ( int, struct baud_setting * );
+void uart_set_clock ( struct baud_setting * );
+
+/* THE END */
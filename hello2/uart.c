@@ -3,6 +3,8 @@
  * Tom Trebisky  1-18-2022
  */
 
+#include "baud.h"
+
 typedef volatile unsigned int vu32;
 typedef unsigned int u32;
 typedef unsigned long u64;
@@ -81,10 +83,10 @@ struct rock_uart {
 #define SRR_RESET_RFIFO	0x02
 #define SRR_RESET_TFIFO	0x04
 
-#define UART_CLOCK	24000000
-
 /* Baud rates possible are:
  * 115.2Kbps, 460.8Kbps, 921.6Kbps, 1.5Mbps, 3Mbps, 4Mbps.
+ * From the 24 Mhz crystal only 1.5M is exact, baud.c
+ * finds a better clock for the others.
  */
 
 /* now for the pin control (iomux) settings.
@@ -138,13 +140,10 @@ uart_iomux ( void )
 
 #define BAUD_MODE_X	16
 
-void
-uart_baud ( int baud )
+static void
+uart_divisor ( u32 rate )
 {
 	struct rock_uart *up = UART_BASE;
-	u32 rate;
-
-	rate = UART_CLOCK / BAUD_MODE_X / baud;
 
 	up->lcr |= LCR_DLAT;
 
@@ -154,6 +153,47 @@ uart_baud ( int baud )
 	up->lcr &= ~LCR_DLAT;
 }
 
+/* Any rate, using the best clock the CRU can give us (baud.c).
+ * Waits for pending output to go first.
+ * Returns 0 if the rate is impossible, else fills in *sp
+ * (if given) with how we did it, including the error.
+ */
+int
+uart_set_baud ( int baud, struct baud_setting *sp )
+{
+	struct baud_setting s;
+	u32 rates[2];
+
+	baud_pll_rates ( rates );
+	if ( ! baud_solve ( baud, rates, &s ) )
+	    return 0;
+
+	uart_set_clock ( &s );
+
+	if ( sp )
+	    *sp = s;
+	return 1;
+}
+
+/* Go (back) to a setting we already worked out */
+void
+uart_set_clock ( struct baud_setting *sp )
+{
+	struct rock_uart *up = UART_BASE;
+
+	while ( ! (up->status & ST_TE) || (up->status & ST_BUSY) )
+	    ;
+
+	baud_clock ( sp );
+	uart_divisor ( sp->divisor );
+}
+
+void
+uart_baud ( int baud )
+{
+	(void) uart_set_baud ( baud, 0 );
+}
+
 void
 uart_init ( void )
 {
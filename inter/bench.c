@@ -0,0 +1,481 @@
+/* bench.c
+ *
+ * Micro benchmarks, timed with the PMU cycle counter.
+ *
+ * Each benchmark is a function that does the thing once, with an
+ * optional "prep" function run before every sample and a "done"
+ * function run after the last, neither of them timed.
+ * We run it a few times to warm the caches, then take a sample
+ * per call with interrupts off:
+ *
+ *	isb, read PMCCNTR and the event counters
+ *	run it
+ *	isb, read them again
+ *
+ * sort the samples, and print min, median and 99th percentile in
+ * cycles and ns, along with the average count of each PMU event.
+ * The cost of the timing itself (an empty benchmark) is measured
+ * first and taken off everything else.
+ *
+ * Results are printed as CSV lines that start with "bench,",
+ * so they can be picked out of a console capture with grep.
+ *
+ * The cycle counter stops in WFE/WFI, so nothing here waits that way.
+ * Cycles are turned into ns using the CPU clock, which we measure
+ * against the generic counter when we start.
+ */
+
+#include "protos.h"
+#include "clk.h"
+
+typedef volatile unsigned int vu32;
+typedef unsigned int u32;
+typedef unsigned long u64;
+
+#define BIT(x)	(1<<(x))
+
+#define PMCR_E		BIT(0)		/* enable */
+#define PMCR_P		BIT(1)		/* reset event counters */
+#define PMCR_C		BIT(2)		/* reset cycle counter */
+#define PMCR_LC		BIT(6)		/* 64 bit cycle counter */
+#define PMCR_N_SHIFT	11
+#define PMCR_N_MASK	0x1f
+
+#define PMCNT_CYCLES	(1U<<31)
+
+/* In PMCCFILTR and PMEVTYPER, count at EL2 too.
+ * By default only EL0 and EL1 are counted, and we
+ * usually run at EL2.
+ */
+#define PMF_NSH		BIT(27)
+
+/* Some of the common events (ARMv8 ARM, D7.10) */
+#define EV_L1D_REFILL	0x03
+#define EV_L1D_CACHE	0x04
+#define EV_INST_RETIRED	0x08
+#define EV_BR_MIS_PRED	0x10
+#define EV_L2D_REFILL	0x17
+#define EV_BUS_ACCESS	0x19
+
+#define BENCH_WARMUP	10
+#define BENCH_SAMPLES	501
+
+static u32 samples[BENCH_SAMPLES];
+static u64 ev_total[BENCH_MAX_EVENTS];
+
+static int bench_events[BENCH_MAX_EVENTS] = {
+	EV_INST_RETIRED, EV_L1D_CACHE, EV_L1D_REFILL, EV_BR_MIS_PRED
+};
+static int n_events;
+
+static u64 cpu_hz;
+static u32 overhead;
+
+static inline unsigned long
+irq_save ( void )
+{
+	unsigned long flags;
+
+	asm volatile ( "mrs %0, daif" : "=r" (flags) );
+	asm volatile ( "msr DAIFSet, #3" : : : "memory" );
+	return flags;
+}
+
+static inline void
+irq_restore ( unsigned long flags )
+{
+	asm volatile ( "msr daif, %0" : : "r" (flags) : "memory" );
+}
+
+static inline unsigned int
+get_el ( void )
+{
+	u64 val;
+
+	asm volatile ( "mrs %0, CurrentEL" : "=r" (val) );
+	return (val >> 2) & 3;
+}
+
+/* The filter bits for wherever we are running */
+static inline u64
+pmu_filter ( void )
+{
+	return get_el () == 2 ? PMF_NSH : 0;
+}
+
+static inline u64
+read_cycles ( void )
+{
+	u64 val;
+
+	asm volatile ( "isb; mrs %0, pmccntr_el0" : "=r" (val) : : "memory" );
+	return val;
+}
+
+static inline u32
+read_event ( int n )
+{
+	u64 val;
+
+	asm volatile ( "msr pmselr_el0, %0; isb; mrs %1, pmxevcntr_el0"
+	    : "=r" (val) : "r" ((u64) n) : "memory" );
+	return val;
+}
+
+static inline u64
+read_count ( void )
+{
+	u64 val;
+
+	asm volatile ( "isb; mrs %0, cntpct_el0" : "=r" (val) : : "memory" );
+	return val;
+}
+
+/* Choose which event each counter counts, -1 to leave it off */
+void
+bench_set_events ( int *events, int n )
+{
+	u64 pmcr, ena;
+	int i, max;
+
+	asm volatile ( "mrs %0, pmcr_el0" : "=r" (pmcr) );
+	max = (pmcr >> PMCR_N_SHIFT) & PMCR_N_MASK;
+	if ( max > BENCH_MAX_EVENTS )
+	    max = BENCH_MAX_EVENTS;
+	if ( n > max )
+	    n = max;
+
+	ena = PMCNT_CYCLES;
+	n_events = 0;
+	for ( i=0; i<n && events[i] >= 0; i++ ) {
+	    bench_events[i] = events[i];
+	    asm volatile ( "msr pmselr_el0, %0; isb; msr pmxevtyper_el0, %1"
+		: : "r" ((u64) i), "r" ((u64) events[i] | pmu_filter ()) );
+	    ena |= BIT(i);
+	    n_events++;
+	}
+
+	asm volatile ( "msr pmcntenclr_el0, %0" : : "r" ((u64) ~ena & 0xffffffff) );
+	asm volatile ( "msr pmcntenset_el0, %0" : : "r" (ena) );
+	asm volatile ( "isb" );
+}
+
+/* We run on the A53 cluster, so if that changes,
+ * so does how long a cycle is.
+ */
+static int
+bench_clock_change ( int clk, int event, unsigned long old, unsigned long new, void *arg )
+{
+	if ( event == CLK_POST_CHANGE )
+	    cpu_hz = new;
+	return 0;
+}
+
+/* Turn on the PMU, and see how fast the CPU is running */
+void
+bench_init ( void )
+{
+	static int registered;
+	u64 c0, c1, t0, t1;
+
+	/* count at EL0 and EL1, and EL2 if we are there */
+	asm volatile ( "msr pmccfiltr_el0, %0" : : "r" (pmu_filter ()) );
+	asm volatile ( "msr pmcr_el0, %0" : : "r" ((u64) (PMCR_E | PMCR_P | PMCR_C | PMCR_LC)) );
+	asm volatile ( "isb" );
+	bench_set_events ( bench_events, BENCH_MAX_EVENTS );
+
+	/* Spin 10 ms, the cycle counter would stop in WFE */
+	t0 = read_count ();
+	c0 = read_cycles ();
+	do {
+	    t1 = read_count ();
+	} while ( t1 - t0 < gtimer_freq () / 100 );
+	c1 = read_cycles ();
+
+	cpu_hz = (c1 - c0) * gtimer_freq () / (t1 - t0);
+	printf ( "PMU: %d event counters, CPU at %lu Hz (armclkl says %lu)\n",
+	    n_events, cpu_hz, clk_get_rate ( CLK_ARML ) );
+
+	if ( ! registered ) {
+	    clk_notifier_register ( CLK_ARML, bench_clock_change, 0 );
+	    registered = 1;
+	}
+}
+
+static u64
+cycles_ns ( u64 cycles )
+{
+	if ( ! cpu_hz )
+	    return 0;
+	return cycles * 1000000000UL / cpu_hz;
+}
+
+/* Shell sort, so a few hundred samples are no trouble */
+static void
+sort_samples ( u32 *s, int n )
+{
+	int gap, i, j;
+	u32 t;
+
+	for ( gap = n/2; gap > 0; gap /= 2 )
+	    for ( i = gap; i < n; i++ ) {
+		t = s[i];
+		for ( j = i; j >= gap && s[j-gap] > t; j -= gap )
+		    s[j] = s[j-gap];
+		s[j] = t;
+	    }
+}
+
+static void
+take_samples ( struct bench *bp, int nsamp )
+{
+	u32 ev0[BENCH_MAX_EVENTS];
+	unsigned long flags;
+	u64 c0, c1;
+	int i, j;
+
+	for ( j=0; j<n_events; j++ )
+	    ev_total[j] = 0;
+
+	for ( i = -BENCH_WARMUP; i < nsamp; i++ ) {
+	    flags = irq_save ();
+	    if ( bp->prep )
+		(*bp->prep) ( bp->arg );
+
+	    for ( j=0; j<n_events; j++ )
+		ev0[j] = read_event ( j );
+	    c0 = read_cycles ();
+	    (*bp->run) ( bp->arg );
+	    c1 = read_cycles ();
+	    if ( i >= 0 )
+		for ( j=0; j<n_events; j++ )
+		    ev_total[j] += (u32) (read_event ( j ) - ev0[j]);
+	    irq_restore ( flags );
+
+	    if ( i >= 0 )
+		samples[i] = c1 - c0 > overhead ? c1 - c0 - overhead : 0;
+	}
+
+	sort_samples ( samples, nsamp );
+}
+
+static void
+empty ( void *arg )
+{
+}
+
+static void
+show_header ( void )
+{
+	int j;
+
+	printf ( "bench,name,samples,min,median,p99,min_ns,median_ns,p99_ns" );
+	for ( j=0; j<n_events; j++ )
+	    printf ( ",ev_%02x", bench_events[j] );
+	printf ( "\n" );
+}
+
+/* Run one benchmark and print its line */
+void
+bench_run ( struct bench *bp )
+{
+	int nsamp = bp->samples ? bp->samples : BENCH_SAMPLES;
+	u32 min, med, p99;
+	int j;
+
+	if ( nsamp > BENCH_SAMPLES )
+	    nsamp = BENCH_SAMPLES;
+
+	take_samples ( bp, nsamp );
+	if ( bp->done )
+	    (*bp->done) ( bp->arg );
+
+	min = samples[0];
+	med = samples[nsamp/2];
+	p99 = samples[(nsamp * 99) / 100];
+
+	printf ( "bench,%s,%d,%u,%u,%u,%lu,%lu,%lu", bp->name, nsamp,
+	    min, med, p99, cycles_ns ( min ), cycles_ns ( med ), cycles_ns ( p99 ) );
+	for ( j=0; j<n_events; j++ )
+	    printf ( ",%lu", ev_total[j] / nsamp );
+	printf ( "\n" );
+}
+
+/* ------------------------------------------------------ */
+/* The standard set */
+
+#define COPY_SIZE	4096
+
+static u64 copy_src[COPY_SIZE/8];
+static u64 copy_dst[COPY_SIZE/8];
+
+static void
+copy_bytes ( void *arg )
+{
+	volatile char *d = (char *) copy_dst;
+	char *s = (char *) copy_src;
+	int i;
+
+	for ( i=0; i<COPY_SIZE; i++ )
+	    d[i] = s[i];
+}
+
+static void
+copy_words ( void *arg )
+{
+	volatile u64 *d = copy_dst;
+	u64 *s = copy_src;
+	int i;
+
+	for ( i=0; i<COPY_SIZE/8; i++ )
+	    d[i] = s[i];
+}
+
+/* ldp/stp, 64 bytes a time, which is about as well as
+ * a memcpy can do on these cores without NEON.
+ */
+static void
+copy_pairs ( void *arg )
+{
+	u64 *d = copy_dst;
+	u64 *s = copy_src;
+	u64 *end = s + COPY_SIZE/8;
+
+	asm volatile (
+	    "1:	ldp x2, x3, [%1], #16\n"
+	    "	ldp x4, x5, [%1], #16\n"
+	    "	ldp x6, x7, [%1], #16\n"
+	    "	ldp x8, x9, [%1], #16\n"
+	    "	stp x2, x3, [%0], #16\n"
+	    "	stp x4, x5, [%0], #16\n"
+	    "	stp x6, x7, [%0], #16\n"
+	    "	stp x8, x9, [%0], #16\n"
+	    "	cmp %1, %2\n"
+	    "	b.lo 1b\n"
+	    : "+r" (d), "+r" (s)
+	    : "r" (end)
+	    : "x2", "x3", "x4", "x5", "x6", "x7", "x8", "x9", "cc", "memory" );
+}
+
+static int prf_chars;
+
+static void
+count_sink ( void *arg, const char *buf, int n )
+{
+	prf_chars += n;
+}
+
+static void
+do_prf ( const char *fmt, ... )
+{
+	__builtin_va_list args;
+
+	__builtin_va_start ( args, fmt );
+	prf_core ( count_sink, 0, fmt, args );
+	__builtin_va_end ( args );
+}
+
+/* The formatting, without the uart */
+static void
+bench_printf ( void *arg )
+{
+	do_prf ( "Tick %d at %08X: %s %lu\n", 1234, 0xdeadbeef, "hello", 123456789UL );
+}
+
+/* Into the ring, the interrupt sends it later */
+static void
+bench_putc ( void *arg )
+{
+	uart_putc ( '.' );
+}
+
+/* So the result starts a line */
+static void
+putc_done ( void *arg )
+{
+	uart_putc ( '\n' );
+}
+
+/* Reading a register out on the bus */
+static void
+bench_mmio ( void *arg )
+{
+	(void) *(vu32 *) arg;
+}
+
+/* A pending SGI (raised with interrupts off, in prep),
+ * through the GIC driver (which ends with an MMIO write to the
+ * redistributor), and by the ICC system registers alone, which
+ * is what handle_irq in irq.c does now.
+ */
+#define BENCH_SGI	7
+#define ICC_HPPIR1	"S3_0_C12_C12_2"
+#define ICC_IAR1	"S3_0_C12_C12_0"
+#define ICC_EOIR1	"S3_0_C12_C12_1"
+
+static void
+sgi_prep ( void *arg )
+{
+	u64 end, id;
+
+	intcon_sgi ( BENCH_SGI );
+
+	end = deadline_us ( 100 );
+	do {
+	    asm volatile ( "mrs %0, " ICC_HPPIR1 : "=r" (id) );
+	} while ( (id & 0xffffff) != BENCH_SGI && ! deadline_passed ( end ) );
+}
+
+static void
+bench_gic_driver ( void *arg )
+{
+	intcon_irqack ( intcon_irqwho () );
+}
+
+static void
+bench_gic_icc ( void *arg )
+{
+	u64 id;
+
+	asm volatile ( "mrs %0, " ICC_IAR1 : "=r" (id) );
+	asm volatile ( "msr " ICC_EOIR1 ", %0" : : "r" (id) );
+	asm volatile ( "isb" );
+}
+
+static struct bench std_benches[] = {
+	{ "memcpy_byte_4k",	0, copy_bytes, 0, 0, 101 },
+	{ "memcpy_word_4k",	0, copy_words, 0, 0, 101 },
+	{ "memcpy_ldp_4k",	0, copy_pairs, 0, 0, 101 },
+	{ "printf",		0, bench_printf, 0, 0, 0 },
+	{ "uart_putc",		0, bench_putc, putc_done, 0, 201 },
+	{ "mmio_gicd_ctlr",	0, bench_mmio, 0, (void *) 0xfee00000, 0 },
+	{ "mmio_timer",		0, bench_mmio, 0, (void *) 0xff850008, 0 },
+	{ "mmio_gpio",		0, bench_mmio, 0, (void *) 0xff720000, 0 },
+	{ "gic_ack_driver",	sgi_prep, bench_gic_driver, 0, 0, 0 },
+	{ "gic_ack_icc",	sgi_prep, bench_gic_icc, 0, 0, 0 },
+	{ 0 }
+};
+
+void
+bench_all ( void )
+{
+	static struct bench empty_bench = { "empty", 0, empty, 0, 0, 0 };
+	struct bench *bp;
+	int i;
+
+	for ( i=0; i<COPY_SIZE/8; i++ )
+	    copy_src[i] = i * 0x0101010101010101UL;
+
+	bench_init ();
+	show_header ();
+
+	/* What the timing costs, taken off everything after */
+	overhead = 0;
+	bench_run ( &empty_bench );
+	overhead = samples[0];
+
+	for ( bp = std_benches; bp->name; bp++ )
+	    bench_run ( bp );
+}
+
+/* THE END */
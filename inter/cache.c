@@ -0,0 +1,190 @@
+/* cache.c
+ *
+ * The MMU and caches, so that more than one core can share memory.
+ *
+ * With the MMU off every data access is to Device memory, which
+ * is never cached and where ldxr/stxr (and so every lock and
+ * atomic we have) are not promised to work.  Two cores can only
+ * share data sensibly if both have it mapped as cacheable, inner
+ * shareable Normal memory, then the hardware keeps them coherent.
+ *
+ * U-Boot (started with "go") leaves its MMU and caches on at EL2,
+ * with everything identity mapped.  We just keep that.  If we find
+ * the MMU off, we make our own identity map (DRAM cached, the top
+ * 128M of the 4G space as Device) and turn it on.
+ *
+ * Either way we note the MAIR, TCR, TTBR0 and SCTLR so that the
+ * other cores can load the very same settings before they touch
+ * anything (start.S does that in secondary_entry).  They come out
+ * of reset with their caches invalid and the MMU off, so they read
+ * mmu_regs straight from DRAM, which is why we clean it there.
+ */
+
+#include "protos.h"
+
+typedef unsigned int u32;
+typedef unsigned long u64;
+
+#define BIT(x)	(1UL<<(x))
+
+#define SCTLR_M		BIT(0)
+#define SCTLR_C		BIT(2)
+#define SCTLR_I		BIT(12)
+
+/* MAIR attribute 0 is Device-nGnRnE, 1 is Normal write back */
+#define MAIR_VAL	0xff00
+#define ATTR_DEVICE	(0<<2)
+#define ATTR_NORMAL	(1<<2)
+
+#define PTE_TABLE	3
+#define PTE_BLOCK	1
+#define PTE_AP_RES1	BIT(6)		/* AP[1], must be 1 at EL2 */
+#define PTE_INNER_SH	(3<<8)
+#define PTE_AF		BIT(10)
+#define PTE_PXN		BIT(53)
+#define PTE_XN		BIT(54)
+
+/* 4K granule, 32 bit addresses, so the walk starts at level 1 */
+#define TCR_T0SZ	32
+#define TCR_WBWA	((1<<8) | (1<<10))	/* IRGN0, ORGN0 */
+#define TCR_INNER_SH	(3<<12)
+#define TCR_EPD1	BIT(23)			/* EL1, no TTBR1 walks */
+#define TCR_EL2_RES1	(BIT(31) | BIT(23))
+
+#define GB		0x40000000UL
+#define MB2		0x200000UL
+
+/* On the RK3399 the devices are all above this */
+#define DEVICE_BASE	0xf8000000UL
+
+/* TF-A dcsw_op_all() op, in gic/cache_helpers.S */
+#define DCCISW		1
+
+void dcsw_op_all ( u64 );
+void flush_dcache_range ( u64, u64 );
+
+struct mmu_regs mmu_regs;
+
+static u64 l1_table[512] __attribute__ ((aligned(4096)));
+static u64 l2_table[512] __attribute__ ((aligned(4096)));
+
+static int at_el2;
+
+static inline u64
+get_sctlr ( void )
+{
+	u64 val;
+
+	if ( at_el2 )
+	    asm volatile ( "mrs %0, sctlr_el2" : "=r" (val) );
+	else
+	    asm volatile ( "mrs %0, sctlr_el1" : "=r" (val) );
+	return val;
+}
+
+static void
+save_regs ( void )
+{
+	struct mmu_regs *mp = &mmu_regs;
+
+	if ( at_el2 ) {
+	    asm volatile ( "mrs %0, mair_el2" : "=r" (mp->mair) );
+	    asm volatile ( "mrs %0, tcr_el2" : "=r" (mp->tcr) );
+	    asm volatile ( "mrs %0, ttbr0_el2" : "=r" (mp->ttbr) );
+	} else {
+	    asm volatile ( "mrs %0, mair_el1" : "=r" (mp->mair) );
+	    asm volatile ( "mrs %0, tcr_el1" : "=r" (mp->tcr) );
+	    asm volatile ( "mrs %0, ttbr0_el1" : "=r" (mp->ttbr) );
+	}
+	mp->sctlr = get_sctlr ();
+}
+
+/* 0-3G are cached 1G blocks, the last 1G is 2M blocks
+ * so we can make the top of it Device.
+ */
+static void
+build_tables ( void )
+{
+	u64 normal, device, addr;
+	int i;
+
+	normal = PTE_BLOCK | ATTR_NORMAL | PTE_INNER_SH | PTE_AF;
+	device = PTE_BLOCK | ATTR_DEVICE | PTE_AF | PTE_XN;
+	if ( at_el2 ) {
+	    normal |= PTE_AP_RES1;
+	    device |= PTE_AP_RES1;
+	} else
+	    device |= PTE_PXN;
+
+	for ( i=0; i<3; i++ )
+	    l1_table[i] = i * GB | normal;
+	l1_table[3] = (u64) l2_table | PTE_TABLE;
+
+	for ( i=0; i<512; i++ ) {
+	    addr = 3 * GB + i * MB2;
+	    l2_table[i] = addr | (addr < DEVICE_BASE ? normal : device);
+	}
+}
+
+static void
+mmu_enable ( void )
+{
+	u64 tcr, sctlr;
+
+	tcr = TCR_T0SZ | TCR_WBWA | TCR_INNER_SH;
+
+	/* Nothing stale in the caches or the TLB */
+	dcsw_op_all ( DCCISW );
+	asm volatile ( "ic iallu" );
+
+	if ( at_el2 ) {
+	    tcr |= TCR_EL2_RES1;
+	    asm volatile ( "tlbi alle2; dsb sy; isb" );
+	    asm volatile ( "msr mair_el2, %0" : : "r" ((u64) MAIR_VAL) );
+	    asm volatile ( "msr tcr_el2, %0" : : "r" (tcr) );
+	    asm volatile ( "msr ttbr0_el2, %0" : : "r" ((u64) l1_table) );
+	} else {
+	    tcr |= TCR_EPD1;
+	    asm volatile ( "tlbi vmalle1; dsb sy; isb" );
+	    asm volatile ( "msr mair_el1, %0" : : "r" ((u64) MAIR_VAL) );
+	    asm volatile ( "msr tcr_el1, %0" : : "r" (tcr) );
+	    asm volatile ( "msr ttbr0_el1, %0" : : "r" ((u64) l1_table) );
+	}
+	asm volatile ( "isb" );
+
+	sctlr = get_sctlr () | SCTLR_M | SCTLR_C | SCTLR_I;
+	if ( at_el2 )
+	    asm volatile ( "msr sctlr_el2, %0" : : "r" (sctlr) );
+	else
+	    asm volatile ( "msr sctlr_el1, %0" : : "r" (sctlr) );
+	asm volatile ( "isb" );
+}
+
+/* Called once, on the boot core */
+void
+cache_on ( void )
+{
+	u64 val;
+
+	asm volatile ( "mrs %0, CurrentEL" : "=r" (val) );
+	at_el2 = ((val >> 2) & 3) == 2;
+
+	if ( get_sctlr () & SCTLR_M ) {
+	    printf ( "MMU: already on at EL%d, keeping it\n", at_el2 ? 2 : 1 );
+	} else {
+	    build_tables ();
+	    mmu_enable ();
+	    printf ( "MMU: identity map on at EL%d\n", at_el2 ? 2 : 1 );
+	}
+
+	save_regs ();
+	printf ( "MMU: mair %lx tcr %lx ttbr0 %lx sctlr %lx\n",
+	    mmu_regs.mair, mmu_regs.tcr, mmu_regs.ttbr, mmu_regs.sctlr );
+
+	/* for the other cores, which read these uncached */
+	flush_dcache_range ( (u64) &mmu_regs, sizeof(mmu_regs) );
+	flush_dcache_range ( (u64) l1_table, sizeof(l1_table) );
+	flush_dcache_range ( (u64) l2_table, sizeof(l2_table) );
+}
+
+/* THE END */
@@ -0,0 +1,467 @@
+/* clk.c
+ *
+ * A model of the RK3399 clock tree, enough of it for what we use.
+ *
+ * Every clock is described by the same struct: a fixed rate or a
+ * PLL, or else a parent (picked by a mux if it has one) followed
+ * by a divider, a fraction and a gate, any of which may be missing.
+ * So "clk_uart2_div" is cpll or gpll (the uart_src mux) divided by
+ * 1-128, and "clk_uart2" is a mux with no divider.  Rates are always
+ * worked out from the registers, so the tree can't get out of step
+ * with the hardware.  The table is in order, parents first.
+ *
+ * Drivers ask for a rate with clk_get_rate() and register a
+ * notifier to hear about changes.  clk_set_rate() (or set_parent)
+ * tells everything below the clock first (CLK_PRE_CHANGE, with the
+ * rate it is going to get), makes the change, and tells them again
+ * (CLK_POST_CHANGE, with the rate it really got).  A notifier can
+ * refuse at PRE_CHANGE, and then the others get CLK_ABORT_CHANGE.
+ *
+ * Names and registers are from the TRM and the linux rk3399 driver.
+ */
+
+#include "protos.h"
+#include "pll.h"
+#include "clk.h"
+
+typedef volatile unsigned int vu32;
+typedef unsigned int u32;
+typedef unsigned long u64;
+
+#define CRU_BASE	0xff760000
+
+#define CLKSEL_CON(n)	(0x100 + (n)*4)
+#define CLKGATE_CON(n)	(0x300 + (n)*4)
+
+/* The PMUCRU has its own, we reach them from CRU_BASE */
+#define PMUCRU_BASE	0xff750000
+#define PMU_CLKSEL_CON(n)	(PMUCRU_BASE - CRU_BASE + 0x80 + (n)*4)
+#define PMU_CLKGATE_CON(n)	(PMUCRU_BASE - CRU_BASE + 0x100 + (n)*4)
+
+#define REG(off)	(*(vu32 *) (u64) (CRU_BASE + (off)))
+
+/* Rockchip registers with a write mask in the upper half */
+#define MASK_WRITE(off, mask, val)	REG(off) = ((mask) << 16) | (val)
+
+#define XIN_RATE	24000000
+
+#define NONE		(-1)
+
+struct clk {
+	char	*name;
+	u64	fixed;		/* a fixed rate, or 0 */
+	int	pll;		/* a PLL, or NONE */
+	int	parents[4];	/* just one unless there is a mux */
+	int	mux_reg;
+	int	mux_shift;
+	int	mux_width;	/* 0 for no mux */
+	int	div_reg;
+	int	div_shift;
+	int	div_width;	/* 0 for no divider */
+	int	frac_reg;	/* num << 16 | den, 0 for none */
+	int	gate_reg;	/* 0 for no gate */
+	int	gate_bit;
+};
+
+#define NO_PLL		.pll = NONE
+#define PLL(n)		.pll = n, .parents = { CLK_XIN24M }
+#define PARENT(p)	.pll = NONE, .parents = { p }
+#define MUX(r,s,w)	.mux_reg = CLKSEL_CON(r), .mux_shift = s, .mux_width = w
+#define DIV(r,s,w)	.div_reg = CLKSEL_CON(r), .div_shift = s, .div_width = w
+#define FRAC(r)		.frac_reg = CLKSEL_CON(r)
+#define GATE(r,b)	.gate_reg = CLKGATE_CON(r), .gate_bit = b
+#define PMU_DIV(r,s,w)	.div_reg = PMU_CLKSEL_CON(r), .div_shift = s, .div_width = w
+#define PMU_GATE(r,b)	.gate_reg = PMU_CLKGATE_CON(r), .gate_bit = b
+
+static struct clk clks[NUM_CLK] = {
+    [CLK_XIN24M]	= { "xin24m", XIN_RATE, NO_PLL },
+    [CLK_LPLL]		= { "lpll", PLL(PLL_L) },
+    [CLK_BPLL]		= { "bpll", PLL(PLL_B) },
+    [CLK_DPLL]		= { "dpll", PLL(PLL_D) },
+    [CLK_CPLL]		= { "cpll", PLL(PLL_C) },
+    [CLK_GPLL]		= { "gpll", PLL(PLL_G) },
+    [CLK_NPLL]		= { "npll", PLL(PLL_N) },
+    [CLK_VPLL]		= { "vpll", PLL(PLL_V) },
+    [CLK_PPLL]		= { "ppll", PLL(PLL_P) },
+    [CLK_ARML]		= { "armclkl", .pll = NONE,
+			    .parents = { CLK_LPLL, CLK_BPLL, CLK_DPLL, CLK_GPLL },
+			    MUX(0, 6, 2), DIV(0, 0, 5) },
+    [CLK_ARMB]		= { "armclkb", .pll = NONE,
+			    .parents = { CLK_LPLL, CLK_BPLL, CLK_DPLL, CLK_GPLL },
+			    MUX(2, 6, 2), DIV(2, 0, 5) },
+    [CLK_UART_SRC]	= { "clk_uart_src", .pll = NONE,
+			    .parents = { CLK_CPLL, CLK_GPLL },
+			    MUX(33, 15, 1) },
+    [CLK_UART2_DIV]	= { "clk_uart2_div", PARENT(CLK_UART_SRC),
+			    DIV(35, 0, 7), GATE(9, 4) },
+    [CLK_UART2_FRAC]	= { "clk_uart2_frac", PARENT(CLK_UART2_DIV),
+			    FRAC(102), GATE(9, 5) },
+    [CLK_UART2]		= { "clk_uart2", .pll = NONE,
+			    .parents = { CLK_UART2_DIV, CLK_UART2_FRAC, CLK_XIN24M },
+			    MUX(35, 8, 2) },
+    [CLK_TIMER0]	= { "clk_timer00", PARENT(CLK_XIN24M), GATE(26, 0) },
+    [CLK_TIMER1]	= { "clk_timer01", PARENT(CLK_XIN24M), GATE(26, 1) },
+    [CLK_XIN32K]	= { "xin32k", 32768, NO_PLL },
+    [CLK_TSADC]		= { "clk_tsadc", .pll = NONE,
+			    .parents = { CLK_XIN24M, CLK_XIN32K },
+			    MUX(27, 15, 1), DIV(27, 0, 10), GATE(9, 1) },
+    [CLK_I2C0]		= { "clk_i2c0_pmu", PARENT(CLK_PPLL),
+			    PMU_DIV(2, 0, 7), PMU_GATE(0, 9) },
+};
+
+#define MAX_NOTIFIERS	16
+
+struct notifier {
+	int		clk;
+	clk_notifier	func;
+	void		*arg;
+};
+
+static struct notifier notifiers[MAX_NOTIFIERS];
+static int n_notifiers;
+
+static int
+bad_clk ( int id )
+{
+	return id < 0 || id >= NUM_CLK;
+}
+
+static u32
+field ( int reg, int shift, int width )
+{
+	return (REG(reg) >> shift) & ((1 << width) - 1);
+}
+
+char *
+clk_name ( int id )
+{
+	return bad_clk ( id ) ? "?" : clks[id].name;
+}
+
+int
+clk_get_parent ( int id )
+{
+	struct clk *cp;
+
+	if ( bad_clk ( id ) )
+	    return NONE;
+	cp = &clks[id];
+	if ( cp->fixed )
+	    return NONE;
+	if ( ! cp->mux_width )
+	    return cp->parents[0];
+	return cp->parents[field ( cp->mux_reg, cp->mux_shift, cp->mux_width )];
+}
+
+/* The rate this clock makes from a given parent rate */
+static u64
+clk_from_parent ( struct clk *cp, u64 prate )
+{
+	u32 frac, num, den;
+
+	if ( cp->div_width )
+	    prate /= field ( cp->div_reg, cp->div_shift, cp->div_width ) + 1;
+
+	if ( cp->frac_reg ) {
+	    frac = REG(cp->frac_reg);
+	    num = frac >> 16;
+	    den = frac & 0xffff;
+	    if ( ! den )
+		return 0;
+	    prate = prate * num / den;
+	}
+
+	return prate;
+}
+
+u64
+clk_get_rate ( int id )
+{
+	struct clk *cp;
+	int parent;
+
+	if ( bad_clk ( id ) )
+	    return 0;
+	cp = &clks[id];
+
+	if ( cp->fixed )
+	    return cp->fixed;
+	if ( cp->pll != NONE )
+	    return pll_get_rate ( cp->pll );
+
+	parent = clk_get_parent ( id );
+	if ( parent == NONE )
+	    return 0;
+	return clk_from_parent ( cp, clk_get_rate ( parent ) );
+}
+
+/* ------------------------------------------------------ */
+/* Telling everyone */
+
+static u64 old_rates[NUM_CLK];
+static u64 new_rates[NUM_CLK];
+static char affected[NUM_CLK];
+
+/* Mark the clock and everything below it, and note their rates.
+ * The table has parents first, so one pass does it.
+ */
+static void
+mark_subtree ( int id )
+{
+	int i, p;
+
+	for ( i=0; i<NUM_CLK; i++ ) {
+	    affected[i] = 0;
+	    old_rates[i] = clk_get_rate ( i );
+	}
+	affected[id] = 1;
+
+	for ( i=id+1; i<NUM_CLK; i++ ) {
+	    p = clk_get_parent ( i );
+	    if ( p != NONE && affected[p] )
+		affected[i] = 1;
+	}
+}
+
+/* Everything below a clock scales with it */
+static void
+predict ( int id, u64 rate )
+{
+	int i;
+
+	for ( i=0; i<NUM_CLK; i++ ) {
+	    if ( ! affected[i] )
+		continue;
+	    if ( i == id || ! old_rates[id] )
+		new_rates[i] = rate;
+	    else
+		new_rates[i] = old_rates[i] * rate / old_rates[id];
+	}
+}
+
+/* Returns non zero if someone said no */
+static int
+notify ( int event )
+{
+	struct notifier *np;
+	int i, rv;
+
+	for ( i=0; i<n_notifiers; i++ ) {
+	    np = &notifiers[i];
+	    if ( ! affected[np->clk] )
+		continue;
+	    if ( event == CLK_POST_CHANGE && new_rates[np->clk] == old_rates[np->clk] )
+		continue;
+	    rv = (*np->func) ( np->clk, event, old_rates[np->clk], new_rates[np->clk], np->arg );
+	    if ( rv && event == CLK_PRE_CHANGE )
+		return rv;
+	}
+	return 0;
+}
+
+static int
+pre_change ( int id, u64 rate )
+{
+	predict ( id, rate );
+	if ( notify ( CLK_PRE_CHANGE ) ) {
+	    notify ( CLK_ABORT_CHANGE );
+	    return -1;
+	}
+	return 0;
+}
+
+static void
+post_change ( void )
+{
+	int i;
+
+	for ( i=0; i<NUM_CLK; i++ )
+	    if ( affected[i] )
+		new_rates[i] = clk_get_rate ( i );
+	notify ( CLK_POST_CHANGE );
+}
+
+int
+clk_notifier_register ( int id, clk_notifier func, void *arg )
+{
+	if ( bad_clk ( id ) || n_notifiers >= MAX_NOTIFIERS )
+	    return -1;
+	notifiers[n_notifiers].clk = id;
+	notifiers[n_notifiers].func = func;
+	notifiers[n_notifiers].arg = arg;
+	n_notifiers++;
+	return 0;
+}
+
+/* ------------------------------------------------------ */
+/* Changing things */
+
+/* Best num/den (each up to max) for a ratio below 1,
+ * by continued fractions (as in baud.c).
+ */
+static void
+rational ( u64 given_num, u64 given_den, u32 max, u32 *num, u32 *den )
+{
+	u64 n0 = 0, d0 = 1;
+	u64 n1 = 1, d1 = 0;
+	u64 n, d, a, t, k;
+
+	n = given_num;
+	d = given_den;
+
+	while ( d ) {
+	    a = n / d;
+	    if ( n1 * a + n0 > max || d1 * a + d0 > max ) {
+		k = (max - n0) / (n1 ? n1 : 1);
+		t = (max - d0) / (d1 ? d1 : 1);
+		if ( t < k )
+		    k = t;
+		if ( 2 * k >= a ) {
+		    n1 = n1 * k + n0;
+		    d1 = d1 * k + d0;
+		}
+		break;
+	    }
+	    t = n1 * a + n0;
+	    n0 = n1;
+	    n1 = t;
+	    t = d1 * a + d0;
+	    d0 = d1;
+	    d1 = t;
+
+	    t = n % d;
+	    n = d;
+	    d = t;
+	}
+
+	*num = n1;
+	*den = d1;
+}
+
+/* A PLL, a divider or a fraction can be set to a rate.
+ * A mux can't, use clk_set_parent().
+ * Returns -1 if it can't be done or a notifier said no.
+ */
+int
+clk_set_rate ( int id, u64 rate )
+{
+	struct clk *cp;
+	struct pll_setting s;
+	u64 prate, div, got;
+	u32 num, den;
+	int rv = 0;
+
+	if ( bad_clk ( id ) || rate == 0 )
+	    return -1;
+	cp = &clks[id];
+
+	if ( cp->pll != NONE ) {
+	    if ( ! pll_solve ( rate, &s ) )
+		return -1;
+	    got = s.rate;
+	} else if ( cp->div_width || cp->frac_reg ) {
+	    prate = clk_get_rate ( clk_get_parent ( id ) );
+	    if ( cp->div_width ) {
+		div = (prate + rate / 2) / rate;
+		if ( div < 1 )
+		    div = 1;
+		if ( div > (1 << cp->div_width) )
+		    div = 1 << cp->div_width;
+		got = prate / div;
+	    } else {
+		rational ( rate, prate, 0xffff, &num, &den );
+		if ( ! num || ! den || num > den )
+		    return -1;
+		got = prate * num / den;
+	    }
+	} else
+	    return -1;
+
+	mark_subtree ( id );
+	if ( pre_change ( id, got ) )
+	    return -1;
+
+	if ( cp->pll != NONE )
+	    rv = pll_set_rate ( cp->pll, rate );
+	else if ( cp->div_width )
+	    MASK_WRITE ( cp->div_reg, ((1 << cp->div_width) - 1) << cp->div_shift,
+		(div - 1) << cp->div_shift );
+	else
+	    REG(cp->frac_reg) = (num << 16) | den;
+
+	post_change ();
+	return rv;
+}
+
+int
+clk_set_parent ( int id, int parent )
+{
+	struct clk *cp;
+	int i;
+
+	if ( bad_clk ( id ) || bad_clk ( parent ) )
+	    return -1;
+	cp = &clks[id];
+	if ( ! cp->mux_width )
+	    return clk_get_parent ( id ) == parent ? 0 : -1;
+
+	for ( i=0; i < (1 << cp->mux_width) && i < 4; i++ )
+	    if ( cp->parents[i] == parent )
+		break;
+	if ( i == 4 || i == (1 << cp->mux_width) )
+	    return -1;
+
+	mark_subtree ( id );
+	if ( pre_change ( id, clk_from_parent ( cp, clk_get_rate ( parent ) ) ) )
+	    return -1;
+
+	MASK_WRITE ( cp->mux_reg, ((1 << cp->mux_width) - 1) << cp->mux_shift,
+	    i << cp->mux_shift );
+
+	post_change ();
+	return 0;
+}
+
+/* Gates are "clock disable" bits, 0 is running */
+int
+clk_enable ( int id )
+{
+	struct clk *cp;
+
+	if ( bad_clk ( id ) )
+	    return -1;
+	cp = &clks[id];
+	if ( cp->gate_reg )
+	    MASK_WRITE ( cp->gate_reg, 1 << cp->gate_bit, 0 );
+	return 0;
+}
+
+int
+clk_disable ( int id )
+{
+	struct clk *cp;
+
+	if ( bad_clk ( id ) )
+	    return -1;
+	cp = &clks[id];
+	if ( cp->gate_reg )
+	    MASK_WRITE ( cp->gate_reg, 1 << cp->gate_bit, 1 << cp->gate_bit );
+	return 0;
+}
+
+void
+clk_dump ( void )
+{
+	struct clk *cp;
+	int i, p;
+
+	for ( i=0; i<NUM_CLK; i++ ) {
+	    cp = &clks[i];
+	    p = clk_get_parent ( i );
+	    printf ( "%-16s %12lu Hz  from %-14s%s\n", cp->name, clk_get_rate ( i ),
+		p == NONE ? "-" : clks[p].name,
+		cp->gate_reg && (REG(cp->gate_reg) & (1 << cp->gate_bit)) ? "  (off)" : "" );
+	}
+}
+
+/* THE END */
@@ -0,0 +1,45 @@
+/* clk.h
+ *
+ * A model of (part of) the RK3399 clock tree, see clk.c
+ */
+
+#define CLK_XIN24M	0
+#define CLK_LPLL	1
+#define CLK_BPLL	2
+#define CLK_DPLL	3
+#define CLK_CPLL	4
+#define CLK_GPLL	5
+#define CLK_NPLL	6
+#define CLK_VPLL	7
+#define CLK_PPLL	8
+#define CLK_ARML	9	/* A53 cores */
+#define CLK_ARMB	10	/* A72 cores */
+#define CLK_UART_SRC	11
+#define CLK_UART2_DIV	12
+#define CLK_UART2_FRAC	13
+#define CLK_UART2	14
+#define CLK_TIMER0	15	/* timer00, our one shot */
+#define CLK_TIMER1	16	/* timer01, our clock */
+#define CLK_XIN32K	17
+#define CLK_TSADC	18
+#define CLK_I2C0	19	/* in the PMU, for the PMIC */
+#define NUM_CLK		20
+
+/* Notifier events */
+#define CLK_PRE_CHANGE		1	/* a non zero return stops it */
+#define CLK_POST_CHANGE		2
+#define CLK_ABORT_CHANGE	3
+
+typedef int (*clk_notifier) ( int, int, unsigned long, unsigned long, void * );
+
+unsigned long clk_get_rate ( int );
+int clk_set_rate ( int, unsigned long );
+int clk_get_parent ( int );
+int clk_set_parent ( int, int );
+int clk_enable ( int );
+int clk_disable ( int );
+char *clk_name ( int );
+int clk_notifier_register ( int, clk_notifier, void * );
+void clk_dump ( void );
+
+/* THE END */
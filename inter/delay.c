@@ -0,0 +1,147 @@
+/* delay.c
+ *
+ * Delays for the RK3399, timed by the ARM generic counter.
+ *
+ * The old delay() counted down a loop, so it depended on the CPU
+ * clock, the caches and the compiler, and had to be fixed by hand
+ * every time the clock changed.  cntpct_el0 counts at cntfrq_el0
+ * (24 Mhz here) no matter what the PLLs are doing.
+ *
+ *   udelay ( us ), mdelay ( ms ), ndelay ( ns )
+ *
+ * and for polling something with a timeout:
+ *
+ *   u64 end = deadline_us ( 500 );
+ *   while ( ! ready () )
+ *	if ( deadline_passed ( end ) )
+ *	    return -1;
+ *
+ * Longer waits sleep in WFE between events from the counter's
+ * event stream (about every 10 us), short ones just spin.
+ * An interrupt also ends the WFE early, which is harmless,
+ * we just check the count and go back.
+ *
+ * ndelay can't do better than one count (42 ns) and the
+ * time it takes to get here.
+ */
+
+typedef unsigned int u32;
+typedef unsigned long u64;
+typedef volatile unsigned int vu32;
+
+/* The bootrom leaves the counter stopped and cntfrq at 0.
+ * U-Boot (SPL) starts it with the first secure timer,
+ * when we come straight from the bootrom, we have to.
+ */
+#define STIMER0_BASE	0xff8680a0
+#define STIMER_LOAD0	0x00
+#define STIMER_LOAD1	0x04
+#define STIMER_CONTROL	0x1c
+#define STIMER_ENA	1
+
+#define COUNTER_FREQ	24000000
+
+#define STIMER(off)	(*(vu32 *) (u64) (STIMER0_BASE + (off)))
+
+/* cntkctl_el1 event stream, an event each time
+ * bit 7 of the count goes from 0 to 1 (every 256 counts)
+ */
+#define EVNTEN		(1<<2)
+#define EVNTI		7
+#define EVNT_COUNTS	(2 << EVNTI)
+
+static u64 delay_freq = COUNTER_FREQ;
+
+static inline u64
+read_count ( void )
+{
+	u64 val;
+
+	asm volatile ( "isb; mrs %0, cntpct_el0" : "=r" (val) : : "memory" );
+	return val;
+}
+
+static inline unsigned int
+get_el ( void )
+{
+	u64 val;
+
+	asm volatile ( "mrs %0, CurrentEL" : "=r" (val) );
+	return (val >> 2) & 3;
+}
+
+void
+delay_init ( void )
+{
+	u64 val;
+
+	asm volatile ( "mrs %0, cntfrq_el0" : "=r" (val) );
+
+	if ( val == 0 && get_el () == 3 ) {
+	    val = COUNTER_FREQ;
+	    asm volatile ( "msr cntfrq_el0, %0" : : "r" (val) );
+	    if ( ! (STIMER(STIMER_CONTROL) & STIMER_ENA) ) {
+		STIMER(STIMER_LOAD0) = 0xffffffff;
+		STIMER(STIMER_LOAD1) = 0xffffffff;
+		STIMER(STIMER_CONTROL) = STIMER_ENA;
+	    }
+	}
+	if ( val )
+	    delay_freq = val;
+
+	asm volatile ( "mrs %0, cntkctl_el1" : "=r" (val) );
+	val &= ~0xfc;
+	val |= EVNTEN | (EVNTI << 4);
+	asm volatile ( "msr cntkctl_el1, %0" : : "r" (val) );
+	asm volatile ( "isb" );
+}
+
+/* Counts from now until the deadline, rounded up */
+u64
+deadline_ns ( u64 ns )
+{
+	return read_count () + (ns * delay_freq + 999999999) / 1000000000;
+}
+
+u64
+deadline_us ( u64 us )
+{
+	return read_count () + (us * delay_freq + 999999) / 1000000;
+}
+
+int
+deadline_passed ( u64 end )
+{
+	return (long) (read_count () - end) >= 0;
+}
+
+/* Wait until the count gets to end */
+void
+delay_until ( u64 end )
+{
+	while ( (long) (end - read_count ()) > 2 * EVNT_COUNTS )
+	    asm volatile ( "wfe" );
+
+	while ( ! deadline_passed ( end ) )
+	    ;
+}
+
+void
+ndelay ( u32 ns )
+{
+	delay_until ( deadline_ns ( ns ) );
+}
+
+void
+udelay ( u32 us )
+{
+	delay_until ( deadline_us ( us ) );
+}
+
+void
+mdelay ( u32 ms )
+{
+	delay_until ( deadline_us ( (u64) ms * 1000 ) );
+}
+
+/* THE END */
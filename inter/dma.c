@@ -0,0 +1,336 @@
+/* dma.c
+ *
+ * Just enough of a driver for the PL330 DMA controller
+ * in the RK3399 to send buffers to a peripheral (the uart).
+ *
+ * The RK3399 has two of these, DMAC0 (dmac_bus) and
+ * DMAC1 (dmac_peri).  The uarts are on dmac_peri.
+ * The TRM says little, the ARM "PrimeCell DMA Controller
+ * (PL330) Technical Reference Manual" has everything.
+ *
+ * A PL330 runs little programs ("microcode") that we build
+ * in memory.  We write one for each transfer: for every
+ * buffer in the list, point the source at it, then loop
+ * doing bursts of 16 bytes as the peripheral asks for them,
+ * then single bytes for what is left over.  At the end we
+ * signal an event, which is wired to an interrupt.
+ */
+
+#include "protos.h"
+#include "rk3399_ints.h"
+
+typedef volatile unsigned int vu32;
+typedef unsigned int u32;
+
+#define BIT(x)	(1<<(x))
+
+struct pl330_chan_regs {
+	vu32	sar;		/* 0x400 */
+	vu32	dar;
+	vu32	ccr;
+	vu32	lc0;
+	vu32	lc1;
+	u32	_pad[3];
+};
+
+struct pl330 {
+	vu32	dsr;		/* 0x000 */
+	vu32	dpc;
+	u32	_pad0[6];
+	vu32	inten;		/* 0x020 */
+	vu32	int_event_ris;
+	vu32	intmis;
+	vu32	intclr;
+	vu32	fsrd;		/* 0x030 */
+	vu32	fsrc;
+	vu32	ftrd;
+	u32	_pad1;
+	vu32	ftr[8];		/* 0x040 */
+	u32	_pad2[40];
+	struct {
+	    vu32	csr;
+	    vu32	cpc;
+	} chan_stat[8];		/* 0x100 */
+	u32	_pad3[176];
+	struct pl330_chan_regs	chan[8];	/* 0x400 */
+	u32	_pad4[512];
+	vu32	dbgstatus;	/* 0xd00 */
+	vu32	dbgcmd;
+	vu32	dbginst0;
+	vu32	dbginst1;
+};
+
+#define DMAC0_BASE	((struct pl330 *) 0xff6d0000)
+#define DMAC1_BASE	((struct pl330 *) 0xff6e0000)
+
+#define DMA_BASE	DMAC1_BASE
+
+/* events 0 and 1 are wired to these */
+static int dma_irqs[DMA_MAX_CHAN] = { IRQ_DMAC1_0, IRQ_DMAC1_1 };
+
+#define DBG_BUSY	BIT(0)
+
+/* Instructions */
+#define DMAEND		0x00
+#define DMAKILL		0x01
+#define DMAWMB		0x13
+#define DMALD		0x04
+#define DMALP		0x20	/* | lc<<1 */
+#define DMASTPS		0x29
+#define DMASTPB		0x2b
+#define DMAWFPS		0x30
+#define DMAWFPB		0x32
+#define DMASEV		0x34
+#define DMAFLUSHP	0x35
+#define DMALPEND	0x38	/* | lc<<2 */
+#define DMAGO		0xa0
+#define DMAMOV		0xbc
+
+#define MOV_SAR		0
+#define MOV_CCR		1
+#define MOV_DAR		2
+
+/* Channel control:
+ * source increments, destination fixed, bytes,
+ * non-secure on both sides.
+ */
+#define CCR_SRC_INC	BIT(0)
+#define CCR_SRC_BURST(n)	(((n)-1) << 4)
+#define CCR_SRC_NS	BIT(9)
+#define CCR_DST_BURST(n)	(((n)-1) << 18)
+#define CCR_DST_NS	BIT(23)
+
+#define BURST		16
+
+#define CCR_BURST	(CCR_SRC_INC | CCR_SRC_BURST(BURST) | CCR_DST_BURST(BURST) | CCR_SRC_NS | CCR_DST_NS)
+#define CCR_SINGLE	(CCR_SRC_INC | CCR_SRC_BURST(1) | CCR_DST_BURST(1) | CCR_SRC_NS | CCR_DST_NS)
+
+/* Enough for the biggest list, each buffer takes 40 bytes or so */
+#define PROG_SIZE	1024
+
+struct dma_chan {
+	unsigned char	prog[PROG_SIZE];
+	unsigned char	*pc;
+	volatile int	busy;
+	void		(*done) ( void * );
+	void		*arg;
+};
+
+static struct dma_chan dma_chans[DMA_MAX_CHAN] __attribute__ ((aligned(64)));
+
+/* -------------------------------------------------- */
+
+static void
+emit1 ( struct dma_chan *cp, int a )
+{
+	*cp->pc++ = a;
+}
+
+static void
+emit2 ( struct dma_chan *cp, int a, int b )
+{
+	*cp->pc++ = a;
+	*cp->pc++ = b;
+}
+
+static void
+emit_mov ( struct dma_chan *cp, int reg, u32 val )
+{
+	emit2 ( cp, DMAMOV, reg );
+	*cp->pc++ = val;
+	*cp->pc++ = val >> 8;
+	*cp->pc++ = val >> 16;
+	*cp->pc++ = val >> 24;
+}
+
+/* One loop of count (1 to 256) transfers to the peripheral,
+ * either bursts or single bytes.
+ */
+static void
+emit_loop ( struct dma_chan *cp, int periph, int count, int burst )
+{
+	unsigned char *top;
+
+	emit2 ( cp, DMALP, count - 1 );
+	top = cp->pc;
+	if ( burst ) {
+	    emit2 ( cp, DMAWFPB, periph << 3 );
+	    emit1 ( cp, DMALD );
+	    emit2 ( cp, DMASTPB, periph << 3 );
+	} else {
+	    emit2 ( cp, DMAWFPS, periph << 3 );
+	    emit1 ( cp, DMALD );
+	    emit2 ( cp, DMASTPS, periph << 3 );
+	}
+	emit2 ( cp, DMALPEND, cp->pc - top );
+}
+
+static void
+emit_buf ( struct dma_chan *cp, int periph, char *buf, int len )
+{
+	int n;
+
+	emit_mov ( cp, MOV_SAR, (u32) (unsigned long) buf );
+
+	n = len / BURST;
+	if ( n ) {
+	    emit_mov ( cp, MOV_CCR, CCR_BURST );
+	    while ( n > 0 ) {
+		emit_loop ( cp, periph, n > 256 ? 256 : n, 1 );
+		n -= 256;
+	    }
+	}
+
+	n = len % BURST;
+	if ( n ) {
+	    emit_mov ( cp, MOV_CCR, CCR_SINGLE );
+	    emit_loop ( cp, periph, n, 0 );
+	}
+}
+
+/* Run an instruction through the debug interface.
+ * DMAGO must be given to the manager thread,
+ * DMAKILL to the channel thread.
+ */
+static void
+dma_debug ( int chan, int channel_thread, unsigned char *insn, u32 arg )
+{
+	struct pl330 *dp = DMA_BASE;
+
+	while ( dp->dbgstatus & DBG_BUSY )
+	    ;
+
+	dp->dbginst0 = (insn[1] << 24) | (insn[0] << 16) | (chan << 8) | channel_thread;
+	dp->dbginst1 = arg;
+	dp->dbgcmd = 0;
+}
+
+/* -------------------------------------------------- */
+
+void
+dma_init ( void )
+{
+	struct pl330 *dp = DMA_BASE;
+	int i;
+
+	/* event n interrupts for channel n */
+	dp->intclr = 0xff;
+	for ( i=0; i<DMA_MAX_CHAN; i++ ) {
+	    dp->inten |= BIT(i);
+	    irq_request ( dma_irqs[i], dma_handler, 0, IRQ_PRIO_NORMAL );
+	}
+}
+
+int
+dma_busy ( int chan )
+{
+	return dma_chans[chan].busy;
+}
+
+/* Stop a channel where it is, for a panic.
+ * done() is not called.
+ */
+void
+dma_kill ( int chan )
+{
+	unsigned char kill[2];
+
+	if ( chan < 0 || chan >= DMA_MAX_CHAN )
+	    return;
+
+	kill[0] = DMAKILL;
+	kill[1] = 0;
+	dma_debug ( chan, 1, kill, 0 );
+	dma_chans[chan].busy = 0;
+}
+
+/* Send a list of buffers to a peripheral register.
+ * done(arg) is called from the interrupt when it is all gone.
+ * The buffers must stay put until then.
+ */
+int
+dma_to_periph ( int chan, int periph, u32 dst, struct dma_seg *segs, int nseg,
+	void (*done) ( void * ), void *arg )
+{
+	struct dma_chan *cp = &dma_chans[chan];
+	unsigned char go[2];
+	int i;
+
+	if ( chan < 0 || chan >= DMA_MAX_CHAN || cp->busy )
+	    return -1;
+	if ( nseg > DMA_MAX_SEG )
+	    return -1;
+
+	cp->pc = cp->prog;
+	emit_mov ( cp, MOV_DAR, dst );
+	emit2 ( cp, DMAFLUSHP, periph << 3 );
+
+	for ( i=0; i<nseg; i++ ) {
+	    if ( segs[i].len <= 0 )
+		continue;
+
+	    /* worst case for this buffer, plus the ending */
+	    if ( cp->pc + 36 + 9 * (segs[i].len / BURST / 256) + 8 > &cp->prog[PROG_SIZE] )
+		return -1;
+	    emit_buf ( cp, periph, segs[i].buf, segs[i].len );
+
+	    /* the DMA reads memory, not our cache */
+	    clean_dcache_range ( (unsigned long) segs[i].buf, segs[i].len );
+	}
+
+	emit1 ( cp, DMAWMB );
+	emit2 ( cp, DMASEV, chan << 3 );
+	emit1 ( cp, DMAEND );
+
+	clean_dcache_range ( (unsigned long) cp->prog, cp->pc - cp->prog );
+
+	cp->done = done;
+	cp->arg = arg;
+	cp->busy = 1;
+
+	go[0] = DMAGO | BIT(1);		/* non-secure */
+	go[1] = chan;
+	dma_debug ( chan, 0, go, (u32) (unsigned long) cp->prog );
+
+	return 0;
+}
+
+/* Called from handle_irq for either DMA interrupt.
+ * Faults don't have an event, but we check for them here
+ * so a stuck channel at least gets reported.
+ */
+void
+dma_handler ( void *arg )
+{
+	struct pl330 *dp = DMA_BASE;
+	struct dma_chan *cp;
+	unsigned char kill[2];
+	u32 events;
+	u32 faults;
+	int i;
+
+	faults = dp->fsrc;
+	for ( i=0; i<DMA_MAX_CHAN; i++ ) {
+	    if ( ! (faults & BIT(i)) )
+		continue;
+	    printf ( "DMA channel %d fault: %h at %h\n", i, dp->ftr[i], dp->chan_stat[i].cpc );
+	    kill[0] = DMAKILL;
+	    kill[1] = 0;
+	    dma_debug ( i, 1, kill, 0 );
+	    dma_chans[i].busy = 0;
+	}
+
+	events = dp->intmis;
+	dp->intclr = events;
+
+	for ( i=0; i<DMA_MAX_CHAN; i++ ) {
+	    if ( ! (events & BIT(i)) )
+		continue;
+	    cp = &dma_chans[i];
+	    cp->busy = 0;
+	    if ( cp->done )
+		cp->done ( cp->arg );
+	}
+}
+
+/* THE END */
@@ -0,0 +1,351 @@
+/* dvfs.c
+ *
+ * A thermal governor for the two CPU clusters.
+ *
+ * Rather than always running at 100 Mhz because the chip runs hot,
+ * we run as fast as we can and back off when it gets warm.
+ * Every DVFS_PERIOD_MS a software timer reads the TSADC (the CPU
+ * and GPU sensors, we go by the hotter one) and moves the clusters
+ * through their operating points (the table is from the linux
+ * rk3399 device tree):
+ *
+ *   at or over TRIP_CRIT		both clusters to the lowest point
+ *   at or over TRIP_HOT		one step down, the A72s first
+ *   under TRIP_HOT - HYSTERESIS	one step up, the A53s first,
+ *					but only after UP_SAMPLES of that
+ *
+ * In between we stay put, which is the hysteresis.  There is no
+ * sensor for each cluster, so the A72s (which make most of the heat)
+ * give way first and get their speed back last.
+ *
+ * Each point needs a voltage.  If pmic.c can set the rail for a
+ * cluster, we raise the voltage before going faster and drop it
+ * after going slower, and all the points can be used.  If not, we
+ * only use points that are good at the boot voltage, unless the
+ * clusters were already running faster than that when we started
+ * (FULL_SPEED), which we take to mean someone turned it up.
+ * dvfs_set_max_uv() moves that limit.
+ *
+ * The timer runs in interrupt context, so all it does is read the
+ * temperature and note what should happen.  Changing a point means
+ * relocking a PLL and stepping a rail over I2C, which takes
+ * milliseconds, so that is done by dvfs_poll(), which the main
+ * loop calls often.  Anything long that doesn't call it (the
+ * benchmarks) holds up the change, critical or not.
+ *
+ * The changes are logged with TRACE, and we keep the time spent
+ * at each point, which dvfs_dump() shows.
+ */
+
+#include "protos.h"
+#include "pll.h"
+#include "clk.h"
+#include "trace.h"
+
+typedef unsigned int u32;
+typedef unsigned long u64;
+
+#define MHZ		1000000
+
+#define DVFS_PERIOD_MS	250
+
+/* millidegrees C */
+#define TRIP_HOT	75000
+#define TRIP_CRIT	90000
+#define HYSTERESIS	10000
+
+/* a second of being cool before going up */
+#define UP_SAMPLES	4
+
+/* What we take the rails to be at after U-Boot,
+ * if we can't ask the PMIC.
+ */
+#define BOOT_UV		900000
+
+struct opp {
+	u64	rate;
+	int	uv;
+};
+
+static struct opp opp_l[] = {
+	{  408*MHZ,  825000 },
+	{  600*MHZ,  825000 },
+	{  816*MHZ,  850000 },
+	{ 1008*MHZ,  925000 },
+	{ 1200*MHZ, 1000000 },
+	{ 1416*MHZ, 1125000 }
+};
+
+static struct opp opp_b[] = {
+	{  408*MHZ,  825000 },
+	{  600*MHZ,  825000 },
+	{  816*MHZ,  825000 },
+	{ 1008*MHZ,  875000 },
+	{ 1200*MHZ,  950000 },
+	{ 1416*MHZ, 1025000 },
+	{ 1608*MHZ, 1100000 },
+	{ 1800*MHZ, 1200000 }
+};
+
+#define MAX_OPP		8
+
+struct cluster {
+	char		*name;
+	int		id;		/* CLUSTER_L or CLUSTER_B */
+	int		clk;
+	struct opp	*opps;
+	int		nopp;
+	int		cur;		/* where we are */
+	int		max;		/* as high as we may go */
+	u64		time[MAX_OPP];	/* timer_now ticks at each point */
+	int		changes;
+	int		fails;
+};
+
+static struct cluster clusters[2] = {
+    { "A53", CLUSTER_L, CLK_ARML, opp_l, sizeof(opp_l) / sizeof(opp_l[0]) },
+    { "A72", CLUSTER_B, CLK_ARMB, opp_b, sizeof(opp_b) / sizeof(opp_b[0]) }
+};
+
+#define LITTLE	(&clusters[0])
+#define BIG	(&clusters[1])
+
+static struct swtimer dvfs_timer;
+
+/* What the timer wants dvfs_poll() to do */
+#define ACT_NONE	0
+#define ACT_UP		1
+#define ACT_DOWN	2
+#define ACT_CRIT	3
+
+static volatile int pending;
+
+static u64 last_sample;
+static int last_temp;
+static int max_temp;
+static int cool_count;
+static int hot_trips;
+static int crit_trips;
+static int bad_reads;
+
+/* The highest point good for a voltage, or the one we are
+ * already running at if that is higher.
+ */
+static int
+find_max ( struct cluster *cp, int uv )
+{
+	u64 rate = clk_get_rate ( cp->clk );
+	int i, max = 0;
+
+	for ( i=0; i<cp->nopp; i++ ) {
+	    if ( cp->opps[i].uv <= uv || cp->opps[i].rate <= rate )
+		max = i;
+	}
+	return max;
+}
+
+static void
+account ( u64 now )
+{
+	LITTLE->time[LITTLE->cur] += now - last_sample;
+	BIG->time[BIG->cur] += now - last_sample;
+	last_sample = now;
+}
+
+/* The voltage goes up before the clock, and down after it */
+static int
+change_opp ( struct cluster *cp, int n )
+{
+	struct opp *op = &cp->opps[n];
+	int up = op->rate > clk_get_rate ( cp->clk );
+
+	if ( up && pmic_ok ( cp->id ) && pmic_set_uv ( cp->id, op->uv ) < 0 )
+	    return -1;
+	if ( cpu_clock_set ( cp->id, op->rate ) < 0 )
+	    return -1;
+	if ( ! up && pmic_ok ( cp->id ) )
+	    pmic_set_uv ( cp->id, op->uv );
+	return 0;
+}
+
+/* Returns 0 if it worked */
+static int
+set_opp ( struct cluster *cp, int n )
+{
+	int old = cp->cur;
+
+	if ( n < 0 || n > cp->max || n == cp->cur )
+	    return -1;
+
+	if ( change_opp ( cp, n ) < 0 ) {
+	    /* don't keep trying it */
+	    cp->fails++;
+	    if ( n > cp->cur )
+		cp->max = cp->cur;
+	    return -1;
+	}
+
+	cp->cur = n;
+	cp->changes++;
+	TRACE ( "DVFS %s %d -> %d Mhz at %d mC\n", cp->name,
+	    cp->opps[old].rate / MHZ, cp->opps[n].rate / MHZ, last_temp );
+	return 0;
+}
+
+static int
+read_temp ( int *temp )
+{
+	int cpu, gpu;
+
+	if ( tsadc_temp ( TSADC_CPU, &cpu ) < 0 )
+	    return -1;
+	if ( tsadc_temp ( TSADC_GPU, &gpu ) == 0 && gpu > cpu )
+	    cpu = gpu;
+	*temp = cpu;
+	return 0;
+}
+
+/* Never overrides something more urgent that
+ * dvfs_poll() hasn't got to yet.
+ */
+static void
+post ( int act )
+{
+	if ( act > pending )
+	    pending = act;
+}
+
+/* From the software timer, every DVFS_PERIOD_MS */
+static void
+dvfs_sample ( void *arg )
+{
+	int temp;
+
+	account ( timer_now () );
+
+	/* If we can't tell, assume the worst */
+	if ( read_temp ( &temp ) < 0 ) {
+	    bad_reads++;
+	    temp = TRIP_HOT;
+	}
+	last_temp = temp;
+	if ( temp > max_temp )
+	    max_temp = temp;
+
+	if ( temp >= TRIP_CRIT ) {
+	    cool_count = 0;
+	    post ( ACT_CRIT );
+	    return;
+	}
+
+	if ( temp >= TRIP_HOT ) {
+	    cool_count = 0;
+	    post ( ACT_DOWN );
+	    return;
+	}
+
+	if ( temp >= TRIP_HOT - HYSTERESIS ) {
+	    cool_count = 0;
+	    return;
+	}
+
+	if ( ++cool_count < UP_SAMPLES )
+	    return;
+	cool_count = 0;
+	post ( ACT_UP );
+}
+
+/* From the main loop, make the change the timer asked for */
+void
+dvfs_poll ( void )
+{
+	int act;
+
+	if ( ! pending )
+	    return;
+	act = __atomic_exchange_n ( &pending, ACT_NONE, __ATOMIC_RELAXED );
+
+	switch ( act ) {
+	    case ACT_CRIT:
+		if ( BIG->cur || LITTLE->cur ) {
+		    crit_trips++;
+		    TRACE ( "DVFS critical, %d mC\n", last_temp );
+		}
+		set_opp ( BIG, 0 );
+		set_opp ( LITTLE, 0 );
+		break;
+	    case ACT_DOWN:
+		if ( set_opp ( BIG, BIG->cur - 1 ) == 0 || set_opp ( LITTLE, LITTLE->cur - 1 ) == 0 )
+		    hot_trips++;
+		break;
+	    case ACT_UP:
+		if ( set_opp ( LITTLE, LITTLE->cur + 1 ) < 0 )
+		    set_opp ( BIG, BIG->cur + 1 );
+		break;
+	}
+}
+
+/* Let the governor use points up to this voltage,
+ * once the PMIC has been set for it.
+ */
+void
+dvfs_set_max_uv ( int cluster, int uv )
+{
+	struct cluster *cp = cluster == CLUSTER_B ? BIG : LITTLE;
+
+	cp->max = find_max ( cp, uv );
+}
+
+/* Start at the top and let the temperature bring us down */
+void
+dvfs_init ( void )
+{
+	struct cluster *cp;
+	int i;
+
+	last_sample = timer_now ();
+	for ( i=0; i<2; i++ ) {
+	    cp = &clusters[i];
+	    cp->max = find_max ( cp, pmic_ok ( cp->id ) ? pmic_max_uv ( cp->id ) : BOOT_UV );
+	    if ( change_opp ( cp, cp->max ) == 0 )
+		cp->cur = cp->max;
+	    else
+		cp->cur = cp->max = 0;
+	    printf ( "DVFS: %s up to %lu Mhz, starting at %lu Mhz\n", cp->name,
+		cp->opps[cp->max].rate / MHZ, clk_get_rate ( cp->clk ) / MHZ );
+	}
+
+	swtimer_init ( &dvfs_timer, dvfs_sample, 0 );
+	swtimer_start ( &dvfs_timer, timer_hz () / 1000 * DVFS_PERIOD_MS,
+	    timer_hz () / 1000 * DVFS_PERIOD_MS );
+}
+
+void
+dvfs_dump ( void )
+{
+	struct cluster *cp;
+	u64 total, ms;
+	int i, n;
+
+	printf ( "DVFS: %d.%03d C now, %d.%03d C max, %d hot, %d critical, %d bad reads\n",
+	    last_temp / 1000, (last_temp < 0 ? -last_temp : last_temp) % 1000,
+	    max_temp / 1000, max_temp % 1000, hot_trips, crit_trips, bad_reads );
+
+	for ( i=0; i<2; i++ ) {
+	    cp = &clusters[i];
+	    total = 0;
+	    for ( n=0; n<cp->nopp; n++ )
+		total += cp->time[n];
+	    printf ( "  %s at %lu Mhz, %d changes, %d failed\n", cp->name,
+		cp->opps[cp->cur].rate / MHZ, cp->changes, cp->fails );
+	    for ( n=0; n<cp->nopp; n++ ) {
+		if ( ! cp->time[n] )
+		    continue;
+		ms = cp->time[n] * 1000 / timer_hz ();
+		printf ( "    %4lu Mhz %8lu ms %3lu%%\n", cp->opps[n].rate / MHZ,
+		    ms, total ? cp->time[n] * 100 / total : 0 );
+	    }
+	}
+}
+
+/* THE END */
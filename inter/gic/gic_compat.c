@@ -108,7 +108,7 @@ dump_mmu ( u32 *base )
 		int i;
 
 		for ( i=0; i<MMU_LINES; i++ ) {
-			printf ( "%X:  %X %X %X %X\n",
+			printf ( "%08X:  %08X %08X %08X %08X\n",
 				base, base[0], base[1], base[2], base[3] );
 			base += 4;
 		}
@@ -121,14 +121,14 @@ gic_cpu_checker ( void )
 		unsigned long lreg;
 
 		// This only exists on aarch32
-		// printf ( "Sctlr = %X\n", read_sctlr() );
+		// printf ( "Sctlr = %08X\n", read_sctlr() );
 
 		printf ( "Current EL = %d\n", get_current_el() );
 
 		reg = read_sctlr_el1();
-		printf ( "Sctlr_el1 = %X\n", reg );
+		printf ( "Sctlr_el1 = %08X\n", reg );
 		reg = read_sctlr_el2();
-		printf ( "Sctlr_el2 = %X\n", reg );
+		printf ( "Sctlr_el2 = %08X\n", reg );
 
 		if ( reg & SCTLR_M_BIT )
 			printf ( "MMU enabled\n" );
@@ -188,26 +188,76 @@ intcon_gic_init ( void )
 		all_sgi ();
 }
 
+/* Each of the other cores calls this for itself once it is
+ * running (see smp.c), to wake up its redistributor and turn
+ * on its CPU interface.  intcon_gic_init() did core 0.
+ */
 void
 intcon_gic_cpu_init ( void )
 {
-		/* not used for v3 at present */
+		int core = intcon_core ();
+
+		if ( core <= CPU_0 )
+			return;
+
+		gicv3_rdistif_init ( core );
+		gicv3_cpuif_enable ( core );
 }
 
 void
 intcon_ena ( int irq )
 {
-		printf ( "Enable IRQ %d in GIC\n", irq );
-		gicv3_enable_interrupt ( irq, CPU_0 );
-		/* XXX what are priority values? */
-		gicv3_set_interrupt_priority ( irq, CPU_0, 3 );
-		gicv3_set_interrupt_group ( irq, CPU_0, INTR_GROUP1NS );
+		intcon_ena_cpu ( irq, CPU_0 );
+}
+
+/* SGI and PPI are per core, and live in that core's
+ * redistributor, so we have to say which one.
+ * For an SPI the core does not matter.
+ */
+void
+intcon_ena_cpu ( int irq, int cpu )
+{
+		intcon_ena_prio ( irq, cpu, IRQ_PRIO_NORMAL );
+}
+
+/* Lower priority values are more urgent.  The GIC-500 keeps
+ * 5 bits, and since we are non-secure, what we write is shifted
+ * down one and gets the top bit set, so only the top 4 bits of
+ * our value count.  An interrupt can only preempt the handler
+ * for another one if those differ.
+ * Set the group and priority before turning it on.
+ */
+void
+intcon_ena_prio ( int irq, int cpu, int prio )
+{
+		printf ( "Enable IRQ %d in GIC (core %d, priority %x)\n", irq, cpu, prio );
+		gicv3_set_interrupt_group ( irq, cpu, INTR_GROUP1NS );
+		gicv3_set_interrupt_priority ( irq, cpu, prio );
+		gicv3_enable_interrupt ( irq, cpu );
+}
+
+/* Our core number as the GIC driver counts them
+ * (0-3 are the A53 cluster, 4-5 the A72)
+ */
+int
+intcon_core ( void )
+{
+		u_register_t mpidr;
+
+		asm volatile ( "mrs %0, mpidr_el1" : "=r" (mpidr) );
+		return plat_core_pos_by_mpidr ( mpidr );
 }
 
 void
 intcon_dis ( int irq )
 {
-		gicv3_disable_interrupt ( irq, CPU_0 );
+		intcon_dis_cpu ( irq, CPU_0 );
+}
+
+void
+intcon_dis_cpu ( int irq, int cpu )
+{
+		gicv3_disable_interrupt ( irq, cpu );
 }
 
 int
@@ -227,7 +277,19 @@ intcon_irqack ( int irq )
 void
 intcon_sgi ( int sgi )
 {
-		gicv3_raise_sgi ( sgi, GICV3_G1NS, CPU_0 );
+		intcon_sgi_cpu ( sgi, intcon_core () );
+}
+
+/* Send an SGI to another core (or ourself).
+ * The ATF driver is written for EL3, in the secure world,
+ * where G1NS means writing ICC_ASGI1R (the "other" security
+ * state).  We are non-secure, so for us it is ICC_SGI1R,
+ * which is what the driver writes for G1S.
+ */
+void
+intcon_sgi_cpu ( int sgi, int cpu )
+{
+		gicv3_raise_sgi ( sgi, GICV3_G1S, smp_mpidr ( cpu ) );
 }
 
 /* ====================================================================== */
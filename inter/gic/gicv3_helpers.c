@@ -126,7 +126,7 @@ void gicv3_rdistif_base_addrs_probe(uintptr_t *rdistif_base_addrs,
 				TYPER_PROC_NUM_MASK;
 		}
 
-		printf ( "gicv3_rdistif_base_addrs_probe - proc_num, base = %d %X\n", proc_num, rdistif_base );
+		printf ( "gicv3_rdistif_base_addrs_probe - proc_num, base = %d %08X\n", proc_num, rdistif_base );
 		if (proc_num < rdistif_num) {
 			rdistif_base_addrs[proc_num] = rdistif_base;
 		}
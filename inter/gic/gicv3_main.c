@@ -1022,9 +1022,9 @@ void gicv3_enable_interrupt(unsigned int id, unsigned int proc_num)
 	assert(gicv3_driver_data->rdistif_base_addrs != NULL);
 
 	// TJT
-	printf ( "GIC enable int %d, gicd base = %X\n",
+	printf ( "GIC enable int %d, gicd base = %08X\n",
 			id, gicv3_driver_data->gicd_base );
-	printf ( "GIC enable int %d, rdist base = %X\n",
+	printf ( "GIC enable int %d, rdist base = %08X\n",
 			id, gicv3_driver_data->rdistif_base_addrs[proc_num] );
 	/* I see this:
 		Enable IRQ 113 in GIC
@@ -1051,11 +1051,11 @@ void gicv3_enable_interrupt(unsigned int id, unsigned int proc_num)
 	} else {
 		/* For SPIs: 32-1019 and ESPIs: 4096-5119 */
 		gicd_base = gicv3_get_multichip_base(id, gicv3_driver_data->gicd_base);
-		printf ( "GIC enable int %d, multichip gicd base = %X\n",
+		printf ( "GIC enable int %d, multichip gicd base = %08X\n",
 			id, gicd_base );
 		gicd_set_isenabler(gicd_base, id);
 		// TJT
-		printf ( "For SPI %d, multichip dist base = %X\n", id, gicd_base );
+		printf ( "For SPI %d, multichip dist base = %08X\n", id, gicd_base );
 	}
 }
 
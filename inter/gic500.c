@@ -212,7 +212,7 @@ gic_check ( void )
 
 		gp = (struct gic500_dist *) 0;
 
-		printf ( "GIC groupR = %X\n", &gp->group );
+		printf ( "GIC groupR = %08X\n", &gp->group );
 }
 
 void
@@ -220,9 +220,9 @@ gic_init ( void )
 {
 		struct gic500_dist *gp = (struct gic500_dist *) GICD_BASE;
 
-		printf ( "GIC distributor type = %X\n", gp->type );
-		printf ( "GIC distributor type2 = %X\n", gp->type2 );
-		printf ( "GIC distributor iid = %X\n", gp->type2 );
+		printf ( "GIC distributor type = %08X\n", gp->type );
+		printf ( "GIC distributor type2 = %08X\n", gp->type2 );
+		printf ( "GIC distributor iid = %08X\n", gp->type2 );
 
 		gic_check ();
 }
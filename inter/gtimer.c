@@ -0,0 +1,200 @@
+/* gtimer.c
+ *
+ * The ARM generic timer, for the RK3399
+ *
+ * Every core has its own set of timers in system registers,
+ * all comparing against the one system count (cntpct_el0),
+ * and each one interrupts only its own core through a PPI
+ * in that core's redistributor.  No MMIO, nothing shared with
+ * the other cores, and the count is the same on all of them,
+ * so it makes a good timestamp too.
+ *
+ * Which timer we use depends on where we run:
+ *
+ *   EL1  - CNTP (cntp_ctl_el0, cntp_cval_el0), PPI 14 (irq 30)
+ *          start.S sets cnthctl_el2 so EL1 may use it.
+ *   EL2  - CNTHP (cnthp_ctl_el2, cnthp_cval_el2), PPI 10 (irq 26)
+ *
+ * We use the compare value (cval) rather than tval, and move it
+ * ahead by exactly one period each tick, so the tick never drifts
+ * no matter how late the handler runs.
+ *
+ * cntfrq_el0 is set by the boot firmware (24 Mhz on the RK3399).
+ */
+
+#include "protos.h"
+#include "rk3399_ints.h"
+#include "trace.h"
+
+typedef unsigned long u64;
+
+#define BIT(x)	(1<<(x))
+
+#define CTL_ENABLE	BIT(0)
+#define CTL_IMASK	BIT(1)
+#define CTL_ISTATUS	BIT(2)
+
+#define DEFAULT_FREQ	24000000
+
+#define MAX_CORES	6
+
+struct gtimer_core {
+	u64	interval;
+	u64	ticks;
+	void	(*func) ( int );
+};
+
+static struct gtimer_core gtimer_cores[MAX_CORES];
+
+static int use_hyp;
+static u64 freq;
+
+static inline unsigned int
+get_el ( void )
+{
+	u64 val;
+
+	asm volatile ( "mrs %0, CurrentEL" : "=r" (val) );
+	return (val >> 2) & 3;
+}
+
+static inline void
+set_ctl ( u64 val )
+{
+	if ( use_hyp )
+	    asm volatile ( "msr cnthp_ctl_el2, %0" : : "r" (val) );
+	else
+	    asm volatile ( "msr cntp_ctl_el0, %0" : : "r" (val) );
+	asm volatile ( "isb" );
+}
+
+static inline u64
+get_cval ( void )
+{
+	u64 val;
+
+	if ( use_hyp )
+	    asm volatile ( "mrs %0, cnthp_cval_el2" : "=r" (val) );
+	else
+	    asm volatile ( "mrs %0, cntp_cval_el0" : "=r" (val) );
+	return val;
+}
+
+static inline void
+set_cval ( u64 val )
+{
+	if ( use_hyp )
+	    asm volatile ( "msr cnthp_cval_el2, %0" : : "r" (val) );
+	else
+	    asm volatile ( "msr cntp_cval_el0, %0" : : "r" (val) );
+}
+
+/* The isb keeps the read from being done early */
+u64
+gtimer_count ( void )
+{
+	u64 val;
+
+	asm volatile ( "isb; mrs %0, cntpct_el0" : "=r" (val) : : "memory" );
+	return val;
+}
+
+u64
+gtimer_freq ( void )
+{
+	return freq;
+}
+
+/* Counts to nanoseconds, without overflow for a few years */
+u64
+gtimer_ns ( u64 count )
+{
+	return (count / freq) * 1000000000UL + (count % freq) * 1000000000UL / freq;
+}
+
+int
+gtimer_irq ( void )
+{
+	return use_hyp ? IRQ_CNTHP : IRQ_CNTP;
+}
+
+u64
+gtimer_ticks ( int core )
+{
+	if ( core < 0 || core >= MAX_CORES )
+	    return 0;
+	return gtimer_cores[core].ticks;
+}
+
+/* Each core calls this for itself */
+void
+gtimer_init ( void )
+{
+	asm volatile ( "mrs %0, cntfrq_el0" : "=r" (freq) );
+	if ( freq == 0 )
+	    freq = DEFAULT_FREQ;
+
+	use_hyp = get_el () == 2;
+
+	set_ctl ( CTL_IMASK );
+	/* short and regular, so it may preempt the others */
+	irq_request ( gtimer_irq (), gtimer_handler, 0, IRQ_PRIO_HIGH );
+
+	printf ( "Generic timer: %s, %lu Hz, irq %d\n",
+	    use_hyp ? "cnthp" : "cntp", freq, gtimer_irq () );
+}
+
+/* Tick this core hz times a second, calling func (if any)
+ * with the core number each time.
+ */
+void
+gtimer_start ( int hz, void (*func) ( int ) )
+{
+	struct gtimer_core *gp;
+	int core = intcon_core ();
+
+	if ( core < 0 || core >= MAX_CORES || hz <= 0 )
+	    return;
+
+	gp = &gtimer_cores[core];
+	gp->interval = freq / hz;
+	gp->func = func;
+
+	set_cval ( gtimer_count () + gp->interval );
+	set_ctl ( CTL_ENABLE );
+}
+
+void
+gtimer_stop ( void )
+{
+	set_ctl ( 0 );
+}
+
+/* The interrupt stays asserted as long as the count is past cval,
+ * so moving cval ahead is what clears it.
+ */
+void
+gtimer_handler ( void *arg )
+{
+	struct gtimer_core *gp;
+	int core = intcon_core ();
+	u64 cval, now;
+
+	if ( core < 0 || core >= MAX_CORES || ! gtimer_cores[core].interval ) {
+	    set_ctl ( CTL_IMASK );
+	    return;
+	}
+	gp = &gtimer_cores[core];
+
+	cval = get_cval () + gp->interval;
+	now = gtimer_count ();
+	if ( cval <= now )
+	    cval += ((now - cval) / gp->interval + 1) * gp->interval;
+	set_cval ( cval );
+
+	gp->ticks++;
+	if ( gp->func )
+	    (*gp->func) ( core );
+}
+
+/* THE END */
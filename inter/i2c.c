@@ -0,0 +1,241 @@
+/* i2c.c
+ *
+ * Driver for the RK3399 I2C controller, just I2C0 in the PMU
+ * domain, which is where the PMIC and the CPU regulators are.
+ *
+ * The controller does whole transfers by itself.  We give it the
+ * chip address and register, and up to 32 bytes go through its
+ * TXDATA/RXDATA registers.  For a read it sends the address and
+ * register, a repeated start, and the address again for reading
+ * ("register" mode).  There is no DMA, and we poll the pending
+ * bits rather than take interrupts (this is how U-Boot does it).
+ *
+ * See chapter 24 of part 2 of the TRM, and the U-Boot and linux
+ * rk3x drivers.
+ */
+
+#include "protos.h"
+#include "clk.h"
+
+typedef volatile unsigned int vu32;
+typedef unsigned int u32;
+typedef unsigned long u64;
+
+#define BIT(x)	(1<<(x))
+
+struct rk_i2c {
+	vu32	con;		/* 00 */
+	vu32	clkdiv;		/* 04 */
+	vu32	mrxaddr;	/* 08 */
+	vu32	mrxraddr;	/* 0c */
+	vu32	mtxcnt;		/* 10 */
+	vu32	mrxcnt;		/* 14 */
+	vu32	ien;		/* 18 */
+	vu32	ipd;		/* 1c */
+	vu32	fcnt;		/* 20 */
+	int	_pad0[55];
+	vu32	txdata[8];	/* 100 */
+	int	_pad1[56];
+	vu32	rxdata[8];	/* 200 */
+};
+
+#define I2C0_BASE	((struct rk_i2c *) 0xff3c0000)
+
+#define CON_EN		BIT(0)
+#define CON_MOD_TX	(0<<1)
+#define CON_MOD_TRX	(1<<1)	/* register, restart, read */
+#define CON_START	BIT(3)
+#define CON_STOP	BIT(4)
+#define CON_LASTACK	BIT(5)	/* nak the last byte we read */
+#define CON_ACTACK	BIT(6)	/* stop if the chip naks */
+
+#define ADDR_VALID	BIT(24)
+
+#define IPD_MBTF	BIT(2)	/* we sent it all */
+#define IPD_MBRF	BIT(3)	/* we got it all */
+#define IPD_START	BIT(4)
+#define IPD_STOP	BIT(5)
+#define IPD_NAK		BIT(6)
+#define IPD_ALL		0x7f
+
+#define I2C_FIFO	32
+
+/* About 100 Mhz from PPLL, and 100 Khz on the bus is plenty */
+#define I2C_CLK_HZ	100000000
+#define I2C_SCL_HZ	100000
+
+/* Per step, a byte at 100 Khz is 90 us */
+#define I2C_TIMEOUT_US	10000
+
+static int i2c_errors;
+
+static int
+i2c_wait ( struct rk_i2c *ip, u32 bit )
+{
+	u64 end = deadline_us ( I2C_TIMEOUT_US );
+
+	while ( ! (ip->ipd & bit) ) {
+	    if ( ip->ipd & IPD_NAK )
+		return -1;
+	    if ( deadline_passed ( end ) )
+		return -1;
+	}
+	ip->ipd = bit;
+	return 0;
+}
+
+static int
+i2c_start ( struct rk_i2c *ip )
+{
+	ip->ipd = IPD_ALL;
+	ip->con = CON_EN | CON_START;
+	return i2c_wait ( ip, IPD_START );
+}
+
+/* Always send a stop, even after an error, so the bus is free */
+static void
+i2c_stop ( struct rk_i2c *ip )
+{
+	ip->ipd = IPD_ALL;
+	ip->con = CON_EN | CON_STOP;
+	i2c_wait ( ip, IPD_STOP );
+	ip->con = 0;
+}
+
+static int
+i2c_fail ( struct rk_i2c *ip )
+{
+	i2c_stop ( ip );
+	i2c_errors++;
+	return -1;
+}
+
+/* Read n bytes starting at a register.
+ * Returns -1 for a nak or a timeout.
+ */
+int
+i2c_read ( int chip, int reg, unsigned char *buf, int n )
+{
+	struct rk_i2c *ip = I2C0_BASE;
+	u32 word;
+	int i;
+
+	if ( n <= 0 || n > I2C_FIFO )
+	    return -1;
+
+	ip->mrxaddr = ADDR_VALID | (chip << 1) | 1;
+	ip->mrxraddr = ADDR_VALID | reg;
+
+	if ( i2c_start ( ip ) < 0 )
+	    return i2c_fail ( ip );
+
+	ip->con = CON_EN | CON_MOD_TRX | CON_LASTACK | CON_ACTACK;
+	ip->mrxcnt = n;
+	if ( i2c_wait ( ip, IPD_MBRF ) < 0 )
+	    return i2c_fail ( ip );
+
+	for ( i=0; i<n; i++ ) {
+	    if ( (i & 3) == 0 )
+		word = ip->rxdata[i/4];
+	    buf[i] = word >> (8 * (i & 3));
+	}
+
+	i2c_stop ( ip );
+	return 0;
+}
+
+/* Write n bytes starting at a register.
+ * The chip address and register go in the FIFO too.
+ */
+int
+i2c_write ( int chip, int reg, unsigned char *buf, int n )
+{
+	struct rk_i2c *ip = I2C0_BASE;
+	unsigned char out[I2C_FIFO];
+	u32 word;
+	int i;
+
+	if ( n < 0 || n > I2C_FIFO - 2 )
+	    return -1;
+
+	out[0] = chip << 1;
+	out[1] = reg;
+	for ( i=0; i<n; i++ )
+	    out[i+2] = buf[i];
+	n += 2;
+
+	if ( i2c_start ( ip ) < 0 )
+	    return i2c_fail ( ip );
+
+	ip->con = CON_EN | CON_MOD_TX | CON_ACTACK;
+	for ( i=0; i<n; i += 4 ) {
+	    word = out[i];
+	    if ( i+1 < n ) word |= out[i+1] << 8;
+	    if ( i+2 < n ) word |= out[i+2] << 16;
+	    if ( i+3 < n ) word |= (u32) out[i+3] << 24;
+	    ip->txdata[i/4] = word;
+	}
+	ip->mtxcnt = n;
+	if ( i2c_wait ( ip, IPD_MBTF ) < 0 )
+	    return i2c_fail ( ip );
+
+	i2c_stop ( ip );
+	return 0;
+}
+
+/* One byte registers are all the PMIC has */
+int
+i2c_read_reg ( int chip, int reg )
+{
+	unsigned char val;
+
+	if ( i2c_read ( chip, reg, &val, 1 ) < 0 )
+	    return -1;
+	return val;
+}
+
+int
+i2c_write_reg ( int chip, int reg, int val )
+{
+	unsigned char byte = val;
+
+	return i2c_write ( chip, reg, &byte, 1 );
+}
+
+int
+i2c_error_count ( void )
+{
+	return i2c_errors;
+}
+
+/* SCL is the clock / 8 / (divl + divh), with the
+ * low time a bit longer than the high time.
+ */
+void
+i2c_init ( void )
+{
+	struct rk_i2c *ip = I2C0_BASE;
+	u64 rate;
+	u32 div, divl, divh;
+
+	clk_set_rate ( CLK_I2C0, I2C_CLK_HZ );
+	clk_enable ( CLK_I2C0 );
+	rate = clk_get_rate ( CLK_I2C0 );
+
+	div = (rate + 8 * I2C_SCL_HZ - 1) / (8 * I2C_SCL_HZ);
+	divh = div * 3 / 7;
+	divl = div - divh;
+
+	ip->con = 0;
+	ip->ipd = IPD_ALL;
+
+	/* The pending bits only show up if enabled here.
+	 * It is never enabled in the GIC, so we just poll.
+	 */
+	ip->ien = IPD_ALL;
+	ip->clkdiv = ((divh - 1) << 16) | (divl - 1);
+
+	printf ( "I2C0: %lu Hz clock, divl %d divh %d\n", rate, divl, divh );
+}
+
+/* THE END */
@@ -0,0 +1,236 @@
+/* irq.c
+ *
+ * Interrupt dispatch.
+ *
+ * Drivers hook their interrupt with irq_request(), giving a
+ * function, an argument for it and a priority.  That sets up the
+ * GIC and puts the function in a table indexed by INTID, so taking
+ * an interrupt is an ack, a table lookup, a call and an EOI.
+ *
+ * We talk to the CPU interface through the system registers:
+ * reading ICC_IAR1_EL1 acks the highest priority pending interrupt
+ * and writing its INTID to ICC_EOIR1_EL1 finishes it.  After one is
+ * done we read IAR1 again, and keep going until it says 1023
+ * (nothing pending), so a burst costs one trip through the vector.
+ *
+ * Handlers run with interrupts enabled.  After the ack, the GIC
+ * only signals interrupts of higher priority (lower value) than
+ * the one being handled, so a fast, urgent interrupt (like the
+ * generic timer tick) can get in while a slow one (like the uart)
+ * is being handled, and nothing interrupts itself.  The vector
+ * saves the registers, we save ELR and SPSR (which the next
+ * interrupt would overwrite) before unmasking.  Depending on how
+ * we were started that is EL1 or EL2, so we look at CurrentEL.
+ *
+ * Every core comes through here.  The table is shared (an SGI or
+ * PPI has the same handler on each core that uses it), the nesting
+ * depth is kept for each core, and the counts are added atomically.
+ *
+ * handle_irq() used to be in main.c and was a chain of if/else.
+ */
+
+#include "protos.h"
+#include "trace.h"
+
+typedef unsigned int u32;
+typedef unsigned long u64;
+
+#define ICC_PMR		"S3_0_C4_C6_0"
+#define ICC_IAR1	"S3_0_C12_C12_0"
+#define ICC_EOIR1	"S3_0_C12_C12_1"
+#define ICC_BPR1	"S3_0_C12_C12_3"
+#define ICC_IGRPEN1	"S3_0_C12_C12_7"
+
+/* 1020 to 1023 are special, 1023 means nothing is pending */
+#define INTID_SPECIAL	1020
+#define INTID_MASK	0xffffff
+
+/* SGIs and PPIs are per core */
+#define FIRST_SPI	32
+
+struct irq_action {
+	irq_handler	func;
+	void		*arg;
+	int		prio;
+	u32		count;
+};
+
+static struct irq_action actions[IRQ_MAX];
+
+static u32 n_entries;
+static u32 n_unhandled;
+static u32 n_spurious;
+static int max_burst;
+static int depth[NUM_CORES];
+static int max_depth;
+
+static int at_el2;
+
+static inline u32
+read_iar ( void )
+{
+	u64 val;
+
+	asm volatile ( "mrs %0, " ICC_IAR1 : "=r" (val) );
+	return val & INTID_MASK;
+}
+
+static inline void
+write_eoi ( u32 intid )
+{
+	u64 val = intid;
+
+	asm volatile ( "msr " ICC_EOIR1 ", %0" : : "r" (val) );
+}
+
+/* Called from the vector, with interrupts masked.
+ * entry is the generic timer count the vector read on the way in,
+ * irqstat.c keeps track of how long we take from there.
+ */
+void
+handle_irq ( unsigned long entry )
+{
+	struct irq_action *ap;
+	u64 elr, spsr, ack;
+	u32 intid;
+	int burst = 0;
+	int core = intcon_core ();
+
+	__atomic_fetch_add ( &n_entries, 1, __ATOMIC_RELAXED );
+	irqstat_entry ( entry );
+
+	for ( ;; ) {
+	    intid = read_iar ();
+	    if ( intid >= INTID_SPECIAL )
+		break;
+	    ack = irqstat_now ();
+	    burst++;
+
+	    ap = intid < IRQ_MAX ? &actions[intid] : 0;
+	    if ( ap && ap->func ) {
+		__atomic_fetch_add ( &ap->count, 1, __ATOMIC_RELAXED );
+		if ( ++depth[core] > max_depth )
+		    max_depth = depth[core];
+
+		if ( at_el2 ) {
+		    asm volatile ( "mrs %0, elr_el2" : "=r" (elr) );
+		    asm volatile ( "mrs %0, spsr_el2" : "=r" (spsr) );
+		} else {
+		    asm volatile ( "mrs %0, elr_el1" : "=r" (elr) );
+		    asm volatile ( "mrs %0, spsr_el1" : "=r" (spsr) );
+		}
+		asm volatile ( "msr DAIFClr, #2" );
+
+		(*ap->func) ( ap->arg );
+
+		asm volatile ( "msr DAIFSet, #2" );
+		if ( at_el2 ) {
+		    asm volatile ( "msr elr_el2, %0" : : "r" (elr) );
+		    asm volatile ( "msr spsr_el2, %0" : : "r" (spsr) );
+		} else {
+		    asm volatile ( "msr elr_el1, %0" : : "r" (elr) );
+		    asm volatile ( "msr spsr_el1, %0" : : "r" (spsr) );
+		}
+		depth[core]--;
+	    } else {
+		__atomic_fetch_add ( &n_unhandled, 1, __ATOMIC_RELAXED );
+		TRACE ( "IRQ %d with no handler\n", intid );
+	    }
+
+	    write_eoi ( intid );
+	    irqstat_irq ( intid, entry, ack, irqstat_now () );
+
+	    /* the next one in this burst was waiting since the last EOI */
+	    entry = irqstat_now ();
+	}
+
+	if ( burst == 0 )
+	    __atomic_fetch_add ( &n_spurious, 1, __ATOMIC_RELAXED );
+	if ( burst > max_burst )
+	    max_burst = burst;
+}
+
+/* Hook an interrupt, and enable it at a priority.
+ * An SGI or PPI can be requested again (with the same function)
+ * by each core that wants it, an SPI only once.
+ * Returns -1 if it is taken or out of range.
+ */
+int
+irq_request ( int intid, irq_handler func, void *arg, int prio )
+{
+	struct irq_action *ap;
+	int cpu;
+
+	if ( intid < 0 || intid >= IRQ_MAX || ! func )
+	    return -1;
+	ap = &actions[intid];
+
+	cpu = intid < FIRST_SPI ? intcon_core () : 0;
+
+	if ( ap->func && (ap->func != func || intid >= FIRST_SPI) ) {
+	    printf ( "IRQ %d is already taken\n", intid );
+	    return -1;
+	}
+
+	ap->func = func;
+	ap->arg = arg;
+	ap->prio = prio;
+	asm volatile ( "dsb sy" );
+
+	intcon_ena_prio ( intid, cpu, prio );
+	return 0;
+}
+
+void
+irq_free ( int intid )
+{
+	struct irq_action *ap;
+
+	if ( intid < 0 || intid >= IRQ_MAX )
+	    return;
+	ap = &actions[intid];
+
+	intcon_dis_cpu ( intid, intid < FIRST_SPI ? intcon_core () : 0 );
+	ap->func = 0;
+	ap->arg = 0;
+}
+
+/* Each core calls this after the GIC cpu interface is on.
+ * Let every priority in, use as many bits as the GIC
+ * allows for preemption, and take group 1 interrupts
+ * (the firmware only turns that on for the boot core).
+ */
+void
+irq_init ( void )
+{
+	u64 val;
+
+	asm volatile ( "mrs %0, CurrentEL" : "=r" (val) );
+	at_el2 = ((val >> 2) & 3) == 2;
+
+	val = 0xff;
+	asm volatile ( "msr " ICC_PMR ", %0" : : "r" (val) );
+	val = 0;
+	asm volatile ( "msr " ICC_BPR1 ", %0" : : "r" (val) );
+	val = 1;
+	asm volatile ( "msr " ICC_IGRPEN1 ", %0" : : "r" (val) );
+	asm volatile ( "isb" );
+}
+
+void
+irq_show ( void )
+{
+	struct irq_action *ap;
+	int i;
+
+	printf ( "IRQ: %d entries, %d spurious, %d unhandled, burst %d, nesting %d\n",
+	    n_entries, n_spurious, n_unhandled, max_burst, max_depth );
+
+	for ( i=0; i<IRQ_MAX; i++ ) {
+	    ap = &actions[i];
+	    if ( ap->func )
+		printf ( "  IRQ %3d  prio %02x  %8d calls\n", i, ap->prio, ap->count );
+	}
+}
+
+/* THE END */
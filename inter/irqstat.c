@@ -0,0 +1,199 @@
+/* irqstat.c
+ *
+ * Interrupt latency and per interrupt statistics.
+ *
+ * The vector in start.S reads cntpct_el0 as soon as it has a
+ * register to put it in, and hands that to handle_irq() (irq.c).
+ * handle_irq() takes the time again after the ack (reading
+ * ICC_IAR1) and after the EOI, and gives all three to us.
+ * When it handles several in one go, the entry time for the
+ * next is the EOI of the one before.
+ * For each INTID we keep:
+ *
+ *   count
+ *   entry to ack  (getting through the vector to the ack)
+ *   ack to EOI    (the handler itself, and the EOI)
+ *
+ * as a total, a max and a histogram.  The timer service also tells
+ * us how late its interrupt was, from the time timer 0 was set to
+ * fire (on its own 24 Mhz clock) to the vector entry.
+ *
+ * All times are counts of the generic counter (42 ns at 24 Mhz).
+ * Histogram bucket n holds times below 2^n counts, the last one
+ * holds everything bigger.
+ *
+ * irqstat_dump() prints it all.  The counts are not atomic,
+ * this is for one core taking interrupts at a time.
+ */
+
+#include "protos.h"
+
+typedef unsigned int u32;
+typedef unsigned long u64;
+
+#define IRQ_STAT_MAX	192	/* the RK3399 has 182 */
+#define HIST_SIZE	16
+
+struct irq_stat {
+	u32	count;
+	u32	ack_max;
+	u32	run_max;
+	u64	ack_sum;
+	u64	run_sum;
+	u32	ack_hist[HIST_SIZE];
+	u32	run_hist[HIST_SIZE];
+};
+
+static struct irq_stat irq_stats[IRQ_STAT_MAX];
+static u32 n_spurious;
+
+/* timer 0 fire to vector entry */
+static u32 timer_hist[HIST_SIZE];
+static u32 timer_count;
+static u32 timer_max;
+static u64 timer_sum;
+
+/* the interrupt being handled now */
+static u64 cur_entry;
+
+static inline u64
+read_count ( void )
+{
+	u64 val;
+
+	asm volatile ( "isb; mrs %0, cntpct_el0" : "=r" (val) : : "memory" );
+	return val;
+}
+
+u64
+irqstat_now ( void )
+{
+	return read_count ();
+}
+
+static int
+bucket ( u64 t )
+{
+	int b = 0;
+
+	while ( t && b < HIST_SIZE - 1 ) {
+	    t >>= 1;
+	    b++;
+	}
+	return b;
+}
+
+void
+irqstat_reset ( void )
+{
+	char *p = (char *) irq_stats;
+	int i;
+
+	for ( i=0; i<sizeof(irq_stats); i++ )
+	    p[i] = 0;
+	for ( i=0; i<HIST_SIZE; i++ )
+	    timer_hist[i] = 0;
+	n_spurious = 0;
+	timer_count = timer_max = 0;
+	timer_sum = 0;
+}
+
+/* Called by handle_irq() once the EOI is done */
+void
+irqstat_irq ( int irq, u64 entry, u64 ack, u64 eoi )
+{
+	struct irq_stat *sp;
+	u64 t;
+
+	if ( irq < 0 || irq >= IRQ_STAT_MAX ) {
+	    n_spurious++;
+	    return;
+	}
+	sp = &irq_stats[irq];
+	sp->count++;
+
+	t = ack - entry;
+	sp->ack_sum += t;
+	if ( t > sp->ack_max )
+	    sp->ack_max = t;
+	sp->ack_hist[bucket(t)]++;
+
+	t = eoi - ack;
+	sp->run_sum += t;
+	if ( t > sp->run_max )
+	    sp->run_max = t;
+	sp->run_hist[bucket(t)]++;
+}
+
+/* handle_irq() tells us this first, so the timer can use it */
+void
+irqstat_entry ( u64 entry )
+{
+	cur_entry = entry;
+}
+
+/* From timer_handler(): how long ago (in counts) the timer fired,
+ * and what the generic counter read when it worked that out.
+ * Both run from the 24 Mhz crystal, so we can take the time since
+ * the vector entry back off to get fire to entry.
+ */
+void
+irqstat_timer ( u64 late, u64 now )
+{
+	u64 since_entry = now - cur_entry;
+	u64 t;
+
+	t = late > since_entry ? late - since_entry : 0;
+	timer_count++;
+	timer_sum += t;
+	if ( t > timer_max )
+	    timer_max = t;
+	timer_hist[bucket(t)]++;
+}
+
+static void
+show_hist ( char *what, u32 *hist )
+{
+	int i;
+
+	printf ( "      %s:", what );
+	for ( i=0; i<HIST_SIZE; i++ ) {
+	    if ( ! hist[i] )
+		continue;
+	    if ( i == HIST_SIZE - 1 )
+		printf ( " >%lu:%u", gtimer_ns ( 1UL << (i-1) ), hist[i] );
+	    else
+		printf ( " <%lu:%u", gtimer_ns ( 1UL << i ), hist[i] );
+	}
+	printf ( "\n" );
+}
+
+void
+irqstat_dump ( void )
+{
+	struct irq_stat *sp;
+	int i;
+
+	printf ( "IRQ stats (ns)      count  entry-ack avg/max    ack-eoi avg/max\n" );
+	for ( i=0; i<IRQ_STAT_MAX; i++ ) {
+	    sp = &irq_stats[i];
+	    if ( ! sp->count )
+		continue;
+	    printf ( "  irq %3d     %10u  %8lu/%-8lu  %8lu/%-8lu\n", i, sp->count,
+		gtimer_ns ( sp->ack_sum / sp->count ), gtimer_ns ( sp->ack_max ),
+		gtimer_ns ( sp->run_sum / sp->count ), gtimer_ns ( sp->run_max ) );
+	    show_hist ( "entry-ack", sp->ack_hist );
+	    show_hist ( "ack-eoi  ", sp->run_hist );
+	}
+
+	if ( timer_count ) {
+	    printf ( "  timer fire to entry %u times, avg %lu max %lu\n", timer_count,
+		gtimer_ns ( timer_sum / timer_count ), gtimer_ns ( timer_max ) );
+	    show_hist ( "fire-entry", timer_hist );
+	}
+
+	if ( n_spurious )
+	    printf ( "  spurious %u\n", n_spurious );
+}
+
+/* THE END */
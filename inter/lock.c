@@ -0,0 +1,512 @@
+/* lock.c
+ *
+ * Spin locks for more than one core.
+ *
+ * The A53 and A72 are ARMv8.0, so there are no LSE atomics (no
+ * CAS or LDADD instructions), just the exclusive monitor: LDAXR
+ * and STLXR (load-acquire and store-release exclusive) and their
+ * relatives.  The simple lock, spin on LDAXR until it is free and
+ * then try a STXR, is taslock here.  With six cores after it every
+ * waiter keeps pulling the line over, and whoever happens to have
+ * it when it is freed gets it, which across two clusters tends to
+ * be a core in the same cluster as the last owner.
+ *
+ * So, as linux did it on arm64 before queued spinlocks:
+ *
+ * ticketlock is a ticket lock.  Taking a ticket is one exclusive
+ * add to next, then we wait for owner to get to our number.  Cores
+ * get the lock in the order they asked.  While waiting, we load
+ * owner with LDAXRH, which leaves the monitor armed on that line,
+ * and WFE.  The unlock is a store to the same line, which clears
+ * the monitor of every waiter and so wakes them (SEVL before the
+ * first WFE makes that one fall through, so we look first).
+ *
+ * mcs_lock is the Mellor-Crummey and Scott queue lock.  Each
+ * waiter brings a node and waits (the same LDAXR and WFE) on its
+ * own node, and the unlock only wakes the next one in line, so a
+ * release touches one waiter's line rather than everyone's.
+ *
+ * rwlock lets any number of readers in, or one writer.  Writers
+ * can be starved by a steady stream of readers.
+ *
+ * lock_bench() runs each of them on 1 to 6 cores at once.
+ */
+
+#include "protos.h"
+#include "lock.h"
+
+typedef unsigned int u32;
+typedef unsigned long u64;
+
+#define TICKET_ONE	(1<<16)
+#define RW_WRITER	0x80000000
+
+void
+ticket_lock ( struct ticketlock *lp )
+{
+	u32 old, tmp, fail;
+
+	asm volatile (
+	"	prfm	pstl1strm, %3\n"
+	"1:	ldaxr	%w0, %3\n"
+	"	add	%w1, %w0, %w5\n"
+	"	stxr	%w2, %w1, %3\n"
+	"	cbnz	%w2, 1b\n"
+	/* our ticket (the old next) is already being served? */
+	"	eor	%w1, %w0, %w0, ror #16\n"
+	"	cbz	%w1, 3f\n"
+	"	sevl\n"
+	"2:	wfe\n"
+	"	ldaxrh	%w2, %4\n"
+	"	eor	%w1, %w2, %w0, lsr #16\n"
+	"	cbnz	%w1, 2b\n"
+	"3:"
+	: "=&r" (old), "=&r" (tmp), "=&r" (fail), "+Q" (*(u32 *) lp), "+Q" (lp->owner)
+	: "r" (TICKET_ONE)
+	: "memory" );
+}
+
+void
+ticket_unlock ( struct ticketlock *lp )
+{
+	u32 tmp;
+
+	asm volatile (
+	"	ldrh	%w1, %0\n"
+	"	add	%w1, %w1, #1\n"
+	"	stlrh	%w1, %0\n"
+	: "+Q" (lp->owner), "=&r" (tmp)
+	:
+	: "memory" );
+}
+
+/* For anything an interrupt handler might take too */
+unsigned long
+ticket_lock_irqsave ( struct ticketlock *lp )
+{
+	unsigned long flags;
+
+	asm volatile ( "mrs %0, daif" : "=r" (flags) );
+	asm volatile ( "msr DAIFSet, #3" : : : "memory" );
+	ticket_lock ( lp );
+	return flags;
+}
+
+void
+ticket_unlock_irqrestore ( struct ticketlock *lp, unsigned long flags )
+{
+	ticket_unlock ( lp );
+	asm volatile ( "msr daif, %0" : : "r" (flags) : "memory" );
+}
+
+/* ---------------------------------------------- */
+
+static inline struct mcs_node *
+xchg_acq_rel ( struct mcs_node * volatile *p, struct mcs_node *val )
+{
+	struct mcs_node *old;
+	u32 fail;
+
+	asm volatile (
+	"1:	ldaxr	%0, %2\n"
+	"	stlxr	%w1, %3, %2\n"
+	"	cbnz	%w1, 1b\n"
+	: "=&r" (old), "=&r" (fail), "+Q" (*p)
+	: "r" (val)
+	: "memory" );
+	return old;
+}
+
+/* Returns 1 if *p was old (and is now new) */
+static inline int
+cas_release ( struct mcs_node * volatile *p, struct mcs_node *old, struct mcs_node *new )
+{
+	struct mcs_node *cur;
+	u32 fail;
+
+	asm volatile (
+	"1:	ldxr	%0, %2\n"
+	"	cmp	%0, %3\n"
+	"	b.ne	2f\n"
+	"	stlxr	%w1, %4, %2\n"
+	"	cbnz	%w1, 1b\n"
+	"2:"
+	: "=&r" (cur), "=&r" (fail), "+Q" (*p)
+	: "r" (old), "r" (new)
+	: "memory", "cc" );
+	return cur == old;
+}
+
+/* Wait with the monitor armed on the line, so the store
+ * that changes it wakes us.
+ */
+static inline void
+wait_zero ( volatile u32 *p )
+{
+	u32 val;
+
+	asm volatile (
+	"	sevl\n"
+	"1:	wfe\n"
+	"	ldaxr	%w0, %1\n"
+	"	cbnz	%w0, 1b\n"
+	: "=&r" (val)
+	: "Q" (*p)
+	: "memory" );
+}
+
+static inline struct mcs_node *
+wait_next ( struct mcs_node * volatile *p )
+{
+	struct mcs_node *val;
+
+	asm volatile (
+	"	sevl\n"
+	"1:	wfe\n"
+	"	ldaxr	%0, %1\n"
+	"	cbz	%0, 1b\n"
+	: "=&r" (val)
+	: "Q" (*p)
+	: "memory" );
+	return val;
+}
+
+void
+mcs_lock ( struct mcs_lock *lp, struct mcs_node *me )
+{
+	struct mcs_node *prev;
+
+	me->next = 0;
+	me->locked = 1;
+
+	prev = xchg_acq_rel ( &lp->tail, me );
+	if ( ! prev )
+	    return;
+
+	__atomic_store_n ( &prev->next, me, __ATOMIC_RELEASE );
+	wait_zero ( &me->locked );
+}
+
+void
+mcs_unlock ( struct mcs_lock *lp, struct mcs_node *me )
+{
+	struct mcs_node *next;
+
+	next = __atomic_load_n ( &me->next, __ATOMIC_ACQUIRE );
+	if ( ! next ) {
+	    if ( cas_release ( &lp->tail, me, 0 ) )
+		return;
+	    /* someone is between the xchg and setting our next */
+	    next = wait_next ( &me->next );
+	}
+	__atomic_store_n ( &next->locked, 0, __ATOMIC_RELEASE );
+}
+
+/* ---------------------------------------------- */
+
+void
+read_lock ( struct rwlock *rw )
+{
+	u32 tmp, fail;
+
+	asm volatile (
+	"	sevl\n"
+	"1:	wfe\n"
+	"2:	ldaxr	%w0, %2\n"
+	"	add	%w0, %w0, #1\n"
+	"	tbnz	%w0, #31, 1b\n"
+	"	stxr	%w1, %w0, %2\n"
+	"	cbnz	%w1, 2b\n"
+	: "=&r" (tmp), "=&r" (fail), "+Q" (rw->lock)
+	:
+	: "memory" );
+}
+
+void
+read_unlock ( struct rwlock *rw )
+{
+	u32 tmp, fail;
+
+	asm volatile (
+	"1:	ldxr	%w0, %2\n"
+	"	sub	%w0, %w0, #1\n"
+	"	stlxr	%w1, %w0, %2\n"
+	"	cbnz	%w1, 1b\n"
+	: "=&r" (tmp), "=&r" (fail), "+Q" (rw->lock)
+	:
+	: "memory" );
+}
+
+void
+write_lock ( struct rwlock *rw )
+{
+	u32 tmp;
+
+	asm volatile (
+	"	sevl\n"
+	"1:	wfe\n"
+	"2:	ldaxr	%w0, %1\n"
+	"	cbnz	%w0, 1b\n"
+	"	stxr	%w0, %w2, %1\n"
+	"	cbnz	%w0, 2b\n"
+	: "=&r" (tmp), "+Q" (rw->lock)
+	: "r" (RW_WRITER)
+	: "memory" );
+}
+
+void
+write_unlock ( struct rwlock *rw )
+{
+	asm volatile ( "stlr wzr, %0" : "=Q" (rw->lock) : : "memory" );
+}
+
+/* ---------------------------------------------- */
+
+void
+tas_lock ( struct taslock *lp )
+{
+	u32 tmp, fail;
+
+	asm volatile (
+	"1:	ldaxr	%w0, %2\n"
+	"	cbnz	%w0, 1b\n"
+	"	stxr	%w1, %w3, %2\n"
+	"	cbnz	%w1, 1b\n"
+	: "=&r" (tmp), "=&r" (fail), "+Q" (lp->lock)
+	: "r" (1)
+	: "memory" );
+}
+
+void
+tas_unlock ( struct taslock *lp )
+{
+	asm volatile ( "stlr wzr, %0" : "=Q" (lp->lock) : : "memory" );
+}
+
+/* ---------------------------------------------- */
+
+/* The benchmark.
+ *
+ * For each lock and for 1 to 6 cores (in core order, so the A72s
+ * join last), every core takes the lock, bumps a shared count and
+ * touches a couple of shared lines, lets go, and waits a little
+ * outside the lock, over and over for BENCH_MS.  We time each
+ * acquire with the generic counter (41 ns a tick at 24 Mhz, so
+ * short ones are mostly rounding).
+ *
+ * Fairness is Jain's index of how many times each core got the
+ * lock: 100 means all the same, 100/n means one core got it all.
+ * The rwlock is run with 9 reads to each write.
+ */
+
+#define BENCH_MS	200
+#define START_US	1000
+#define OUTSIDE_SPINS	50
+#define READS_PER_WRITE	9
+
+#define LOCK_TAS	0
+#define LOCK_TICKET	1
+#define LOCK_MCS	2
+#define LOCK_RW		3
+#define NUM_LOCKS	4
+
+static char *lock_names[] = { "tas", "ticket", "mcs", "rwlock" };
+
+struct lock_result {
+	u64	acquires;
+	u64	wait;		/* counts spent acquiring */
+	u64	max_wait;
+} __attribute__ ((aligned(LOCK_LINE)));
+
+static struct lock_result results[NUM_CORES];
+
+static struct taslock b_tas;
+static struct ticketlock b_ticket;
+static struct mcs_lock b_mcs;
+static struct rwlock b_rw;
+static struct mcs_node b_nodes[NUM_CORES];
+
+static volatile u64 shared[2 * LOCK_LINE / sizeof(u64)] __attribute__ ((aligned(LOCK_LINE)));
+
+static int which_lock;
+static u64 start_at;
+static u64 stop_at;
+
+static inline u64
+count ( void )
+{
+	u64 val;
+
+	asm volatile ( "isb; mrs %0, cntpct_el0" : "=r" (val) : : "memory" );
+	return val;
+}
+
+static void
+bench_core ( void *arg )
+{
+	int core = intcon_core ();
+	struct lock_result *rp = &results[core];
+	struct mcs_node *node = &b_nodes[core];
+	u64 t0, t1, n = 0;
+	int i, read;
+
+	while ( count () < start_at )
+	    ;
+
+	while ( (t0 = count ()) < stop_at ) {
+	    read = which_lock == LOCK_RW && (n % (READS_PER_WRITE + 1)) != 0;
+
+	    switch ( which_lock ) {
+	    case LOCK_TAS:
+		tas_lock ( &b_tas );
+		break;
+	    case LOCK_TICKET:
+		ticket_lock ( &b_ticket );
+		break;
+	    case LOCK_MCS:
+		mcs_lock ( &b_mcs, node );
+		break;
+	    case LOCK_RW:
+		if ( read )
+		    read_lock ( &b_rw );
+		else
+		    write_lock ( &b_rw );
+		break;
+	    }
+	    t1 = count ();
+
+	    if ( read )
+		(void) shared[0];
+	    else {
+		shared[0]++;
+		shared[LOCK_LINE / sizeof(u64)]++;
+	    }
+
+	    switch ( which_lock ) {
+	    case LOCK_TAS:
+		tas_unlock ( &b_tas );
+		break;
+	    case LOCK_TICKET:
+		ticket_unlock ( &b_ticket );
+		break;
+	    case LOCK_MCS:
+		mcs_unlock ( &b_mcs, node );
+		break;
+	    case LOCK_RW:
+		if ( read )
+		    read_unlock ( &b_rw );
+		else
+		    write_unlock ( &b_rw );
+		break;
+	    }
+
+	    rp->acquires++;
+	    rp->wait += t1 - t0;
+	    if ( t1 - t0 > rp->max_wait )
+		rp->max_wait = t1 - t0;
+	    n++;
+
+	    for ( i=0; i<OUTSIDE_SPINS; i++ )
+		asm volatile ( "" );
+	}
+}
+
+/* Every core in mask runs bench_core, we are one of them */
+static void
+lock_run ( u32 mask )
+{
+	struct task_group groups[NUM_CORES];
+	struct task tasks[NUM_CORES];
+	int core, me = intcon_core ();
+
+	start_at = count () + gtimer_freq () / 1000000 * START_US;
+	stop_at = start_at + gtimer_freq () / 1000 * BENCH_MS;
+
+	for ( core = 0; core < NUM_CORES; core++ ) {
+	    if ( core == me || ! ((mask >> core) & 1) )
+		continue;
+	    task_group_init ( &groups[core] );
+	    groups[core].cpus = 1 << core;
+	    task_spawn ( &groups[core], &tasks[core], bench_core, 0 );
+	}
+
+	bench_core ( 0 );
+
+	for ( core = 0; core < NUM_CORES; core++ )
+	    if ( core != me && ((mask >> core) & 1) )
+		task_join ( &groups[core] );
+}
+
+static void
+lock_report ( int lock, u32 mask, int n )
+{
+	struct lock_result *rp;
+	u64 total = 0, sq = 0, wait = 0, max_wait = 0;
+	u64 lo = ~0UL, hi = 0, writes;
+	int core;
+
+	for ( core = 0; core < NUM_CORES; core++ ) {
+	    if ( ! ((mask >> core) & 1) )
+		continue;
+	    rp = &results[core];
+	    total += rp->acquires;
+	    sq += rp->acquires * rp->acquires;
+	    wait += rp->wait;
+	    if ( rp->max_wait > max_wait )
+		max_wait = rp->max_wait;
+	    if ( rp->acquires < lo )
+		lo = rp->acquires;
+	    if ( rp->acquires > hi )
+		hi = rp->acquires;
+	}
+
+	/* every write bumps shared[0], reads don't */
+	writes = lock == LOCK_RW ? 0 : total;
+	if ( lock == LOCK_RW ) {
+	    for ( core = 0; core < NUM_CORES; core++ )
+		if ( (mask >> core) & 1 )
+		    writes += (results[core].acquires + READS_PER_WRITE) / (READS_PER_WRITE + 1);
+	}
+
+	printf ( "  %-6s %d cores  %6lu K/s  wait %5lu ns avg %6lu ns max  fair %3lu (%lu-%lu)%s\n",
+	    lock_names[lock], n, total * 1000 / BENCH_MS / 1000,
+	    total ? gtimer_ns ( wait / total ) : 0, gtimer_ns ( max_wait ),
+	    sq ? total * total * 100 / (n * sq) : 0, lo, hi,
+	    shared[0] == writes ? "" : "  COUNT WRONG" );
+}
+
+/* Run this on core 0, with the other cores in sched_worker() */
+void
+lock_bench ( void )
+{
+	int lock, n, core, i;
+	u32 mask;
+
+	if ( intcon_core () != 0 )
+	    return;
+
+	printf ( "LOCK bench, %d ms each\n", BENCH_MS );
+	for ( lock = 0; lock < NUM_LOCKS; lock++ ) {
+	    mask = 0;
+	    n = 0;
+	    for ( core = 0; core < NUM_CORES; core++ ) {
+		if ( core && ! smp_core_up ( core ) )
+		    continue;
+		mask |= 1 << core;
+		n++;
+
+		for ( i=0; i<NUM_CORES; i++ ) {
+		    results[i].acquires = 0;
+		    results[i].wait = 0;
+		    results[i].max_wait = 0;
+		}
+		shared[0] = 0;
+		which_lock = lock;
+
+		lock_run ( mask );
+		lock_report ( lock, mask, n );
+	    }
+	}
+}
+
+/* THE END */
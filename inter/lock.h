@@ -0,0 +1,59 @@
+/* lock.h
+ *
+ * Spin locks that hold up with all six cores after them
+ * (see lock.c).  All of them start out unlocked as zeros.
+ * spin_lock() and struct spinlock are the ATF ones in gic/,
+ * so ours have other names.
+ */
+
+#define LOCK_LINE	64
+
+/* Ticket lock, first come first served.
+ * owner is the ticket being served, next the next one to give out.
+ */
+struct ticketlock {
+	volatile unsigned short	owner;
+	volatile unsigned short	next;
+};
+
+/* MCS queue lock, each waiter spins on its own node */
+struct mcs_node {
+	struct mcs_node * volatile	next;
+	volatile unsigned int		locked;
+} __attribute__ ((aligned(LOCK_LINE)));
+
+struct mcs_lock {
+	struct mcs_node * volatile	tail;
+};
+
+/* Readers and writers, bit 31 is the writer,
+ * the rest is how many readers there are.
+ */
+struct rwlock {
+	volatile unsigned int	lock;
+};
+
+/* The simple one, just for comparing */
+struct taslock {
+	volatile unsigned int	lock;
+};
+
+void ticket_lock ( struct ticketlock * );
+void ticket_unlock ( struct ticketlock * );
+unsigned long ticket_lock_irqsave ( struct ticketlock * );
+void ticket_unlock_irqrestore ( struct ticketlock *, unsigned long );
+
+void mcs_lock ( struct mcs_lock *, struct mcs_node * );
+void mcs_unlock ( struct mcs_lock *, struct mcs_node * );
+
+void read_lock ( struct rwlock * );
+void read_unlock ( struct rwlock * );
+void write_lock ( struct rwlock * );
+void write_unlock ( struct rwlock * );
+
+void tas_lock ( struct taslock * );
+void tas_unlock ( struct taslock * );
+
+void lock_bench ( void );
+
+/* THE END */
@@ -13,31 +13,55 @@
  */
 
 #include "protos.h"
+#include "rk3399_ints.h"
+#include "trace.h"
+#include "pll.h"
+#include "msgq.h"
+#include "lock.h"
+
+/* Pieces of the delay, between them the main loop
+ * does what interrupt handlers left for it.
+ */
+#define DELAY_STEPS	20
 
-/* This might give about a 1 second delay */
+/* One second, whatever the CPU clock is doing */
 void
 delay ( void )
 {
-        volatile int count = 100000000;
-
-		/* Adjust for when we change the CPU
-		 * from 600 to 100 Mhz.
-		 */
-		count /= 6;
+	int i;
 
-        while ( count-- )
-            ;
+	for ( i=0; i<DELAY_STEPS; i++ ) {
+	    mdelay ( 1000 / DELAY_STEPS );
+	    dvfs_poll ();
+	}
 }
 
+/* Show the interrupt and DVFS statistics every so many blinks
+ * (each one is 2 seconds)
+ */
+#define IRQSTAT_EVERY	15
+
 void
 blinker ( void )
 {
+	int count;
+
 	/* Setting the bit does turn the LED on */
-	for ( ;; ) {
+	for ( count = 1; ; count++ ) {
 	    led_on ();
 	    delay ();
 	    led_off ();
 	    delay ();
+
+	    /* send out what the interrupt handlers logged */
+	    trace_drain ();
+
+	    if ( count % IRQSTAT_EVERY == 0 ) {
+		irqstat_dump ();
+		irq_show ();
+		dvfs_dump ();
+		sched_show ();
+	    }
 	}
 }
 
@@ -57,9 +81,9 @@ examine ( long addr )
 	int *ip = (int *) addr;
 	int val;
 
-	printf ( "Examine %h\n", addr );
+	printf ( "Examine %08X\n", addr );
 	val = *ip;
-	printf ( " value = %h\n", val );
+	printf ( " value = %08X\n", val );
 }
 
 static inline unsigned int
@@ -78,12 +102,12 @@ check_shift(void)
         unsigned int x, y;
 
 	x = 0xabc0;
-	printf ( "Shift input: %h\n", x );
+	printf ( "Shift input: %08X\n", x );
         // asm volatile("mrs %0, CurrentEL" : "=r" (val) : : "cc");
 	// asm volatile ( "lsr     w1, w6, #0" : : : "cc" );
 	// asm("mov %0, %1, ror #1" : "=r" (result) : "r" (value));
 	asm volatile ( "lsr     %0, %1, #0" : "=r" (y) : "r" (x) : "cc" );
-	printf ( "Shift result: %h\n", y );
+	printf ( "Shift result: %08X\n", y );
 }
 
 /* These only go inline with gcc -O of some kind */
@@ -137,6 +161,60 @@ try_syscall ( int a, int b )
         asm volatile("svc #0x123" );
 }
 
+#ifdef DMA_TEST
+/* Send a couple of buffers by DMA and see if the
+ * CPU really is free while they go.
+ */
+static char dma_line[] = "The quick brown fox jumps over the lazy dog 0123456789\r\n";
+static char dma_big[4096];
+
+void
+dma_test ( void )
+{
+	struct dma_seg segs[3];
+	int i, spins;
+
+	for ( i=0; i<sizeof(dma_big); i++ )
+	    dma_big[i] = (i % 64) == 63 ? '\n' : 'A' + (i / 64) % 26;
+
+	segs[0].buf = dma_line;
+	segs[0].len = sizeof(dma_line) - 1;
+	segs[1].buf = dma_big;
+	segs[1].len = sizeof(dma_big);
+	segs[2].buf = dma_line;
+	segs[2].len = sizeof(dma_line) - 1;
+
+	if ( uart_dma_write ( segs, 3 ) < 0 ) {
+	    printf ( "DMA write failed\n" );
+	    return;
+	}
+
+	spins = 0;
+	while ( uart_dma_busy () )
+	    spins++;
+	printf ( "DMA done, %d spins while it ran\n", spins );
+}
+#endif
+
+/* Once a second from the generic timer, on each core that starts it */
+static void
+gtick ( int core )
+{
+	TRACE ( "gtimer tick %d on core %d\n", (int) gtimer_ticks ( core ), core );
+}
+
+/* Each of the other cores runs this once it is up,
+ * and then waits for work from the scheduler.
+ */
+static void
+core_main ( int core )
+{
+	gtimer_init ();
+	gtimer_start ( 1, gtick );
+	msgq_core_init ();
+	sched_worker ( core );
+}
+
 #ifdef BSS_TEST
 int zero;
 int pickle = 12399;
@@ -151,11 +229,15 @@ main ( void )
 
 	uart_init ();
 	gpio_init ();
+	delay_init ();
 
 	printf ( "\n" );
 	// printf ( "Inter demo for RK3399  1-3-2022\n" );
 	printf ( "Inter demo for RK3399  12-10-2025\n" );
 
+	/* The other cores can only share memory with us cached */
+	cache_on ();
+
 #ifdef BSS_TEST
 	/* See if global variables get initialized
 	 * as they should.
@@ -169,13 +251,27 @@ main ( void )
 	 */
 #endif
 
-	/* Drop the CPU clock from 600 to 100 Mhz
-	 * to reduce how hot the chip gets.
-	 * This had no noticeable effect.
-	 * This chip just runs hot.
+	/* Find the CPU rails, so the clocks can go
+	 * faster than the boot voltages allow.
+	 */
+	pmic_init ();
+
+	/* Dropping the CPU clock from 600 to 100 Mhz
+	 * had no noticeable effect on how hot the chip gets,
+	 * it just runs hot.  Now dvfs.c manages the clocks,
+	 * this just keeps things slow until it starts.
 	 */
-	printf ( "Reduce CPU clock to 100 Mhz\n" );
+#ifdef FULL_SPEED
+	/* The boot voltages are not enough for this */
+	printf ( "CPU clocks to 1416 and 1800 Mhz\n" );
+	if ( pmic_set_uv ( RAIL_CPU_L, 1125000 ) == 0 )
+	    cpu_clock_set ( CLUSTER_L, 1416000000 );
+	if ( pmic_set_uv ( RAIL_CPU_B, 1200000 ) == 0 )
+	    cpu_clock_set ( CLUSTER_B, 1800000000 );
+#else
+	printf ( "CPU clock to 100 Mhz until DVFS starts\n" );
 	cpu_clock_100 ();
+#endif
 
 	/* Added 12-6-2025 */
 	printf ( "Fixing HCR so EL2 gets interrupts\n" );
@@ -183,13 +279,35 @@ main ( void )
 
 	intcon_gic_init ();
 	intcon_gic_cpu_init ();
+	irq_init ();
+
+	trace_init ();
+
+	/* From here on, printf just fills a buffer */
+	uart_irq_init ();
+	dma_init ();
 
 	timer_init ();
 
+	gtimer_init ();
+	gtimer_start ( 1, gtick );
+
+	/* Now run as fast as the temperature lets us */
+	tsadc_init ();
+	tsadc_show ();
+	dvfs_init ();
+
 	printf ( "Enable interrupts\n" );
 	// INT_unlock ();
 	enable_irq ();
 
+	/* Now the other five */
+	sched_init ();
+	topo_core_init ( intcon_core () );
+	msgq_core_init ();
+	smp_start ( core_main );
+	topo_show ();
+
 	/* This will check the stack address */
 	// show_stack ( 1 );
 
@@ -216,14 +334,14 @@ main ( void )
 	// running at EL3.
 	// (Actually BL31 is running as a secure monitor
 	//  at EL3).
-	printf ( "Current EL: %h\n", get_el() );
+	printf ( "Current EL: %08X\n", get_el() );
 
 	asm volatile("mrs %0, mpidr_el1" : "=r" (lval) : : "cc");
-	printf ( "MPidr_el1 = %Y\n", lval );
+	printf ( "MPidr_el1 = %016lX\n", lval );
 
 	// No such register (there is a vmpidr_el2)
 	// asm volatile("mrs %0, mpidr_el2" : "=r" (lval) : : "cc");
-	// printf ( "MPidr_el2 = %Y\n", lval );
+	// printf ( "MPidr_el2 = %016lX\n", lval );
 
 	core = lval & 0xff;
 	printf ( "Core %d\n", core );
@@ -235,7 +353,7 @@ main ( void )
 	printf ( "Aff3 %x\n", aff );	/* cluster-3 */
 	aff = (lval>>16) & 0xff;
 	printf ( "Aff2 %x\n", aff );	/* cluster-2 */
-	aff = (lval>>16) & 0xff;
+	aff = (lval>>8) & 0xff;
 	printf ( "Aff1 %x\n", aff );	/* cluster-1 */
 	aff = lval & 0xff;
 	printf ( "Aff0 %x\n", aff );	/* core/cpu */
@@ -250,6 +368,26 @@ main ( void )
 
 	// check_shift ();
 
+#ifdef DMA_TEST
+	dma_test ();
+#endif
+
+#ifdef BENCH_TEST
+	bench_all ();
+#endif
+
+#ifdef SCHED_TEST
+	sched_demo ();
+#endif
+
+#ifdef MSGQ_TEST
+	msgq_bench ();
+#endif
+
+#ifdef LOCK_TEST
+	lock_bench ();
+#endif
+
 #ifdef notdef
 	for ( ;; ) {
 	    // timer_show ();
@@ -273,27 +411,19 @@ main ( void )
  */
 
 void
-handle_irq ( void )
-{
-	int irq;
-
-	printf ( "IRQ interrupt\n" );
-	irq = intcon_irqwho ();
-	printf ( "IRQ Interrupt for IRQ %d\n", irq );
-
-	intcon_irqack ( irq );
-}
-
-void
-handle_fiq ( void )
+handle_fiq ( unsigned long entry )
 {
+	unsigned long ack;
 	int irq;
 
+	irqstat_entry ( entry );
 	printf ( "FIQ interrupt\n" );
 	irq = intcon_irqwho ();
+	ack = irqstat_now ();
 	printf ( "FIQ Interrupt for IRQ %d\n", irq );
 
 	intcon_irqack ( irq );
+	irqstat_irq ( irq, entry, ack, irqstat_now () );
 }
 
 /* We call this rkpanic() to avoid conflict with
@@ -302,6 +432,9 @@ handle_fiq ( void )
 void
 rkpanic ( char *msg )
 {
+	/* get out what is queued, and go polled */
+	uart_flush ();
+
 	printf ( "Panic (%s)\n", msg );
 	printf ( "spinning\n" );
 	spin ();
@@ -338,23 +471,23 @@ handle_sync ( int a, int b )
     // printf ( "Synch exception: %d %d\n", a, b );
     printf ( "Synch exceptionn\n", a, b );
 	asm volatile("mrs %0, ESR_el2" : "=r" (esr) : : "cc");
-	printf ( "ESR = %X\n", esr );
+	printf ( "ESR = %08X\n", esr );
 	ec = esr>>26 & 0x3f;
-	printf ( "ESR.EC = %X\n", ec );
+	printf ( "ESR.EC = %08X\n", ec );
 	asm volatile("mrs %0, ELR_el2" : "=r" (elr) : : "cc");
-	printf ( "ELR = %X\n", elr );
+	printf ( "ELR = %08X\n", elr );
 	if ( ec == 0x15 ) {
-		printf ( " SVC instruction: %X\n", esr & 0xffff );
+		printf ( " SVC instruction: %08X\n", esr & 0xffff );
 		printf ( " SVC args: %d %d\n", a, b );
 		return;
 	}
 
 	if ( ec == 0x20 | ec == 0x21 ) {
-		printf ( "Instruction abort: %X\n", ec );
+		printf ( "Instruction abort: %08X\n", ec );
 	} else if ( ec == 0x24 | ec == 0x25 ) {
-		printf ( "data abort: %X\n", ec );
+		printf ( "data abort: %08X\n", ec );
 	} else {
-		printf ( "unknown: %X\n", ec );
+		printf ( "unknown: %08X\n", ec );
 	}
 
 	rkpanic ( "Synch abort" );
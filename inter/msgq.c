@@ -0,0 +1,566 @@
+/* msgq.c
+ *
+ * Lock free message queues between cores, with SGI doorbells.
+ *
+ * spsc is a ring with one sender and one receiver.  The sender
+ * owns head and the receiver owns tail, and each keeps a copy of
+ * the other's index so it only has to look at the other's cache
+ * line when the ring seems full (or empty).
+ *
+ * mpsc takes any number of senders.  It is Dmitry Vyukov's
+ * bounded queue: a sender claims a cell with a CAS on head, and
+ * each cell has a sequence number that says whether it is free,
+ * or full and ready for the receiver.  A sender that has claimed
+ * a cell but not filled it yet holds up the receiver (but never
+ * the other senders).
+ *
+ * Sending never blocks: put returns -1 if the ring is full.
+ *
+ * Receiving can sleep.  When the receiver finds its queue empty,
+ * it masks IRQs, sets waiting in the doorbell, looks once more,
+ * and if it is still empty it waits in WFI.  A sender, after it puts a message
+ * in, checks waiting, and if it is set it clears it and sends the
+ * receiver an SGI.  Both sides have a full barrier between their
+ * store and their load, so one of them always sees the other:
+ * either the receiver sees the message, or the sender sees it
+ * waiting.  So there is one SGI when the queue goes from empty to
+ * not empty with the receiver asleep, and none otherwise.
+ * Batching: put several, then one kick, which is what send (put
+ * then kick) does for one message.
+ *
+ * The SGI does nothing itself, it just ends the WFI.  Each core
+ * that receives calls msgq_core_init() to take it.
+ *
+ * msgq_bench() measures latency and throughput between every
+ * pair of cores that are up, with the work run as pinned tasks
+ * by sched.c.
+ */
+
+#include "protos.h"
+#include "msgq.h"
+
+typedef unsigned int u32;
+typedef unsigned long u64;
+
+#define SPSC_MASK	(SPSC_SIZE-1)
+#define MPSC_MASK	(MPSC_SIZE-1)
+
+#define SGI_DOORBELL	1
+
+static u32 doorbells[NUM_CORES];
+
+static void
+doorbell_handler ( void *arg )
+{
+	doorbells[intcon_core ()]++;
+}
+
+/* Each core that will receive calls this for itself */
+void
+msgq_core_init ( void )
+{
+	irq_request ( SGI_DOORBELL, doorbell_handler, 0, IRQ_PRIO_NORMAL );
+}
+
+/* Sender side, after the message is in */
+static void
+db_kick ( struct doorbell *db )
+{
+	__atomic_thread_fence ( __ATOMIC_SEQ_CST );
+	if ( ! __atomic_load_n ( &db->waiting, __ATOMIC_RELAXED ) )
+	    return;
+	if ( __atomic_exchange_n ( &db->waiting, 0, __ATOMIC_RELAXED ) ) {
+	    db->rings++;
+	    intcon_sgi_cpu ( SGI_DOORBELL, db->core );
+	}
+}
+
+/* Receiver side, with the queue found empty.
+ * Then it must look again before db_sleep() (or db_disarm() if
+ * it found something).  IRQs stay masked from here to the WFI,
+ * else the SGI could be taken just before the WFI and we would
+ * sleep until some other interrupt.  A pending SGI still ends
+ * a WFI with IRQs masked.
+ */
+static u64
+db_arm ( struct doorbell *db )
+{
+	u64 flags;
+
+	asm volatile ( "mrs %0, daif" : "=r" (flags) );
+	asm volatile ( "msr DAIFSet, #2" : : : "memory" );
+	__atomic_store_n ( &db->waiting, 1, __ATOMIC_RELAXED );
+	__atomic_thread_fence ( __ATOMIC_SEQ_CST );
+	return flags;
+}
+
+static void
+db_disarm ( struct doorbell *db, u64 flags )
+{
+	__atomic_store_n ( &db->waiting, 0, __ATOMIC_RELAXED );
+	asm volatile ( "msr daif, %0" : : "r" (flags) : "memory" );
+}
+
+/* The SGI handler runs when we put DAIF back */
+static void
+db_sleep ( struct doorbell *db, u64 flags )
+{
+	db->sleeps++;
+	asm volatile ( "wfi" );
+	db_disarm ( db, flags );
+}
+
+static void
+db_init ( struct doorbell *db, int core )
+{
+	db->waiting = 0;
+	db->core = core;
+	db->rings = 0;
+	db->sleeps = 0;
+}
+
+/* ---------------------------------------------- */
+
+void
+spsc_init ( struct spsc *q, int core )
+{
+	q->head = q->tail = 0;
+	q->tail_cache = q->head_cache = 0;
+	db_init ( &q->db, core );
+}
+
+/* Sender only.  Returns -1 if full */
+int
+spsc_put ( struct spsc *q, u64 msg )
+{
+	u64 h = q->head;
+
+	if ( h - q->tail_cache >= SPSC_SIZE ) {
+	    q->tail_cache = __atomic_load_n ( &q->tail, __ATOMIC_ACQUIRE );
+	    if ( h - q->tail_cache >= SPSC_SIZE )
+		return -1;
+	}
+
+	q->slots[h & SPSC_MASK] = msg;
+	__atomic_store_n ( &q->head, h + 1, __ATOMIC_RELEASE );
+	return 0;
+}
+
+void
+spsc_kick ( struct spsc *q )
+{
+	db_kick ( &q->db );
+}
+
+int
+spsc_send ( struct spsc *q, u64 msg )
+{
+	if ( spsc_put ( q, msg ) < 0 )
+	    return -1;
+	db_kick ( &q->db );
+	return 0;
+}
+
+/* Receiver only.  Returns -1 if empty */
+int
+spsc_get ( struct spsc *q, u64 *msg )
+{
+	u64 t = q->tail;
+
+	if ( t == q->head_cache ) {
+	    q->head_cache = __atomic_load_n ( &q->head, __ATOMIC_ACQUIRE );
+	    if ( t == q->head_cache )
+		return -1;
+	}
+
+	*msg = q->slots[t & SPSC_MASK];
+	__atomic_store_n ( &q->tail, t + 1, __ATOMIC_RELEASE );
+	return 0;
+}
+
+/* Receiver only, sleeps until there is one */
+u64
+spsc_recv ( struct spsc *q )
+{
+	u64 msg, flags;
+
+	while ( spsc_get ( q, &msg ) < 0 ) {
+	    flags = db_arm ( &q->db );
+	    if ( spsc_get ( q, &msg ) == 0 ) {
+		db_disarm ( &q->db, flags );
+		break;
+	    }
+	    db_sleep ( &q->db, flags );
+	}
+	return msg;
+}
+
+/* ---------------------------------------------- */
+
+void
+mpsc_init ( struct mpsc *q, int core )
+{
+	int i;
+
+	q->head = q->tail = 0;
+	for ( i=0; i<MPSC_SIZE; i++ ) {
+	    q->cells[i].seq = i;
+	    q->cells[i].msg = 0;
+	}
+	db_init ( &q->db, core );
+}
+
+/* Any sender.  Returns -1 if full */
+int
+mpsc_put ( struct mpsc *q, u64 msg )
+{
+	struct mpsc_cell *cp;
+	u64 pos, seq;
+	long diff;
+
+	pos = __atomic_load_n ( &q->head, __ATOMIC_RELAXED );
+	for ( ;; ) {
+	    cp = &q->cells[pos & MPSC_MASK];
+	    seq = __atomic_load_n ( &cp->seq, __ATOMIC_ACQUIRE );
+	    diff = (long) seq - (long) pos;
+	    if ( diff == 0 ) {
+		if ( __atomic_compare_exchange_n ( &q->head, &pos, pos + 1, 1,
+			__ATOMIC_RELAXED, __ATOMIC_RELAXED ) )
+		    break;
+	    } else if ( diff < 0 )
+		return -1;
+	    else
+		pos = __atomic_load_n ( &q->head, __ATOMIC_RELAXED );
+	}
+
+	cp->msg = msg;
+	__atomic_store_n ( &cp->seq, pos + 1, __ATOMIC_RELEASE );
+	return 0;
+}
+
+void
+mpsc_kick ( struct mpsc *q )
+{
+	db_kick ( &q->db );
+}
+
+int
+mpsc_send ( struct mpsc *q, u64 msg )
+{
+	if ( mpsc_put ( q, msg ) < 0 )
+	    return -1;
+	db_kick ( &q->db );
+	return 0;
+}
+
+/* Receiver only.  Returns -1 if empty */
+int
+mpsc_get ( struct mpsc *q, u64 *msg )
+{
+	struct mpsc_cell *cp;
+	u64 pos = q->tail;
+
+	cp = &q->cells[pos & MPSC_MASK];
+	if ( __atomic_load_n ( &cp->seq, __ATOMIC_ACQUIRE ) != pos + 1 )
+	    return -1;
+
+	*msg = cp->msg;
+	__atomic_store_n ( &cp->seq, pos + MPSC_SIZE, __ATOMIC_RELEASE );
+	q->tail = pos + 1;
+	return 0;
+}
+
+u64
+mpsc_recv ( struct mpsc *q )
+{
+	u64 msg, flags;
+
+	while ( mpsc_get ( q, &msg ) < 0 ) {
+	    flags = db_arm ( &q->db );
+	    if ( mpsc_get ( q, &msg ) == 0 ) {
+		db_disarm ( &q->db, flags );
+		break;
+	    }
+	    db_sleep ( &q->db, flags );
+	}
+	return msg;
+}
+
+/* ---------------------------------------------- */
+
+/* Benchmarks.
+ *
+ * Latency: ping-pong over two spsc queues, one way is half the
+ * round trip.  Once with both ends spinning on the queue, and
+ * once sleeping in WFI, where it includes the SGI.
+ *
+ * Throughput: one core sends as fast as it can, in batches of
+ * BATCH with a kick after each, and the other one receives.
+ *
+ * mpsc: every other core sends to core 0 at once.
+ */
+
+#define PING_ROUNDS	1000
+#define TPUT_MSGS	100000
+#define BATCH		32
+
+static struct spsc q_ab, q_ba;
+static struct mpsc q_many;
+
+struct bench_arg {
+	int	sleep;
+	int	count;
+	u64	ticks;
+	u64	sum;
+	int	bad;
+};
+
+static inline u64
+count ( void )
+{
+	u64 val;
+
+	asm volatile ( "isb; mrs %0, cntpct_el0" : "=r" (val) : : "memory" );
+	return val;
+}
+
+static u64
+get_spin ( struct spsc *q )
+{
+	u64 msg;
+
+	while ( spsc_get ( q, &msg ) < 0 )
+	    ;
+	return msg;
+}
+
+static void
+pinger ( void *arg )
+{
+	struct bench_arg *bp = arg;
+	u64 start, msg;
+	int i;
+
+	start = count ();
+	for ( i=0; i<bp->count; i++ ) {
+	    spsc_send ( &q_ab, i );
+	    msg = bp->sleep ? spsc_recv ( &q_ba ) : get_spin ( &q_ba );
+	    if ( msg != i )
+		bp->bad++;
+	}
+	bp->ticks = count () - start;
+}
+
+static void
+ponger ( void *arg )
+{
+	struct bench_arg *bp = arg;
+	u64 msg;
+	int i;
+
+	for ( i=0; i<bp->count; i++ ) {
+	    msg = bp->sleep ? spsc_recv ( &q_ab ) : get_spin ( &q_ab );
+	    spsc_send ( &q_ba, msg );
+	}
+}
+
+static void
+streamer ( void *arg )
+{
+	struct bench_arg *bp = arg;
+	int i = 0, n;
+
+	while ( i < bp->count ) {
+	    for ( n=0; n<BATCH && i < bp->count; n++, i++ )
+		while ( spsc_put ( &q_ab, i ) < 0 )
+		    spsc_kick ( &q_ab );
+	    spsc_kick ( &q_ab );
+	}
+}
+
+static void
+sink ( void *arg )
+{
+	struct bench_arg *bp = arg;
+	u64 start, msg;
+	int i;
+
+	start = count ();
+	for ( i=0; i<bp->count; i++ ) {
+	    msg = spsc_recv ( &q_ab );
+	    if ( msg != i )
+		bp->bad++;
+	}
+	bp->ticks = count () - start;
+}
+
+static void
+many_sender ( void *arg )
+{
+	struct bench_arg *bp = arg;
+	int i;
+
+	for ( i=0; i<bp->count; i++ ) {
+	    while ( mpsc_put ( &q_many, i + 1 ) < 0 )
+		mpsc_kick ( &q_many );
+	    if ( (i % BATCH) == BATCH - 1 )
+		mpsc_kick ( &q_many );
+	}
+	mpsc_kick ( &q_many );
+}
+
+static void
+many_sink ( void *arg )
+{
+	struct bench_arg *bp = arg;
+	u64 start;
+	int i;
+
+	start = count ();
+	for ( i=0; i<bp->count; i++ )
+	    bp->sum += mpsc_recv ( &q_many );
+	bp->ticks = count () - start;
+}
+
+/* Run a on core ca and b on core cb, and wait for both */
+static void
+run_pair ( int ca, void (*a) ( void * ), int cb, void (*b) ( void * ), void *arg_a, void *arg_b )
+{
+	struct task_group ga, gb;
+	struct task ta, tb;
+
+	task_group_init ( &ga );
+	task_group_init ( &gb );
+	ga.cpus = 1 << ca;
+	gb.cpus = 1 << cb;
+
+	task_spawn ( &gb, &tb, b, arg_b );
+	task_spawn ( &ga, &ta, a, arg_a );
+	task_join ( &ga );
+	task_join ( &gb );
+}
+
+/* nanoseconds, one way */
+static u64
+ping_pong ( int ca, int cb, int sleep )
+{
+	struct bench_arg a, b;
+
+	spsc_init ( &q_ab, cb );
+	spsc_init ( &q_ba, ca );
+
+	a.sleep = b.sleep = sleep;
+	a.count = b.count = PING_ROUNDS;
+	a.bad = b.bad = 0;
+	run_pair ( ca, pinger, cb, ponger, &a, &b );
+
+	if ( a.bad )
+	    printf ( "MSGQ: %d bad messages, core %d to %d\n", a.bad, ca, cb );
+	return gtimer_ns ( a.ticks ) / PING_ROUNDS / 2;
+}
+
+/* thousands of messages a second */
+static u64
+stream ( int ca, int cb )
+{
+	struct bench_arg a, b;
+
+	spsc_init ( &q_ab, cb );
+
+	a.count = b.count = TPUT_MSGS;
+	a.bad = b.bad = 0;
+	run_pair ( ca, streamer, cb, sink, &a, &b );
+
+	if ( b.bad )
+	    printf ( "MSGQ: %d out of order, core %d to %d\n", b.bad, ca, cb );
+	return b.ticks ? (u64) TPUT_MSGS * gtimer_freq () / b.ticks / 1000 : 0;
+}
+
+static void
+bench_many ( void )
+{
+	struct task_group groups[NUM_CORES];
+	struct task tasks[NUM_CORES];
+	struct bench_arg args[NUM_CORES];
+	struct bench_arg rx;
+	u64 expect = 0;
+	int core, n = 0;
+
+	mpsc_init ( &q_many, 0 );
+	for ( core = 1; core < NUM_CORES; core++ ) {
+	    if ( ! smp_core_up ( core ) )
+		continue;
+	    args[core].count = TPUT_MSGS / 4;
+	    expect += (u64) args[core].count * (args[core].count + 1) / 2;
+	    n++;
+	}
+	if ( ! n )
+	    return;
+
+	rx.count = n * (TPUT_MSGS / 4);
+	rx.sum = 0;
+
+	for ( core = 1; core < NUM_CORES; core++ ) {
+	    if ( ! smp_core_up ( core ) )
+		continue;
+	    task_group_init ( &groups[core] );
+	    groups[core].cpus = 1 << core;
+	    task_spawn ( &groups[core], &tasks[core], many_sender, &args[core] );
+	}
+
+	/* we are core 0, so we get the receiving */
+	many_sink ( &rx );
+
+	for ( core = 1; core < NUM_CORES; core++ )
+	    if ( smp_core_up ( core ) )
+		task_join ( &groups[core] );
+
+	printf ( "MSGQ mpsc: %d senders to core 0, %lu K msgs/s, %d doorbells, sum %s\n",
+	    n, rx.ticks ? (u64) rx.count * gtimer_freq () / rx.ticks / 1000 : 0,
+	    q_many.db.rings, rx.sum == expect ? "ok" : "BAD" );
+}
+
+static void
+show_header ( char *what )
+{
+	int cb;
+
+	printf ( "MSGQ %s\n         ", what );
+	for ( cb = 0; cb < NUM_CORES; cb++ )
+	    printf ( "  %d %-4s", cb, topo_name ( cb ) );
+	printf ( "\n" );
+}
+
+/* Run this on core 0, with the other cores in sched_worker() */
+void
+msgq_bench ( void )
+{
+	int ca, cb, test;
+	char *names[] = { "latency spinning (ns, one way)",
+		"latency with WFI and doorbell (ns, one way)",
+		"throughput (K msgs/s)" };
+
+	if ( intcon_core () != 0 )
+	    return;
+
+	for ( test = 0; test < 3; test++ ) {
+	    show_header ( names[test] );
+	    for ( ca = 0; ca < NUM_CORES; ca++ ) {
+		if ( ca && ! smp_core_up ( ca ) )
+		    continue;
+		printf ( "  %d %-4s ", ca, topo_name ( ca ) );
+		for ( cb = 0; cb < NUM_CORES; cb++ ) {
+		    if ( cb == ca || (cb && ! smp_core_up ( cb )) ) {
+			printf ( "  %6s", "-" );
+			continue;
+		    }
+		    printf ( "  %6lu", test == 2 ? stream ( ca, cb ) : ping_pong ( ca, cb, test ) );
+		}
+		printf ( "\n" );
+	    }
+	}
+
+	bench_many ();
+}
+
+/* THE END */
@@ -0,0 +1,65 @@
+/* msgq.h
+ *
+ * Message queues between cores (see msgq.c).
+ *
+ * A message is one 64 bit word, a value or a pointer.
+ * Everything one core writes and another reads is on its own
+ * cache line, so the two ends don't fight over lines.
+ */
+
+#define MSGQ_LINE	64
+
+/* Must be powers of 2 */
+#define SPSC_SIZE	256
+#define MPSC_SIZE	256
+
+/* The receiver says it is going to sleep here */
+struct doorbell {
+	volatile int	waiting;
+	int		core;		/* who receives */
+	unsigned int	rings;		/* SGIs sent */
+	unsigned int	sleeps;		/* WFIs done */
+} __attribute__ ((aligned(MSGQ_LINE)));
+
+/* One sender, one receiver */
+struct spsc {
+	volatile unsigned long	head __attribute__ ((aligned(MSGQ_LINE)));
+	unsigned long		tail_cache;	/* sender's idea of tail */
+	volatile unsigned long	tail __attribute__ ((aligned(MSGQ_LINE)));
+	unsigned long		head_cache;	/* receiver's idea of head */
+	struct doorbell		db;
+	unsigned long		slots[SPSC_SIZE] __attribute__ ((aligned(MSGQ_LINE)));
+};
+
+/* Any number of senders, one receiver */
+struct mpsc_cell {
+	volatile unsigned long	seq;
+	unsigned long		msg;
+};
+
+struct mpsc {
+	volatile unsigned long	head __attribute__ ((aligned(MSGQ_LINE)));
+	volatile unsigned long	tail __attribute__ ((aligned(MSGQ_LINE)));
+	struct doorbell		db;
+	struct mpsc_cell	cells[MPSC_SIZE] __attribute__ ((aligned(MSGQ_LINE)));
+};
+
+void msgq_core_init ( void );
+
+void spsc_init ( struct spsc *, int );
+int spsc_put ( struct spsc *, unsigned long );
+void spsc_kick ( struct spsc * );
+int spsc_send ( struct spsc *, unsigned long );
+int spsc_get ( struct spsc *, unsigned long * );
+unsigned long spsc_recv ( struct spsc * );
+
+void mpsc_init ( struct mpsc *, int );
+int mpsc_put ( struct mpsc *, unsigned long );
+void mpsc_kick ( struct mpsc * );
+int mpsc_send ( struct mpsc *, unsigned long );
+int mpsc_get ( struct mpsc *, unsigned long * );
+unsigned long mpsc_recv ( struct mpsc * );
+
+void msgq_bench ( void );
+
+/* THE END */
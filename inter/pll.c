@@ -9,10 +9,20 @@
  * pll.c - driver for the various PLL in the Rockchip RK3399
  *
  * Tom Trebisky  1-3-2022, 2-14-2022, 12-6-2025
+ *
+ * pll_solve() works out the dividers for any rate,
+ * pll_set_rate() puts the PLL in slow mode (running from the
+ * 24 Mhz crystal), changes it, waits for lock and switches back.
+ *
+ * The solver builds on linux for trying things out:
+ *   cc -DPLL_TEST -o pll_test pll.c ; ./pll_test [mhz ...]
  */
 
+#ifndef PLL_TEST
 #include "protos.h"
-// #include "rk3399_ints.h"
+#include "clk.h"
+#endif
+#include "pll.h"
 
 typedef volatile unsigned int vu32;
 typedef unsigned int u32;
@@ -21,6 +31,7 @@ typedef unsigned long u64;
 #define BIT(x)	(1<<(x))
 
 #define CRU_BASE	0xff760000
+#define PMUCRU_BASE	0xff750000
 
 #define L_BASE		(CRU_BASE + 0x00)	/* x */
 #define B_BASE		(CRU_BASE + 0x20)	/* x */
@@ -32,15 +43,177 @@ typedef unsigned long u64;
 #define V_BASE		(CRU_BASE + 0xC0)	/* x */
 
 /* The P pll is in the PMUCRU */
+#define P_BASE		(PMUCRU_BASE + 0x00)
 
 /* Each PLL has the same 5 registers as the RK3328,
  * but the stuff in the registers is laid out differently.
+ *
+ *  CON0  fbdiv [11:0]
+ *  CON1  postdiv2 [14:12], postdiv1 [10:8], refdiv [5:0]
+ *  CON2  frac [23:0], lock (read only) bit 31
+ *  CON3  mode [9:8] (0 slow, 1 normal, 2 deep slow),
+ *        dsmpd bit 3 (1 = integer mode), power down bit 0
+ *
+ * CON0, CON1 and CON3 have a write mask in the upper 16 bits,
+ * CON2 does not.
  */
 
 /* The RK3399 has 8 PLL - 
  * BPLL LPLL DPLL CPLL GPLL NPLL VPLL PPLL
  */
 
+#define XIN_RATE	24000000UL
+#define MHZ		1000000UL
+
+/* Limits from the TRM */
+#define VCO_MIN		(800*MHZ)
+#define VCO_MAX		(3200*MHZ)
+#define FOUT_MIN	(16*MHZ)
+#define FREF_MIN	(1*MHZ)
+#define FREF_MIN_FRAC	(10*MHZ)
+#define FBDIV_MIN	16
+#define FBDIV_MAX	3200
+#define FBDIV_MIN_FRAC	20
+#define FBDIV_MAX_FRAC	320
+#define REFDIV_MAX	63
+#define POSTDIV_MAX	7
+
+#define FRAC_BITS	24
+
+/* ------------------------------------------------------ */
+/* The solver */
+
+static u64
+setting_rate ( struct pll_setting *sp )
+{
+	u64 vco;
+
+	vco = XIN_RATE * sp->fbdiv / sp->refdiv;
+	vco += ((XIN_RATE * sp->frac) >> FRAC_BITS) / sp->refdiv;
+	sp->vco = vco;
+	return vco / sp->postdiv1 / sp->postdiv2;
+}
+
+static u64
+rate_error ( u64 a, u64 b )
+{
+	return a > b ? a - b : b - a;
+}
+
+/* Is try better than best for the rate we want?
+ * Closest first, then integer mode (no fractional jitter),
+ * then the smallest refdiv, then the highest VCO.
+ */
+static int
+better ( struct pll_setting *try, struct pll_setting *best, u64 rate )
+{
+	u64 e_try = rate_error ( try->rate, rate );
+	u64 e_best = rate_error ( best->rate, rate );
+
+	if ( best->fbdiv == 0 || e_try != e_best )
+	    return best->fbdiv == 0 || e_try < e_best;
+	if ( (try->frac == 0) != (best->frac == 0) )
+	    return try->frac == 0;
+	if ( try->refdiv != best->refdiv )
+	    return try->refdiv < best->refdiv;
+	return try->vco > best->vco;
+}
+
+/* Find the dividers for a rate (Hz).
+ * Returns 0 if it is out of range.
+ */
+int
+pll_solve ( u64 rate, struct pll_setting *best )
+{
+	struct pll_setting try;
+	u64 vco, fref, fb;
+	int ref, p1, p2;
+
+	best->fbdiv = 0;
+	if ( rate < FOUT_MIN || rate > VCO_MAX )
+	    return 0;
+
+	for ( p1 = 1; p1 <= POSTDIV_MAX; p1++ ) {
+	    for ( p2 = 1; p2 <= p1; p2++ ) {
+		vco = rate * p1 * p2;
+		if ( vco < VCO_MIN || vco > VCO_MAX )
+		    continue;
+		try.postdiv1 = p1;
+		try.postdiv2 = p2;
+
+		for ( ref = 1; ref <= REFDIV_MAX; ref++ ) {
+		    fref = XIN_RATE / ref;
+		    if ( fref < FREF_MIN )
+			break;
+		    try.refdiv = ref;
+
+		    /* integer mode, rounded to the nearest */
+		    fb = (vco * ref + XIN_RATE / 2) / XIN_RATE;
+		    if ( fb >= FBDIV_MIN && fb <= FBDIV_MAX ) {
+			try.fbdiv = fb;
+			try.frac = 0;
+			try.rate = setting_rate ( &try );
+			if ( try.vco >= VCO_MIN && try.vco <= VCO_MAX && better ( &try, best, rate ) )
+			    *best = try;
+		    }
+
+		    /* fraction mode makes up the rest */
+		    if ( fref < FREF_MIN_FRAC )
+			continue;
+		    fb = vco * ref / XIN_RATE;
+		    if ( fb < FBDIV_MIN_FRAC || fb > FBDIV_MAX_FRAC )
+			continue;
+		    try.fbdiv = fb;
+		    try.frac = (((vco * ref - fb * XIN_RATE) << FRAC_BITS) + XIN_RATE / 2) / XIN_RATE;
+		    if ( try.frac >= (1 << FRAC_BITS) )
+			continue;
+		    if ( try.frac == 0 )
+			continue;
+		    try.rate = setting_rate ( &try );
+		    if ( better ( &try, best, rate ) )
+			*best = try;
+		}
+	    }
+	}
+
+	return best->fbdiv != 0;
+}
+
+static char *pll_names[] = { "LPLL", "BPLL", "DPLL", "CPLL", "GPLL", "NPLL", "VPLL", "PPLL" };
+
+char *
+pll_name ( int pll )
+{
+	if ( pll < 0 || pll >= NUM_PLL )
+	    return "?";
+	return pll_names[pll];
+}
+
+#ifndef PLL_TEST
+
+/* ------------------------------------------------------ */
+/* The hardware */
+
+static u32 pll_bases[] = {
+	L_BASE, B_BASE, D_BASE, C_BASE, G_BASE, N_BASE, V_BASE, P_BASE
+};
+
+#define PLL_REG(base, n)	(*(vu32 *) (u64) ((base) + 4*(n)))
+
+/* Rockchip registers with a write mask in the upper half */
+#define MASK_WRITE(reg, mask, val)	reg = ((mask) << 16) | (val)
+
+#define CON3_MODE_SHIFT	8
+#define CON3_MODE_MASK	3
+#define MODE_SLOW	0
+#define MODE_NORMAL	1
+#define CON3_DSMPD	BIT(3)
+#define CON3_PWRDOWN	BIT(0)
+#define CON2_LOCK	BIT(31)
+
+/* Locking takes about 1000 reference clocks at the worst */
+#define LOCK_TIMEOUT	2000	/* us */
+
 static void
 pll_dump ( char *who, u32 base, int extra )
 {
@@ -55,11 +228,11 @@ pll_dump ( char *who, u32 base, int extra )
 		l = base;
 		p = (u32 *) l;
 		printf ( "\n" );
-		printf ( "%s CON0 = %X\n", who, *p++ );
-		printf ( "%s CON1 = %X\n", who, *p++ );
-		printf ( "%s CON2 = %X\n", who, *p++ );
-		printf ( "%s CON3 = %X\n", who, *p++ );
-		printf ( "%s CON4 = %X\n", who, *p++ );
+		printf ( "%s CON0 = %08X\n", who, *p++ );
+		printf ( "%s CON1 = %08X\n", who, *p++ );
+		printf ( "%s CON2 = %08X\n", who, *p++ );
+		printf ( "%s CON3 = %08X\n", who, *p++ );
+		printf ( "%s CON4 = %08X\n", who, *p++ );
 
 		p = (u32 *) l;
 		printf ( "%s bypass = %d\n", who, (p[0] >>15) & 0x1 );
@@ -102,24 +275,6 @@ pll_dump ( char *who, u32 base, int extra )
 		printf ( "%s   fout = %d\n", who, fout );
 }
 
-static void
-pll_cut ( char *who, u32 base, int cut )
-{
-		u32 *p;
-		unsigned long l;
-		u32 val;
-		u32 mask;
-
-		/* Avoid warning */
-		l = base;
-		p = (u32 *) l;
-
-		/* change postdiv2 in CON1 */
-		val = (0x7 << (16+12)) | cut<<12;
-		p[1] = val;
-
-}
-
 #ifdef RK3328
 static void
 pll_cut ( char *who, u32 base, int cut )
@@ -145,6 +300,147 @@ pll_cut ( char *who, u32 base, int cut )
 }
 #endif
 
+/* What a PLL is running at now (Hz) */
+u64
+pll_get_rate ( int pll )
+{
+	struct pll_setting s;
+	u32 base, c1, c3;
+
+	if ( pll < 0 || pll >= NUM_PLL )
+	    return 0;
+	base = pll_bases[pll];
+
+	c3 = PLL_REG(base, 3);
+	if ( c3 & CON3_PWRDOWN )
+	    return 0;
+	if ( ((c3 >> CON3_MODE_SHIFT) & CON3_MODE_MASK) != MODE_NORMAL )
+	    return XIN_RATE;
+
+	c1 = PLL_REG(base, 1);
+	s.fbdiv = PLL_REG(base, 0) & 0xfff;
+	s.refdiv = c1 & 0x3f;
+	s.postdiv1 = (c1 >> 8) & 0x7;
+	s.postdiv2 = (c1 >> 12) & 0x7;
+	s.frac = (c3 & CON3_DSMPD) ? 0 : PLL_REG(base, 2) & 0xffffff;
+	if ( ! s.refdiv || ! s.postdiv1 || ! s.postdiv2 )
+	    return 0;
+
+	return setting_rate ( &s );
+}
+
+static void
+pll_mode ( u32 base, int mode )
+{
+	MASK_WRITE ( PLL_REG(base, 3), CON3_MODE_MASK << CON3_MODE_SHIFT, mode << CON3_MODE_SHIFT );
+}
+
+/* Program a PLL for a rate (Hz).
+ * Whatever runs from it goes at 24 Mhz for the moment it takes.
+ * Returns -1 if the rate can't be done or it would not lock.
+ */
+int
+pll_set_rate ( int pll, u64 rate )
+{
+	struct pll_setting s;
+	u64 end;
+	u32 base;
+
+	if ( pll < 0 || pll >= NUM_PLL )
+	    return -1;
+
+	/* We are running from DDR */
+	if ( pll == PLL_D ) {
+	    printf ( "Not changing DPLL, we run from DDR\n" );
+	    return -1;
+	}
+
+	if ( ! pll_solve ( rate, &s ) ) {
+	    printf ( "%s: can't make %lu Hz\n", pll_name ( pll ), rate );
+	    return -1;
+	}
+	base = pll_bases[pll];
+
+	pll_mode ( base, MODE_SLOW );
+
+	MASK_WRITE ( PLL_REG(base, 3), CON3_PWRDOWN, 0 );
+	MASK_WRITE ( PLL_REG(base, 0), 0xfff, s.fbdiv );
+	MASK_WRITE ( PLL_REG(base, 1), 0x773f,
+	    (s.postdiv2 << 12) | (s.postdiv1 << 8) | s.refdiv );
+	if ( s.frac ) {
+	    PLL_REG(base, 2) = s.frac;
+	    MASK_WRITE ( PLL_REG(base, 3), CON3_DSMPD, 0 );
+	} else
+	    MASK_WRITE ( PLL_REG(base, 3), CON3_DSMPD, CON3_DSMPD );
+
+	end = deadline_us ( LOCK_TIMEOUT );
+	while ( ! (PLL_REG(base, 2) & CON2_LOCK) ) {
+	    if ( deadline_passed ( end ) ) {
+		printf ( "%s: no lock at %lu Hz, left in slow mode\n", pll_name ( pll ), s.rate );
+		return -1;
+	    }
+	}
+
+	pll_mode ( base, MODE_NORMAL );
+	return 0;
+}
+
+/* ------------------------------------------------------ */
+/* CPU cluster clocks */
+
+#define CLKSEL_CON(n)	(*(vu32 *) (u64) (CRU_BASE + 0x100 + 4*(n)))
+
+/* The cluster dividers, from the U-Boot rk3399 clock driver.
+ * The little cluster is CLKSEL_CON0/1, the big one CLKSEL_CON2/3.
+ *   CON0/2  aclkm div [12:8], pll select [7:6] (0 = its own PLL),
+ *           core div [4:0]
+ *   CON1/3  pclk_dbg div [12:8], atclk div [4:0]
+ */
+#define ACLKM_HZ	(300*MHZ)
+#define ATCLK_HZ	(300*MHZ)
+#define PCLK_DBG_HZ	(100*MHZ)
+
+static void
+cluster_divs ( int cluster, u64 rate )
+{
+	int aclkm, atclk, pclk;
+	int con = cluster == CLUSTER_B ? 2 : 0;
+
+	aclkm = (rate + ACLKM_HZ - 1) / ACLKM_HZ - 1;
+	atclk = (rate + ATCLK_HZ - 1) / ATCLK_HZ - 1;
+	pclk = (rate + PCLK_DBG_HZ - 1) / PCLK_DBG_HZ - 1;
+
+	MASK_WRITE ( CLKSEL_CON(con), 0x1fdf, (aclkm << 8) | (0 << 6) | 0 );
+	MASK_WRITE ( CLKSEL_CON(con+1), 0x1f1f, (pclk << 8) | atclk );
+}
+
+/* Run a cluster at a rate.
+ * Going up, the bus dividers go first so they are never too fast,
+ * going down they go last.
+ *
+ * Beware: 1.4 Ghz (A53) and 1.8 Ghz (A72) need more voltage than
+ * the boot defaults, so the rail has to be turned up first
+ * (pmic_set_uv(), dvfs.c does this).
+ */
+int
+cpu_clock_set ( int cluster, u64 rate )
+{
+	int pll = cluster == CLUSTER_B ? PLL_B : PLL_L;
+	u64 old = pll_get_rate ( pll );
+	int rv;
+
+	if ( rate > old )
+	    cluster_divs ( cluster, rate );
+
+	/* through clk.c, so anyone who cares hears about it */
+	rv = clk_set_rate ( cluster == CLUSTER_B ? CLK_BPLL : CLK_LPLL, rate );
+
+	if ( rv == 0 && rate <= old )
+	    cluster_divs ( cluster, rate );
+
+	return rv;
+}
+
 /* Reduce the CPU clock from the original
  * 600 Mhz to 100 so the chip can run cooler.
  * Here is what the PLL looks like after this.
@@ -161,17 +457,21 @@ pll_cut ( char *who, u32 base, int cut )
  *  L fracdiv = 1F 799
  *  L   foutvco = 1200
  *  L   fout = 100
+ *
+ * This used to just change postdiv2, now we let the solver do it.
  */
 
 void
 cpu_clock_100 ( void )
 {
-		pll_cut ( "L", L_BASE, 6 );
+		cpu_clock_set ( CLUSTER_L, 100*MHZ );
 }
 
 void
 pll_test ( void )
 {
+		int i;
+
 		pll_dump ( "L", L_BASE, 1 );
 		pll_dump ( "B", B_BASE, 1 );
 		pll_dump ( "D", D_BASE, 1 );
@@ -180,6 +480,73 @@ pll_test ( void )
 		pll_dump ( "G", G_BASE, 1 );
 		pll_dump ( "N", N_BASE, 1 );
 		pll_dump ( "V", V_BASE, 1 );
+
+		printf ( "\n" );
+		for ( i=0; i<NUM_PLL; i++ )
+		    printf ( "%s = %lu Hz\n", pll_name ( i ), pll_get_rate ( i ) );
+}
+
+#endif	/* PLL_TEST */
+
+/* ------------------------------------------------------ */
+
+#ifdef PLL_TEST
+#include <stdio.h>
+#include <stdlib.h>
+
+static void
+show ( u64 rate )
+{
+	struct pll_setting s;
+
+	if ( ! pll_solve ( rate, &s ) ) {
+	    printf ( "%12lu  can't do it\n", rate );
+	    return;
+	}
+	printf ( "%12lu  ref %2d fb %4d p1 %d p2 %d frac %8u  vco %10lu  gives %12lu (%+ld)\n",
+	    rate, s.refdiv, s.fbdiv, s.postdiv1, s.postdiv2, s.frac,
+	    s.vco, s.rate, (long) s.rate - (long) rate );
+}
+
+/* Check every Mhz against the limits, then show some rates */
+int
+main ( int argc, char **argv )
+{
+	static u64 rates[] = { 100*MHZ, 200*MHZ, 408*MHZ, 594*MHZ, 600*MHZ, 800*MHZ,
+	    816*MHZ, 1008*MHZ, 1200*MHZ, 1416*MHZ, 1512*MHZ, 1608*MHZ, 1800*MHZ,
+	    1992*MHZ, 148500000, 297000000, 676000000, 12000000, 4000*MHZ };
+	struct pll_setting s;
+	int i, bad = 0;
+	u64 r;
+
+	if ( argc > 1 ) {
+	    for ( i=1; i<argc; i++ )
+		show ( atof ( argv[i] ) * MHZ );
+	    return 0;
+	}
+
+	/* below 17 Mhz the VCO can't get to 800 Mhz with postdiv 7*7 */
+	for ( r = 17*MHZ; r <= VCO_MAX; r += MHZ ) {
+	    if ( ! pll_solve ( r, &s ) ) {
+		printf ( "no solution for %lu\n", r );
+		bad++;
+		continue;
+	    }
+	    if ( s.vco < VCO_MIN || s.vco > VCO_MAX || XIN_RATE / s.refdiv < FREF_MIN ||
+		    s.postdiv1 > POSTDIV_MAX || s.postdiv2 > s.postdiv1 ||
+		    (s.frac && (s.fbdiv < FBDIV_MIN_FRAC || s.fbdiv > FBDIV_MAX_FRAC)) ||
+		    (!s.frac && (s.fbdiv < FBDIV_MIN || s.fbdiv > FBDIV_MAX)) ||
+		    rate_error ( s.rate, r ) > 1000 ) {
+		printf ( "bad solution for %lu\n", r );
+		bad++;
+	    }
+	}
+	printf ( "every Mhz from %lu to %lu: %d bad\n", 17*MHZ, VCO_MAX, bad );
+
+	for ( i=0; i<sizeof(rates)/sizeof(rates[0]); i++ )
+	    show ( rates[i] );
+	return bad != 0;
 }
+#endif	/* PLL_TEST */
 
 /* THE END */
@@ -0,0 +1,40 @@
+/* pll.h
+ *
+ * The PLLs in the RK3399 CRU (and PMUCRU for PPLL)
+ */
+
+#define PLL_L		0	/* A53 cluster */
+#define PLL_B		1	/* A72 cluster */
+#define PLL_D		2	/* DDR */
+#define PLL_C		3
+#define PLL_G		4
+#define PLL_N		5
+#define PLL_V		6	/* video */
+#define PLL_P		7	/* in the PMU domain */
+#define NUM_PLL		8
+
+/* A solution for one rate:
+ *   fout = 24 Mhz / refdiv * (fbdiv + frac / 2^24) / postdiv1 / postdiv2
+ */
+struct pll_setting {
+	unsigned long	rate;		/* what we get */
+	unsigned long	vco;
+	int		refdiv;
+	int		fbdiv;
+	int		postdiv1;
+	int		postdiv2;
+	unsigned int	frac;		/* 0 for integer mode */
+};
+
+int pll_solve ( unsigned long, struct pll_setting * );
+
+unsigned long pll_get_rate ( int );
+int pll_set_rate ( int, unsigned long );
+char *pll_name ( int );
+
+#define CLUSTER_L	0
+#define CLUSTER_B	1
+
+int cpu_clock_set ( int, unsigned long );
+
+/* THE END */
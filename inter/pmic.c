@@ -0,0 +1,244 @@
+/* pmic.c
+ *
+ * The CPU supply rails on the Orange Pi 4, over I2C0.
+ *
+ *   VDD_CPU_L	RK808 PMIC (address 0x1b), BUCK2
+ *   VDD_CPU_B	Silergy SYR827 (address 0x40), VSEL0
+ *
+ * The RK808 does not supply the big cluster, that takes more
+ * current than it can give, so there is a separate buck converter
+ * for it (a FAN53555 work alike, as on most RK3399 boards).
+ * Both set the voltage the same way, 712.5 mV plus 12.5 mV steps
+ * in 6 bits, and both ramp to a new voltage at a set rate.
+ *
+ * Going up the RK808 can overshoot, so like linux we never take
+ * it more than 100 mV at a time.  After each change we wait for
+ * the ramp, plus a bit.  Setting a rail is slow (each I2C write
+ * takes about half a millisecond, and then the ramp), so this is
+ * not something to do often.
+ *
+ * Interrupts stay on through all of it.  The bus is kept to one
+ * core at a time by i2c_lock, which is let go while we wait for
+ * a ramp.  Since an interrupt handler could spin on it forever,
+ * none of this may be called from one (dvfs.c does it from the
+ * main loop).  Only one caller should be setting a given rail.
+ *
+ * Register details are from the RK808 datasheet and the linux
+ * rk808 and fan53555 regulator drivers.
+ */
+
+#include "protos.h"
+#include "lock.h"
+
+typedef unsigned int u32;
+typedef unsigned long u64;
+
+#define BIT(x)	(1<<(x))
+
+#define RK808_ADDR		0x1b
+#define RK808_ID_MSB		0x17
+#define RK808_BUCK2_CONFIG	0x32
+#define RK808_BUCK2_ON_VSEL	0x33
+
+/* In the BUCK config registers: 2, 4, 6, 10 mV/us */
+#define RK808_RAMP_SHIFT	3
+#define RK808_RAMP_MASK		3
+
+#define SYR_ADDR		0x40
+#define SYR_VSEL0		0x00
+#define SYR_CONTROL		0x02
+#define SYR_ID1			0x03
+
+#define SYR_BUCK_EN		BIT(7)
+
+/* In CONTROL: 64 mV/us down to 0.5 mV/us */
+#define SYR_SLEW_SHIFT		4
+#define SYR_SLEW_MASK		7
+
+#define VSEL_MASK		0x3f
+#define VSEL_MIN_UV		712500
+#define VSEL_STEP_UV		12500
+
+/* At most this many steps at a time (100 mV) */
+#define MAX_STEPS		8
+
+#define SETTLE_US		20
+
+static int rk808_ramps[] = { 2000, 4000, 6000, 10000 };
+static int syr_slews[] = { 64000, 32000, 16000, 8000, 4000, 2000, 1000, 500 };
+
+struct rail {
+	char	*name;
+	int	chip;
+	int	reg;
+	int	min_uv;
+	int	max_uv;		/* never set it higher than this */
+	int	ramp;		/* uV per us */
+	int	ok;
+	int	changes;
+};
+
+static struct rail rails[NUM_RAILS] = {
+    [RAIL_CPU_L] = { "vdd_cpu_l", RK808_ADDR, RK808_BUCK2_ON_VSEL,  800000, 1150000 },
+    [RAIL_CPU_B] = { "vdd_cpu_b", SYR_ADDR,   SYR_VSEL0,            800000, 1250000 }
+};
+
+/* The I2C bus (see above) */
+static struct ticketlock i2c_lock;
+
+static struct rail *
+get_rail ( int rail )
+{
+	if ( rail < 0 || rail >= NUM_RAILS || ! rails[rail].ok )
+	    return 0;
+	return &rails[rail];
+}
+
+static int
+read_sel ( struct rail *rp )
+{
+	int val;
+
+	val = i2c_read_reg ( rp->chip, rp->reg );
+	if ( val < 0 )
+	    return -1;
+	return val & VSEL_MASK;
+}
+
+/* Keep the other bits (the SYR827 enable) as they are */
+static int
+write_sel ( struct rail *rp, int sel )
+{
+	int val;
+
+	val = i2c_read_reg ( rp->chip, rp->reg );
+	if ( val < 0 )
+	    return -1;
+	return i2c_write_reg ( rp->chip, rp->reg, (val & ~VSEL_MASK) | sel );
+}
+
+int
+pmic_get_uv ( int rail )
+{
+	struct rail *rp = get_rail ( rail );
+	int sel;
+
+	if ( ! rp )
+	    return -1;
+
+	ticket_lock ( &i2c_lock );
+	sel = read_sel ( rp );
+	ticket_unlock ( &i2c_lock );
+
+	if ( sel < 0 )
+	    return -1;
+	return VSEL_MIN_UV + sel * VSEL_STEP_UV;
+}
+
+/* Set a rail to at least uv, and wait for it to get there.
+ * Returns -1 if it is out of range or the chip didn't answer.
+ */
+int
+pmic_set_uv ( int rail, int uv )
+{
+	struct rail *rp = get_rail ( rail );
+	int old, sel, next;
+	int rv = 0;
+
+	if ( ! rp || uv < rp->min_uv || uv > rp->max_uv )
+	    return -1;
+
+	sel = (uv - VSEL_MIN_UV + VSEL_STEP_UV - 1) / VSEL_STEP_UV;
+	if ( sel > VSEL_MASK )
+	    return -1;
+
+	ticket_lock ( &i2c_lock );
+	old = read_sel ( rp );
+	ticket_unlock ( &i2c_lock );
+	if ( old < 0 )
+	    rv = -1;
+
+	while ( rv == 0 && old != sel ) {
+	    next = sel;
+	    if ( next > old + MAX_STEPS )
+		next = old + MAX_STEPS;
+
+	    ticket_lock ( &i2c_lock );
+	    rv = write_sel ( rp, next ) < 0 ? -1 : 0;
+	    ticket_unlock ( &i2c_lock );
+	    if ( rv < 0 )
+		break;
+
+	    /* the bus is free for others while it ramps */
+	    udelay ( (next > old ? next - old : old - next) * VSEL_STEP_UV / rp->ramp + SETTLE_US );
+	    old = next;
+	}
+
+	if ( rv == 0 )
+	    rp->changes++;
+	return rv;
+}
+
+int
+pmic_max_uv ( int rail )
+{
+	struct rail *rp = get_rail ( rail );
+
+	return rp ? rp->max_uv : -1;
+}
+
+int
+pmic_ok ( int rail )
+{
+	return get_rail ( rail ) != 0;
+}
+
+/* See who answers, and how fast they ramp.
+ * Returns how many rails we can set.
+ */
+int
+pmic_init ( void )
+{
+	struct rail *rp;
+	int val;
+	int n = 0;
+
+	i2c_init ();
+
+	rp = &rails[RAIL_CPU_L];
+	if ( i2c_read_reg ( RK808_ADDR, RK808_ID_MSB ) >= 0 &&
+		(val = i2c_read_reg ( RK808_ADDR, RK808_BUCK2_CONFIG )) >= 0 ) {
+	    rp->ramp = rk808_ramps[(val >> RK808_RAMP_SHIFT) & RK808_RAMP_MASK];
+	    rp->ok = 1;
+	    n++;
+	}
+
+	rp = &rails[RAIL_CPU_B];
+	if ( i2c_read_reg ( SYR_ADDR, SYR_ID1 ) >= 0 &&
+		(val = i2c_read_reg ( SYR_ADDR, SYR_CONTROL )) >= 0 ) {
+	    rp->ramp = syr_slews[(val >> SYR_SLEW_SHIFT) & SYR_SLEW_MASK];
+	    rp->ok = 1;
+	    n++;
+	}
+
+	pmic_show ();
+	return n;
+}
+
+void
+pmic_show ( void )
+{
+	struct rail *rp;
+	int i;
+
+	for ( i=0; i<NUM_RAILS; i++ ) {
+	    rp = &rails[i];
+	    if ( ! rp->ok )
+		printf ( "PMIC: %s not found\n", rp->name );
+	    else
+		printf ( "PMIC: %s at %d uV, ramp %d uV/us, %d changes\n",
+		    rp->name, pmic_get_uv ( i ), rp->ramp, rp->changes );
+	}
+}
+
+/* THE END */
@@ -1,262 +1,553 @@
-/* serial.c
- * (c) Tom Trebisky  7-2-2017
+/* prf.c
  *
- * Serial (uart) driver for the F411
- * For the 411 this is section 19 of RM0383
+ * printf and friends.
  *
- * This began (2017) as a simple polled output driver for
- *  console messages on port 1
- * In 2020, I decided to extend it to listen to a GPS receiver
- *  on port 2.
+ * This used to format into a 128 byte buffer on the stack and
+ * then hand that to uart_puts().  Now the formatting is done by
+ * prf_core(), which hands pieces of output to a "sink" function
+ * as it goes.  printf() uses a sink that goes straight to the
+ * uart, sprintf() and asnprintf() use one that fills a buffer.
+ * Nothing is limited by a buffer size anymore (except sprintf,
+ * which was always absurd).
  *
- * Notice that I number these 1,2,3.
- * However my "3" is what they call "6" in the manual.
- * 
- * On the F411, USART1 and USART6 are on the APB2 bus.
- * On the F411, USART2 is on the APB1 bus.
+ * Supported:
+ *   %d %i %u %x %X %o %c %s %p %%
+ *   flags - 0 + space #, width and precision (numbers or *)
+ *   l and ll (and z) for 64 bit values
  *
- * On the F411, after reset, with no fiddling with RCC
- *  settings, both are running at 16 Mhz.
- *  Apparently on the F411 both APB1 and APB2
- *   always run at the same rate.
+ * and, so old code keeps working:
+ *   %h  32 bit hex as xxxxyyyy (same as %08X)
+ *   %Y  64 bit hex, 16 digits (same as %016lX)
  *
- * NOTE: On my black pill boards, pins C6 and C7 are not available,
- *  Meaning that UART3 (aka UART6) is not available.
- *  The code is in here, but not of much use if you can't
- *  get to the pins!!
+ * Hex comes from a table, decimal two digits at a time from a
+ * table of pairs.  Division by a constant is done by the compiler
+ * as a multiply, so there is no udiv in the loop at all.
+ *
+ * This file builds on linux too, for checking against the
+ * real thing:
+ *   cc -DPRF_TEST -o prf_test prf.c ; ./prf_test
  */
 
 #include <stdarg.h>
+
+#ifndef PRF_TEST
 #include "protos.h"
+#else
+typedef void (*prf_sink) ( void *, const char *, int );
+#endif
 
-#define PRINTF_BUF_SIZE 128
-// static void asnprintf (char *abuf, unsigned int size, const char *fmt, va_list args);
-void asnprintf (char *abuf, unsigned int size, const char *fmt, va_list args);
+typedef unsigned long u64;
+
+static const char hex_upper[] = "0123456789ABCDEF";
+static const char hex_lower[] = "0123456789abcdef";
+
+static const char dec_pairs[] =
+	"00010203040506070809"
+	"10111213141516171819"
+	"20212223242526272829"
+	"30313233343536373839"
+	"40414243444546474849"
+	"50515253545556575859"
+	"60616263646566676869"
+	"70717273747576777879"
+	"80818283848586878889"
+	"90919293949596979899";
+
+#define F_LEFT		0x01
+#define F_ZERO		0x02
+#define F_PLUS		0x04
+#define F_SPACE		0x08
+#define F_ALT		0x10
+#define F_UPPER		0x20
+
+static const char spaces[] = "                ";
+static const char zeros[] = "0000000000000000";
+
+static void
+pad ( prf_sink sink, void *arg, const char *fill, int n )
+{
+	while ( n > 16 ) {
+	    sink ( arg, fill, 16 );
+	    n -= 16;
+	}
+	if ( n > 0 )
+	    sink ( arg, fill, n );
+}
 
-void
-printf ( char *fmt, ... )
+/* Digits go in from the end of buf, we return the start */
+static char *
+fmt_dec ( char *end, u64 val )
 {
-	char buf[PRINTF_BUF_SIZE];
-        va_list args;
+	char *p = end;
+	const char *dp;
+	u64 q;
+
+	while ( val >= 100 ) {
+	    q = val / 100;
+	    dp = &dec_pairs[2 * (val - q * 100)];
+	    *--p = dp[1];
+	    *--p = dp[0];
+	    val = q;
+	}
+	if ( val >= 10 ) {
+	    dp = &dec_pairs[2 * val];
+	    *--p = dp[1];
+	    *--p = dp[0];
+	} else
+	    *--p = '0' + val;
+
+	return p;
+}
 
-        va_start ( args, fmt );
-        asnprintf ( buf, PRINTF_BUF_SIZE, fmt, args );
-        va_end ( args );
+static char *
+fmt_hex ( char *end, u64 val, int upper )
+{
+	const char *hp = upper ? hex_upper : hex_lower;
+	char *p = end;
+
+	do {
+	    *--p = hp[val & 0xf];
+	    val >>= 4;
+	} while ( val );
 
-        uart_puts ( buf );
+	return p;
 }
 
-/* The limit is absurd, so take care */
-void
-sprintf ( char *buf, char *fmt, ... )
+static char *
+fmt_oct ( char *end, u64 val )
 {
-        va_list args;
+	char *p = end;
 
-        va_start ( args, fmt );
-        asnprintf ( buf, 256, fmt, args );
-        va_end ( args );
-}
+	do {
+	    *--p = '0' + (val & 7);
+	    val >>= 3;
+	} while ( val );
 
-/* ========================================================================= */
+	return p;
+}
 
-/* Here I develop a simple printf.
- * It only has 3 triggers:
- *  %s to inject a string
- *  %d to inject a decimal number
- *  %h to inject a 32 bit hex value as xxxxyyyy
+/* Put out one number with all the trimmings:
+ *  [left spaces] [sign or 0x] [zeros] digits [right spaces]
  */
+static void
+put_number ( prf_sink sink, void *arg, u64 val, int neg, int base,
+	int flags, int width, int prec )
+{
+	char buf[24];
+	char *end = &buf[sizeof(buf)];
+	char *p;
+	char prefix[2];
+	int nprefix = 0;
+	int ndig, nzero, len;
+
+	if ( base == 10 )
+	    p = fmt_dec ( end, val );
+	else if ( base == 16 )
+	    p = fmt_hex ( end, val, flags & F_UPPER );
+	else
+	    p = fmt_oct ( end, val );
+	ndig = end - p;
+
+	/* "%.0d" of 0 is nothing at all */
+	if ( prec == 0 && val == 0 )
+	    ndig = 0;
+
+	if ( neg )
+	    prefix[nprefix++] = '-';
+	else if ( flags & F_PLUS )
+	    prefix[nprefix++] = '+';
+	else if ( flags & F_SPACE )
+	    prefix[nprefix++] = ' ';
+
+	if ( (flags & F_ALT) && val != 0 ) {
+	    if ( base == 16 ) {
+		prefix[nprefix++] = '0';
+		prefix[nprefix++] = (flags & F_UPPER) ? 'X' : 'x';
+	    } else if ( base == 8 && prec <= ndig )
+		prec = ndig + 1;
+	}
 
-#define PUTCHAR(x)      if ( buf <= end ) *buf++ = (x)
-
-static const char hex_table[] = "0123456789ABCDEF";
+	nzero = prec > ndig ? prec - ndig : 0;
+	len = nprefix + nzero + ndig;
 
-// #define HEX(x)  ((x)<10 ? '0'+(x) : 'A'+(x)-10)
-#define HEX(x)  hex_table[(x)]
+	/* zero fill to the width, unless there is a precision */
+	if ( (flags & (F_ZERO|F_LEFT)) == F_ZERO && prec < 0 && width > len ) {
+	    nzero += width - len;
+	    len = width;
+	}
 
-#ifdef notdef
-static char *
-sprintnb ( char *buf, char *end, int n, int b)
-{
-        char prbuf[16];
-        register char *cp;
-
-        if (b == 10 && n < 0) {
-            PUTCHAR('-');
-            n = -n;
-        }
-        cp = prbuf;
-
-        do {
-            // *cp++ = "0123456789ABCDEF"[n%b];
-            *cp++ = hex_table[n%b];
-            n /= b;
-        } while (n);
-
-        do {
-            PUTCHAR(*--cp);
-        } while (cp > prbuf);
-
-        return buf;
+	if ( ! (flags & F_LEFT) && width > len )
+	    pad ( sink, arg, spaces, width - len );
+	if ( nprefix )
+	    sink ( arg, prefix, nprefix );
+	pad ( sink, arg, zeros, nzero );
+	if ( ndig )
+	    sink ( arg, end - ndig, ndig );
+	if ( (flags & F_LEFT) && width > len )
+	    pad ( sink, arg, spaces, width - len );
 }
-#endif
 
-static char *
-sprintn ( char *buf, char *end, int n )
+static void
+put_string ( prf_sink sink, void *arg, const char *s, int flags, int width, int prec )
 {
-        char prbuf[16];
-        char *cp;
-
-        if ( n < 0 ) {
-            PUTCHAR('-');
-            n = -n;
-        }
-        cp = prbuf;
-
-        do {
-            // *cp++ = "0123456789"[n%10];
-            *cp++ = hex_table[n%10];
-            n /= 10;
-        } while (n);
-
-        do {
-            PUTCHAR(*--cp);
-        } while (cp > prbuf);
-
-        return buf;
+	int len;
+
+	if ( ! s )
+	    s = "(null)";
+
+	for ( len = 0; s[len] && (prec < 0 || len < prec); len++ )
+	    ;
+
+	if ( ! (flags & F_LEFT) && width > len )
+	    pad ( sink, arg, spaces, width - len );
+	sink ( arg, s, len );
+	if ( (flags & F_LEFT) && width > len )
+	    pad ( sink, arg, spaces, width - len );
 }
 
-static char *
-shex2( char *buf, char *end, int val )
+/* The engine for everything here.
+ * Returns how many characters went to the sink.
+ * We count them with a wrapper so the sinks stay simple.
+ */
+struct prf_count {
+	prf_sink	sink;
+	void		*arg;
+	int		count;
+};
+
+static void
+count_sink ( void *arg, const char *s, int n )
 {
-        PUTCHAR( HEX((val>>4)&0xf) );
-        PUTCHAR( HEX(val&0xf) );
-        return buf;
+	struct prf_count *cp = arg;
+
+	cp->count += n;
+	cp->sink ( cp->arg, s, n );
 }
 
-#ifdef notdef
-static char *
-shex3( char *buf, char *end, int val )
+int
+prf_core ( prf_sink user_sink, void *user_arg, const char *fmt, va_list args )
 {
-        PUTCHAR( HEX((val>>8)&0xf) );
-        return shex2(buf,end,val);
+	struct prf_count cnt;
+	prf_sink sink = count_sink;
+	void *arg = &cnt;
+	const char *lit;
+	int flags, width, prec, lng;
+	long sval;
+	u64 val;
+	char ch;
+	int c;
+
+	cnt.sink = user_sink;
+	cnt.arg = user_arg;
+	cnt.count = 0;
+
+	for ( ;; ) {
+	    /* Runs of plain text go out in one piece */
+	    lit = fmt;
+	    while ( *fmt && *fmt != '%' )
+		fmt++;
+	    if ( fmt > lit )
+		sink ( arg, lit, fmt - lit );
+	    if ( *fmt == '\0' )
+		break;
+	    fmt++;
+
+	    flags = 0;
+	    for ( ;; ) {
+		c = *fmt;
+		if ( c == '-' )
+		    flags |= F_LEFT;
+		else if ( c == '0' )
+		    flags |= F_ZERO;
+		else if ( c == '+' )
+		    flags |= F_PLUS;
+		else if ( c == ' ' )
+		    flags |= F_SPACE;
+		else if ( c == '#' )
+		    flags |= F_ALT;
+		else
+		    break;
+		fmt++;
+	    }
+
+	    width = 0;
+	    if ( *fmt == '*' ) {
+		width = va_arg ( args, int );
+		if ( width < 0 ) {
+		    flags |= F_LEFT;
+		    width = -width;
+		}
+		fmt++;
+	    } else {
+		while ( *fmt >= '0' && *fmt <= '9' )
+		    width = width * 10 + *fmt++ - '0';
+	    }
+
+	    prec = -1;
+	    if ( *fmt == '.' ) {
+		fmt++;
+		prec = 0;
+		if ( *fmt == '*' ) {
+		    prec = va_arg ( args, int );
+		    fmt++;
+		} else {
+		    while ( *fmt >= '0' && *fmt <= '9' )
+			prec = prec * 10 + *fmt++ - '0';
+		}
+	    }
+
+	    /* On aarch64 long, long long and size_t are all 64 bits */
+	    lng = 0;
+	    while ( *fmt == 'l' || *fmt == 'z' ) {
+		lng = 1;
+		fmt++;
+	    }
+
+	    c = *fmt++;
+	    switch ( c ) {
+		case 'd':
+		case 'i':
+		    sval = lng ? va_arg ( args, long ) : va_arg ( args, int );
+		    if ( sval < 0 )
+			put_number ( sink, arg, - (u64) sval, 1, 10, flags, width, prec );
+		    else
+			put_number ( sink, arg, sval, 0, 10, flags, width, prec );
+		    break;
+		case 'u':
+		case 'x':
+		case 'X':
+		case 'o':
+		    val = lng ? va_arg ( args, u64 ) : va_arg ( args, unsigned int );
+		    if ( c == 'X' )
+			flags |= F_UPPER;
+		    put_number ( sink, arg, val, 0, c == 'u' ? 10 : c == 'o' ? 8 : 16,
+			flags & ~(F_PLUS|F_SPACE), width, prec );
+		    break;
+		case 'p':
+		    val = (u64) va_arg ( args, void * );
+		    put_number ( sink, arg, val, 0, 16, flags | F_ALT, width, prec );
+		    break;
+		case 'h':
+		    val = va_arg ( args, unsigned int );
+		    put_number ( sink, arg, val, 0, 16, F_UPPER | F_ZERO, 8, -1 );
+		    break;
+		case 'Y':
+		    val = va_arg ( args, u64 );
+		    put_number ( sink, arg, val, 0, 16, F_UPPER | F_ZERO, 16, -1 );
+		    break;
+		case 'c':
+		    ch = va_arg ( args, int );
+		    if ( ! (flags & F_LEFT) && width > 1 )
+			pad ( sink, arg, spaces, width - 1 );
+		    sink ( arg, &ch, 1 );
+		    if ( (flags & F_LEFT) && width > 1 )
+			pad ( sink, arg, spaces, width - 1 );
+		    break;
+		case 's':
+		    put_string ( sink, arg, va_arg ( args, char * ), flags, width, prec );
+		    break;
+		case '%':
+		    sink ( arg, "%", 1 );
+		    break;
+		case '\0':
+		    /* % at the very end */
+		    return cnt.count;
+		default:
+		    /* unknown, print nothing */
+		    break;
+	    }
+	}
+
+	return cnt.count;
 }
 
-static char *
-shex4( char *buf, char *end, int val )
+/* ========================================================================= */
+
+/* Buffer sink for sprintf and friends.
+ * Like snprintf, we keep counting after the buffer fills.
+ */
+struct prf_buf {
+	char	*buf;
+	char	*end;	/* leave room for the null */
+};
+
+static void
+buf_sink ( void *arg, const char *s, int n )
 {
-        buf = shex2(buf,end,val>>8);
-        return shex2(buf,end,val);
+	struct prf_buf *bp = arg;
+
+	while ( n-- > 0 && bp->buf < bp->end )
+	    *bp->buf++ = *s++;
 }
-#endif
 
-static char *
-shex8( char *buf, char *end, int val )
+/* The size includes the null at the end */
+void
+asnprintf ( char *abuf, unsigned int size, const char *fmt, va_list args )
 {
-        buf = shex2(buf,end,val>>24);
-        buf = shex2(buf,end,val>>16);
-        buf = shex2(buf,end,val>>8);
-        return shex2(buf,end,val);
+	struct prf_buf b;
+
+	if ( size == 0 )
+	    return;
+
+	b.buf = abuf;
+	b.end = abuf + size - 1;
+	prf_core ( buf_sink, &b, fmt, args );
+	*b.buf = '\0';
 }
 
-/* For 64 bit long */
-static char *
-shex16( char *buf, char *end, long val )
+#ifndef PRF_TEST
+
+/* Console sink, the uart wants \r\n */
+static void
+uart_sink ( void *arg, const char *s, int n )
 {
-        buf = shex2(buf,end,val>>56);
-        buf = shex2(buf,end,val>>48);
-        buf = shex2(buf,end,val>>40);
-        buf = shex2(buf,end,val>>32);
-
-        buf = shex2(buf,end,val>>24);
-        buf = shex2(buf,end,val>>16);
-        buf = shex2(buf,end,val>>8);
-        return shex2(buf,end,val);
+	while ( n-- > 0 ) {
+	    if ( *s == '\n' )
+		uart_putc ( '\r' );
+	    uart_putc ( *s++ );
+	}
 }
 
-// static void
 void
-asnprintf (char *abuf, unsigned int size, const char *fmt, va_list args)
+printf ( char *fmt, ... )
 {
-    char *buf, *end;
-    int c;
-    char *p;
-
-    buf = abuf;
-    end = buf + size - 1;
-    if (end < buf - 1) {
-        end = ((void *) -1);
-        size = end - buf + 1;
-    }
-
-    while ( c = *fmt++ ) {
-	if ( c != '%' ) {
-            PUTCHAR(c);
-            continue;
-        }
-	c = *fmt++;
-	if ( c == 'd' ) {
-	    buf = sprintn ( buf, end, va_arg(args,int) );
-	    continue;
-	}
-	if ( c == 'x' ) {
-	    buf = shex2 ( buf, end, va_arg(args,int) & 0xff );
-	    continue;
-	}
-	if ( c == 'h' || c == 'X' ) {
-	    buf = shex8 ( buf, end, va_arg(args,int) );
-	    continue;
-	}
-	/* 64 bit long -- added 12-1-2025 */
-    if ( c == 'Y' ) {
-        buf = shex16 ( buf, end, va_arg(args,long) );
-        continue;
-    }
-	if ( c == 'c' ) {
-            PUTCHAR( va_arg(args,int) );
-	    continue;
-	}
-	if ( c == 's' ) {
-	    p = va_arg(args,char *);
-	    // printf ( "Got: %s\n", p );
-	    while ( c = *p++ )
-		PUTCHAR(c);
-	    continue;
-	}
-    }
-    if ( buf > end )
-	buf = end;
-    PUTCHAR('\0');
+        va_list args;
+
+        va_start ( args, fmt );
+        prf_core ( uart_sink, 0, fmt, args );
+        va_end ( args );
 }
 
-#ifdef notdef
+/* The limit is absurd, so take care */
 void
-serial_printf ( int fd, char *fmt, ... )
+sprintf ( char *buf, char *fmt, ... )
 {
-	char buf[PRINTF_BUF_SIZE];
         va_list args;
 
         va_start ( args, fmt );
-        asnprintf ( buf, PRINTF_BUF_SIZE, fmt, args );
+        asnprintf ( buf, 256, fmt, args );
         va_end ( args );
-
-        uart_puts ( fd, buf );
 }
-#endif
 
 /* Handy now and then */
 void
 show_reg ( char *msg, int *addr )
 {
-	printf ( "%s %h %h\n", msg, (long) addr, *addr );
-
-	/*
-	console_puts ( msg );
-	console_putc ( ' ' );
-	print32 ( (int) addr );
-	console_putc ( ' ' );
-	print32 ( *addr );
-	console_putc ( '\n' );
-	*/
+	printf ( "%s %p %08X\n", msg, addr, *addr );
+}
+
+#endif	/* PRF_TEST */
+
+/* ========================================================================= */
+
+#ifdef PRF_TEST
+
+/* Check against the C library on linux.
+ * Only formats that mean the same thing to both are here.
+ */
+#include <stdio.h>
+#include <string.h>
+
+static int n_fail;
+static int n_pass;
+
+static void
+check ( const char *fmt, ... )
+{
+	char mine[256];
+	char real[256];
+	va_list args;
+
+	va_start ( args, fmt );
+	asnprintf ( mine, sizeof(mine), fmt, args );
+	va_end ( args );
+
+	va_start ( args, fmt );
+	vsnprintf ( real, sizeof(real), fmt, args );
+	va_end ( args );
+
+	if ( strcmp ( mine, real ) != 0 ) {
+	    printf ( "FAIL %-12s mine \"%s\" real \"%s\"\n", fmt, mine, real );
+	    n_fail++;
+	} else
+	    n_pass++;
+}
+
+static void
+check_str ( const char *want, const char *fmt, ... )
+{
+	char mine[256];
+	va_list args;
+
+	va_start ( args, fmt );
+	asnprintf ( mine, sizeof(mine), fmt, args );
+	va_end ( args );
+
+	if ( strcmp ( mine, want ) != 0 ) {
+	    printf ( "FAIL %-12s mine \"%s\" want \"%s\"\n", fmt, mine, want );
+	    n_fail++;
+	} else
+	    n_pass++;
+}
+
+static void
+test_trunc ( char *buf, int size, const char *fmt, ... )
+{
+	va_list args;
+
+	va_start ( args, fmt );
+	asnprintf ( buf, size, fmt, args );
+	va_end ( args );
+}
+
+int
+main ( int argc, char **argv )
+{
+	static long vals[] = { 0, 1, -1, 9, 10, 99, 100, 101, 12345, -12345,
+	    2147483647L, -2147483647L-1, 4294967295L, 1234567890123L,
+	    0x7fffffffffffffffL, -0x7fffffffffffffffL-1 };
+	static const char *ifmts[] = { "%d", "%5d", "%-5d|", "%05d", "%+d", "% d",
+	    "%.3d", "%8.3d", "%-08d|", "%.0d", "%u", "%x", "%X", "%#x", "%#X",
+	    "%08x", "%#010x", "%o", "%#o", "%12u", "%-12x|" };
+	static const char *lfmts[] = { "%ld", "%20ld", "%-20ld|", "%020ld", "%+ld",
+	    "%lu", "%lx", "%lX", "%#lx", "%018lx", "%lo", "%lld", "%llx", "%zu" };
+	char small[8];
+	int i, j;
+
+	for ( i=0; i<sizeof(vals)/sizeof(vals[0]); i++ ) {
+	    for ( j=0; j<sizeof(ifmts)/sizeof(ifmts[0]); j++ )
+		check ( ifmts[j], (int) vals[i] );
+	    for ( j=0; j<sizeof(lfmts)/sizeof(lfmts[0]); j++ )
+		check ( lfmts[j], vals[i] );
+	}
+
+	check ( "%s", "hello" );
+	check ( "[%10s]", "hello" );
+	check ( "[%-10s]", "hello" );
+	check ( "[%.3s]", "hello" );
+	check ( "[%*s]", 8, "hi" );
+	check ( "[%-*s]", 8, "hi" );
+	check ( "[%*d]", -6, 42 );
+	check ( "[%.*d]", 4, 42 );
+	check ( "%c%c%c", 'a', 'b', 'c' );
+	check ( "[%3c]", 'z' );
+	check ( "100%%" );
+	check ( "%p", (void *) 0x12345678 );
+	check ( "%20p|", (void *) 0xffff0000 );
+	check ( "a %s b %d c %x d %lu\n", "str", -7, 0xbeef, 1UL << 63 );
+
+	check_str ( "DEADBEEF", "%h", 0xdeadbeef );
+	check_str ( "0000001F", "%h", 0x1f );
+	check_str ( "0123456789ABCDEF", "%Y", 0x0123456789abcdefL );
+	check_str ( "(null)", "%s", (char *) 0 );
+
+	/* truncation */
+	test_trunc ( small, sizeof(small), "%d", 123456789 );
+	check_str ( "1234567", "%s", small );
+
+	printf ( "%d passed, %d failed\n", n_pass, n_fail );
+	return n_fail ? 1 : 0;
 }
+#endif	/* PRF_TEST */
 
 /* THE END */
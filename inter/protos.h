@@ -8,10 +8,53 @@ void rkpanic ( char * );
 
 void uart_init ( void );
 void uart_puts ( char * );
+void uart_putc ( char );
+void uart_irq_init ( void );
+void uart_handler ( void * );
+void uart_flush ( void );
 
-void timer_handler ( void );
+/* timer.c - a 64 bit clock and software timers */
+#define SWTIMER_MAX	64
+
+struct swtimer {
+	unsigned long	when;		/* deadline, in timer_now ticks */
+	unsigned long	period;		/* 0 for one shot */
+	void		(*func) ( void * );
+	void		*arg;
+	int		slot;		/* place in the heap, -1 if idle */
+};
+
+void timer_handler ( void * );
 void timer_init ( void );
 void timer_show ( void );
+unsigned long timer_now ( void );
+unsigned long timer_hz ( void );
+void swtimer_init ( struct swtimer *, void (*) ( void * ), void * );
+int swtimer_start ( struct swtimer *, unsigned long, unsigned long );
+int swtimer_start_at ( struct swtimer *, unsigned long, unsigned long );
+void swtimer_cancel ( struct swtimer * );
+int swtimer_pending ( struct swtimer * );
+
+/* gtimer.c - the ARM generic timer, one per core */
+void gtimer_init ( void );
+void gtimer_start ( int, void (*) ( int ) );
+void gtimer_stop ( void );
+void gtimer_handler ( void * );
+int gtimer_irq ( void );
+unsigned long gtimer_count ( void );
+unsigned long gtimer_freq ( void );
+unsigned long gtimer_ns ( unsigned long );
+unsigned long gtimer_ticks ( int );
+
+/* delay.c - timed by the generic counter */
+void delay_init ( void );
+void ndelay ( unsigned int );
+void udelay ( unsigned int );
+void mdelay ( unsigned int );
+unsigned long deadline_ns ( unsigned long );
+unsigned long deadline_us ( unsigned long );
+int deadline_passed ( unsigned long );
+void delay_until ( unsigned long );
 
 void gpio_init ( void );
 void led_on ( void );
@@ -24,14 +67,174 @@ void printf ( char *, ... );
 
 void show_reg ( char *, int * );
 
+/* prf.c - the printf engine, a sink gets n characters at a time */
+typedef void (*prf_sink) ( void *, const char *, int );
+int prf_core ( prf_sink, void *, const char *, __builtin_va_list );
+
 void mmu_init ( void );
 
 void intcon_gic_init ( void );
 void intcon_gic_cpu_init ( void );
 int intcon_irqwho ( void );
 void intcon_ena ( int );
+void intcon_ena_cpu ( int, int );
+void intcon_ena_prio ( int, int, int );
+void intcon_dis ( int );
+void intcon_dis_cpu ( int, int );
+int intcon_core ( void );
 void intcon_irqack ( int );
 void intcon_sgi ( int );
+void intcon_sgi_cpu ( int, int );
+
+/* irq.c - interrupt dispatch, lower priority values preempt higher */
+#define IRQ_MAX		192	/* the RK3399 has 182 */
+
+#define IRQ_PRIO_HIGH	0x40
+#define IRQ_PRIO_NORMAL	0x80
+#define IRQ_PRIO_LOW	0xc0
+
+typedef void (*irq_handler) ( void * );
+
+void irq_init ( void );
+int irq_request ( int, irq_handler, void *, int );
+void irq_free ( int );
+void irq_show ( void );
+
+/* dma.c */
+#define DMA_MAX_CHAN	2
+#define DMA_MAX_SEG	16
+
+struct dma_seg {
+	char	*buf;
+	int	len;
+};
+
+void dma_init ( void );
+int dma_busy ( int );
+void dma_kill ( int );
+int dma_to_periph ( int, int, unsigned int, struct dma_seg *, int, void (*) ( void * ), void * );
+void dma_handler ( void * );
+
+int uart_dma_write ( struct dma_seg *, int );
+int uart_dma_busy ( void );
+
+/* irqstat.c */
+unsigned long irqstat_now ( void );
+void irqstat_entry ( unsigned long );
+void irqstat_irq ( int, unsigned long, unsigned long, unsigned long );
+void irqstat_timer ( unsigned long, unsigned long );
+void irqstat_reset ( void );
+void irqstat_dump ( void );
+
+/* bench.c */
+#define BENCH_MAX_EVENTS	4
+
+struct bench {
+	char	*name;
+	void	(*prep) ( void * );	/* before each sample, not timed */
+	void	(*run) ( void * );	/* what we time */
+	void	(*done) ( void * );	/* after the last sample */
+	void	*arg;
+	int	samples;		/* 0 for the default */
+};
+
+void bench_init ( void );
+void bench_set_events ( int *, int );
+void bench_run ( struct bench * );
+void bench_all ( void );
+
+/* tsadc.c - temperature sensors */
+#define TSADC_CPU	0
+#define TSADC_GPU	1
+#define TSADC_CHANNELS	2
+
+void tsadc_init ( void );
+int tsadc_temp ( int, int * );
+void tsadc_show ( void );
+
+/* i2c.c - I2C0, for the PMIC */
+void i2c_init ( void );
+int i2c_read ( int, int, unsigned char *, int );
+int i2c_write ( int, int, unsigned char *, int );
+int i2c_read_reg ( int, int );
+int i2c_write_reg ( int, int, int );
+int i2c_error_count ( void );
+
+/* pmic.c - the CPU rails, same numbers as CLUSTER_L and CLUSTER_B */
+#define RAIL_CPU_L	0
+#define RAIL_CPU_B	1
+#define NUM_RAILS	2
+
+int pmic_init ( void );
+int pmic_get_uv ( int );
+int pmic_set_uv ( int, int );
+int pmic_max_uv ( int );
+int pmic_ok ( int );
+void pmic_show ( void );
+
+/* dvfs.c - thermal governor for the clusters */
+void dvfs_init ( void );
+void dvfs_poll ( void );
+void dvfs_set_max_uv ( int, int );
+void dvfs_dump ( void );
+
+/* cache.c - the MMU settings the other cores copy, start.S knows this layout */
+struct mmu_regs {
+	unsigned long	mair;
+	unsigned long	tcr;
+	unsigned long	ttbr;
+	unsigned long	sctlr;
+};
+
+void cache_on ( void );
+
+/* smp.c - the other cores, started with PSCI */
+#define NUM_CORES	6
+#define CORE_STACK_SIZE	(64*1024)	/* CORE_STACK_SHIFT in start.S */
+
+int smp_start ( void (*) ( int ) );
+int smp_core_up ( int );
+int smp_num_up ( void );
+unsigned long smp_mpidr ( int );
+
+/* topo.c - which cores are big and which little */
+#define PLACE_ANY	0
+#define PLACE_BIG	1	/* heavy kernels */
+#define PLACE_LITTLE	2	/* background work */
+
+void topo_core_init ( int );
+char *topo_name ( int );
+int topo_cluster ( int );
+int topo_capacity ( int );
+unsigned int topo_mask ( int );
+int topo_is_big ( int );
+void topo_show ( void );
+
+/* sched.c - work stealing across the cores */
+struct task_group {
+	volatile int	pending;
+	unsigned int	cpus;		/* 0 for any */
+};
+
+struct task {
+	void			(*func) ( void * );
+	void			*arg;
+	struct task_group	*group;
+};
+
+void sched_init ( void );
+void sched_worker ( int );
+void task_group_init ( struct task_group * );
+void task_group_place ( struct task_group *, int );
+void task_spawn ( struct task_group *, struct task *, void (*) ( void * ), void * );
+void task_join ( struct task_group * );
+void parallel_for ( long, long, long, void (*) ( long, long, void * ), void * );
+void parallel_for_on ( int, long, long, long, void (*) ( long, long, void * ), void * );
+void sched_show ( void );
+void sched_demo ( void );
+
+/* gic/cache_helpers.S */
+void clean_dcache_range ( unsigned long, unsigned long );
 
 void pll_test ( void );
 void cpu_clock_100 ( void );
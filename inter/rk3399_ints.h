@@ -42,12 +42,23 @@
 #define IRQ_PPI_14      30
 #define IRQ_PPI_15      31
 
+/* The generic timer PPIs (the usual ones, as in the linux dts) */
+#define IRQ_CNTHP	IRQ_PPI_10	/* EL2 physical */
+#define IRQ_CNTV	IRQ_PPI_11	/* virtual */
+#define IRQ_CNTPS	IRQ_PPI_13	/* secure physical */
+#define IRQ_CNTP	IRQ_PPI_14	/* EL1 physical */
+
 /* SPI follow -- all high level */
 /* We have 150 SPI (32 to 181)
  * 2 are NA so 148 are "in use" and this is what the TRM quotes
  */
 #define IRQ_CRYPTO0	32
 // ...
+#define IRQ_DMAC0_0	37	/* dmac_bus */
+#define IRQ_DMAC0_1	38
+#define IRQ_DMAC1_0	39	/* dmac_peri */
+#define IRQ_DMAC1_1	40
+
 #define IRQ_GPIO0	46
 #define IRQ_GPIO1	47
 #define IRQ_GPIO2	48
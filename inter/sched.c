@@ -0,0 +1,633 @@
+/* sched.c
+ *
+ * Spread work over all the cores, by work stealing.
+ *
+ * Each core has a Chase-Lev deque of tasks.  A core pushes the
+ * tasks it spawns on the bottom of its own deque and pops from
+ * there too (last in, first out, so what it works on is still in
+ * its cache).  A core with nothing to do takes from the top of
+ * someone else's deque, the oldest task, which for a parallel_for
+ * is the biggest piece of the range.  Only steals ever contend,
+ * and that is one CAS on the victim's top.
+ *
+ * The deque is the one from "Correct and Efficient Work-Stealing
+ * for Weak Memory Models" (Le, Pop, Cohen, Zappa Nardelli, 2013),
+ * written with the gcc __atomic builtins, so the barriers are
+ * right on the weakly ordered A53 and A72.  It has a fixed size
+ * and does not grow; if it is full, task_spawn() just runs the
+ * task right there.
+ *
+ * Fork/join: task_spawn() puts a task in a group and task_join()
+ * waits for the group to be done.  While it waits it runs tasks
+ * (its own first, then stolen ones), so a join never just blocks
+ * a core.  parallel_for() splits a range in halves down to a grain
+ * size, spawning one half each time, which is how the work gets
+ * out to the other cores.
+ *
+ * The other cores sit in sched_worker().  With nothing to steal
+ * they wait in WFE, and task_spawn() does an SEV when any of them
+ * are waiting.  Any interrupt ends a WFE too, as does the event
+ * stream delay.c sets up, so a missed SEV only costs a little time.
+ *
+ * Placement: a group can be limited to a set of cores (see topo.c,
+ * PLACE_BIG for heavy kernels, PLACE_LITTLE for background work).
+ * Its tasks are only ever run on those cores.  A thief looks at
+ * the cpus of the task on top (kept next to it in the deque)
+ * before it takes it, and leaves it if it may not run it.  A task
+ * spawned on a core that may not run it goes in the inbox instead,
+ * a few slots that any allowed core takes from.
+ *
+ * Tasks and groups belong to the caller and must stay put until
+ * the join (a local variable is fine, since the join is always
+ * before the return).  Don't spawn from an interrupt handler:
+ * a deque only has one owner.
+ */
+
+#include "protos.h"
+
+typedef unsigned int u32;
+typedef unsigned long u64;
+
+/* Must be a power of 2 */
+#define DEQUE_SIZE	256
+#define DEQUE_MASK	(DEQUE_SIZE-1)
+
+#define CACHE_LINE	64
+
+/* from steal(), someone else got it, try again */
+#define ABORT		((struct task *) 1)
+
+#define INBOX_SIZE	16
+
+/* an inbox slot someone is filling in */
+#define CLAIMED		((struct task *) 1)
+
+#define CPUS_OK(cpus,core)	(! (cpus) || ((cpus) >> (core)) & 1)
+#define ALLOWED(tp,core)	CPUS_OK ( (tp)->group->cpus, core )
+
+/* top and bottom on their own lines, they are written by different cores */
+struct deque {
+	volatile long	top __attribute__ ((aligned(CACHE_LINE)));
+	volatile long	bottom __attribute__ ((aligned(CACHE_LINE)));
+	struct task	*buf[DEQUE_SIZE] __attribute__ ((aligned(CACHE_LINE)));
+	u32		cpus[DEQUE_SIZE];	/* each task's group->cpus */
+};
+
+struct sched_stats {
+	u32	spawned;
+	u32	inline_run;	/* deque was full */
+	u32	run;
+	u32	stolen;		/* run that we took from someone else */
+	u32	steal_fail;
+	u64	items;		/* parallel_for, how much of the range */
+	u64	busy;		/* gtimer counts running tasks */
+	u64	idle;		/* and waiting for them */
+} __attribute__ ((aligned(CACHE_LINE)));
+
+static struct deque deques[NUM_CORES];
+static struct sched_stats stats[NUM_CORES];
+static u32 seeds[NUM_CORES];
+
+static struct task * volatile inbox[INBOX_SIZE];
+static u32 inbox_cpus[INBOX_SIZE];
+
+static volatile int idle_workers;
+static volatile int workers;
+
+/* ---------------------------------------------- */
+
+/* Owner only.  Returns -1 if full */
+static int
+deque_push ( struct deque *dp, struct task *tp )
+{
+	long b, t;
+
+	b = __atomic_load_n ( &dp->bottom, __ATOMIC_RELAXED );
+	t = __atomic_load_n ( &dp->top, __ATOMIC_ACQUIRE );
+	if ( b - t >= DEQUE_SIZE )
+	    return -1;
+
+	__atomic_store_n ( &dp->buf[b & DEQUE_MASK], tp, __ATOMIC_RELAXED );
+	dp->cpus[b & DEQUE_MASK] = tp->group->cpus;
+	__atomic_thread_fence ( __ATOMIC_RELEASE );
+	__atomic_store_n ( &dp->bottom, b + 1, __ATOMIC_RELAXED );
+	return 0;
+}
+
+/* Owner only.  The last one is raced for with the thieves */
+static struct task *
+deque_pop ( struct deque *dp )
+{
+	struct task *tp;
+	long b, t;
+
+	b = __atomic_load_n ( &dp->bottom, __ATOMIC_RELAXED ) - 1;
+	__atomic_store_n ( &dp->bottom, b, __ATOMIC_RELAXED );
+	__atomic_thread_fence ( __ATOMIC_SEQ_CST );
+	t = __atomic_load_n ( &dp->top, __ATOMIC_RELAXED );
+
+	if ( t > b ) {
+	    __atomic_store_n ( &dp->bottom, b + 1, __ATOMIC_RELAXED );
+	    return 0;
+	}
+
+	tp = __atomic_load_n ( &dp->buf[b & DEQUE_MASK], __ATOMIC_RELAXED );
+	if ( t == b ) {
+	    if ( ! __atomic_compare_exchange_n ( &dp->top, &t, t + 1, 0,
+		    __ATOMIC_SEQ_CST, __ATOMIC_RELAXED ) )
+		tp = 0;
+	    __atomic_store_n ( &dp->bottom, b + 1, __ATOMIC_RELAXED );
+	}
+	return tp;
+}
+
+/* Anyone.  Returns 0 if empty (or if the top one is not
+ * for this core), ABORT if we lost a race.
+ * Until the CAS works, the task may already have been run
+ * and gone (with its group), so we can't look at it.  Its
+ * cpus are kept in the deque for that.  The slot can't be
+ * used again until top moves on, and then the CAS fails.
+ */
+static struct task *
+deque_steal ( struct deque *dp, int core )
+{
+	struct task *tp;
+	u32 cpus;
+	long b, t;
+
+	t = __atomic_load_n ( &dp->top, __ATOMIC_ACQUIRE );
+	__atomic_thread_fence ( __ATOMIC_SEQ_CST );
+	b = __atomic_load_n ( &dp->bottom, __ATOMIC_ACQUIRE );
+
+	if ( t >= b )
+	    return 0;
+
+	tp = __atomic_load_n ( &dp->buf[t & DEQUE_MASK], __ATOMIC_RELAXED );
+	cpus = dp->cpus[t & DEQUE_MASK];
+	if ( ! tp || ! CPUS_OK ( cpus, core ) )
+	    return 0;
+	if ( ! __atomic_compare_exchange_n ( &dp->top, &t, t + 1, 0,
+		__ATOMIC_SEQ_CST, __ATOMIC_RELAXED ) )
+	    return ABORT;
+	return tp;
+}
+
+/* For a task spawned on a core that may not run it.
+ * The slot is claimed first, so its cpus are there before
+ * the task is.  If the inbox is full, wait for a slot.
+ */
+static void
+inbox_put ( struct task *tp )
+{
+	struct task *empty;
+	int i;
+
+	for ( ;; ) {
+	    for ( i=0; i<INBOX_SIZE; i++ ) {
+		empty = 0;
+		if ( __atomic_compare_exchange_n ( &inbox[i], &empty, CLAIMED, 0,
+			__ATOMIC_ACQUIRE, __ATOMIC_RELAXED ) ) {
+		    inbox_cpus[i] = tp->group->cpus;
+		    __atomic_store_n ( &inbox[i], tp, __ATOMIC_RELEASE );
+		    return;
+		}
+	    }
+	}
+}
+
+/* As with stealing, the task is only ours to look at once
+ * the CAS works.  The same task could have been taken and put
+ * back in this slot in the meantime (with other cpus), so we
+ * check again then, and put it back if it isn't for us.
+ */
+static struct task *
+inbox_get ( int core )
+{
+	struct task *tp;
+	int i;
+
+	for ( i=0; i<INBOX_SIZE; i++ ) {
+	    tp = __atomic_load_n ( &inbox[i], __ATOMIC_ACQUIRE );
+	    if ( ! tp || tp == CLAIMED || ! CPUS_OK ( inbox_cpus[i], core ) )
+		continue;
+	    if ( ! __atomic_compare_exchange_n ( &inbox[i], &tp, 0, 0,
+		    __ATOMIC_ACQUIRE, __ATOMIC_RELAXED ) )
+		continue;
+	    if ( ALLOWED ( tp, core ) )
+		return tp;
+	    inbox_put ( tp );
+	}
+	return 0;
+}
+
+/* ---------------------------------------------- */
+
+static inline u64
+count ( void )
+{
+	u64 val;
+
+	asm volatile ( "isb; mrs %0, cntpct_el0" : "=r" (val) : : "memory" );
+	return val;
+}
+
+/* xorshift, to pick a victim */
+static int
+pick_victim ( int core )
+{
+	u32 x = seeds[core];
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	seeds[core] = x;
+	return x % NUM_CORES;
+}
+
+static void
+run_task ( int core, struct task *tp )
+{
+	struct sched_stats *sp = &stats[core];
+	struct task_group *gp = tp->group;
+	u64 start = count ();
+
+	(*tp->func) ( tp->arg );
+
+	sp->run++;
+	sp->busy += count () - start;
+
+	/* release, so whoever sees pending go to 0 sees our work */
+	__atomic_fetch_sub ( &gp->pending, 1, __ATOMIC_RELEASE );
+	asm volatile ( "dsb ish; sev" );
+}
+
+/* Our own first, then the inbox, then go around the others
+ * once from a random start.
+ */
+static struct task *
+find_task ( int core )
+{
+	struct sched_stats *sp = &stats[core];
+	struct task *tp;
+	int i, victim;
+
+	tp = deque_pop ( &deques[core] );
+	if ( tp )
+	    return tp;
+
+	tp = inbox_get ( core );
+	if ( tp ) {
+	    sp->stolen++;
+	    return tp;
+	}
+
+	victim = pick_victim ( core );
+	for ( i=0; i<NUM_CORES; i++, victim = (victim + 1) % NUM_CORES ) {
+	    if ( victim == core )
+		continue;
+	    tp = deque_steal ( &deques[victim], core );
+	    if ( tp == ABORT ) {
+		sp->steal_fail++;
+		continue;
+	    }
+	    if ( tp ) {
+		sp->stolen++;
+		return tp;
+	    }
+	}
+	return 0;
+}
+
+/* ---------------------------------------------- */
+
+/* Any core at all */
+void
+task_group_init ( struct task_group *gp )
+{
+	gp->pending = 0;
+	gp->cpus = 0;
+}
+
+/* Only the cores for this kind of work */
+void
+task_group_place ( struct task_group *gp, int place )
+{
+	gp->cpus = topo_mask ( place );
+}
+
+void
+task_spawn ( struct task_group *gp, struct task *tp, void (*func) ( void * ), void *arg )
+{
+	int core = intcon_core ();
+
+	tp->func = func;
+	tp->arg = arg;
+	tp->group = gp;
+
+	__atomic_fetch_add ( &gp->pending, 1, __ATOMIC_RELAXED );
+	stats[core].spawned++;
+
+	if ( ! ALLOWED ( tp, core ) ) {
+	    inbox_put ( tp );
+	    __atomic_thread_fence ( __ATOMIC_SEQ_CST );
+	    asm volatile ( "dsb ish; sev" );
+	    return;
+	}
+
+	if ( deque_push ( &deques[core], tp ) < 0 ) {
+	    stats[core].inline_run++;
+	    run_task ( core, tp );
+	    return;
+	}
+
+	/* against sched_worker() going idle just now */
+	__atomic_thread_fence ( __ATOMIC_SEQ_CST );
+	if ( idle_workers )
+	    asm volatile ( "dsb ish; sev" );
+}
+
+/* Help out until everything in the group is done */
+void
+task_join ( struct task_group *gp )
+{
+	int core = intcon_core ();
+	struct task *tp;
+	u64 start;
+
+	while ( __atomic_load_n ( &gp->pending, __ATOMIC_ACQUIRE ) ) {
+	    tp = find_task ( core );
+	    if ( tp ) {
+		run_task ( core, tp );
+		continue;
+	    }
+
+	    /* someone else has the last of it */
+	    start = count ();
+	    if ( __atomic_load_n ( &gp->pending, __ATOMIC_ACQUIRE ) )
+		asm volatile ( "wfe" );
+	    stats[core].idle += count () - start;
+	}
+}
+
+/* ---------------------------------------------- */
+
+struct pf_range {
+	long	lo;
+	long	hi;
+	long	grain;
+	u32	cpus;
+	void	(*body) ( long, long, void * );
+	void	*arg;
+};
+
+/* As deep as the splitting goes, log2 of the longest range.
+ * This is about 2K of stack, and a join can run another
+ * pf_run() on top of it, so the cores get 64K stacks.
+ */
+#define PF_MAX_SPLITS	32
+
+/* Give away the top half until what is left is small,
+ * do that, then wait for the halves we gave away.
+ */
+static void
+pf_run ( void *arg )
+{
+	struct pf_range *rp = arg;
+	struct pf_range kids[PF_MAX_SPLITS];
+	struct task tasks[PF_MAX_SPLITS];
+	struct task_group group;
+	long lo = rp->lo, hi = rp->hi, mid;
+	int n = 0;
+
+	task_group_init ( &group );
+	group.cpus = rp->cpus;
+
+	while ( hi - lo > rp->grain && n < PF_MAX_SPLITS ) {
+	    mid = lo + (hi - lo) / 2;
+	    kids[n] = *rp;
+	    kids[n].lo = mid;
+	    kids[n].hi = hi;
+	    task_spawn ( &group, &tasks[n], pf_run, &kids[n] );
+	    hi = mid;
+	    n++;
+	}
+
+	(*rp->body) ( lo, hi, rp->arg );
+	stats[intcon_core ()].items += hi - lo;
+
+	task_join ( &group );
+}
+
+/* Call body(lo, hi, arg) on pieces of [lo, hi) no bigger than
+ * grain (or about that), on whatever cores of the given kind are
+ * free, and return when all of it is done.  If we are not one of
+ * them, the whole range goes to them and we wait.
+ */
+void
+parallel_for_on ( int place, long lo, long hi, long grain,
+	void (*body) ( long, long, void * ), void *arg )
+{
+	struct pf_range range;
+	struct task_group group;
+	struct task root;
+
+	if ( hi <= lo )
+	    return;
+	if ( grain < 1 )
+	    grain = 1;
+
+	range.lo = lo;
+	range.hi = hi;
+	range.grain = grain;
+	range.body = body;
+	range.arg = arg;
+
+	task_group_init ( &group );
+	if ( place != PLACE_ANY )
+	    task_group_place ( &group, place );
+	range.cpus = group.cpus;
+
+	task_spawn ( &group, &root, pf_run, &range );
+	task_join ( &group );
+}
+
+void
+parallel_for ( long lo, long hi, long grain, void (*body) ( long, long, void * ), void *arg )
+{
+	parallel_for_on ( PLACE_ANY, lo, hi, grain, body, arg );
+}
+
+/* ---------------------------------------------- */
+
+/* The other cores run this (from core_main) and never come back */
+void
+sched_worker ( int core )
+{
+	struct sched_stats *sp = &stats[core];
+	struct task *tp;
+	u64 start;
+
+	__atomic_fetch_add ( &workers, 1, __ATOMIC_RELAXED );
+
+	for ( ;; ) {
+	    tp = find_task ( core );
+	    if ( tp ) {
+		run_task ( core, tp );
+		continue;
+	    }
+
+	    /* Say we are idle, then look once more, so a spawn
+	     * either sees us idle (and does an SEV) or we see it.
+	     */
+	    start = count ();
+	    __atomic_fetch_add ( &idle_workers, 1, __ATOMIC_RELAXED );
+	    __atomic_thread_fence ( __ATOMIC_SEQ_CST );
+	    tp = find_task ( core );
+	    if ( ! tp )
+		asm volatile ( "wfe" );
+	    __atomic_fetch_sub ( &idle_workers, 1, __ATOMIC_RELAXED );
+	    sp->idle += count () - start;
+
+	    if ( tp )
+		run_task ( core, tp );
+	}
+}
+
+void
+sched_init ( void )
+{
+	int core;
+
+	for ( core = 0; core < NUM_CORES; core++ )
+	    seeds[core] = 0x9e3779b9 * (core + 1);
+}
+
+/* What each cluster got done, in parallel_for items per second
+ * of busy time, per core.  This is how to check the placement.
+ */
+static void
+sched_clusters ( void )
+{
+	struct sched_stats *sp;
+	u64 freq = gtimer_freq ();
+	u64 items, busy;
+	int cl, core, n;
+
+	for ( cl = 0; cl < NUM_CORES; cl++ ) {
+	    items = busy = 0;
+	    n = 0;
+	    for ( core = 0; core < NUM_CORES; core++ ) {
+		if ( topo_cluster ( core ) != cl )
+		    continue;
+		sp = &stats[core];
+		items += sp->items;
+		busy += sp->busy;
+		n++;
+	    }
+	    if ( ! n )
+		continue;
+	    printf ( "  cluster %d: %d cores, %lu items, busy %lu ms, %lu items/s per core\n",
+		cl, n, items, busy * 1000 / freq, busy ? items * freq / busy : 0 );
+	}
+}
+
+void
+sched_show ( void )
+{
+	struct sched_stats *sp;
+	u64 freq = gtimer_freq ();
+	int core;
+
+	printf ( "SCHED: %d workers\n", workers );
+	for ( core = 0; core < NUM_CORES; core++ ) {
+	    sp = &stats[core];
+	    if ( ! sp->spawned && ! sp->run )
+		continue;
+	    printf ( "  core %d: %d spawned, %d inline, %d run, %d stolen, %d lost races, busy %lu ms, idle %lu ms\n",
+		core, sp->spawned, sp->inline_run, sp->run, sp->stolen, sp->steal_fail,
+		sp->busy * 1000 / freq, sp->idle * 1000 / freq );
+	}
+
+	sched_clusters ();
+}
+
+/* ---------------------------------------------- */
+
+/* A checksum over 4M, on one core and then on all of them,
+ * then on just the big cores and just the little ones.
+ */
+
+#define DEMO_SIZE	(4*1024*1024)
+#define DEMO_GRAIN	(64*1024)
+#define DEMO_CHUNKS	(DEMO_SIZE / DEMO_GRAIN)
+
+static unsigned char demo_buf[DEMO_SIZE];
+static u32 demo_sums[DEMO_CHUNKS];
+
+static void
+demo_sum ( long lo, long hi, void *arg )
+{
+	u32 sum = 0;
+	long i;
+
+	for ( i=lo; i<hi; i++ )
+	    sum += demo_buf[i] * (u32) (i + 1);
+
+	/* always called on whole grains */
+	demo_sums[lo / DEMO_GRAIN] = sum;
+}
+
+static u32
+demo_total ( void )
+{
+	u32 sum = 0;
+	int i;
+
+	for ( i=0; i<DEMO_CHUNKS; i++ ) {
+	    sum += demo_sums[i];
+	    demo_sums[i] = 0;
+	}
+	return sum;
+}
+
+static void
+demo_chunks ( long lo, long hi, void *arg )
+{
+	long i;
+
+	for ( i=lo; i<hi; i++ )
+	    demo_sum ( i * DEMO_GRAIN, (i + 1) * DEMO_GRAIN, arg );
+}
+
+static char *place_names[] = { "all", "big", "little" };
+
+void
+sched_demo ( void )
+{
+	u64 start, t1, tn;
+	u32 s1, sn;
+	int i, place;
+
+	for ( i=0; i<DEMO_SIZE; i++ )
+	    demo_buf[i] = i * 7 + (i >> 9);
+
+	start = count ();
+	demo_chunks ( 0, DEMO_CHUNKS, 0 );
+	t1 = count () - start;
+	s1 = demo_total ();
+	printf ( "SCHED demo: one core %lu us\n", gtimer_ns ( t1 ) / 1000 );
+
+	for ( place = PLACE_ANY; place <= PLACE_LITTLE; place++ ) {
+	    start = count ();
+	    parallel_for_on ( place, 0, DEMO_CHUNKS, 1, demo_chunks, 0 );
+	    tn = count () - start;
+	    sn = demo_total ();
+	    printf ( "SCHED demo: %s cores (%02x) %lu us, %lu MB/s, sums %x %x %s\n",
+		place_names[place], topo_mask ( place ),
+		gtimer_ns ( tn ) / 1000, tn ? (u64) DEMO_SIZE * gtimer_freq () / tn / 1000000 : 0,
+		s1, sn, s1 == sn ? "ok" : "MISMATCH" );
+	}
+	sched_show ();
+}
+
+/* THE END */
@@ -0,0 +1,195 @@
+/* smp.c
+ *
+ * Start the other five cores.
+ *
+ * The RK3399 has four A53s (cluster 0, MPIDR 0x000-0x003) and
+ * two A72s (cluster 1, MPIDR 0x100-0x101).  We run on core 0 and
+ * the rest are held off by BL31 (ATF), which owns the power
+ * controller.  The device tree says the enable method for all of
+ * them is "psci", so we ask BL31 with a PSCI CPU_ON call, giving
+ * the MPIDR, where to start, and a context value that shows up
+ * in x0 on the new core (we pass the core number).
+ *
+ * PSCI calls are an SMC, with the function in x0 and arguments
+ * in x1-x3, and the result comes back in x0 (SMC calling
+ * convention, which lets the firmware trash x4-x17 too).  Under
+ * a hypervisor, QEMU's virt machine for instance, it is an HVC
+ * instead, build with -DPSCI_HVC for that.
+ *
+ * The new core starts at secondary_entry (start.S) at the same EL
+ * we called from, with the MMU off.  That loads the MMU settings
+ * core 0 left in mmu_regs (cache.c), sets up the vectors and its
+ * own stack, and calls secondary_main() here, which sets up its
+ * part of the GIC and calls the function given to smp_start().
+ *
+ * The PSCI numbers are from gic/include/psci.h, which we can't
+ * include from here.
+ */
+
+#include "protos.h"
+
+typedef unsigned long u64;
+
+#define PSCI_VERSION		0x84000000
+#define PSCI_CPU_ON_AARCH64	0xc4000003
+
+#define PSCI_E_SUCCESS		0
+#define PSCI_E_ALREADY_ON	-4
+
+/* How long to wait for a core to say it is up */
+#define CORE_UP_MS		100
+
+static char *psci_errors[] = {
+	"success", "not supported", "invalid params", "denied",
+	"already on", "on pending", "internal failure", "not present",
+	"disabled", "invalid address"
+};
+
+#define NUM_PSCI_ERRORS	(sizeof(psci_errors) / sizeof(psci_errors[0]))
+
+/* start.S puts each core's sp at the top of its own slot */
+char core_stacks[NUM_CORES][CORE_STACK_SIZE] __attribute__ ((aligned(16)));
+
+void start ( void );
+void secondary_entry ( void );
+extern char _end[];	/* from spl.lds, the end of the image */
+void inter_fixup ( void );
+void flush_dcache_range ( u64, u64 );
+
+static void (*core_func) ( int );
+static volatile int core_up[NUM_CORES];
+static int num_up = 1;
+
+static long
+psci_call ( u64 fn, u64 a1, u64 a2, u64 a3 )
+{
+	register u64 x0 asm ( "x0" ) = fn;
+	register u64 x1 asm ( "x1" ) = a1;
+	register u64 x2 asm ( "x2" ) = a2;
+	register u64 x3 asm ( "x3" ) = a3;
+
+#ifdef PSCI_HVC
+	asm volatile ( "hvc #0"
+#else
+	asm volatile ( "smc #0"
+#endif
+	    : "+r" (x0), "+r" (x1), "+r" (x2), "+r" (x3)
+	    :
+	    : "x4", "x5", "x6", "x7", "x8", "x9", "x10", "x11",
+	      "x12", "x13", "x14", "x15", "x16", "x17", "memory" );
+
+	return x0;
+}
+
+static char *
+psci_error ( long err )
+{
+	if ( err > 0 || -err >= NUM_PSCI_ERRORS )
+	    return "unknown";
+	return psci_errors[-err];
+}
+
+/* The inverse of plat_core_pos_by_mpidr() in gic/gic_compat.c */
+u64
+smp_mpidr ( int core )
+{
+	if ( core < 4 )
+	    return core;
+	return 0x100 | (core - 4);
+}
+
+/* Each new core lands here, from secondary_entry in start.S,
+ * with its MMU and caches on and interrupts masked.
+ */
+void
+secondary_main ( int core )
+{
+	u64 val;
+
+	asm volatile ( "mrs %0, CurrentEL" : "=r" (val) );
+	if ( ((val >> 2) & 3) == 2 )
+	    inter_fixup ();
+
+	topo_core_init ( core );
+	intcon_gic_cpu_init ();
+	irq_init ();
+	delay_init ();
+
+	core_up[core] = 1;
+	asm volatile ( "dsb sy; sev" );
+
+	asm volatile ( "msr DAIFClr, #3; isb" );
+
+	if ( core_func )
+	    (*core_func) ( core );
+
+	for ( ;; )
+	    asm volatile ( "wfi" );
+}
+
+/* Start every core but this one, and have each call func
+ * with its core number once it is ready for interrupts.
+ * Returns how many cores are running, counting us.
+ */
+int
+smp_start ( void (*func) ( int ) )
+{
+	u64 end;
+	long rv;
+	int me = intcon_core ();
+	int core;
+
+	rv = psci_call ( PSCI_VERSION, 0, 0, 0 );
+	printf ( "PSCI version %d.%d\n", (int) (rv >> 16) & 0xffff, (int) rv & 0xffff );
+
+	core_func = func;
+	core_up[me] = 1;
+
+	/* The new cores run with the caches off until they load
+	 * the MMU settings, and the image or their stacks could
+	 * still be dirty in our cache.
+	 */
+	flush_dcache_range ( (u64) start, (u64) _end - (u64) start );
+	flush_dcache_range ( (u64) core_stacks, sizeof(core_stacks) );
+
+	for ( core = 0; core < NUM_CORES; core++ ) {
+	    if ( core == me )
+		continue;
+
+	    rv = psci_call ( PSCI_CPU_ON_AARCH64, smp_mpidr ( core ), (u64) secondary_entry, core );
+	    if ( rv != PSCI_E_SUCCESS && rv != PSCI_E_ALREADY_ON ) {
+		printf ( "SMP: core %d (mpidr %lx) CPU_ON failed: %s (%ld)\n",
+		    core, smp_mpidr ( core ), psci_error ( rv ), rv );
+		continue;
+	    }
+
+	    end = deadline_us ( CORE_UP_MS * 1000 );
+	    while ( ! core_up[core] && ! deadline_passed ( end ) )
+		asm volatile ( "wfe" );
+
+	    if ( core_up[core] ) {
+		num_up++;
+		printf ( "SMP: core %d (mpidr %lx) is up\n", core, smp_mpidr ( core ) );
+	    } else
+		printf ( "SMP: core %d (mpidr %lx) never came up\n", core, smp_mpidr ( core ) );
+	}
+
+	printf ( "SMP: %d of %d cores running\n", num_up, NUM_CORES );
+	return num_up;
+}
+
+int
+smp_core_up ( int core )
+{
+	if ( core < 0 || core >= NUM_CORES )
+	    return 0;
+	return core_up[core];
+}
+
+int
+smp_num_up ( void )
+{
+	return num_up;
+}
+
+/* THE END */
@@ -5,9 +5,13 @@
 
 #include "protos.h"
 #include "rk3399_ints.h"
+#include "trace.h"
+#include "clk.h"
+#include "lock.h"
 
 typedef volatile unsigned int vu32;
 typedef unsigned int u32;
+typedef unsigned long u64;
 
 #define BIT(x)	(1<<(x))
 
@@ -19,7 +23,6 @@ typedef unsigned int u32;
  *
  * See chapter 10 of the TRM (page 556)
  */
-#define TIMER_CLOCK	24000000
 
 struct rk_timer {
 	vu32	count0;
@@ -42,73 +45,364 @@ struct rk_timer {
 #define SYS_TIMER 	0
 #define SYS_TIMER_IRQ	IRQ_TIMER0
 
+#define CLOCK_TIMER	1
+
 /* The TRM is entirely vague on how 6 timers are arranged within
  * the address block given by the base address, but experiment
  * shows that it is a contiguous array at the start of the block.
  */
 
 /* The timer counts up until it reaches a value, then interrupts.
+ * In free run mode (CTRL_MODE clear) it starts over, in
+ * "user defined count" mode (CTRL_MODE set) it does not.
+ *
+ * We use two channels:
+ *
+ *  CLOCK_TIMER free runs to 2^64, and is our 64 bit clock.
+ *  It is never touched again, so it never loses time.
+ *
+ *  SYS_TIMER is set up one shot for the next deadline of the
+ *  software timers below, and only runs when one is pending
+ *  (no ticks when nothing is due).
+ *
+ * Software timers are kept in a binary heap ordered by deadline.
+ * Each timer knows its place in the heap, so cancelling one
+ * is as cheap as adding it.  Any core may start or cancel a
+ * timer, and the handler can be interrupted (by something of
+ * higher priority that might do the same), so the heap and the
+ * hardware are only touched holding heap_lock, with interrupts
+ * masked.  The handler lets go of it to call each function,
+ * which may start or cancel timers itself.
  */
 
-static struct rk_timer *cur_timer;
+/* Don't set the hardware for less than this (2 us) */
+#define MIN_DELTA	(timer_rate / 500000)
 
-void
-timer_handler ( void )
+/* The timers run from xin24m, but we ask the clock tree */
+static u64 timer_rate = 24000000;
+
+static struct rk_timer *sys_timer;
+static u64 hw_deadline;			/* when sys_timer will fire */
+static struct rk_timer *clock_timer;
+
+static struct swtimer *heap[SWTIMER_MAX];
+static int nheap;
+static struct ticketlock heap_lock;
+
+static int ticks;
+
+static struct rk_timer *
+timer_base ( int t )
 {
-	struct rk_timer *tp = cur_timer;
+	if ( t < 6 )
+	    return &TIMER0_BASE[t];
+	return &TIMER6_BASE[t-6];
+}
 
-	/* clear the interrupt */
-	tp->intstatus = 1;
-	printf ( "Tick\n" );
+u64
+timer_hz ( void )
+{
+	return timer_rate;
 }
 
-void
-timer_setup ( int t, u32 val )
+/* The 64 bit count can't be read in one go.
+ * If the high half changed while we read the low half, try again.
+ */
+u64
+timer_now ( void )
 {
-	struct rk_timer *tp;
+	struct rk_timer *tp = clock_timer;
+	u32 hi, lo;
+
+	do {
+	    hi = tp->val1;
+	    lo = tp->val0;
+	} while ( hi != tp->val1 );
+
+	return ((u64) hi << 32) | lo;
+}
+
+/* ------------------------------------------------------ */
+/* The heap, smallest deadline at heap[0] */
+
+static void
+heap_set ( int i, struct swtimer *tp )
+{
+	heap[i] = tp;
+	tp->slot = i;
+}
+
+static void
+heap_up ( int i )
+{
+	struct swtimer *tp = heap[i];
+	int parent;
+
+	while ( i > 0 ) {
+	    parent = (i - 1) / 2;
+	    if ( heap[parent]->when <= tp->when )
+		break;
+	    heap_set ( i, heap[parent] );
+	    i = parent;
+	}
+	heap_set ( i, tp );
+}
+
+static void
+heap_down ( int i )
+{
+	struct swtimer *tp = heap[i];
+	int child;
+
+	for ( ;; ) {
+	    child = 2 * i + 1;
+	    if ( child >= nheap )
+		break;
+	    if ( child + 1 < nheap && heap[child+1]->when < heap[child]->when )
+		child++;
+	    if ( tp->when <= heap[child]->when )
+		break;
+	    heap_set ( i, heap[child] );
+	    i = child;
+	}
+	heap_set ( i, tp );
+}
+
+static void
+heap_remove ( struct swtimer *tp )
+{
+	int i = tp->slot;
 
-	if ( t > 11 )
+	tp->slot = -1;
+	if ( --nheap == i )
 	    return;
-	if ( t < 6 )
-	    tp = &TIMER0_BASE[t];
+
+	heap_set ( i, heap[nheap] );
+	if ( i > 0 && heap[i]->when < heap[(i-1)/2]->when )
+	    heap_up ( i );
 	else
-	    tp = &TIMER6_BASE[t-6];
-	cur_timer = tp;
+	    heap_down ( i );
+}
+
+/* ------------------------------------------------------ */
+
+/* Set the hardware for whatever is due first */
+static void
+timer_program ( void )
+{
+	struct rk_timer *tp = sys_timer;
+	u64 now, delta;
+
+	tp->control = 0;
+	if ( nheap == 0 )
+	    return;
+
+	now = timer_now ();
+	delta = heap[0]->when > now ? heap[0]->when - now : 0;
+	if ( delta < MIN_DELTA )
+	    delta = MIN_DELTA;
+	hw_deadline = now + delta;
 
-	tp->control &= ~CTRL_ENA;
-	tp->control &= ~CTRL_MODE;	/* free run */
-	tp->control |= CTRL_INTENA;
 	tp->count2 = 0;			/* 2,3 are start value */
 	tp->count3 = 0;
-	tp->count0 = val;		/* 0,1 are end value */
-	tp->count1 = 0;
-	tp->control |=  CTRL_ENA;
+	tp->count0 = delta;		/* 0,1 are end value */
+	tp->count1 = delta >> 32;
+	tp->control = CTRL_MODE | CTRL_INTENA | CTRL_ENA;
+}
+
+void
+swtimer_init ( struct swtimer *tp, void (*func) ( void * ), void *arg )
+{
+	tp->func = func;
+	tp->arg = arg;
+	tp->when = 0;
+	tp->period = 0;
+	tp->slot = -1;
+}
+
+/* Call func at the absolute time "when" (ticks of timer_now),
+ * then every "period" ticks after that if period is not 0.
+ * A timer that is already pending is moved.
+ * Returns -1 if there is no room.
+ */
+int
+swtimer_start_at ( struct swtimer *tp, u64 when, u64 period )
+{
+	unsigned long flags;
+
+	flags = ticket_lock_irqsave ( &heap_lock );
+
+	if ( tp->slot < 0 ) {
+	    if ( nheap >= SWTIMER_MAX ) {
+		ticket_unlock_irqrestore ( &heap_lock, flags );
+		return -1;
+	    }
+	    tp->slot = nheap++;
+	    heap[tp->slot] = tp;
+	}
+
+	tp->when = when;
+	tp->period = period;
+	heap_up ( tp->slot );
+	heap_down ( tp->slot );
+
+	if ( heap[0] == tp )
+	    timer_program ();
+
+	ticket_unlock_irqrestore ( &heap_lock, flags );
+	return 0;
+}
+
+/* The same, "delay" ticks from now */
+int
+swtimer_start ( struct swtimer *tp, u64 delay, u64 period )
+{
+	return swtimer_start_at ( tp, timer_now () + delay, period );
+}
+
+void
+swtimer_cancel ( struct swtimer *tp )
+{
+	unsigned long flags;
+	int first;
+
+	flags = ticket_lock_irqsave ( &heap_lock );
+	if ( tp->slot >= 0 ) {
+	    first = tp->slot == 0;
+	    heap_remove ( tp );
+	    if ( first )
+		timer_program ();
+	}
+	ticket_unlock_irqrestore ( &heap_lock, flags );
+}
+
+int
+swtimer_pending ( struct swtimer *tp )
+{
+	return tp->slot >= 0;
+}
+
+/* Run everything that is due.
+ * A periodic timer keeps to its schedule, if we fell more than
+ * a whole period behind, the missed calls are skipped.
+ * The function may start or cancel timers, including its own.
+ */
+void
+timer_handler ( void *arg )
+{
+	struct rk_timer *tp = sys_timer;
+	struct swtimer *sp;
+	unsigned long flags;
+	u64 now;
+
+	/* for irqstat, how late we are */
+	now = timer_now ();
+	irqstat_timer ( now - hw_deadline, irqstat_now () );
+
+	/* clear the interrupt */
+	flags = ticket_lock_irqsave ( &heap_lock );
+	tp->intstatus = 1;
+	tp->control = 0;
+
+	now = timer_now ();
+	while ( nheap && heap[0]->when <= now ) {
+	    sp = heap[0];
+	    if ( sp->period ) {
+		sp->when += sp->period;
+		if ( sp->when <= now )
+		    sp->when += ((now - sp->when) / sp->period + 1) * sp->period;
+		heap_down ( 0 );
+	    } else
+		heap_remove ( sp );
+
+	    ticket_unlock_irqrestore ( &heap_lock, flags );
+	    (*sp->func) ( sp->arg );
+	    flags = ticket_lock_irqsave ( &heap_lock );
+	    now = timer_now ();
+	}
+
+	timer_program ();
+	ticket_unlock_irqrestore ( &heap_lock, flags );
+}
+
+/* If our clock changes, timer_now() goes at a new rate,
+ * so every deadline and period is scaled to match.
+ * The time already gone stays as it was.
+ */
+static int
+timer_clock_change ( int clk, int event, unsigned long old, unsigned long new, void *arg )
+{
+	unsigned long flags;
+	struct swtimer *sp;
+	u64 now;
+	int i;
 
-	intcon_ena ( SYS_TIMER_IRQ );
+	if ( event != CLK_POST_CHANGE || ! old || ! new )
+	    return 0;
 
-	printf ( "Timer: %d  %h %h\n", tp->intstatus, tp->count1, tp->count0 );
+	flags = ticket_lock_irqsave ( &heap_lock );
+	now = timer_now ();
+	for ( i=0; i<nheap; i++ ) {
+	    sp = heap[i];
+	    if ( sp->when > now )
+		sp->when = now + (sp->when - now) * new / old;
+	    sp->period = sp->period * new / old;
+	}
+	timer_rate = new;
+	timer_program ();
+	ticket_unlock_irqrestore ( &heap_lock, flags );
+	return 0;
 }
 
 void
 timer_show ( void )
 {
-	struct rk_timer *tp = cur_timer;
-	u32 hi, lo;
+	printf ( "Timer: %d pending, clock %lu\n", nheap, timer_now () );
+}
 
-	hi = tp->val1;
-	lo = tp->val0;
-	printf ( "Timer: %d  %h %h\n", tp->intstatus, hi, lo );
+static struct swtimer tick_timer;
+
+/* This used to be a printf, which took longer
+ * than everything else here put together.
+ */
+static void
+tick ( void *arg )
+{
+	TRACE ( "Tick %d\n", ++ticks );
 }
 
 void
 timer_init ( void )
 {
-	u32 val;
-	struct rk_timer *tp = TIMER0_BASE;
+	struct rk_timer *tp;
+
+	timer_rate = clk_get_rate ( CLK_TIMER1 );
+	clk_enable ( CLK_TIMER0 );
+	clk_enable ( CLK_TIMER1 );
+	clk_notifier_register ( CLK_TIMER1, timer_clock_change, 0 );
+
+	/* The clock, free run to 2^64 */
+	tp = timer_base ( CLOCK_TIMER );
+	clock_timer = tp;
+	tp->control = 0;
+	tp->count2 = 0;
+	tp->count3 = 0;
+	tp->count0 = 0xffffffff;
+	tp->count1 = 0xffffffff;
+	tp->control = CTRL_ENA;
+
+	sys_timer = timer_base ( SYS_TIMER );
+	sys_timer->control = 0;
+	sys_timer->intstatus = 1;
+	nheap = 0;
+
+	irq_request ( SYS_TIMER_IRQ, timer_handler, 0, IRQ_PRIO_NORMAL );
 
-	val = TIMER_CLOCK / 2;
+	/* the old 2 Hz tick, now as a software timer */
+	swtimer_init ( &tick_timer, tick, 0 );
+	swtimer_start ( &tick_timer, timer_rate / 2, timer_rate / 2 );
 
-	timer_setup ( SYS_TIMER, val );
+	timer_show ();
 }
 
 /* THE END */
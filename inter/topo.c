@@ -0,0 +1,220 @@
+/* topo.c
+ *
+ * Which cores are big and which are little.
+ *
+ * Each core reads its own MIDR and MPIDR as it comes up (they
+ * are system registers, no other core can read them for it).
+ * The part number in the MIDR tells us what it is:
+ *
+ *   0xD03  Cortex-A53	(this gives MIDR 410FD034 on the RK3399)
+ *   0xD08  Cortex-A72
+ *
+ * and Aff1 in the MPIDR is the cluster.  On the RK3399 that is
+ * four A53s in cluster 0 and two A72s in cluster 1, but we go by
+ * what the cores say, not by that.
+ *
+ * The capacity of a core is how much work it gets done compared
+ * to the fastest core in the system, which gets 1024 (as linux
+ * does it).  It is the work per Mhz for its part (the
+ * "capacity-dmips-mhz" values from the linux rk3399 device tree)
+ * times what its cluster is clocked at right now, so it moves
+ * with DVFS.
+ *
+ * The placement policy is just a set of cores for each kind of
+ * work (see sched.c), picked by capacity when the group is placed:
+ *
+ *   PLACE_BIG	  heavy kernels, the cores with the most capacity
+ *   PLACE_LITTLE  background work, the cores with the least
+ *   PLACE_ANY	  everything that is up
+ *
+ * If all the cores have about the same capacity (or none of one
+ * kind came up), big and little are both just every core.
+ */
+
+#include "protos.h"
+#include "clk.h"
+
+typedef unsigned int u32;
+typedef unsigned long u64;
+
+#define MIDR_PART(m)	(((m) >> 4) & 0xfff)
+#define MPIDR_AFF1(m)	(((m) >> 8) & 0xff)
+
+#define SCALE		1024
+
+struct part {
+	int	part;
+	char	*name;
+	int	dmips_mhz;
+	int	clk;		/* on the RK3399 */
+};
+
+static struct part parts[] = {
+	{ 0xd03, "A53", 485, CLK_ARML },
+	{ 0xd08, "A72", 1024, CLK_ARMB }
+};
+
+#define NUM_PARTS	(sizeof(parts) / sizeof(parts[0]))
+
+/* anything we don't know, counted as big */
+static struct part unknown_part = { 0, "unknown", 1024, -1 };
+
+struct core_topo {
+	u32		midr;
+	u64		mpidr;
+	int		cluster;
+	struct part	*pp;
+	int		valid;
+};
+
+static struct core_topo topo[NUM_CORES];
+
+/* Each core calls this for itself */
+void
+topo_core_init ( int core )
+{
+	struct core_topo *tp;
+	u64 val;
+	int i;
+
+	if ( core < 0 || core >= NUM_CORES )
+	    return;
+	tp = &topo[core];
+
+	asm volatile ( "mrs %0, midr_el1" : "=r" (val) );
+	tp->midr = val;
+	asm volatile ( "mrs %0, mpidr_el1" : "=r" (val) );
+	tp->mpidr = val;
+	tp->cluster = MPIDR_AFF1 ( val );
+
+	tp->pp = &unknown_part;
+	for ( i=0; i<NUM_PARTS; i++ )
+	    if ( parts[i].part == MIDR_PART ( tp->midr ) )
+		tp->pp = &parts[i];
+
+	asm volatile ( "dmb ish" );
+	tp->valid = 1;
+}
+
+static int
+known ( int core )
+{
+	return core >= 0 && core < NUM_CORES && topo[core].valid &&
+	    (core == intcon_core () || smp_core_up ( core ));
+}
+
+char *
+topo_name ( int core )
+{
+	return known ( core ) ? topo[core].pp->name : "none";
+}
+
+int
+topo_cluster ( int core )
+{
+	return known ( core ) ? topo[core].cluster : -1;
+}
+
+/* Work per second, before scaling.  With no clock (or no
+ * RK3399) we can only go by the work per Mhz.
+ */
+static u64
+raw_capacity ( int core )
+{
+	struct part *pp = topo[core].pp;
+	u64 mhz = 1;
+
+	if ( pp->clk >= 0 )
+	    mhz = clk_get_rate ( pp->clk ) / 1000000;
+	if ( mhz == 0 )
+	    mhz = 1;
+	return pp->dmips_mhz * mhz;
+}
+
+/* 1024 for the fastest core right now */
+int
+topo_capacity ( int core )
+{
+	u64 raw, max = 0;
+	int i;
+
+	if ( ! known ( core ) )
+	    return 0;
+
+	for ( i=0; i<NUM_CORES; i++ ) {
+	    if ( known ( i ) && (raw = raw_capacity ( i )) > max )
+		max = raw;
+	}
+	return raw_capacity ( core ) * SCALE / max;
+}
+
+/* Cores within 1/8 of the fastest (or the slowest) count as
+ * big (or little), so a few Mhz either way don't split a cluster.
+ */
+#define NEAR		8
+
+/* The cores for a kind of work, one bit for each.
+ * This goes by capacity right now, so if DVFS has the A72s
+ * down at 408 Mhz with the A53s at 1416, the A53s are big.
+ */
+u32
+topo_mask ( int place )
+{
+	int i;
+	u64 cap[NUM_CORES];
+	u64 lo = 0, hi = 0;
+	u32 all = 0, big = 0, little = 0;
+
+	for ( i=0; i<NUM_CORES; i++ ) {
+	    if ( ! known ( i ) )
+		continue;
+	    all |= 1 << i;
+	    cap[i] = raw_capacity ( i );
+	    if ( ! lo || cap[i] < lo )
+		lo = cap[i];
+	    if ( cap[i] > hi )
+		hi = cap[i];
+	}
+
+	for ( i=0; i<NUM_CORES; i++ ) {
+	    if ( ! (all & (1 << i)) )
+		continue;
+	    if ( cap[i] * NEAR >= hi * (NEAR - 1) )
+		big |= 1 << i;
+	    if ( cap[i] * NEAR <= lo * (NEAR + 1) )
+		little |= 1 << i;
+	}
+
+	if ( place == PLACE_BIG )
+	    return big;
+	if ( place == PLACE_LITTLE )
+	    return little;
+	return all;
+}
+
+int
+topo_is_big ( int core )
+{
+	return (topo_mask ( PLACE_BIG ) >> core) & 1;
+}
+
+void
+topo_show ( void )
+{
+	struct core_topo *tp;
+	int core;
+
+	for ( core = 0; core < NUM_CORES; core++ ) {
+	    tp = &topo[core];
+	    if ( ! known ( core ) ) {
+		printf ( "TOPO: core %d not running\n", core );
+		continue;
+	    }
+	    printf ( "TOPO: core %d  midr %08x  mpidr %05lx  cluster %d  %s  %s  capacity %d\n",
+		core, tp->midr, tp->mpidr & 0xffffff, tp->cluster, tp->pp->name,
+		topo_is_big ( core ) ? "big" : "little", topo_capacity ( core ) );
+	}
+	printf ( "TOPO: big %02x, little %02x\n", topo_mask ( PLACE_BIG ), topo_mask ( PLACE_LITTLE ) );
+}
+
+/* THE END */
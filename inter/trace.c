@@ -0,0 +1,216 @@
+/* trace.c
+ *
+ * Deferred binary logging (see trace.h)
+ *
+ * printf from an interrupt handler formats the whole message a
+ * character at a time before anything happens.  TRACE() just
+ * drops a record into a ring in RAM:
+ *
+ *   word 0	address of the format string (written last)
+ *   word 1	nargs << 24 | core
+ *   word 2,3	cntpct_el0 (the generic timer count)
+ *   then 2 words (64 bits) per argument
+ *
+ * Word 0 doubles as the "ready" flag, the reader stops at
+ * a zero there.  For that to work every word in the ring must
+ * be zero when it is claimed, so the reader clears each record
+ * it takes, all of it, before giving the space back.  Space is
+ * claimed with a compare and swap on the head, so an interrupt
+ * handler can log in the middle of someone else's TRACE()
+ * without any locking.
+ *
+ * trace_drain() (called from the main loop, not interrupts)
+ * sends whatever is ready out the uart in binary blocks:
+ *
+ *   0x1b 'T'  nwords (u16)  words ...  crc32 (u32)
+ *
+ * which serial/tracedump picks out from the rest of the
+ * console output and turns back into text.
+ */
+
+#include "protos.h"
+#include "trace.h"
+
+typedef unsigned int u32;
+typedef unsigned long u64;
+
+/* in words, must be a power of 2 */
+#define TRACE_RING_SIZE		(16*1024)
+#define TRACE_RING_MASK		(TRACE_RING_SIZE-1)
+
+#define TRACE_HDR		4
+
+/* Largest block trace_drain sends at once (words) */
+#define TRACE_BLOCK		256
+
+#define TRACE_ESC		0x1b
+#define TRACE_TAG		'T'
+
+static u32 trace_ring[TRACE_RING_SIZE];
+static unsigned int trace_head;		/* words claimed */
+static unsigned int trace_tail;		/* words drained */
+static unsigned int n_dropped;
+
+static u32 trace_block[TRACE_BLOCK];
+
+static inline u64
+read_cntpct ( void )
+{
+	u64 val;
+
+	asm volatile ( "mrs %0, cntpct_el0" : "=r" (val) );
+	return val;
+}
+
+static inline u32
+read_core ( void )
+{
+	u64 val;
+
+	asm volatile ( "mrs %0, mpidr_el1" : "=r" (val) );
+	return val & 0xffff;
+}
+
+static inline u32
+crc32_word ( u32 crc, u32 val )
+{
+	asm volatile ( "crc32w %w0, %w0, %w1" : "+r" (crc) : "r" (val) );
+	return crc;
+}
+
+void
+trace_init ( void )
+{
+	trace_head = 0;
+	trace_tail = 0;
+	n_dropped = 0;
+}
+
+unsigned int
+trace_dropped ( void )
+{
+	return n_dropped;
+}
+
+#define SLOT(i)		trace_ring[(i) & TRACE_RING_MASK]
+
+void
+trace_log ( const char *fmt, int nargs, long a0, long a1, long a2, long a3 )
+{
+	unsigned int head, tail, need;
+	u64 now;
+
+	need = TRACE_HDR + 2 * nargs;
+
+	head = __atomic_load_n ( &trace_head, __ATOMIC_RELAXED );
+	do {
+	    tail = __atomic_load_n ( &trace_tail, __ATOMIC_ACQUIRE );
+	    if ( head - tail + need > TRACE_RING_SIZE ) {
+		__atomic_fetch_add ( &n_dropped, 1, __ATOMIC_RELAXED );
+		return;
+	    }
+	} while ( ! __atomic_compare_exchange_n ( &trace_head, &head, head + need,
+		    1, __ATOMIC_RELAXED, __ATOMIC_RELAXED ) );
+
+	now = read_cntpct ();
+
+	SLOT(head+1) = (nargs << 24) | read_core ();
+	SLOT(head+2) = now;
+	SLOT(head+3) = now >> 32;
+
+	switch ( nargs ) {
+	    case 4:
+		SLOT(head+10) = a3;
+		SLOT(head+11) = (u64) a3 >> 32;
+	    case 3:
+		SLOT(head+8) = a2;
+		SLOT(head+9) = (u64) a2 >> 32;
+	    case 2:
+		SLOT(head+6) = a1;
+		SLOT(head+7) = (u64) a1 >> 32;
+	    case 1:
+		SLOT(head+4) = a0;
+		SLOT(head+5) = (u64) a0 >> 32;
+	}
+
+	/* everything above must be seen before this */
+	__atomic_store_n ( &SLOT(head), (u32) (u64) fmt, __ATOMIC_RELEASE );
+}
+
+static void
+send_block ( u32 *buf, int n )
+{
+	u32 crc = ~0;
+	char *p;
+	int i;
+
+	uart_putc ( TRACE_ESC );
+	uart_putc ( TRACE_TAG );
+	uart_putc ( n );
+	uart_putc ( n >> 8 );
+
+	p = (char *) buf;
+	for ( i=0; i<n*4; i++ )
+	    uart_putc ( p[i] );
+
+	for ( i=0; i<n; i++ )
+	    crc = crc32_word ( crc, buf[i] );
+	crc = ~crc;
+
+	uart_putc ( crc );
+	uart_putc ( crc >> 8 );
+	uart_putc ( crc >> 16 );
+	uart_putc ( crc >> 24 );
+}
+
+/* Send everything that is ready.
+ * Only one caller at a time (this is the only reader).
+ * Returns the number of records sent.
+ */
+int
+trace_drain ( void )
+{
+	unsigned int tail, head;
+	int nrec = 0;
+	int n, len, i;
+	u32 fmt;
+
+	tail = __atomic_load_n ( &trace_tail, __ATOMIC_RELAXED );
+
+	for ( ;; ) {
+	    head = __atomic_load_n ( &trace_head, __ATOMIC_ACQUIRE );
+	    n = 0;
+
+	    while ( tail != head ) {
+		fmt = __atomic_load_n ( &SLOT(tail), __ATOMIC_ACQUIRE );
+		if ( fmt == 0 )
+		    break;		/* claimed but not written yet */
+		len = TRACE_HDR + 2 * (SLOT(tail+1) >> 24);
+		if ( n + len > TRACE_BLOCK )
+		    break;
+
+		/* zero all of it, records vary in length so after the
+		 * ring wraps any of these words may be where the next
+		 * record's word 0 lands.
+		 */
+		for ( i=0; i<len; i++ ) {
+		    trace_block[n+i] = SLOT(tail+i);
+		    SLOT(tail+i) = 0;
+		}
+		n += len;
+		tail += len;
+		nrec++;
+	    }
+
+	    if ( n == 0 )
+		break;
+
+	    /* give the space back before the slow part */
+	    __atomic_store_n ( &trace_tail, tail, __ATOMIC_RELEASE );
+	    send_block ( trace_block, n );
+	}
+
+	return nrec;
+}
+
+/* THE END */
@@ -0,0 +1,36 @@
+/* trace.h
+ *
+ * Deferred binary logging.
+ *
+ *   TRACE ( "Tick %d at %h\n", count, addr );
+ *
+ * stores only the address of the format string, a timestamp
+ * and the raw arguments.  The text is put back together on
+ * the host by serial/tracedump, using the format strings in
+ * rock.elf.  So the format must be a string constant, and a
+ * %s argument only makes sense if it points at one too.
+ *
+ * Up to 4 arguments.
+ */
+
+void trace_log ( const char *, int, long, long, long, long );
+void trace_init ( void );
+int trace_drain ( void );
+unsigned int trace_dropped ( void );
+
+/* Count the arguments: TRACE_NARGS(0, a, b) is 2 */
+#define TRACE_NARGS(...)	TRACE_NARGS_(__VA_ARGS__, 4, 3, 2, 1, 0)
+#define TRACE_NARGS_(z,a,b,c,d,n,...)	n
+
+#define TRACE_CAT(a,b)		TRACE_CAT_(a,b)
+#define TRACE_CAT_(a,b)		a ## b
+
+#define TRACE_0(f)		trace_log ( f, 0, 0, 0, 0, 0 )
+#define TRACE_1(f,a)		trace_log ( f, 1, (long)(a), 0, 0, 0 )
+#define TRACE_2(f,a,b)		trace_log ( f, 2, (long)(a), (long)(b), 0, 0 )
+#define TRACE_3(f,a,b,c)	trace_log ( f, 3, (long)(a), (long)(b), (long)(c), 0 )
+#define TRACE_4(f,a,b,c,d)	trace_log ( f, 4, (long)(a), (long)(b), (long)(c), (long)(d) )
+
+#define TRACE(f, ...)	TRACE_CAT(TRACE_, TRACE_NARGS(0, ##__VA_ARGS__)) ( f, ##__VA_ARGS__ )
+
+/* THE END */
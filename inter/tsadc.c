@@ -0,0 +1,205 @@
+/* tsadc.c
+ *
+ * The temperature sensors on the RK3399.
+ *
+ * The TSADC has two channels: 0 is in the CPU area (shared by
+ * both clusters, there is no sensor for each one) and 1 is the GPU.
+ * We run it in "auto" mode, where it converts both channels every
+ * few milliseconds by itself and we just read the last result.
+ *
+ * The converter gives a 10 bit code, which goes up with the
+ * temperature, and the table below (from the linux rockchip
+ * thermal driver) turns it into millidegrees C.  It is only good
+ * from -40 to 125 C, anything outside that is treated as an error.
+ *
+ * As a safety net we also set the hardware shutdown: if a channel
+ * goes over TSHUT_TEMP the TSADC tells the CRU to reset the chip.
+ * Nothing we do in software can stop that.
+ *
+ * The sequence to set up the analog side (the GRF test bits)
+ * is from linux too.  The TRM says nothing about it.
+ */
+
+#include "protos.h"
+#include "clk.h"
+
+typedef volatile unsigned int vu32;
+typedef unsigned int u32;
+typedef unsigned long u64;
+
+#define BIT(x)	(1<<(x))
+
+struct rk_tsadc {
+	vu32	user_con;		/* 00 */
+	vu32	auto_con;		/* 04 */
+	vu32	int_en;			/* 08 */
+	vu32	int_pd;			/* 0c */
+	int	_pad0[4];
+	vu32	data[4];		/* 20 */
+	vu32	comp_int[4];		/* 30 */
+	vu32	comp_shut[4];		/* 40 */
+	int	_pad1[4];
+	vu32	hight_int_debounce;	/* 60 */
+	vu32	hight_tshut_debounce;	/* 64 */
+	vu32	auto_period;		/* 68 */
+	vu32	auto_period_ht;		/* 6c */
+};
+
+#define TSADC_BASE	((struct rk_tsadc *) 0xff260000)
+
+#define AUTO_EN		BIT(0)
+#define AUTO_Q_SEL	BIT(1)		/* codes go up with temperature */
+#define AUTO_SRC_EN(c)	BIT(4+(c))
+#define AUTO_TSHUT_HIGH	BIT(8)
+
+#define INT_TSHUT_CRU(c)	BIT(8+(c))
+
+#define DATA_MASK	0x3ff
+
+/* In clk_tsadc cycles, 1875 is 2.5 ms at 750 khz */
+#define TSADC_HZ	750000
+#define AUTO_PERIOD	1875
+#define DEBOUNCE	4
+
+/* The chip resets itself above this (millidegrees) */
+#define TSHUT_TEMP	110000
+
+/* In the GRF, with a write mask in the upper 16 bits */
+#define GRF_BASE		0xff770000
+#define GRF_SARADC_TESTBIT	0xe644
+#define GRF_TSADC_TESTBIT_L	0xe648
+#define GRF_TSADC_TESTBIT_H	0xe64c
+
+#define GRF(off)	(*(vu32 *) (u64) (GRF_BASE + (off)))
+
+#define GRF_TSADC_VCM_EN	((BIT(7) << 16) | BIT(7))
+#define GRF_TESTBIT_ON		((BIT(2) << 16) | BIT(2))
+
+/* The pclk gate is on a bus clock that clk.c does not model */
+#define CRU_BASE		0xff760000
+#define CLKGATE_CON22		(*(vu32 *) (u64) (CRU_BASE + 0x300 + 4*22))
+#define PCLK_TSADC_GATE		13
+
+struct tsadc_code {
+	int	code;
+	int	temp;
+};
+
+static struct tsadc_code code_table[] = {
+	{ 402, -40000 }, { 410, -35000 }, { 419, -30000 }, { 427, -25000 },
+	{ 436, -20000 }, { 444, -15000 }, { 453, -10000 }, { 461,  -5000 },
+	{ 470,      0 }, { 478,   5000 }, { 487,  10000 }, { 496,  15000 },
+	{ 504,  20000 }, { 513,  25000 }, { 521,  30000 }, { 530,  35000 },
+	{ 538,  40000 }, { 547,  45000 }, { 555,  50000 }, { 564,  55000 },
+	{ 573,  60000 }, { 581,  65000 }, { 590,  70000 }, { 599,  75000 },
+	{ 607,  80000 }, { 616,  85000 }, { 624,  90000 }, { 633,  95000 },
+	{ 642, 100000 }, { 650, 105000 }, { 659, 110000 }, { 667, 115000 },
+	{ 675, 120000 }, { 684, 125000 }
+};
+
+#define NUM_CODES	(sizeof(code_table) / sizeof(code_table[0]))
+
+static int tsadc_running;
+
+/* Interpolate, between the table entries on either side */
+static int
+code_to_temp ( int code, int *temp )
+{
+	struct tsadc_code *lo, *hi;
+	int i;
+
+	for ( i=1; i<NUM_CODES; i++ ) {
+	    hi = &code_table[i];
+	    lo = &code_table[i-1];
+	    if ( code >= lo->code && code <= hi->code ) {
+		*temp = lo->temp + (code - lo->code) * (hi->temp - lo->temp) / (hi->code - lo->code);
+		return 0;
+	    }
+	}
+	return -1;
+}
+
+/* The other way, rounding down so the shutdown is never late */
+static int
+temp_to_code ( int temp )
+{
+	struct tsadc_code *lo, *hi;
+	int i;
+
+	for ( i=1; i<NUM_CODES; i++ ) {
+	    hi = &code_table[i];
+	    lo = &code_table[i-1];
+	    if ( temp <= hi->temp )
+		return lo->code + (temp - lo->temp) * (hi->code - lo->code) / (hi->temp - lo->temp);
+	}
+	return code_table[NUM_CODES-1].code;
+}
+
+void
+tsadc_init ( void )
+{
+	struct rk_tsadc *tp = TSADC_BASE;
+	int chan;
+
+	clk_set_parent ( CLK_TSADC, CLK_XIN24M );
+	clk_set_rate ( CLK_TSADC, TSADC_HZ );
+	clk_enable ( CLK_TSADC );
+	CLKGATE_CON22 = BIT(PCLK_TSADC_GATE) << 16;
+
+	tp->auto_con = 0;
+
+	/* Power up the analog part */
+	GRF(GRF_TSADC_TESTBIT_L) = GRF_TSADC_VCM_EN;
+	GRF(GRF_TSADC_TESTBIT_H) = GRF_TSADC_VCM_EN;
+	udelay ( 15 );
+	GRF(GRF_SARADC_TESTBIT) = GRF_TESTBIT_ON;
+	GRF(GRF_TSADC_TESTBIT_H) = GRF_TESTBIT_ON;
+	udelay ( 90 );
+
+	tp->auto_period = AUTO_PERIOD;
+	tp->hight_int_debounce = DEBOUNCE;
+	tp->auto_period_ht = AUTO_PERIOD;
+	tp->hight_tshut_debounce = DEBOUNCE;
+
+	for ( chan = 0; chan < TSADC_CHANNELS; chan++ ) {
+	    tp->comp_shut[chan] = temp_to_code ( TSHUT_TEMP );
+	    tp->int_en |= INT_TSHUT_CRU(chan);
+	    tp->auto_con |= AUTO_SRC_EN(chan);
+	}
+
+	tp->auto_con |= AUTO_TSHUT_HIGH | AUTO_Q_SEL | AUTO_EN;
+	tsadc_running = 1;
+
+	/* give it time for a first conversion */
+	mdelay ( 10 );
+}
+
+/* The last temperature on a channel, in millidegrees C.
+ * Returns -1 if there isn't a good one.
+ */
+int
+tsadc_temp ( int chan, int *temp )
+{
+	struct rk_tsadc *tp = TSADC_BASE;
+
+	if ( ! tsadc_running || chan < 0 || chan >= TSADC_CHANNELS )
+	    return -1;
+
+	return code_to_temp ( tp->data[chan] & DATA_MASK, temp );
+}
+
+void
+tsadc_show ( void )
+{
+	int chan, temp;
+
+	for ( chan = 0; chan < TSADC_CHANNELS; chan++ ) {
+	    if ( tsadc_temp ( chan, &temp ) < 0 )
+		printf ( "TSADC %s: no reading\n", chan == TSADC_CPU ? "cpu" : "gpu" );
+	    else
+		printf ( "TSADC %s: %d.%03d C\n", chan == TSADC_CPU ? "cpu" : "gpu",
+		    temp / 1000, (temp < 0 ? -temp : temp) % 1000 );
+	}
+}
+
+/* THE END */
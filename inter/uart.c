@@ -1,9 +1,18 @@
 /* Simple serial driver for the Rockchip RK3399
  *
  * Tom Trebisky  1-2-2022
+ *
+ * Output starts out polled, just as it always was.
+ * Once the GIC is set up, uart_irq_init() switches us
+ * to sending through a ring buffer, which the THRE
+ * interrupt drains into the fifo.  So a printf in an
+ * interrupt handler costs a copy, not the serial time.
  */
 
 #include "protos.h"
+#include "rk3399_ints.h"
+#include "clk.h"
+#include "lock.h"
 
 typedef volatile unsigned int vu32;
 typedef unsigned int u32;
@@ -68,6 +77,8 @@ struct rock_uart {
 
 #define UART_BASE	UART2_BASE
 
+#define UART_IRQ	IRQ_UART2
+
 /* Bits in the status register */
 #define ST_BUSY		BIT(0)
 #define ST_TNF		BIT(1)
@@ -75,14 +86,147 @@ struct rock_uart {
 #define ST_RNE		BIT(3)
 #define ST_RF		BIT(4)
 
+/* Bits in the IER */
+#define IER_ERBFI	BIT(0)		/* rx data */
+#define IER_ETBEI	BIT(1)		/* tx holding register empty */
+#define IER_PTIME	BIT(7)		/* THRE interrupt at the stet level */
+
+/* Interrupt ID in the low bits of the IIR */
+#define IIR_MASK	0xf
+#define IIR_NONE	0x1
+#define IIR_THRE	0x2
+#define IIR_BUSY	0x7
+
+/* stet - interrupt when the tx fifo gets down to 1/4 full */
+#define TX_EMPTY_QUARTER	2
+
+#define UART_FIFO_SIZE	64
+
+/* Must be a power of 2 */
+#define TX_RING_SIZE	4096
+#define TX_RING_MASK	(TX_RING_SIZE-1)
+
+static char tx_ring[TX_RING_SIZE];
+static volatile unsigned int tx_head;	/* next to fill */
+static volatile unsigned int tx_tail;	/* next to send */
+
+/* 0 until interrupts are set up, and again after a panic */
+static int tx_irq_mode;
+
+/* The fifo belongs to the DMA while this is set */
+static volatile int tx_dma_busy;
+
+/* Hands off the fifo while the uart clock changes */
+static volatile int tx_hold;
+
+/* The rate U-Boot set, kept when the clock changes */
+static unsigned int uart_baud_rate;
+
+#define LCR_DLAT	0x80
+#define BAUD_MODE_X	16
+
+/* Any core may printf, so masking interrupts is not enough
+ * to keep the ring to ourself, we take a spin lock as well.
+ * Characters from two cores can still end up interleaved.
+ * A ticket lock, so a core printing a lot can't shut out the rest.
+ */
+static struct ticketlock tx_spin;
+
+static inline unsigned long
+tx_lock ( void )
+{
+	return ticket_lock_irqsave ( &tx_spin );
+}
+
+static inline void
+tx_unlock ( unsigned long flags )
+{
+	ticket_unlock_irqrestore ( &tx_spin, flags );
+}
+
+/* dll and dlh are where data and ier are, with DLAT set */
+static unsigned int
+uart_get_divisor ( void )
+{
+	struct rock_uart *up = UART_BASE;
+	unsigned int div;
+
+	up->lcr |= LCR_DLAT;
+	div = (up->data & 0xff) | ((up->ier & 0xff) << 8);
+	up->lcr &= ~LCR_DLAT;
+	return div;
+}
+
+static void
+uart_set_divisor ( unsigned int div )
+{
+	struct rock_uart *up = UART_BASE;
+
+	up->lcr |= LCR_DLAT;
+	up->data = div & 0xff;
+	up->ier = (div >> 8) & 0xff;
+	up->lcr &= ~LCR_DLAT;
+}
+
+/* clk.c tells us before and after clk_uart2 changes.
+ * Before, we stop filling the fifo and let it empty (the
+ * divisor can't be changed while the uart is busy), after,
+ * we set the divisor for the same baud rate at the new clock.
+ * We say no if a DMA is going.
+ */
+static int
+uart_clock_change ( int clk, int event, unsigned long old, unsigned long new, void *arg )
+{
+	struct rock_uart *up = UART_BASE;
+	unsigned long flags;
+	unsigned int div;
+
+	if ( event == CLK_PRE_CHANGE ) {
+	    if ( tx_dma_busy )
+		return 1;
+	    flags = tx_lock ();
+	    tx_hold = 1;
+	    up->ier &= ~IER_ETBEI;
+	    tx_unlock ( flags );
+
+	    while ( ! (up->status & ST_TE) || (up->status & ST_BUSY) )
+		;
+	    return 0;
+	}
+
+	if ( event == CLK_POST_CHANGE && uart_baud_rate ) {
+	    div = (new + BAUD_MODE_X * uart_baud_rate / 2) / (BAUD_MODE_X * uart_baud_rate);
+	    if ( div < 1 )
+		div = 1;
+	    uart_set_divisor ( div );
+	}
+
+	/* post change or abort, carry on */
+	flags = tx_lock ();
+	tx_hold = 0;
+	if ( tx_irq_mode && tx_tail != tx_head )
+	    up->ier |= IER_ETBEI;
+	tx_unlock ( flags );
+	return 0;
+}
+
+/* U-Boot sets the baud rate, we just note what it is
+ * so we can keep it when the clock changes.
+ */
 void
 uart_init ( void )
 {
-	/* nothing here, we rely on U-Boot */
+	unsigned int div;
+
+	div = uart_get_divisor ();
+	if ( div )
+	    uart_baud_rate = clk_get_rate ( CLK_UART2 ) / (BAUD_MODE_X * div);
+
+	clk_notifier_register ( CLK_UART2, uart_clock_change, 0 );
 }
 
-void
-uart_putc ( char c )
+static void
+uart_putc_polled ( char c )
 {
 	struct rock_uart *up = UART_BASE;
 
@@ -92,6 +236,229 @@ uart_putc ( char c )
 	up->data = c;
 }
 
+/* Move as much as will fit from the ring into the fifo.
+ * One read of tfl tells us how much room there is,
+ * so we don't need to check the status for every byte.
+ * Called with the lock held.
+ */
+static void
+tx_fill ( void )
+{
+	struct rock_uart *up = UART_BASE;
+	int room;
+
+	if ( tx_dma_busy || tx_hold ) {
+	    up->ier &= ~IER_ETBEI;
+	    return;
+	}
+
+	room = UART_FIFO_SIZE - up->tfl;
+	while ( room-- > 0 && tx_tail != tx_head ) {
+	    up->data = tx_ring[tx_tail & TX_RING_MASK];
+	    tx_tail++;
+	}
+
+	if ( tx_tail == tx_head )
+	    up->ier &= ~IER_ETBEI;
+}
+
+void
+uart_putc ( char c )
+{
+	struct rock_uart *up = UART_BASE;
+	unsigned long flags;
+
+	if ( ! tx_irq_mode ) {
+	    uart_putc_polled ( c );
+	    return;
+	}
+
+	flags = tx_lock ();
+
+	/* Full: we may be in a handler with interrupts off,
+	 * so don't wait for the interrupt, push some out now.
+	 * If a DMA has the fifo (or the clock is changing),
+	 * we can only drop characters.
+	 */
+	if ( (tx_dma_busy || tx_hold) && tx_head - tx_tail >= TX_RING_SIZE ) {
+	    tx_unlock ( flags );
+	    return;
+	}
+
+	while ( tx_head - tx_tail >= TX_RING_SIZE ) {
+	    while ( ! (up->status & ST_TNF) )
+		;
+	    tx_fill ();
+	}
+
+	tx_ring[tx_head & TX_RING_MASK] = c;
+	tx_head++;
+
+	if ( ! tx_hold && ! (up->ier & IER_ETBEI) ) {
+	    tx_fill ();
+	    if ( tx_tail != tx_head )
+		up->ier |= IER_ETBEI;
+	}
+
+	tx_unlock ( flags );
+}
+
+/* Called from handle_irq for UART_IRQ */
+void
+uart_handler ( void *arg )
+{
+	struct rock_uart *up = UART_BASE;
+	unsigned long flags;
+	int iir;
+
+	iir = up->iir & IIR_MASK;
+
+	/* reading the status register clears busy detect */
+	if ( iir == IIR_BUSY )
+	    (void) up->status;
+
+	flags = tx_lock ();
+	tx_fill ();
+	tx_unlock ( flags );
+}
+
+/* Switch output to the ring buffer.
+ * Call this after the GIC is initialized.
+ */
+void
+uart_irq_init ( void )
+{
+	struct rock_uart *up = UART_BASE;
+
+	up->stet = TX_EMPTY_QUARTER;
+	up->ier = IER_PTIME;
+
+	irq_request ( UART_IRQ, uart_handler, 0, IRQ_PRIO_NORMAL );
+	tx_irq_mode = 1;
+}
+
+/* ---------------------------------------------- */
+
+/* Sending with the PL330 (see dma.c)
+ *
+ * In DMA mode 1 the uart asks for a burst whenever the tx fifo
+ * is down to the stet level (1/4 full, so there is room for 48)
+ * and for single bytes whenever it is not full.
+ * UART2 is request 4 on dmac_peri.
+ */
+#define UART_DMA_CHAN	0
+#define UART_DMA_TX	4
+
+#define SDMAM_MODE1	1
+
+/* DMA interrupt, the buffers are gone */
+static void
+uart_dma_done ( void *arg )
+{
+	struct rock_uart *up = UART_BASE;
+	unsigned long flags;
+
+	flags = tx_lock ();
+	tx_dma_busy = 0;
+	up->sdmam = 0;		/* no more requests for a finished channel */
+
+	/* pick up anything printf queued in the meantime */
+	if ( tx_tail != tx_head ) {
+	    tx_fill ();
+	    if ( tx_tail != tx_head )
+		up->ier |= IER_ETBEI;
+	}
+	tx_unlock ( flags );
+}
+
+/* Send a list of buffers, which must not change until
+ * uart_dma_busy() says we are done.  Anything already in the
+ * ring goes first (by polling), anything printed while the DMA
+ * runs waits in the ring until it is done.
+ * Returns -1 if a DMA is already running, or the uart
+ * clock is being changed.
+ */
+int
+uart_dma_write ( struct dma_seg *segs, int nseg )
+{
+	struct rock_uart *up = UART_BASE;
+	unsigned long flags;
+	int rv;
+
+	flags = tx_lock ();
+
+	/* not with the clock changing either, the ring can't drain */
+	if ( tx_dma_busy || tx_hold ) {
+	    tx_unlock ( flags );
+	    return -1;
+	}
+
+	while ( tx_tail != tx_head ) {
+	    while ( ! (up->status & ST_TNF) )
+		;
+	    tx_fill ();
+	}
+
+	up->ier &= ~IER_ETBEI;
+	up->stet = TX_EMPTY_QUARTER;
+	up->sdmam = SDMAM_MODE1;
+
+	tx_dma_busy = 1;
+	rv = dma_to_periph ( UART_DMA_CHAN, UART_DMA_TX, (u32) (unsigned long) &up->data,
+		segs, nseg, uart_dma_done, 0 );
+	if ( rv < 0 )
+	    tx_dma_busy = 0;
+
+	tx_unlock ( flags );
+	return rv;
+}
+
+int
+uart_dma_busy ( void )
+{
+	return tx_dma_busy;
+}
+
+/* For rkpanic(), and anything else that must get its
+ * message out with interrupts off (or broken).
+ * Send whatever is in the ring by polling, wait until
+ * the transmitter is idle, and stay polled from here on.
+ *
+ * No lock here: we may have faulted while holding it, or
+ * another core that holds it may have stopped.  Some other
+ * core's output could get mixed in, which beats no output.
+ * A DMA still going is killed, so its bytes don't get mixed
+ * in with ours.
+ */
+void
+uart_flush ( void )
+{
+	struct rock_uart *up = UART_BASE;
+	unsigned long flags;
+
+	asm volatile ( "mrs %0, daif" : "=r" (flags) );
+	asm volatile ( "msr DAIFSet, #3" : : : "memory" );
+
+	up->ier &= ~IER_ETBEI;
+	tx_irq_mode = 0;
+
+	if ( tx_dma_busy ) {
+	    dma_kill ( UART_DMA_CHAN );
+	    up->sdmam = 0;
+	    tx_dma_busy = 0;
+	}
+
+	while ( tx_tail != tx_head ) {
+	    uart_putc_polled ( tx_ring[tx_tail & TX_RING_MASK] );
+	    tx_tail++;
+	}
+
+	while ( ! (up->status & ST_TE) || (up->status & ST_BUSY) )
+	    ;
+
+	asm volatile ( "msr daif, %0" : : "r" (flags) : "memory" );
+}
+
 /* Portable code below here */
 
 void
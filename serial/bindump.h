@@ -0,0 +1,53 @@
+/* bindump.h
+ *
+ * Framed binary dump protocol, shared (by copying!)
+ * between bare_dump and the dumprecv host program
+ * in the serial directory.
+ *
+ * Everything is little endian.
+ *
+ * A frame from the target:
+ *   0  'R' 'K'		magic
+ *   2  type		S, D or E
+ *   3  0
+ *   4  seq		frame number (u32)
+ *   8  addr		target address of the data (u32)
+ *  12  len		bytes of payload (u16)
+ *  14  0 0
+ *  16  payload
+ *      crc		CRC-32 of everything after the magic (u32)
+ *
+ *  S (start) has a payload of three u32: nbytes, nframes, frame size
+ *  D (data) frames are numbered 0 .. nframes-1
+ *  E (end) comes after the last frame sent, seq is nframes
+ *
+ * A command from the host:
+ *   0  'R' 'K'
+ *   2  cmd		G, R or Q
+ *   3  0
+ *   4  seq		first frame to resend (u32)
+ *   8  count		how many (u32)
+ *  12  crc		CRC-32 of bytes 2 to 11 (u32)
+ *
+ * The CRC is the usual one (zlib, ethernet) which is exactly
+ * what the ARMv8 crc32 instructions compute.
+ */
+
+#define BD_MAGIC0	'R'
+#define BD_MAGIC1	'K'
+
+/* frame types */
+#define BD_START	'S'
+#define BD_DATA		'D'
+#define BD_END		'E'
+
+/* commands */
+#define BD_GO		'G'	/* send everything */
+#define BD_RESEND	'R'	/* send some frames again */
+#define BD_QUIT		'Q'	/* all done */
+
+#define BD_HDR_SIZE	16
+#define BD_CMD_SIZE	16
+#define BD_FRAME_SIZE	1024	/* payload bytes, multiple of 4 */
+
+/* THE END */
@@ -0,0 +1,82 @@
+/* binload.h
+ *
+ * Framed binary load protocol, shared (by copying!)
+ * between bare_load and the sendload host program
+ * in the serial directory.
+ *
+ * Everything is little endian.
+ *
+ * A frame from the host:
+ *   0  'R' 'L'		magic
+ *   2  type		P, W or J
+ *   3  0
+ *   4  seq		frame number (u32)
+ *   8  addr		target address (u32)
+ *  12  len		bytes of payload (u16)
+ *  14  0 0
+ *  16  payload
+ *      crc		CRC-32 of everything after the magic (u32)
+ *
+ *  P (ping) starts a load, the next frame expected is seq 1
+ *  B (baud) has a payload of one u32, a new baud rate.  The target
+ *    acks (or naks) at the old rate, then switches.  It must see a
+ *    good frame (a ping) at the new rate within BL_BAUD_WAIT seconds
+ *    or it goes back to the old rate.  Seq is ignored, like a ping.
+ *  W (write) puts the payload at addr
+ *  J (jump) has a payload of three u32: load address, nbytes
+ *    and the CRC-32 of the whole image.  If the image in memory
+ *    checks out, the target jumps to addr.
+ *
+ * A reply from the target:
+ *   0  'R' 'L'
+ *   2  reply		A or N
+ *   3  why		0 or the reason for a N
+ *   4  seq		the next frame the target wants (u32)
+ *   8  errors	uart receive errors so far (u32)
+ *  12  crc		CRC-32 of bytes 2 to 11 (u32)
+ *
+ * Frames must arrive in order.  Every good frame gets an A,
+ * so the host can keep several frames in flight and just count.
+ * A bad or out of order frame gets a N telling where to start
+ * over (go back N).  A frame that was already taken (a resend
+ * that was not needed) is just acked again.
+ *
+ * The CRC is the usual one (zlib, ethernet) which is exactly
+ * what the ARMv8 crc32 instructions compute.
+ */
+
+#define BL_MAGIC0	'R'
+#define BL_MAGIC1	'L'
+
+/* frame types */
+#define BL_PING		'P'
+#define BL_WRITE	'W'
+#define BL_JUMP		'J'
+#define BL_BAUD		'B'
+
+/* replies */
+#define BL_ACK		'A'
+#define BL_NAK		'N'
+
+/* reasons for a N */
+#define BL_WHY_CRC	'C'	/* bad CRC or length */
+#define BL_WHY_SEQ	'S'	/* a frame went missing */
+#define BL_WHY_ADDR	'A'	/* address not allowed */
+#define BL_WHY_IMAGE	'I'	/* whole image CRC is wrong */
+#define BL_WHY_TYPE	'T'	/* unknown frame type */
+#define BL_WHY_BAUD	'B'	/* can't do that baud rate */
+
+#define BL_HDR_SIZE	16
+#define BL_REPLY_SIZE	16
+#define BL_FRAME_SIZE	1024	/* payload bytes, multiple of 4 */
+
+#define BL_BAUD_START	1500000
+#define BL_BAUD_WAIT	3	/* seconds */
+#define BL_BAUD_PPM	20000	/* worst error we will switch to */
+
+/* How many frames the host may have unacknowledged.
+ * They must all fit in the target receive ring.
+ */
+#define BL_WINDOW	6
+
+/* THE END */
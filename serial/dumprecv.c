@@ -0,0 +1,370 @@
+/* dumprecv.c
+ *
+ * Catch a binary memory dump sent by bare_dump (bin_dump)
+ * and write it to a file.
+ *
+ * We send "go", collect frames, and when the end frame shows up
+ * (or the line goes quiet) we ask for whatever is missing or had
+ * a bad CRC, until we have it all.  The protocol is in bindump.h
+ *
+ * Invoke this as follows:
+ *  dumprecv [options]
+ *	-d device	(default /dev/ttyUSB0)
+ *	-s baud		(default 1500000)
+ *	-o file		(default dump.bin)
+ *	-v		report every bad and resent frame
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+
+#include "bindump.h"
+#include "tty.h"
+
+#define DEFAULT_DEV	"/dev/ttyUSB0"
+#define DEFAULT_BAUD	1500000
+#define DEFAULT_OUT	"dump.bin"
+
+/* How long the line can be quiet before we ask again (ms) */
+#define QUIET_TIME	500
+
+/* Give up after this many resend requests in a row get us nothing */
+#define MAX_ROUNDS	20
+
+int fd;
+int verbose = 0;
+
+/* Input is buffered, since we read it a byte at a time */
+static unsigned char in_buf[4096];
+static int in_count;
+static int in_next;
+
+/* what we are catching */
+unsigned int dump_addr;
+unsigned int dump_bytes;
+unsigned int dump_frames;
+unsigned int frame_size;
+unsigned char *image;
+unsigned char *have;
+
+int n_good;
+int n_bad;
+int n_dup;
+
+void
+error ( char *msg )
+{
+	fprintf ( stderr, "%s\n", msg );
+	exit ( 1 );
+}
+
+static double
+now ( void )
+{
+	struct timespec ts;
+
+	clock_gettime ( CLOCK_MONOTONIC, &ts );
+	return ts.tv_sec + ts.tv_nsec * 1.0e-9;
+}
+
+/* Returns -1 on a timeout */
+static int
+get_byte ( void )
+{
+	if ( in_next >= in_count ) {
+	    in_count = tty_read ( fd, in_buf, sizeof(in_buf), QUIET_TIME );
+	    in_next = 0;
+	    if ( in_count == 0 )
+		return -1;
+	}
+	return in_buf[in_next++];
+}
+
+static unsigned int
+get32 ( unsigned char *p )
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int) p[3] << 24);
+}
+
+static void
+put32 ( unsigned char *p, unsigned int val )
+{
+	p[0] = val;
+	p[1] = val >> 8;
+	p[2] = val >> 16;
+	p[3] = val >> 24;
+}
+
+static void
+send_cmd ( int cmd, unsigned int seq, unsigned int count )
+{
+	unsigned char buf[BD_CMD_SIZE];
+
+	buf[0] = BD_MAGIC0;
+	buf[1] = BD_MAGIC1;
+	buf[2] = cmd;
+	buf[3] = 0;
+	put32 ( &buf[4], seq );
+	put32 ( &buf[8], count );
+	put32 ( &buf[12], crc32 ( 0, &buf[2], 10 ) );
+
+	tty_write ( fd, buf, BD_CMD_SIZE );
+}
+
+/* Read one frame into buf.
+ * Returns the type, 0 for a bad frame, -1 on a timeout.
+ * Anything between frames (like the messages bare_dump
+ * prints before it starts) is passed to stdout.
+ */
+static int
+get_frame ( unsigned char *buf, unsigned int *seq, unsigned int *addr, int *len )
+{
+	int c, i, n;
+
+	for ( ;; ) {
+	    c = get_byte ();
+	    if ( c < 0 )
+		return -1;
+	    if ( c != BD_MAGIC0 ) {
+		if ( ! dump_frames )
+		    putchar ( c );
+		continue;
+	    }
+	    c = get_byte ();
+	    if ( c < 0 )
+		return -1;
+	    if ( c == BD_MAGIC1 )
+		break;
+	}
+
+	buf[0] = BD_MAGIC0;
+	buf[1] = BD_MAGIC1;
+	for ( i=2; i<BD_HDR_SIZE; i++ ) {
+	    if ( (c = get_byte ()) < 0 )
+		return -1;
+	    buf[i] = c;
+	}
+
+	n = buf[12] | (buf[13] << 8);
+	if ( n > BD_FRAME_SIZE )
+	    return 0;
+
+	for ( i=0; i<n+4; i++ ) {
+	    if ( (c = get_byte ()) < 0 )
+		return -1;
+	    buf[BD_HDR_SIZE+i] = c;
+	}
+
+	if ( crc32 ( 0, &buf[2], BD_HDR_SIZE - 2 + n ) != get32 ( &buf[BD_HDR_SIZE+n] ) )
+	    return 0;
+
+	*seq = get32 ( &buf[4] );
+	*addr = get32 ( &buf[8] );
+	*len = n;
+	return buf[2];
+}
+
+/* Send go until the start frame shows up */
+static void
+start_dump ( void )
+{
+	unsigned char buf[BD_HDR_SIZE + BD_FRAME_SIZE + 4];
+	unsigned int seq, addr;
+	int len;
+	int type;
+	int tries;
+
+	for ( tries = 0; tries < 20; tries++ ) {
+	    send_cmd ( BD_GO, 0, 0 );
+	    do {
+		type = get_frame ( buf, &seq, &addr, &len );
+	    } while ( type > 0 && type != BD_START );
+
+	    if ( type == BD_START && len == 12 ) {
+		dump_addr = addr;
+		dump_bytes = get32 ( &buf[BD_HDR_SIZE] );
+		dump_frames = get32 ( &buf[BD_HDR_SIZE+4] );
+		frame_size = get32 ( &buf[BD_HDR_SIZE+8] );
+		if ( frame_size == 0 || frame_size > BD_FRAME_SIZE )
+		    error ( "Bad frame size in start frame" );
+		return;
+	    }
+	}
+
+	error ( "No response from target" );
+}
+
+/* Ask for the first run of missing frames.
+ * Only one request is out at a time, the target isn't reading
+ * while it sends, and a few commands would overrun its 64 byte
+ * receive fifo.  Every resend request is answered with an end
+ * frame, which is when we ask for the next run.
+ * Returns how many frames are missing.
+ */
+static int
+ask_missing ( void )
+{
+	unsigned int seq, first = 0, count = 0;
+	int missing = 0;
+
+	seq = 0;
+	while ( seq < dump_frames ) {
+	    if ( have[seq] ) {
+		seq++;
+		continue;
+	    }
+	    if ( ! count )
+		first = seq;
+	    while ( seq < dump_frames && ! have[seq] ) {
+		if ( first + count == seq )
+		    count++;
+		seq++;
+		missing++;
+	    }
+	}
+
+	if ( count ) {
+	    if ( verbose )
+		printf ( "resend frames %d to %d\n", first, first + count - 1 );
+	    send_cmd ( BD_RESEND, first, count );
+	}
+
+	return missing;
+}
+
+static void
+collect ( void )
+{
+	unsigned char buf[BD_HDR_SIZE + BD_FRAME_SIZE + 4];
+	unsigned int seq, addr;
+	unsigned int off;
+	int len;
+	int type;
+	int rounds = 0;
+	int last_good = 0;
+	int missing;
+
+	for ( ;; ) {
+	    type = get_frame ( buf, &seq, &addr, &len );
+
+	    if ( type == BD_DATA ) {
+		off = seq * frame_size;
+		if ( seq >= dump_frames || addr != dump_addr + off || off + len > dump_bytes ) {
+		    n_bad++;
+		    continue;
+		}
+		if ( have[seq] ) {
+		    n_dup++;
+		    continue;
+		}
+		memcpy ( &image[off], &buf[BD_HDR_SIZE], len );
+		have[seq] = 1;
+		n_good++;
+		continue;
+	    }
+
+	    if ( type == 0 ) {
+		if ( verbose )
+		    printf ( "bad frame\n" );
+		n_bad++;
+		continue;
+	    }
+
+	    if ( type == BD_START )
+		continue;
+
+	    /* end frame, or the line went quiet */
+	    missing = ask_missing ();
+	    if ( missing == 0 )
+		break;
+
+	    /* a round that got us nothing */
+	    if ( n_good == last_good )
+		rounds++;
+	    else
+		rounds = 0;
+	    last_good = n_good;
+
+	    if ( rounds > MAX_ROUNDS ) {
+		fprintf ( stderr, "Giving up with %d frames missing\n", missing );
+		break;
+	    }
+	    if ( type < 0 )
+		printf ( "timeout, %d frames missing\n", missing );
+	}
+
+	send_cmd ( BD_QUIT, 0, 0 );
+	tty_drain ( fd );
+}
+
+int
+main ( int argc, char **argv )
+{
+	char *dev = DEFAULT_DEV;
+	char *out = DEFAULT_OUT;
+	int baud = DEFAULT_BAUD;
+	double t0, t;
+	int ofd;
+
+	--argc;
+	++argv;
+
+	while ( argc && **argv == '-' ) {
+	    switch ( argv[0][1] ) {
+		case 'v':
+		    verbose = 1;
+		    break;
+		case 'd':
+		case 's':
+		case 'o':
+		    if ( argc < 2 )
+			error ( "Usage: dumprecv [-d dev] [-s baud] [-o file] [-v]" );
+		    if ( argv[0][1] == 'd' )
+			dev = argv[1];
+		    else if ( argv[0][1] == 's' )
+			baud = atoi ( argv[1] );
+		    else
+			out = argv[1];
+		    --argc;
+		    ++argv;
+		    break;
+		default:
+		    error ( "Usage: dumprecv [-d dev] [-s baud] [-o file] [-v]" );
+	    }
+	    --argc;
+	    ++argv;
+	}
+
+	fd = tty_open ( dev, baud );
+
+	start_dump ();
+	printf ( "\nReceiving %d bytes from %08x in %d frames\n", dump_bytes, dump_addr, dump_frames );
+
+	image = calloc ( 1, dump_bytes );
+	have = calloc ( 1, dump_frames );
+	if ( ! image || ! have )
+	    error ( "Out of memory" );
+
+	t0 = now ();
+	collect ();
+	t = now () - t0;
+
+	ofd = open ( out, O_WRONLY | O_CREAT | O_TRUNC, 0644 );
+	if ( ofd < 0 )
+	    error ( "Cannot create output file" );
+	if ( write ( ofd, image, dump_bytes ) != dump_bytes )
+	    error ( "Write to output file fails" );
+	close ( ofd );
+
+	printf ( "%d bytes to %s in %.2f seconds (%.0f bytes/s, line rate is %d)\n",
+	    dump_bytes, out, t, dump_bytes / t, baud / 10 );
+	printf ( "%d frames, %d bad, %d duplicate\n", n_good, n_bad, n_dup );
+
+	return 0;
+}
+
+/* THE END */
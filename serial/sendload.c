@@ -0,0 +1,441 @@
+/* sendload.c
+ *
+ * Send a binary image to bare_load over the uart
+ * and have it jump to the image.
+ *
+ * We keep several frames in flight (BL_WINDOW) and count
+ * the acks as they come back.  A nak says where the target
+ * wants us to start over, a quiet line makes us start over
+ * from the last frame acknowledged.  The protocol is in binload.h
+ *
+ * Invoke this as follows:
+ *  sendload [options] image.bin
+ *	-d device	(default /dev/ttyUSB0)
+ *	-s baud		(default 1500000)
+ *	-b baud		switch to this rate for the load
+ *	-a addr		where to load it (default 0xff8d0000, in SRAM)
+ *	-e addr		where to start it (default the load address)
+ *	-t		stay and show the console after the jump
+ *	-v		report every nak and timeout
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#include "binload.h"
+#include "tty.h"
+
+#define DEFAULT_DEV	"/dev/ttyUSB0"
+#define DEFAULT_BAUD	1500000
+#define DEFAULT_ADDR	0xff8d0000
+
+#define USAGE	"Usage: sendload [-d dev] [-s baud] [-b baud] [-a addr] [-e addr] [-t] [-v] image"
+
+/* How long to wait for a reply (ms) */
+#define QUIET_TIME	200
+
+/* Give up after this many timeouts in a row */
+#define MAX_QUIET	25
+
+int fd;
+int verbose = 0;
+
+/* Input is buffered, since we read it a byte at a time */
+static unsigned char in_buf[4096];
+static int in_count;
+static int in_next;
+
+unsigned char *image;
+unsigned int image_size;
+unsigned int load_addr = DEFAULT_ADDR;
+unsigned int entry_addr;
+int have_entry;
+
+unsigned int nframes;
+
+int n_sent;
+int n_nak;
+int n_quiet;
+unsigned int target_errors;
+
+void
+error ( char *msg )
+{
+	fprintf ( stderr, "%s\n", msg );
+	exit ( 1 );
+}
+
+static double
+now ( void )
+{
+	struct timespec ts;
+
+	clock_gettime ( CLOCK_MONOTONIC, &ts );
+	return ts.tv_sec + ts.tv_nsec * 1.0e-9;
+}
+
+/* Returns -1 on a timeout */
+static int
+get_byte ( int ms )
+{
+	if ( in_next >= in_count ) {
+	    in_count = tty_read ( fd, in_buf, sizeof(in_buf), ms );
+	    in_next = 0;
+	    if ( in_count == 0 )
+		return -1;
+	}
+	return in_buf[in_next++];
+}
+
+static unsigned int
+get32 ( unsigned char *p )
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int) p[3] << 24);
+}
+
+static void
+put32 ( unsigned char *p, unsigned int val )
+{
+	p[0] = val;
+	p[1] = val >> 8;
+	p[2] = val >> 16;
+	p[3] = val >> 24;
+}
+
+static void
+send_frame ( int type, unsigned int seq, unsigned int addr, unsigned char *data, int len )
+{
+	unsigned char buf[BL_HDR_SIZE + BL_FRAME_SIZE + 4];
+
+	buf[0] = BL_MAGIC0;
+	buf[1] = BL_MAGIC1;
+	buf[2] = type;
+	buf[3] = 0;
+	put32 ( &buf[4], seq );
+	put32 ( &buf[8], addr );
+	buf[12] = len;
+	buf[13] = len >> 8;
+	buf[14] = 0;
+	buf[15] = 0;
+	if ( len )
+	    memcpy ( &buf[BL_HDR_SIZE], data, len );
+	put32 ( &buf[BL_HDR_SIZE+len], crc32 ( 0, &buf[2], BL_HDR_SIZE - 2 + len ) );
+
+	tty_write ( fd, buf, BL_HDR_SIZE + len + 4 );
+	n_sent++;
+}
+
+/* Frame 0 is the ping, 1 .. nframes carry the image,
+ * and nframes+1 is the jump.
+ */
+static void
+send_seq ( unsigned int seq )
+{
+	unsigned char info[12];
+	unsigned int off;
+	int len;
+
+	if ( seq == nframes + 1 ) {
+	    put32 ( &info[0], load_addr );
+	    put32 ( &info[4], image_size );
+	    put32 ( &info[8], crc32 ( 0, image, image_size ) );
+	    send_frame ( BL_JUMP, seq, entry_addr, info, 12 );
+	    return;
+	}
+
+	off = (seq - 1) * BL_FRAME_SIZE;
+	len = BL_FRAME_SIZE;
+	if ( off + len > image_size )
+	    len = image_size - off;
+	send_frame ( BL_WRITE, seq, load_addr + off, image + off, len );
+}
+
+/* Wait for a reply.
+ * Returns A or N, or -1 on a timeout.
+ * Anything else on the line (like the messages bare_load
+ * prints) is passed to stdout.
+ */
+static int
+get_reply ( int *why, unsigned int *next )
+{
+	unsigned char buf[BL_REPLY_SIZE];
+	int c, i;
+
+	for ( ;; ) {
+	    c = get_byte ( QUIET_TIME );
+	    if ( c < 0 )
+		return -1;
+	    if ( c != BL_MAGIC0 ) {
+		putchar ( c );
+		continue;
+	    }
+	    c = get_byte ( QUIET_TIME );
+	    if ( c < 0 )
+		return -1;
+	    if ( c != BL_MAGIC1 )
+		continue;
+
+	    buf[0] = BL_MAGIC0;
+	    buf[1] = BL_MAGIC1;
+	    for ( i=2; i<BL_REPLY_SIZE; i++ ) {
+		if ( (c = get_byte ( QUIET_TIME )) < 0 )
+		    return -1;
+		buf[i] = c;
+	    }
+
+	    if ( crc32 ( 0, &buf[2], 10 ) != get32 ( &buf[12] ) )
+		continue;
+
+	    *why = buf[3];
+	    *next = get32 ( &buf[4] );
+	    target_errors = get32 ( &buf[8] );
+	    return buf[2];
+	}
+}
+
+/* Ping until the target answers */
+static void
+start_load ( void )
+{
+	unsigned int next;
+	int tries;
+	int why;
+
+	for ( tries = 0; tries < 50; tries++ ) {
+	    send_frame ( BL_PING, 0, 0, NULL, 0 );
+	    if ( get_reply ( &why, &next ) == BL_ACK && next == 1 )
+		return;
+	}
+
+	error ( "No response from target" );
+}
+
+/* Ask the target for a new rate, then go there ourselves.
+ * If it does not answer there, both sides go back.
+ * Returns the rate we end up at.
+ */
+static int
+change_baud ( int old, int baud )
+{
+	unsigned char arg[4];
+	unsigned int next;
+	double give_up;
+	int type;
+	int why;
+	int tries;
+
+	for ( tries = 0; tries < 10; tries++ ) {
+	    put32 ( arg, baud );
+	    send_frame ( BL_BAUD, 0, 0, arg, 4 );
+	    type = get_reply ( &why, &next );
+	    if ( type == BL_NAK && why == BL_WHY_BAUD ) {
+		printf ( "Target can't do %d baud, staying at %d\n", baud, old );
+		return old;
+	    }
+	    if ( type == BL_ACK )
+		break;
+	}
+	if ( type != BL_ACK )
+	    error ( "No answer to baud rate change" );
+
+	tty_baud ( fd, baud );
+	in_next = in_count = 0;
+
+	/* leave time to fall back before the target does */
+	give_up = now () + BL_BAUD_WAIT / 2.0;
+	while ( now () < give_up ) {
+	    send_frame ( BL_PING, 0, 0, NULL, 0 );
+	    if ( get_reply ( &why, &next ) == BL_ACK )
+		return baud;
+	}
+
+	printf ( "No answer at %d baud, going back to %d\n", baud, old );
+	tty_baud ( fd, old );
+	in_next = in_count = 0;
+	sleep ( BL_BAUD_WAIT );
+	start_load ();
+	return old;
+}
+
+static void
+send_image ( void )
+{
+	unsigned int last = nframes + 1;
+	unsigned int base = 1;		/* next frame the target wants */
+	unsigned int send = 1;		/* next frame we send */
+	unsigned int rewound = 0;	/* where we last went back to */
+	unsigned int next;
+	int quiet = 0;
+	int type;
+	int why;
+
+	while ( base <= last ) {
+	    while ( send <= last && send - base < BL_WINDOW )
+		send_seq ( send++ );
+
+	    type = get_reply ( &why, &next );
+
+	    if ( type < 0 ) {
+		if ( ++quiet > MAX_QUIET )
+		    error ( "Target stopped answering" );
+		if ( verbose )
+		    printf ( "timeout, resend from %d\n", base );
+		n_quiet++;
+		send = base;
+		rewound = 0;
+		continue;
+	    }
+	    quiet = 0;
+
+	    if ( next > base )
+		base = next;
+	    if ( send < base )
+		send = base;
+
+	    if ( type == BL_ACK )
+		continue;
+
+	    n_nak++;
+	    if ( why == BL_WHY_ADDR )
+		error ( "Target will not load at that address" );
+	    if ( why == BL_WHY_IMAGE )
+		error ( "Image CRC does not match after loading" );
+	    if ( why == BL_WHY_TYPE )
+		error ( "Target did not understand a frame" );
+
+	    /* Every frame in flight after a bad one gets a nak,
+	     * only go back once for each.
+	     */
+	    if ( next != rewound ) {
+		if ( verbose )
+		    printf ( "nak (%c), resend from %d\n", why, next );
+		send = next;
+		rewound = next;
+	    }
+	}
+}
+
+static void
+read_image ( char *path )
+{
+	struct stat st;
+	int ifd;
+
+	ifd = open ( path, O_RDONLY );
+	if ( ifd < 0 || fstat ( ifd, &st ) < 0 )
+	    error ( "Cannot open image" );
+	image_size = st.st_size;
+	if ( image_size == 0 )
+	    error ( "Image is empty" );
+
+	image = malloc ( image_size );
+	if ( ! image )
+	    error ( "Out of memory" );
+	if ( read ( ifd, image, image_size ) != image_size )
+	    error ( "Cannot read image" );
+	close ( ifd );
+
+	nframes = (image_size + BL_FRAME_SIZE - 1) / BL_FRAME_SIZE;
+}
+
+/* After the jump, just show what comes out */
+static void
+terminal ( void )
+{
+	unsigned char buf[256];
+	int n;
+
+	fflush ( stdout );
+	for ( ;; ) {
+	    n = tty_read ( fd, buf, sizeof(buf), 1000 );
+	    if ( n > 0 )
+		write ( 1, buf, n );
+	}
+}
+
+int
+main ( int argc, char **argv )
+{
+	char *dev = DEFAULT_DEV;
+	int baud = DEFAULT_BAUD;
+	int new_baud = 0;
+	int term = 0;
+	double t0, t;
+
+	--argc;
+	++argv;
+
+	while ( argc && **argv == '-' ) {
+	    switch ( argv[0][1] ) {
+		case 'v':
+		    verbose = 1;
+		    break;
+		case 't':
+		    term = 1;
+		    break;
+		case 'd':
+		case 's':
+		case 'b':
+		case 'a':
+		case 'e':
+		    if ( argc < 2 )
+			error ( USAGE );
+		    if ( argv[0][1] == 'd' )
+			dev = argv[1];
+		    else if ( argv[0][1] == 's' )
+			baud = atoi ( argv[1] );
+		    else if ( argv[0][1] == 'b' )
+			new_baud = atoi ( argv[1] );
+		    else if ( argv[0][1] == 'a' )
+			load_addr = strtoul ( argv[1], NULL, 16 );
+		    else {
+			entry_addr = strtoul ( argv[1], NULL, 16 );
+			have_entry = 1;
+		    }
+		    --argc;
+		    ++argv;
+		    break;
+		default:
+		    error ( USAGE );
+	    }
+	    --argc;
+	    ++argv;
+	}
+
+	if ( argc != 1 )
+	    error ( USAGE );
+
+	read_image ( argv[0] );
+	if ( ! have_entry )
+	    entry_addr = load_addr;
+
+	fd = tty_open ( dev, baud );
+
+	start_load ();
+	if ( new_baud && new_baud != baud )
+	    baud = change_baud ( baud, new_baud );
+
+	printf ( "Sending %d bytes to %08x in %d frames\n", image_size, load_addr, nframes );
+
+	t0 = now ();
+	send_image ();
+	t = now () - t0;
+
+	printf ( "%d bytes in %.2f seconds (%.0f bytes/s, line rate is %d)\n",
+	    image_size, t, image_size / t, baud / 10 );
+	printf ( "%d frames sent, %d naks, %d timeouts, %d target rx errors\n",
+	    n_sent, n_nak, n_quiet, target_errors );
+	printf ( "Started at %08x\n", entry_addr );
+
+	if ( term )
+	    terminal ();
+
+	return 0;
+}
+
+/* THE END */
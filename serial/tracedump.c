@@ -0,0 +1,383 @@
+/* tracedump.c
+ *
+ * Turn the binary trace records from inter (trace.c)
+ * back into text.
+ *
+ * The target only sends the address of each format string,
+ * so we need the ELF file it was built from to find them.
+ * Ordinary console output goes through untouched, the trace
+ * blocks are picked out and decoded in place.
+ *
+ * Invoke this as follows:
+ *  tracedump [options] rock.elf
+ *	-d device	(default /dev/ttyUSB0)
+ *	-s baud		(default 1500000)
+ *	-i file		decode a capture file instead of the serial port
+ *	-f hz		generic timer frequency (default 24000000)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <elf.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "tty.h"
+
+#define DEFAULT_DEV	"/dev/ttyUSB0"
+#define DEFAULT_BAUD	1500000
+#define DEFAULT_FREQ	24000000
+
+#define USAGE	"Usage: tracedump [-d dev] [-s baud] [-i capture] [-f hz] elf"
+
+/* From trace.c */
+#define TRACE_ESC	0x1b
+#define TRACE_TAG	'T'
+#define TRACE_HDR	4
+#define TRACE_BLOCK	256
+
+typedef unsigned long long u64;
+
+/* Sections of the ELF file that are loaded on the target */
+#define MAX_SECT	32
+
+struct sect {
+	u64		addr;
+	u64		size;
+	char		*data;
+};
+
+struct sect sects[MAX_SECT];
+int nsects;
+
+int fd = -1;
+FILE *in_file;
+double freq = DEFAULT_FREQ;
+
+u64 first_ts;
+int have_first;
+
+int n_records;
+int n_bad;
+
+void
+error ( char *msg )
+{
+	fprintf ( stderr, "%s\n", msg );
+	exit ( 1 );
+}
+
+static void
+load_elf ( char *path )
+{
+	Elf64_Ehdr *eh;
+	Elf64_Shdr *sh;
+	struct stat st;
+	char *buf;
+	int efd;
+	int i;
+
+	efd = open ( path, O_RDONLY );
+	if ( efd < 0 || fstat ( efd, &st ) < 0 )
+	    error ( "Cannot open ELF file" );
+	buf = mmap ( NULL, st.st_size, PROT_READ, MAP_PRIVATE, efd, 0 );
+	if ( buf == MAP_FAILED )
+	    error ( "Cannot map ELF file" );
+	close ( efd );
+
+	eh = (Elf64_Ehdr *) buf;
+	if ( st.st_size < sizeof(*eh) || memcmp ( buf, ELFMAG, SELFMAG ) != 0 || buf[EI_CLASS] != ELFCLASS64 )
+	    error ( "Not a 64 bit ELF file" );
+	if ( eh->e_shoff + eh->e_shnum * sizeof(*sh) > st.st_size )
+	    error ( "Bad ELF section table" );
+
+	sh = (Elf64_Shdr *) (buf + eh->e_shoff);
+	for ( i=0; i<eh->e_shnum && nsects < MAX_SECT; i++ ) {
+	    if ( sh[i].sh_type != SHT_PROGBITS || ! (sh[i].sh_flags & SHF_ALLOC) )
+		continue;
+	    if ( sh[i].sh_offset + sh[i].sh_size > st.st_size )
+		continue;
+	    sects[nsects].addr = sh[i].sh_addr;
+	    sects[nsects].size = sh[i].sh_size;
+	    sects[nsects].data = buf + sh[i].sh_offset;
+	    nsects++;
+	}
+}
+
+/* A string on the target, if it is in the ELF file */
+static char *
+target_string ( u64 addr )
+{
+	int i;
+
+	for ( i=0; i<nsects; i++ )
+	    if ( addr >= sects[i].addr && addr < sects[i].addr + sects[i].size )
+		return sects[i].data + (addr - sects[i].addr);
+	return NULL;
+}
+
+/* ---------------------------------------------- */
+
+/* Format one record the way inter/prf.c would have.
+ * We pick apart each conversion and hand it to our own printf,
+ * with the length adjusted to suit the 64 bit argument.
+ */
+static void
+format ( char *fmt, u64 *args, int nargs )
+{
+	char spec[40];
+	char *sp;
+	int c;
+	int n = 0;
+	int lng;
+	char *s;
+	u64 val;
+
+#define NEXT_ARG	(n < nargs ? args[n++] : (n++, 0))
+
+	while ( (c = *fmt++) ) {
+	    if ( c != '%' ) {
+		if ( c != '\r' )
+		    putchar ( c );
+		continue;
+	    }
+
+	    /* flags, width, precision */
+	    sp = spec;
+	    *sp++ = '%';
+	    while ( *fmt && strchr ( "-0+ #.*123456789", *fmt ) && sp < &spec[20] ) {
+		if ( *fmt == '*' )
+		    sp += sprintf ( sp, "%d", (int) NEXT_ARG );
+		else
+		    *sp++ = *fmt;
+		fmt++;
+	    }
+
+	    lng = 0;
+	    while ( *fmt == 'l' || *fmt == 'z' ) {
+		lng = 1;
+		fmt++;
+	    }
+
+	    c = *fmt++;
+	    if ( c == '\0' )
+		break;
+
+	    switch ( c ) {
+		case 'd':
+		case 'i':
+		case 'u':
+		case 'x':
+		case 'X':
+		case 'o':
+		    val = NEXT_ARG;
+		    if ( lng ) {
+			sprintf ( sp, "ll%c", c );
+			printf ( spec, val );
+		    } else {
+			sprintf ( sp, "%c", c );
+			printf ( spec, (unsigned int) val );
+		    }
+		    break;
+		case 'p':
+		    strcpy ( sp, "#llx" );
+		    printf ( spec, NEXT_ARG );
+		    break;
+		case 'h':
+		    printf ( "%08X", (unsigned int) NEXT_ARG );
+		    break;
+		case 'Y':
+		    printf ( "%016llX", NEXT_ARG );
+		    break;
+		case 'c':
+		    strcpy ( sp, "c" );
+		    printf ( spec, (int) NEXT_ARG );
+		    break;
+		case 's':
+		    s = target_string ( NEXT_ARG );
+		    strcpy ( sp, "s" );
+		    printf ( spec, s ? s : "(?)" );
+		    break;
+		case '%':
+		    putchar ( '%' );
+		    break;
+		default:
+		    /* prf.c ignores these */
+		    break;
+	    }
+	}
+}
+
+static unsigned int
+get32 ( unsigned char *p )
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int) p[3] << 24);
+}
+
+static void
+decode_block ( unsigned int *w, int n )
+{
+	u64 args[4];
+	u64 ts;
+	char *fmt;
+	int nargs, core;
+	int i, j;
+
+	i = 0;
+	while ( i + TRACE_HDR <= n ) {
+	    nargs = w[i+1] >> 24;
+	    core = w[i+1] & 0xffff;
+	    ts = w[i+2] | ((u64) w[i+3] << 32);
+	    if ( nargs > 4 || i + TRACE_HDR + 2 * nargs > n ) {
+		n_bad++;
+		return;
+	    }
+
+	    for ( j=0; j<nargs; j++ )
+		args[j] = w[i+4+2*j] | ((u64) w[i+5+2*j] << 32);
+
+	    if ( ! have_first ) {
+		first_ts = ts;
+		have_first = 1;
+	    }
+
+	    printf ( "[%11.6f %x] ", (ts - first_ts) / freq, core );
+	    fmt = target_string ( w[i] );
+	    if ( fmt )
+		format ( fmt, args, nargs );
+	    else
+		printf ( "(format %08x not in ELF file)\n", w[i] );
+
+	    n_records++;
+	    i += TRACE_HDR + 2 * nargs;
+	}
+}
+
+/* ---------------------------------------------- */
+
+static unsigned char in_buf[4096];
+static int in_count;
+static int in_next;
+
+/* Returns -1 at the end of the capture file */
+static int
+get_byte ( void )
+{
+	while ( in_next >= in_count ) {
+	    in_next = 0;
+	    if ( in_file ) {
+		in_count = fread ( in_buf, 1, sizeof(in_buf), in_file );
+		if ( in_count <= 0 )
+		    return -1;
+	    } else {
+		fflush ( stdout );
+		in_count = tty_read ( fd, in_buf, sizeof(in_buf), 1000 );
+	    }
+	}
+	return in_buf[in_next++];
+}
+
+static void
+run ( void )
+{
+	unsigned char buf[TRACE_BLOCK*4 + 4];
+	int c, n, i;
+
+	for ( ;; ) {
+	    c = get_byte ();
+	    if ( c < 0 )
+		return;
+	    if ( c != TRACE_ESC ) {
+		if ( c != '\r' )
+		    putchar ( c );
+		continue;
+	    }
+
+	    if ( (c = get_byte ()) != TRACE_TAG ) {
+		if ( c < 0 )
+		    return;
+		continue;
+	    }
+
+	    n = get_byte ();
+	    n |= get_byte () << 8;
+	    if ( n <= 0 || n > TRACE_BLOCK ) {
+		n_bad++;
+		continue;
+	    }
+
+	    for ( i=0; i < n*4 + 4; i++ ) {
+		if ( (c = get_byte ()) < 0 )
+		    return;
+		buf[i] = c;
+	    }
+
+	    if ( crc32 ( 0, buf, n*4 ) != get32 ( &buf[n*4] ) ) {
+		printf ( "[bad trace block]\n" );
+		n_bad++;
+		continue;
+	    }
+
+	    /* the target is little endian, like us */
+	    decode_block ( (unsigned int *) buf, n );
+	}
+}
+
+int
+main ( int argc, char **argv )
+{
+	char *dev = DEFAULT_DEV;
+	char *capture = NULL;
+	int baud = DEFAULT_BAUD;
+
+	--argc;
+	++argv;
+
+	while ( argc && **argv == '-' ) {
+	    switch ( argv[0][1] ) {
+		case 'd':
+		case 's':
+		case 'i':
+		case 'f':
+		    if ( argc < 2 )
+			error ( USAGE );
+		    if ( argv[0][1] == 'd' )
+			dev = argv[1];
+		    else if ( argv[0][1] == 's' )
+			baud = atoi ( argv[1] );
+		    else if ( argv[0][1] == 'i' )
+			capture = argv[1];
+		    else
+			freq = atof ( argv[1] );
+		    --argc;
+		    ++argv;
+		    break;
+		default:
+		    error ( USAGE );
+	    }
+	    --argc;
+	    ++argv;
+	}
+
+	if ( argc != 1 )
+	    error ( USAGE );
+
+	load_elf ( argv[0] );
+
+	if ( capture ) {
+	    in_file = fopen ( capture, "r" );
+	    if ( ! in_file )
+		error ( "Cannot open capture file" );
+	} else
+	    fd = tty_open ( dev, baud );
+
+	run ();
+
+	fprintf ( stderr, "%d trace records, %d bad\n", n_records, n_bad );
+	return 0;
+}
+
+/* THE END */
@@ -0,0 +1,179 @@
+/* tty.c
+ *
+ * Serial port helpers for the host side tools.
+ *
+ * Everything here is raw 8N1 with no flow control,
+ * which is all the RK3399 uart gives us anyway.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <termios.h>
+#include <sys/select.h>
+
+#include "tty.h"
+
+void error ( char * );
+
+struct baud {
+	int	rate;
+	speed_t	code;
+};
+
+static struct baud bauds[] = {
+	{ 115200,	B115200 },
+	{ 230400,	B230400 },
+	{ 460800,	B460800 },
+	{ 921600,	B921600 },
+	{ 1000000,	B1000000 },
+	{ 1500000,	B1500000 },
+	{ 2000000,	B2000000 },
+	{ 3000000,	B3000000 },
+	{ 4000000,	B4000000 },
+	{ 0,		0 }
+};
+
+static speed_t
+baud_code ( int rate )
+{
+	struct baud *bp;
+
+	for ( bp = bauds; bp->rate; bp++ )
+	    if ( bp->rate == rate )
+		return bp->code;
+
+	error ( "Unsupported baud rate" );
+	return 0;
+}
+
+int
+tty_open ( char *path, int rate )
+{
+	struct termios tio;
+	speed_t code;
+	int fd;
+
+	code = baud_code ( rate );
+
+	fd = open ( path, O_RDWR | O_NOCTTY );
+	if ( fd < 0 ) {
+	    perror ( path );
+	    exit ( 1 );
+	}
+
+	if ( tcgetattr ( fd, &tio ) < 0 )
+	    error ( "Not a serial port" );
+
+	cfmakeraw ( &tio );
+	tio.c_cflag |= CLOCAL | CREAD;
+	tio.c_cflag &= ~(CRTSCTS | CSTOPB | PARENB);
+	tio.c_cc[VMIN] = 0;
+	tio.c_cc[VTIME] = 0;
+	cfsetispeed ( &tio, code );
+	cfsetospeed ( &tio, code );
+
+	if ( tcsetattr ( fd, TCSANOW, &tio ) < 0 )
+	    error ( "Cannot set up serial port" );
+
+	tcflush ( fd, TCIOFLUSH );
+	return fd;
+}
+
+/* Change the rate, after what we sent has gone */
+void
+tty_baud ( int fd, int rate )
+{
+	struct termios tio;
+	speed_t code;
+
+	code = baud_code ( rate );
+
+	if ( tcgetattr ( fd, &tio ) < 0 )
+	    error ( "Not a serial port" );
+	cfsetispeed ( &tio, code );
+	cfsetospeed ( &tio, code );
+	if ( tcsetattr ( fd, TCSADRAIN, &tio ) < 0 )
+	    error ( "Cannot change baud rate" );
+
+	tcflush ( fd, TCIFLUSH );
+}
+
+/* Read up to n bytes, waiting at most ms milliseconds
+ * for the first one.  Returns 0 on a timeout.
+ */
+int
+tty_read ( int fd, unsigned char *buf, int n, int ms )
+{
+	struct timeval tv;
+	fd_set fds;
+	int rv;
+
+	FD_ZERO ( &fds );
+	FD_SET ( fd, &fds );
+	tv.tv_sec = ms / 1000;
+	tv.tv_usec = (ms % 1000) * 1000;
+
+	rv = select ( fd + 1, &fds, NULL, NULL, &tv );
+	if ( rv < 0 && errno != EINTR )
+	    error ( "select fails on serial port" );
+	if ( rv <= 0 )
+	    return 0;
+
+	rv = read ( fd, buf, n );
+	if ( rv < 0 )
+	    error ( "read fails on serial port" );
+	return rv;
+}
+
+void
+tty_write ( int fd, unsigned char *buf, int n )
+{
+	int rv;
+
+	while ( n > 0 ) {
+	    rv = write ( fd, buf, n );
+	    if ( rv < 0 )
+		error ( "write fails on serial port" );
+	    buf += rv;
+	    n -= rv;
+	}
+}
+
+/* Wait for output to go, toss any input */
+void
+tty_drain ( int fd )
+{
+	tcdrain ( fd );
+	tcflush ( fd, TCIFLUSH );
+}
+
+/* The usual CRC-32 (zlib, ethernet), as computed
+ * on the target with the ARMv8 crc32 instructions.
+ * Start with crc = 0.
+ */
+unsigned int
+crc32 ( unsigned int crc, unsigned char *buf, int n )
+{
+	static unsigned int table[256];
+	unsigned int c;
+	int i, j;
+
+	if ( ! table[1] ) {
+	    for ( i=0; i<256; i++ ) {
+		c = i;
+		for ( j=0; j<8; j++ )
+		    c = (c & 1) ? 0xedb88320 ^ (c >> 1) : c >> 1;
+		table[i] = c;
+	    }
+	}
+
+	crc = ~crc;
+	while ( n-- )
+	    crc = table[(crc ^ *buf++) & 0xff] ^ (crc >> 8);
+	return ~crc;
+}
+
+/* THE END */
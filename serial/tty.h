@@ -0,0 +1,14 @@
+/* tty.h
+ *
+ * Serial port helpers for the host side tools.
+ */
+
+int tty_open ( char *, int );
+void tty_baud ( int, int );
+int tty_read ( int, unsigned char *, int, int );
+void tty_write ( int, unsigned char *, int );
+void tty_drain ( int );
+
+unsigned int crc32 ( unsigned int, unsigned char *, int );
+
+/* THE END */